@@ -21,14 +21,17 @@
 #include "api/inc/uvisor_exports.h"
 #include "api/inc/virq_exports.h"
 #include "api/inc/debug_exports.h"
+#include "api/inc/channel_exports.h"
 #include "api/inc/halt_exports.h"
 #include "api/inc/pool_queue_exports.h"
 #include "api/inc/page_allocator_exports.h"
+#include "api/inc/rpc_exports.h"
+#include "api/inc/uvisor_semaphore_exports.h"
 #include "api/inc/uvisor_spinlock_exports.h"
 #include <stdint.h>
 
 #define UVISOR_API_MAGIC 0x5C9411B4
-#define UVISOR_API_VERSION (10)
+#define UVISOR_API_VERSION (18)
 
 UVISOR_EXTERN_C_BEGIN
 
@@ -61,10 +64,22 @@ typedef struct {
 
     int (*page_malloc)(UvisorPageTable * const table);
     int (*page_free)(const UvisorPageTable * const table);
+    int (*page_clean)(uint32_t max_pages);
+    int (*page_get_stats)(UvisorPageStats * const stats);
+    int (*page_share)(const UvisorPageTable * const table, int dst_box, uint32_t acl);
+    int (*page_revoke)(const UvisorPageTable * const table, int dst_box);
 
     int (*box_namespace)(int box_id, char *box_namespace, size_t length);
     int (*box_id_for_namespace)(int * const box_id, const char * const box_namespace);
 
+    int (*rpc_get_stats)(uvisor_rpc_stats_t * stats);
+
+    int (*channel_create)(UvisorChannelRing * ring, int consumer_box);
+    int (*channel_attach)(UvisorChannelRing * ring, UvisorSemaphore * semaphore);
+    int (*channel_close)(UvisorChannelRing * ring);
+
+    int (*box_kick)(int box_id);
+
     void (*debug_init)(const TUvisorDebugDriver * const driver);
     void (*error)(THaltUserError reason);
     void (*start)(void);
@@ -84,6 +99,11 @@ typedef struct {
     uvisor_pool_slot_t (*pool_queue_try_dequeue_first)(uvisor_pool_queue_t *);
     uvisor_pool_slot_t (*pool_queue_find_first)(uvisor_pool_queue_t *, TQueryFN_Ptr, void *);
     uvisor_pool_slot_t (*pool_queue_try_find_first)(uvisor_pool_queue_t *, TQueryFN_Ptr, void *);
+    int                (*pool_queue_init_mode)(uvisor_pool_queue_t *, uvisor_pool_t *, void *, size_t, size_t, uint8_t);
+    int                (*pool_queue_try_enqueue_batch)(uvisor_pool_queue_t *, const uvisor_pool_slot_t *, size_t);
+    size_t             (*pool_queue_try_dequeue_batch)(uvisor_pool_queue_t *, uvisor_pool_slot_t *, size_t);
+    size_t             (*pool_allocate_n)(uvisor_pool_t *, uvisor_pool_slot_t *, size_t);
+    size_t             (*pool_try_allocate_n)(uvisor_pool_t *, uvisor_pool_slot_t *, size_t);
 
     void (*spin_init)(UvisorSpinlock * spinlock);
     bool (*spin_trylock)(UvisorSpinlock * spinlock);
@@ -19,6 +19,7 @@
 
 #include "api/inc/uvisor_exports.h"
 #include "api/inc/page_allocator_exports.h"
+#include "api/inc/ipc_exports.h"
 #include "api/inc/rpc_exports.h"
 #include <stddef.h>
 #include <stdint.h>
@@ -33,6 +34,42 @@ UVISOR_EXTERN void const * const public_box_cfg_ptr;
 #define __UVISOR_BOX_ROUND_4(size) \
     (((size) + 3UL) & ~3UL)
 
+/* The number of slots of the RPC and IPC queues of the boxes configured in a
+ * file. To set them for a box, define them before including the uVisor
+ * library in the file that configures the box. Each can range from 1 to
+ * UVISOR_RPC_MESSAGE_SLOTS_MAX, UVISOR_RPC_FN_GROUP_SLOTS_MAX or
+ * UVISOR_IPC_SLOTS_MAX. */
+#ifndef UVISOR_BOX_RPC_OUTGOING_SLOTS
+#define UVISOR_BOX_RPC_OUTGOING_SLOTS UVISOR_RPC_OUTGOING_MESSAGE_SLOTS
+#endif
+#ifndef UVISOR_BOX_RPC_INCOMING_SLOTS
+#define UVISOR_BOX_RPC_INCOMING_SLOTS UVISOR_RPC_INCOMING_MESSAGE_SLOTS
+#endif
+#ifndef UVISOR_BOX_RPC_FN_GROUP_SLOTS
+#define UVISOR_BOX_RPC_FN_GROUP_SLOTS UVISOR_RPC_FN_GROUP_SLOTS
+#endif
+#ifndef UVISOR_BOX_IPC_SEND_SLOTS
+#define UVISOR_BOX_IPC_SEND_SLOTS UVISOR_IPC_SEND_SLOTS
+#endif
+#ifndef UVISOR_BOX_IPC_RECV_SLOTS
+#define UVISOR_BOX_IPC_RECV_SLOTS UVISOR_IPC_RECV_SLOTS
+#endif
+
+#define __UVISOR_BOX_RPC_SIZE \
+    UVISOR_RPC_SIZE(UVISOR_BOX_RPC_OUTGOING_SLOTS, UVISOR_BOX_RPC_INCOMING_SLOTS, UVISOR_BOX_RPC_FN_GROUP_SLOTS)
+
+#define __UVISOR_BOX_IPC_SIZE \
+    UVISOR_IPC_SIZE(UVISOR_BOX_IPC_SEND_SLOTS, UVISOR_BOX_IPC_RECV_SLOTS)
+
+#define __UVISOR_BOX_QUEUE_SLOTS \
+    { \
+        UVISOR_BOX_RPC_OUTGOING_SLOTS, \
+        UVISOR_BOX_RPC_INCOMING_SLOTS, \
+        UVISOR_BOX_RPC_FN_GROUP_SLOTS, \
+        UVISOR_BOX_IPC_SEND_SLOTS, \
+        UVISOR_BOX_IPC_RECV_SLOTS, \
+    }
+
 #define UVISOR_DISABLED   0
 #define UVISOR_PERMISSIVE 1
 #define UVISOR_ENABLED    2
@@ -55,15 +92,16 @@ UVISOR_EXTERN void const * const public_box_cfg_ptr;
             sizeof(RtxBoxIndex), \
             0, \
             0, \
-            sizeof(uvisor_rpc_t), \
-            sizeof(uvisor_ipc_t), \
+            __UVISOR_BOX_RPC_SIZE, \
+            __UVISOR_BOX_IPC_SIZE, \
             0, \
         }, \
         0, \
         NULL, \
         NULL, \
         acl_list, \
-        acl_list_count \
+        acl_list_count, \
+        __UVISOR_BOX_QUEUE_SLOTS \
     }; \
     \
     UVISOR_EXTERN const __attribute__((section(".keep.uvisor.cfgtbl_ptr_first"), aligned(4))) void * const public_box_cfg_ptr = &public_box_cfg;
@@ -89,9 +127,8 @@ UVISOR_EXTERN void const * const public_box_cfg_ptr;
                     __UVISOR_BOX_ROUND_4(context_size) + \
                     __UVISOR_BOX_ROUND_4(__uvisor_box_heapsize) + \
                     __UVISOR_BOX_ROUND_4(sizeof(RtxBoxIndex)) + \
-                    __UVISOR_BOX_ROUND_4(sizeof(uvisor_rpc_outgoing_message_queue_t)) + \
-                    __UVISOR_BOX_ROUND_4(sizeof(uvisor_rpc_incoming_message_queue_t)) + \
-                    __UVISOR_BOX_ROUND_4(sizeof(uvisor_rpc_fn_group_queue_t)) + \
+                    __UVISOR_BOX_ROUND_4(__UVISOR_BOX_RPC_SIZE) + \
+                    __UVISOR_BOX_ROUND_4(__UVISOR_BOX_IPC_SIZE) + \
                     __UVISOR_BOX_ROUND_4(sizeof(struct _reent)) \
                 ) \
             * 8) \
@@ -104,15 +141,16 @@ UVISOR_EXTERN void const * const public_box_cfg_ptr;
             sizeof(RtxBoxIndex), \
             context_size, \
             sizeof(struct _reent), \
-            sizeof(uvisor_rpc_t), \
-            sizeof(uvisor_ipc_t), \
+            __UVISOR_BOX_RPC_SIZE, \
+            __UVISOR_BOX_IPC_SIZE, \
             __uvisor_box_heapsize, \
         }, \
         UVISOR_MIN_STACK(stack_size), \
         __uvisor_box_lib_config, \
         __uvisor_box_namespace, \
         acl_list, \
-        acl_list_count \
+        acl_list_count, \
+        __UVISOR_BOX_QUEUE_SLOTS \
     }; \
     \
     UVISOR_EXTERN const __attribute__((section(".keep.uvisor.cfgtbl_ptr"), aligned(4))) void * const box_name ## _cfg_ptr = &box_name ## _cfg;
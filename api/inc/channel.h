@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __UVISOR_API_CHANNEL_H__
+#define __UVISOR_API_CHANNEL_H__
+
+#include "api/inc/channel_exports.h"
+#include "api/inc/uvisor_exports.h"
+#include "api/inc/uvisor_semaphore_exports.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/** Set up a channel to stream data from the calling box to another box
+ *
+ * The ring of the channel takes a whole page of the page heap owned by the
+ * calling box, which is shared with the other box for reading and writing.
+ * Once the channel is set up, data moves through the ring with no call into
+ * uVisor. Only one thread of each box can use the channel.
+ *
+ * @param[in]  ring          the start of a page owned by the calling box
+ * @param[in]  consumer_box  the id of the box to stream data to
+ *
+ * @return     0 on success, non-zero error code otherwise
+ */
+UVISOR_EXTERN int uvisor_channel_create(UvisorChannelRing * ring, int consumer_box);
+
+/** Get woken up when data arrives on a channel to the calling box
+ *
+ * uVisor posts to the semaphore when the ring of the channel becomes
+ * non-empty. It does so on the next thread switch of the producer box.
+ *
+ * @param[in]  ring       the ring of a channel to the calling box
+ * @param[in]  semaphore  an initialized semaphore of the calling box
+ *
+ * @return     0 on success, non-zero error code otherwise
+ */
+UVISOR_EXTERN int uvisor_channel_attach(UvisorChannelRing * ring, UvisorSemaphore * semaphore);
+
+/** Close a channel. Either box of the channel can close it.
+ *
+ * When the producer box closes the channel, the page of the ring is revoked
+ * from the consumer box. The producer box still owns the page.
+ *
+ * @return     0 on success, non-zero error code otherwise
+ */
+UVISOR_EXTERN int uvisor_channel_close(UvisorChannelRing * ring);
+
+/** Write data to a channel, as its producer
+ *
+ * The data is written all at once or not at all. No call into uVisor is
+ * made.
+ *
+ * @return     0 on success, `UVISOR_ERROR_BUFFER_TOO_SMALL` if the ring has
+ *             not enough room for the data, non-zero error code otherwise
+ */
+UVISOR_EXTERN int uvisor_channel_write(UvisorChannelRing * ring, const void * data, size_t len);
+
+/** Read data from a channel, as its consumer
+ *
+ * The data is read all at once or not at all. No call into uVisor is made.
+ *
+ * @return     0 on success, `UVISOR_ERROR_BUFFER_TOO_SMALL` if the ring holds
+ *             less data than requested, non-zero error code otherwise
+ */
+UVISOR_EXTERN int uvisor_channel_read(UvisorChannelRing * ring, void * data, size_t len);
+
+/** Return the number of bytes that can be read from a channel. */
+UVISOR_EXTERN size_t uvisor_channel_available(UvisorChannelRing * ring);
+
+/** Wait for data on a channel, as its consumer
+ *
+ * @param[in]  ring        the ring of the channel
+ * @param[in]  semaphore   the semaphore attached to the channel
+ * @param[in]  timeout_ms  how long to wait (in ms) for data before returning.
+ *                         0 means don't wait at all, `UVISOR_WAIT_FOREVER`
+ *                         means wait forever.
+ * @return     0 if the channel holds data, `UVISOR_ERROR_TIMEOUT` if no data
+ *             arrived in time
+ */
+UVISOR_EXTERN int uvisor_channel_wait(UvisorChannelRing * ring, UvisorSemaphore * semaphore, uint32_t timeout_ms);
+
+#endif /* __UVISOR_API_CHANNEL_H__ */
@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __UVISOR_API_CHANNEL_EXPORTS_H__
+#define __UVISOR_API_CHANNEL_EXPORTS_H__
+
+#include "api/inc/halt_exports.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* The number of channels uVisor keeps track of, for all boxes together */
+#ifndef UVISOR_CHANNEL_SLOTS
+#define UVISOR_CHANNEL_SLOTS 4
+#endif
+
+/* Header of the ring of a channel, at the start of the page of the ring. The
+ * data of the ring follows the header, up to the end of the page.
+ *
+ * The head and the tail are the positions the producer box writes to and the
+ * consumer box reads from. They count up to twice the size of the data and
+ * then wrap around, so that a full ring can be told apart from an empty one.
+ * The producer only writes the head and the consumer only writes the tail, so
+ * they need no lock. Neither box trusts the other one, so each checks the
+ * index written by the other one before using it.
+ *
+ * uVisor only reads the ring, to find out if it must wake the consumer up. */
+typedef struct {
+    /* Position of the producer */
+    volatile uint32_t head;
+
+    /* Position of the consumer */
+    volatile uint32_t tail;
+
+    /* Number of times the ring went from empty to non-empty. uVisor wakes the
+     * consumer up when this changes. */
+    volatile uint32_t wake_ups;
+} UvisorChannelRing;
+
+/* Return the distance from one position in a ring to a later one. */
+static inline uint32_t uvisor_channel_ring_distance(uint32_t from, uint32_t to, uint32_t size)
+{
+    return to >= from ? to - from : to + 2 * size - from;
+}
+
+/* Return the position `len` bytes after another one in a ring. */
+static inline uint32_t uvisor_channel_ring_advance(uint32_t position, uint32_t len, uint32_t size)
+{
+    position += len;
+    return position >= 2 * size ? position - 2 * size : position;
+}
+
+/* Copy data to or from a ring, starting at a position, in at most two pieces
+ * if the data wraps around the end of the ring. */
+static inline void uvisor_channel_ring_copy(UvisorChannelRing * ring, uint32_t position, uint32_t size,
+                                            uint8_t * data, size_t len, bool to_ring)
+{
+    uint8_t * ring_data = (uint8_t *) (ring + 1);
+    uint32_t offset = position >= size ? position - size : position;
+    uint32_t first = size - offset < len ? size - offset : len;
+
+    if (to_ring) {
+        memcpy(ring_data + offset, data, first);
+        memcpy(ring_data, data + first, len - first);
+    } else {
+        memcpy(data, ring_data + offset, first);
+        memcpy(data + first, ring_data, len - first);
+    }
+}
+
+/* Write data to a ring as its producer. The data is written all at once or
+ * not at all. Only one thread can write to a ring.
+ * @param size  the size of the data of the ring
+ * @returns 0 on success, 1 on success if the ring was empty before, so that
+ *          the consumer must be woken up, `UVISOR_ERROR_BUFFER_TOO_SMALL` if
+ *          the ring has not enough room for the data, or
+ *          `UVISOR_ERROR_INVALID_PARAMETERS` if the consumer corrupted the
+ *          ring */
+static inline int uvisor_channel_ring_write(UvisorChannelRing * ring, uint32_t size, const void * data, size_t len)
+{
+    uint32_t head = ring->head;
+    uint32_t tail = ring->tail;
+
+    if (head >= 2 * size || tail >= 2 * size || uvisor_channel_ring_distance(tail, head, size) > size) {
+        return UVISOR_ERROR_INVALID_PARAMETERS;
+    }
+    if (len > size - uvisor_channel_ring_distance(tail, head, size)) {
+        return UVISOR_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    /* The data must be in the ring before the consumer sees the new head. */
+    uvisor_channel_ring_copy(ring, head, size, (uint8_t *) data, len, true);
+    __sync_synchronize();
+    ring->head = uvisor_channel_ring_advance(head, len, size);
+
+    /* The consumer updates the tail before it checks the head to decide
+     * whether to sleep, while we check the tail after updating the head. So
+     * either the consumer sees the new data, or we see that it had read all
+     * the data before and may be sleeping. */
+    __sync_synchronize();
+    if (ring->tail == head) {
+        ring->wake_ups++;
+        return 1;
+    }
+    return 0;
+}
+
+/* Read data from a ring as its consumer. The data is read all at once or not
+ * at all. Only one thread can read from a ring.
+ * @param size  the size of the data of the ring
+ * @returns 0 on success, `UVISOR_ERROR_BUFFER_TOO_SMALL` if the ring holds
+ *          less data than requested, or `UVISOR_ERROR_INVALID_PARAMETERS` if
+ *          the producer corrupted the ring */
+static inline int uvisor_channel_ring_read(UvisorChannelRing * ring, uint32_t size, void * data, size_t len)
+{
+    uint32_t head = ring->head;
+    uint32_t tail = ring->tail;
+
+    if (head >= 2 * size || tail >= 2 * size || uvisor_channel_ring_distance(tail, head, size) > size) {
+        return UVISOR_ERROR_INVALID_PARAMETERS;
+    }
+    if (len > uvisor_channel_ring_distance(tail, head, size)) {
+        return UVISOR_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    /* Read the data only after reading the head that covers it, and free
+     * its room only after reading it. */
+    __sync_synchronize();
+    uvisor_channel_ring_copy(ring, tail, size, (uint8_t *) data, len, false);
+    __sync_synchronize();
+    ring->tail = uvisor_channel_ring_advance(tail, len, size);
+    /* See `uvisor_channel_ring_write`. */
+    __sync_synchronize();
+    return 0;
+}
+
+/* Return whether a ring holds no data, as its consumer. */
+static inline bool uvisor_channel_ring_is_empty(const UvisorChannelRing * ring)
+{
+    return ring->head == ring->tail;
+}
+
+#endif /* __UVISOR_API_CHANNEL_EXPORTS_H__ */
@@ -25,29 +25,38 @@
 
 /** Wait for any of the specified IPC operations to complete.
  *
- * @note  This function currently spins, burning through power.
+ * The calling thread sleeps until uVisor completes one of the operations. Up
+ * to `UVISOR_IPC_WAITER_SLOTS` threads of a box can sleep at the same time;
+ * further threads that would need to sleep fail with
+ * `UVISOR_ERROR_OUT_OF_STRUCTURES`.
  *
- * @param[in]  wait_tokens  a bitfield of tokens to wait on
- * @param[out] done_tokens  a bitfield which tokens completed
+ * @param[in]  wait_tokens  the set of tokens to wait on, built with
+ *                          `uvisor_ipc_tokens_clear` and `uvisor_ipc_tokens_add`
+ * @param[out] done_tokens  the set of tokens which completed
  * @param[in]  timeout_ms   how long to wait (in ms) for an IPC operation
- *                          before returning. 0 means don't wait at all. Any
- *                          other value means wait forever.
- * @return     0 on success, non-zero error code otherwise
+ *                          before returning. 0 means don't wait at all,
+ *                          `UVISOR_WAIT_FOREVER` means wait forever.
+ * @return     0 on success, `UVISOR_ERROR_TIMEOUT` if no operation completed
+ *             in time, non-zero error code otherwise
  */
-UVISOR_EXTERN int ipc_waitforany(uint32_t wait_tokens, uint32_t * done_tokens, uint32_t timeout_ms);
+UVISOR_EXTERN int ipc_waitforany(const uvisor_ipc_tokens_t * wait_tokens, uvisor_ipc_tokens_t * done_tokens,
+                                 uint32_t timeout_ms);
 
 /** Wait for all of the specified IPC operations to complete.
  *
- * @note  This function currently spins, burning through power.
+ * The calling thread sleeps like in `ipc_waitforany`. The timeout covers the
+ * whole wait, not each of the operations.
  *
- * @param[in]  wait_tokens  a bitfield of tokens to wait on
- * @param[out] done_tokens  a bitfield which tokens completed
+ * @param[in]  wait_tokens  the set of tokens to wait on
+ * @param[out] done_tokens  the set of tokens which completed
  * @param[in]  timeout_ms   how long to wait (in ms) for an IPC operation
- *                          before returning. 0 means don't wait at all.
- *                          Any other value means wait forever.
- * @return     0 on success, non-zero error code otherwise
+ *                          before returning. 0 means don't wait at all,
+ *                          `UVISOR_WAIT_FOREVER` means wait forever.
+ * @return     0 on success, `UVISOR_ERROR_TIMEOUT` if the operations did not
+ *             all complete in time, non-zero error code otherwise
  */
-UVISOR_EXTERN int ipc_waitforall(uint32_t wait_tokens, uint32_t * done_tokens, uint32_t timeout_ms);
+UVISOR_EXTERN int ipc_waitforall(const uvisor_ipc_tokens_t * wait_tokens, uvisor_ipc_tokens_t * done_tokens,
+                                 uint32_t timeout_ms);
 
 /** Asynchronously send an IPC message
  *
@@ -73,4 +82,34 @@ UVISOR_EXTERN int ipc_send(uvisor_ipc_desc_t * desc, const void * msg);
  */
 UVISOR_EXTERN int ipc_recv(uvisor_ipc_desc_t * desc, void * msg);
 
+/** Asynchronously send an IPC message by moving the page that holds it
+ *
+ * Instead of copying the message, uVisor moves the page to the receiving box
+ * when the message is delivered. From then on the receiving box owns the page,
+ * and the sending box can no longer access it. The page is also taken away
+ * from the boxes it was shared with. The message is only delivered to a
+ * receive started with `ipc_recv_page`.
+ *
+ * @param[in]  desc   an IPC descriptor for the message, whose length is at
+ *                    most the page size
+ * @param[in]  page   the start of a page of the page heap owned by the calling
+ *                    box, which holds the message
+ *
+ * @return     0 on success, non-zero error code otherwise
+ */
+UVISOR_EXTERN int ipc_send_page(uvisor_ipc_desc_t * desc, void * page);
+
+/** Asynchronously receive an IPC message sent with `ipc_send_page`
+ *
+ * @note The memory pointed to by page must be valid until after the receive
+ * is complete.
+ *
+ * @param[inout] desc   an IPC descriptor for the message
+ * @param[out]   page   where to write the start of the page that holds the
+ *                      message, which the calling box owns from then on
+ *
+ * @return     0 on success, non-zero error code otherwise
+ */
+UVISOR_EXTERN int ipc_recv_page(uvisor_ipc_desc_t * desc, void ** page);
+
 #endif /* __UVISOR_API_IPC_H__ */
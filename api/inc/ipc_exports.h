@@ -18,26 +18,90 @@
 #define __UVISOR_API_IPC_EXPORTS_H__
 
 #include "api/inc/pool_queue_exports.h"
+#include "api/inc/uvisor_semaphore_exports.h"
 #include "api/inc/uvisor_spinlock_exports.h"
 #include "api/inc/vmpu_exports.h"
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 /* Use the invalid box ID to mean "receive from any" box. */
 #define UVISOR_BOX_ID_ANY UVISOR_BOX_ID_INVALID
 
+/* The default number of slots of the IPC queues of a box. Each box can set
+ * its own, see UVISOR_BOX_IPC_SEND_SLOTS in box_config.h. */
 #define UVISOR_IPC_SEND_SLOTS 16
 #define UVISOR_IPC_RECV_SLOTS 16
 
-/* The value UVISOR_IPC_INVALID_TOKEN is defined to should be useful as a null
- * token, and preferably not having any other legitimate use. Due to the
- * internal bitfield representation of tokens, it makes a lot of sense to use 0
- * as the null token. ipc_allocate_token() returns 0 if no tokens are
- * available. Freeing 0 bits means nothing ('&= ~0' is a no-op). No other value
- * makes as much sense to use as 0. If tokens become represented internally as
- * something other than a bitfield, it would make sense to reconsider the value
- * used here. */
+/* The maximum number of slots of the IPC queues of a box. */
+#define UVISOR_IPC_SLOTS_MAX 64
+
+/* The number of threads of a box that can sleep in ipc_waitforany or
+ * ipc_waitforall at the same time. Further threads poll instead. */
+#define UVISOR_IPC_WAITER_SLOTS 4
+
+/* The number of IPC operations each box can have outstanding at the same
+ * time, as a multiple of 32. uVisor and the boxes must use the same value. */
+#ifndef UVISOR_IPC_TOKENS
+#define UVISOR_IPC_TOKENS 256
+#endif
+
+#if UVISOR_IPC_TOKENS <= 0 || UVISOR_IPC_TOKENS % 32 != 0
+#error "UVISOR_IPC_TOKENS must be a positive multiple of 32"
+#endif
+
+#define UVISOR_IPC_TOKEN_WORDS (UVISOR_IPC_TOKENS / 32)
+
+/* A token is the index of its bit in the token bitmaps of a box, plus one.
+ * This leaves 0 as the null token, which ipc_allocate_token() returns if no
+ * tokens are available and which is never found in a set of tokens. */
 #define UVISOR_IPC_INVALID_TOKEN 0
 
+/* A set of tokens, as a bitmap */
+typedef struct uvisor_ipc_tokens {
+    uint32_t words[UVISOR_IPC_TOKEN_WORDS];
+} uvisor_ipc_tokens_t;
+
+static inline void uvisor_ipc_tokens_clear(uvisor_ipc_tokens_t * tokens)
+{
+    int i;
+
+    for (i = 0; i < UVISOR_IPC_TOKEN_WORDS; i++) {
+        tokens->words[i] = 0;
+    }
+}
+
+/* Add a token to a set. Invalid tokens are ignored. */
+static inline void uvisor_ipc_tokens_add(uvisor_ipc_tokens_t * tokens, uint32_t token)
+{
+    if (token != UVISOR_IPC_INVALID_TOKEN && token <= UVISOR_IPC_TOKENS) {
+        token--;
+        tokens->words[token / 32] |= 1UL << (token % 32);
+    }
+}
+
+/* Return whether a set holds a token. Invalid tokens are never held. */
+static inline bool uvisor_ipc_tokens_has(const uvisor_ipc_tokens_t * tokens, uint32_t token)
+{
+    if (token == UVISOR_IPC_INVALID_TOKEN || token > UVISOR_IPC_TOKENS) {
+        return false;
+    }
+    token--;
+    return tokens->words[token / 32] & (1UL << (token % 32));
+}
+
+static inline bool uvisor_ipc_tokens_empty(const uvisor_ipc_tokens_t * tokens)
+{
+    int i;
+
+    for (i = 0; i < UVISOR_IPC_TOKEN_WORDS; i++) {
+        if (tokens->words[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
 typedef enum uvisor_ipc_io_state {
     UVISOR_IPC_IO_STATE_INVALID,
     UVISOR_IPC_IO_STATE_IDLE,
@@ -75,38 +139,93 @@ typedef struct uvisor_ipc_desc {
     uint32_t token;
 } uvisor_ipc_desc_t;
 
+/* The message is a page of the page heap, which is moved from the sending box
+ * to the receiving box instead of being copied. When sending, msg is the start
+ * of the page. When receiving, msg points to where uVisor writes the start of
+ * the page. Page sends only match page receives, and vice versa. */
+#define UVISOR_IPC_FLAG_PAGE (1UL << 0)
+
 /* IPC IO Request Structure */
 typedef struct uvisor_ipc_io {
     uvisor_ipc_desc_t * desc;
     void * msg;
     uvisor_ipc_io_state_t state;
+    uint32_t flags;
+    /* The next receive IO in the same bucket of the port index */
+    uvisor_pool_slot_t port_next;
 } uvisor_ipc_io_t;
 
-#define UVISOR_IPC_SEND_TYPE(slots) \
-    struct { \
-        uvisor_pool_queue_t queue; \
-        uvisor_pool_t pool; \
-        uvisor_pool_queue_entry_t entries[slots]; \
-        uvisor_ipc_io_t io[slots]; \
-    }
+/* The number of buckets of the port index of a box, as a power of two */
+#ifndef UVISOR_IPC_PORT_BUCKETS
+#define UVISOR_IPC_PORT_BUCKETS 16
+#endif
 
-#define UVISOR_IPC_RECV_TYPE(slots) \
-    struct { \
-        uvisor_pool_queue_t queue; \
-        uvisor_pool_t pool; \
-        uvisor_pool_queue_entry_t entries[slots]; \
-        uvisor_ipc_io_t io[slots]; \
-    }
+#if UVISOR_IPC_PORT_BUCKETS & (UVISOR_IPC_PORT_BUCKETS - 1)
+#error "UVISOR_IPC_PORT_BUCKETS must be a power of two"
+#endif
+
+/* Index from ports to the receive IOs waiting on them, so that uVisor doesn't
+ * have to search the whole receive queue for each message.
+ * Each bucket lists the receive IOs of the ports that hash to it, linked
+ * through their port_next field, in the order they were posted. The box
+ * threads push the IOs they post onto the incoming stack of the bucket, and
+ * uVisor moves them to the end of the list before each lookup. Only uVisor
+ * changes the lists. */
+typedef struct uvisor_ipc_port_index {
+    uvisor_pool_slot_t incoming[UVISOR_IPC_PORT_BUCKETS];
+    uvisor_pool_slot_t head[UVISOR_IPC_PORT_BUCKETS];
+    uvisor_pool_slot_t tail[UVISOR_IPC_PORT_BUCKETS];
+} uvisor_ipc_port_index_t;
+
+static inline uint32_t uvisor_ipc_port_bucket(size_t port)
+{
+    /* Keep the middle bits of a multiplicative hash. */
+    return (((uint32_t) port * 2654435761UL) >> 16) & (UVISOR_IPC_PORT_BUCKETS - 1);
+}
+
+/* Push a receive IO, which must be in the receive queue already, onto the
+ * incoming stack of the bucket of its port. Any number of threads can push
+ * concurrently. */
+static inline void uvisor_ipc_port_index_push(uvisor_ipc_port_index_t * index, uvisor_ipc_io_t * io,
+                                              uvisor_pool_slot_t slot)
+{
+    uvisor_pool_slot_t * incoming = &index->incoming[uvisor_ipc_port_bucket(io->desc->port)];
+    uvisor_pool_slot_t top;
+
+    do {
+        top = *((volatile uvisor_pool_slot_t *) incoming);
+        io->port_next = top;
+    } while (!__sync_bool_compare_and_swap(incoming, top, slot));
+}
 
-typedef UVISOR_IPC_SEND_TYPE(UVISOR_IPC_SEND_SLOTS) uvisor_ipc_send_queue_t;
-typedef UVISOR_IPC_RECV_TYPE(UVISOR_IPC_RECV_SLOTS) uvisor_ipc_recv_queue_t;
+/* The queues of the IPC BSS section of a box. The pools of the queues are
+ * laid out after the uvisor_ipc_t in the section, each sized for the number
+ * of slots of the box, in the order of UVISOR_IPC_SIZE. */
+typedef struct uvisor_ipc_send_queue {
+    uvisor_pool_queue_t queue;
+    uvisor_ipc_io_t * io;
+} uvisor_ipc_send_queue_t;
+
+typedef struct uvisor_ipc_recv_queue {
+    uvisor_pool_queue_t queue;
+    uvisor_ipc_io_t * io;
+    uvisor_ipc_port_index_t port_index;
+} uvisor_ipc_recv_queue_t;
+
+/* A thread sleeping until some IPC operations of its box complete. uVisor
+ * posts to the semaphore when it completes any of the tokens. */
+typedef struct uvisor_ipc_waiter {
+    UvisorSemaphore semaphore;
+    uvisor_ipc_tokens_t tokens; /* The tokens waited for, or none if the waiter is free. */
+} uvisor_ipc_waiter_t;
 
 typedef struct uvisor_ipc {
     uvisor_ipc_send_queue_t send_queue;
     uvisor_ipc_recv_queue_t recv_queue;
-    UvisorSpinlock tokens_lock; /* Protect access to tokens. */
-    uint32_t allocated_tokens; /* Endpoints read and write. */
-    uint32_t completed_tokens; /* uVisor and endpoints read and write. */
+    UvisorSpinlock tokens_lock; /* Protect access to the completed tokens and the waiters. */
+    uvisor_ipc_tokens_t allocated_tokens; /* Endpoints read and write, atomically. */
+    uvisor_ipc_tokens_t completed_tokens; /* uVisor and endpoints read and write. */
+    uvisor_ipc_waiter_t waiters[UVISOR_IPC_WAITER_SLOTS];
 } uvisor_ipc_t;
 
 static inline uvisor_ipc_t * uvisor_ipc(UvisorBoxIndex * const index)
@@ -114,4 +233,44 @@ static inline uvisor_ipc_t * uvisor_ipc(UvisorBoxIndex * const index)
     return (uvisor_ipc_t *) index->bss.address_of.ipc;
 }
 
+/* The size of the IPC BSS section of a box with the given numbers of slots */
+#define UVISOR_IPC_SIZE(send_slots, recv_slots) \
+    (__UVISOR_POOL_ROUND(sizeof(uvisor_ipc_t)) + \
+     UVISOR_POOL_SIZE(sizeof(uvisor_ipc_io_t), (send_slots)) + \
+     UVISOR_POOL_SIZE(sizeof(uvisor_ipc_io_t), (recv_slots)))
+
+/* Lay out the pools of the IPC queues of a box after its uvisor_ipc_t, as
+ * sized by UVISOR_IPC_SIZE, and initialize the queues. The box threads only
+ * enqueue into the IPC queues and uVisor is their only consumer, so they don't
+ * need to be locked. Return 0 on success, non-zero otherwise. */
+static inline int uvisor_ipc_queues_init(uvisor_ipc_t * ipc, const UvisorBoxQueueSlots * slots)
+{
+    uint8_t * next = (uint8_t *) ipc + __UVISOR_POOL_ROUND(sizeof(uvisor_ipc_t));
+    uvisor_pool_t * pool;
+    int i;
+
+    pool = (uvisor_pool_t *) next;
+    ipc->send_queue.io = (uvisor_ipc_io_t *) uvisor_pool_array(pool, slots->ipc_send);
+    next += UVISOR_POOL_SIZE(sizeof(uvisor_ipc_io_t), slots->ipc_send);
+    if (uvisor_pool_queue_init_mode(&ipc->send_queue.queue, pool, ipc->send_queue.io, sizeof(uvisor_ipc_io_t),
+                                    slots->ipc_send, UVISOR_POOL_QUEUE_MODE_MPSC)) {
+        return -1;
+    }
+
+    pool = (uvisor_pool_t *) next;
+    ipc->recv_queue.io = (uvisor_ipc_io_t *) uvisor_pool_array(pool, slots->ipc_recv);
+    if (uvisor_pool_queue_init_mode(&ipc->recv_queue.queue, pool, ipc->recv_queue.io, sizeof(uvisor_ipc_io_t),
+                                    slots->ipc_recv, UVISOR_POOL_QUEUE_MODE_MPSC)) {
+        return -1;
+    }
+
+    for (i = 0; i < UVISOR_IPC_PORT_BUCKETS; i++) {
+        ipc->recv_queue.port_index.incoming[i] = UVISOR_POOL_SLOT_INVALID;
+        ipc->recv_queue.port_index.head[i] = UVISOR_POOL_SLOT_INVALID;
+        ipc->recv_queue.port_index.tail[i] = UVISOR_POOL_SLOT_INVALID;
+    }
+
+    return 0;
+}
+
 #endif
@@ -43,6 +43,47 @@ static UVISOR_FORCEINLINE int uvisor_page_free(const UvisorPageTable * const tab
     return uvisor_api.page_free(table);
 }
 
+/* Zero free pages in advance, so that they need not be zeroed when they are
+ * allocated. Call this repeatedly when the system is idle.
+ * @param max_pages the maximum number of pages to zero. uVisor may zero fewer
+ *                  pages to bound the time spent in the call.
+ * @returns the number of free pages that still need zeroing
+ */
+static UVISOR_FORCEINLINE int uvisor_page_clean(uint32_t max_pages)
+{
+    return uvisor_api.page_clean(max_pages);
+}
+
+/* Get the page zeroing statistics.
+ * @param stats[out] the statistics
+ * @returns Non-zero on failure with failure class `UVISOR_ERROR_CLASS_PAGE`. See `UVISOR_ERROR_PAGE_*`.
+ */
+static UVISOR_FORCEINLINE int uvisor_page_get_stats(UvisorPageStats * const stats)
+{
+    return uvisor_api.page_get_stats(stats);
+}
+
+/* Share pages owned by the calling box with another box. The pages stay shared
+ * until they are revoked or freed by the calling box.
+ * @param table     the pages to share, as returned by `uvisor_page_malloc`
+ * @param dst_box   the id of the box to share the pages with
+ * @param acl       `UVISOR_TACL_UREAD` to share the pages for reading only, or
+ *                  `UVISOR_TACL_UREAD | UVISOR_TACL_UWRITE`
+ * @returns Non-zero on failure with failure class `UVISOR_ERROR_CLASS_PAGE`. See `UVISOR_ERROR_PAGE_*`.
+ */
+static UVISOR_FORCEINLINE int uvisor_page_share(const UvisorPageTable * const table, int dst_box, uint32_t acl)
+{
+    return uvisor_api.page_share(table, dst_box, acl);
+}
+
+/* Stop sharing pages owned by the calling box with another box.
+ * @returns Non-zero on failure with failure class `UVISOR_ERROR_CLASS_PAGE`. See `UVISOR_ERROR_PAGE_*`.
+ */
+static UVISOR_FORCEINLINE int uvisor_page_revoke(const UvisorPageTable * const table, int dst_box)
+{
+    return uvisor_api.page_revoke(table, dst_box);
+}
+
 /* @returns the active page size for one page. */
 static UVISOR_FORCEINLINE uint32_t uvisor_get_page_size(void)
 {
@@ -29,6 +29,8 @@
 #define UVISOR_ERROR_PAGE_INVALID_PAGE_ORIGIN   (UVISOR_ERROR_CLASS_PAGE + 4)
 #define UVISOR_ERROR_PAGE_INVALID_PAGE_OWNER    (UVISOR_ERROR_CLASS_PAGE + 5)
 #define UVISOR_ERROR_PAGE_INVALID_PAGE_COUNT    (UVISOR_ERROR_CLASS_PAGE + 6)
+#define UVISOR_ERROR_PAGE_INVALID_BOX_ID        (UVISOR_ERROR_CLASS_PAGE + 7)
+#define UVISOR_ERROR_PAGE_INVALID_ACL           (UVISOR_ERROR_CLASS_PAGE + 8)
 
 /* Contains the uVisor page size.
  * @warning Do not read directly, instead use `uvisor_get_page_size()` accessor! */
@@ -40,4 +42,11 @@ typedef struct {
     void * page_origins[1]; /* Table of pointers to the origin of each page. */
 } UvisorPageTable;
 
+typedef struct {
+    uint32_t free_count;        /* The number of free pages. */
+    uint32_t dirty_count;       /* The number of free pages that still need zeroing. */
+    uint32_t prezeroed_count;   /* The number of pages allocated that were zeroed in advance. */
+    uint32_t zeroed_sync_count; /* The number of pages zeroed during allocation. */
+} UvisorPageStats;
+
 #endif /* __UVISOR_API_PAGE_ALLOCATOR_EXPORTS_H__ */
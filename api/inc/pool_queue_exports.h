@@ -27,6 +27,19 @@
 #define UVISOR_POOL_QUEUE_NON_BLOCKING (0)
 #define UVISOR_POOL_QUEUE_BLOCKING (1)
 
+/* Pool queue modes
+ *
+ * In the locked mode, all queue operations are serialized by the pool
+ * spinlock, and any number of threads can enqueue and dequeue slots.
+ *
+ * In the MPSC (multiple producers, single consumer) mode, slots are enqueued
+ * without taking the pool spinlock, so enqueuing never fails and never blocks
+ * the consumer. Only a single consumer may dequeue or search the queue. The
+ * consumer doesn't take the pool spinlock either. Allocating and freeing slots
+ * still take the pool spinlock in both modes. */
+#define UVISOR_POOL_QUEUE_MODE_LOCKED (0)
+#define UVISOR_POOL_QUEUE_MODE_MPSC   (1)
+
 #define UVISOR_POOL_SLOT_INVALID     ((uint8_t) 0xFFU)
 #define UVISOR_POOL_SLOT_IS_DEQUEUED ((uint8_t) 0xFEU)
 #define UVISOR_POOL_SLOT_IS_FREE     ((uint8_t) 0xFDU)
@@ -94,9 +107,35 @@ typedef struct uvisor_pool_queue {
     /* The last allocated slot */
     uvisor_pool_slot_t tail;
 
+    /* One of the UVISOR_POOL_QUEUE_MODE_* values */
+    uint8_t mode;
+
+    /* In MPSC mode, the last slot enqueued by a producer that the consumer
+     * has not moved to the queue yet. These slots are linked in reverse
+     * order through their next field. */
+    uvisor_pool_slot_t incoming;
+
     uvisor_pool_t * pool;
 } uvisor_pool_queue_t;
 
+/* Round a size up so that what follows it is aligned like a pointer, which
+ * the slots of a pool may contain. */
+#define __UVISOR_POOL_ROUND(size) \
+    (((size) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+/* The size of a pool of `num` slots of `stride` bytes each, laid out in one
+ * piece: the pool, its management array, and then its slots. */
+#define UVISOR_POOL_SIZE(stride, num) \
+    (__UVISOR_POOL_ROUND(sizeof(uvisor_pool_t) + sizeof(uvisor_pool_queue_entry_t) * (num)) + \
+     __UVISOR_POOL_ROUND((stride) * (num)))
+
+/* Return the slots of a pool of `num` slots laid out in one piece, as sized by
+ * `UVISOR_POOL_SIZE`. */
+static inline void * uvisor_pool_array(uvisor_pool_t * pool, size_t num)
+{
+    return (uint8_t *) pool + __UVISOR_POOL_ROUND(sizeof(uvisor_pool_t) + sizeof(uvisor_pool_queue_entry_t) * num);
+}
+
 /* Intialize a pool.
  * Return 0 on success, non-zero otherwise. */
 UVISOR_EXTERN int uvisor_pool_init(uvisor_pool_t * pool, void * array, size_t stride, size_t num);
@@ -105,6 +144,11 @@ UVISOR_EXTERN int uvisor_pool_init(uvisor_pool_t * pool, void * array, size_t st
  * Return 0 on success, non-zero otherwise. */
 UVISOR_EXTERN int uvisor_pool_queue_init(uvisor_pool_queue_t * pool_queue, uvisor_pool_t * pool, void * array, size_t stride, size_t num);
 
+/* Initialize a pool queue in the specified mode (UVISOR_POOL_QUEUE_MODE_*).
+ * `uvisor_pool_queue_init` initializes the queue in the locked mode.
+ * Return 0 on success, non-zero otherwise. */
+UVISOR_EXTERN int uvisor_pool_queue_init_mode(uvisor_pool_queue_t * pool_queue, uvisor_pool_t * pool, void * array, size_t stride, size_t num, uint8_t mode);
+
 /* Allocate a slot from the pool. This doesn't put anything in the slot for
  * you. It's up to you to do that. Return the index of the allocated slot, or
  * UVISOR_POOL_SLOT_INVALID if there is no available slot. This function will
@@ -114,10 +158,24 @@ UVISOR_EXTERN uvisor_pool_slot_t uvisor_pool_allocate(uvisor_pool_t * pool);
  * serializing access to the pool can not be taken. */
 UVISOR_EXTERN uvisor_pool_slot_t uvisor_pool_try_allocate(uvisor_pool_t * pool);
 
-/* Enqueue the specified slot into the queue. */
+/* Allocate count slots from the pool with a single lock acquisition and store
+ * their indexes in the slots array. Either all count slots are allocated or
+ * none is. Return the number of allocated slots, which is 0 if the pool has
+ * fewer than count free slots. The try variant also returns 0 if the spin lock
+ * serializing access to the pool can not be taken. */
+UVISOR_EXTERN size_t uvisor_pool_allocate_n(uvisor_pool_t * pool, uvisor_pool_slot_t * slots, size_t count);
+UVISOR_EXTERN size_t uvisor_pool_try_allocate_n(uvisor_pool_t * pool, uvisor_pool_slot_t * slots, size_t count);
+
+/* Enqueue the specified slot into the queue. In MPSC mode, the try variant
+ * never fails. */
 UVISOR_EXTERN void uvisor_pool_queue_enqueue(uvisor_pool_queue_t * pool_queue, uvisor_pool_slot_t slot);
 UVISOR_EXTERN int uvisor_pool_queue_try_enqueue(uvisor_pool_queue_t * pool_queue, uvisor_pool_slot_t slot);
 
+/* Enqueue count slots into the queue, in order, with a single lock acquisition.
+ * Return 0 on success, non-zero if any of the slots is invalid or if the spin
+ * lock serializing access to the pool could not be taken. */
+UVISOR_EXTERN int uvisor_pool_queue_try_enqueue_batch(uvisor_pool_queue_t * pool_queue, const uvisor_pool_slot_t * slots, size_t count);
+
 /* Free the specified slot back into the pool. Invalid slots are ignored.
  * Return the slot that was freed, or UVISOR_POOL_SLOT_IS_FREE if the slot was
  * already freed, or UVISOR_POOL_SLOT_INVALID if the slot being requested to
@@ -125,6 +183,9 @@ UVISOR_EXTERN int uvisor_pool_queue_try_enqueue(uvisor_pool_queue_t * pool_queue
 UVISOR_EXTERN uvisor_pool_slot_t uvisor_pool_free(uvisor_pool_t * pool, uvisor_pool_slot_t slot);
 UVISOR_EXTERN uvisor_pool_slot_t uvisor_pool_try_free(uvisor_pool_t * pool, uvisor_pool_slot_t slot);
 
+/* In MPSC mode, the following dequeue and find functions may only be called by
+ * the consumer of the queue. */
+
 /* Remove the specified slot from the queue. This function does not free the
  * specified slot back into the pool. Return the slot that was dequeued, or
  * UVISOR_POOL_SLOT_IS_DEQUEUED if the slot was already dequeued, or
@@ -140,6 +201,13 @@ UVISOR_EXTERN uvisor_pool_slot_t uvisor_pool_queue_dequeue(uvisor_pool_queue_t *
 UVISOR_EXTERN uvisor_pool_slot_t uvisor_pool_queue_dequeue_first(uvisor_pool_queue_t * pool_queue);
 UVISOR_EXTERN uvisor_pool_slot_t uvisor_pool_queue_try_dequeue_first(uvisor_pool_queue_t * pool_queue);
 
+/* Remove up to max slots from the front of the queue with a single lock
+ * acquisition, and store them in queue order in the slots array. This function
+ * does not free the dequeued slots back into the pool. Return the number of
+ * dequeued slots, which is 0 if the queue is empty or if the spin lock
+ * serializing access to the pool could not be taken. */
+UVISOR_EXTERN size_t uvisor_pool_queue_try_dequeue_batch(uvisor_pool_queue_t * pool_queue, uvisor_pool_slot_t * slots, size_t max);
+
 /* Find the first (in queue order) slot that the supplied query function
  * returns non-zero for. The query function is provided with `context` on every
  * invocation. This allows query functions to access additional data without
@@ -163,6 +231,16 @@ static inline uvisor_pool_slot_t uvisor_pool_queue_try_allocate(uvisor_pool_queu
     return uvisor_pool_try_allocate(pool_queue->pool);
 }
 
+static inline size_t uvisor_pool_queue_allocate_n(uvisor_pool_queue_t * pool_queue, uvisor_pool_slot_t * slots, size_t count)
+{
+    return uvisor_pool_allocate_n(pool_queue->pool, slots, count);
+}
+
+static inline size_t uvisor_pool_queue_try_allocate_n(uvisor_pool_queue_t * pool_queue, uvisor_pool_slot_t * slots, size_t count)
+{
+    return uvisor_pool_try_allocate_n(pool_queue->pool, slots, count);
+}
+
 /* Inline helper function to make freeing slots for pool queues easier and
  * better encapsulated (clients don't need to pull the pool out of the pool
  * queue, or even realize pool_queue is implemented with a pool) */
@@ -17,6 +17,7 @@
 #ifndef __UVISOR_API_RPC_H__
 #define __UVISOR_API_RPC_H__
 
+#include "api/inc/api.h"
 #include "api/inc/rpc_exports.h"
 #include "api/inc/uvisor_exports.h"
 #include <stdint.h>
@@ -53,4 +54,144 @@ UVISOR_EXTERN int rpc_fncall_waitfor(const TFN_Ptr fn_ptr_array[], size_t fn_cou
  */
 UVISOR_EXTERN int rpc_fncall_wait(uvisor_rpc_result_t result, uint32_t timeout_ms, uint32_t * ret);
 
+/** A completed asynchronous RPC, as returned by `rpc_completion_wait` */
+typedef struct uvisor_rpc_completion {
+    /* The token returned when the RPC was started */
+    uvisor_rpc_result_t result;
+
+    /* The return value of the target function */
+    uint32_t value;
+} uvisor_rpc_completion_t;
+
+/** Initialize a completion queue.
+ *
+ * @param cq[out] The completion queue to initialize
+ * @returns       Non-zero on error, zero on success
+ */
+UVISOR_EXTERN int rpc_completion_queue_init(uvisor_rpc_completion_queue_t * cq);
+
+/** Start an asynchronous RPC that completes into a completion queue.
+ *
+ * Like `rpc_fncall_async`, but the result is not waited for with
+ * `rpc_fncall_wait`. Instead, uVisor adds the RPC to the completion queue when
+ * it finishes, and `rpc_completion_wait` returns it. Many RPCs can complete
+ * into the same completion queue.
+ *
+ * @param p0..p3[in]  The parameters of the target function
+ * @param gateway[in] The RPC gateway to call through
+ * @param cq[in]      The completion queue to add the RPC to when it finishes
+ * @param result[out] The token the completion of the RPC is reported with
+ * @returns           Non-zero if there was no free outgoing message slot, zero
+ *                    if the RPC was started
+ */
+UVISOR_EXTERN int rpc_fncall_async_completion(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3, const TRPCGateway * gateway,
+                                              uvisor_rpc_completion_queue_t * cq, uvisor_rpc_result_t * result);
+
+/** Wait for asynchronous RPCs to finish.
+ *
+ * Wait until at least one of the RPCs started with the completion queue has
+ * finished, and return all the finished ones, up to `max`. Only one thread
+ * may wait on a completion queue at a time.
+ *
+ * @param cq[in]         The completion queue to wait on
+ * @param timeout_ms[in] How long to wait (in ms) for an RPC to finish before
+ *                       returning
+ * @param out[out]       The finished RPCs, in the order they finished
+ * @param max[in]        The number of entries of `out`
+ * @returns              The number of finished RPCs stored in `out`, zero on
+ *                       timeout
+ */
+UVISOR_EXTERN size_t rpc_completion_wait(uvisor_rpc_completion_queue_t * cq, uint32_t timeout_ms,
+                                         uvisor_rpc_completion_t out[], size_t max);
+
+/** Call an RPC that passes buffers by reference, and wait for it to finish.
+ *
+ * The callee box accesses the buffers in place, without copying them. uVisor
+ * checks that the calling box can access each buffer, and grants the callee
+ * box access to the buffers it can't access yet until the RPC completes. Such
+ * buffers must each lie in a single page of the page heap owned by the
+ * calling box. Buffers in public memory can always be passed. The pointers to
+ * the buffers are passed to the target function as regular parameters.
+ * Like the synchronous RPC, this waits forever for the result.
+ *
+ * @param p0..p3[in]       The parameters of the target function
+ * @param gateway[in]      The RPC gateway to call through
+ * @param buffers[in]      The buffers the target function accesses
+ * @param buffer_count[in] The number of buffers, at most
+ *                         `UVISOR_RPC_BUFFER_COUNT`
+ * @param ret[out]         The return value of the target function. Optional.
+ * @returns                Zero if the RPC finished, or
+ *                         `UVISOR_ERROR_INVALID_PARAMETERS` if uVisor
+ *                         rejected the buffers. The target function is not
+ *                         called then.
+ */
+UVISOR_EXTERN int rpc_fncall_sync_buffers(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3, const TRPCGateway * gateway,
+                                          const uvisor_rpc_buffer_t buffers[], size_t buffer_count, uint32_t * ret);
+
+/** A call of a batch of RPCs
+ *
+ * The parameters and the gateway are the same as those the RPC gateway macros
+ * pass to the target function.
+ */
+typedef struct uvisor_rpc_call {
+    uint32_t p0;
+    uint32_t p1;
+    uint32_t p2;
+    uint32_t p3;
+    const TRPCGateway * gateway;
+} uvisor_rpc_call_t;
+
+/** Call a batch of RPCs and wait for all of them to finish.
+ *
+ * The calls are sent together: their outgoing message slots are allocated at
+ * once, and uVisor delivers the calls to the same callee box together. The
+ * calling thread is woken up only once, when the last call of the batch
+ * finishes. Like the synchronous RPC, this waits forever for the results.
+ *
+ * @param calls[in]    The RPCs to call, in order
+ * @param count[in]    The number of RPCs to call, at most the number of
+ *                     outgoing message slots of the box
+ * @param results[out] The return values of the RPCs, in the same order as the
+ *                     calls
+ * @returns            Zero if all the RPCs finished, or
+ *                     `UVISOR_ERROR_INVALID_PARAMETERS` if `count` is too
+ *                     large, or `UVISOR_ERROR_OUT_OF_STRUCTURES` if there are
+ *                     fewer than `count` free outgoing message slots. In case
+ *                     of error, none of the RPCs is called.
+ */
+UVISOR_EXTERN int rpc_fncall_batch(const uvisor_rpc_call_t calls[], size_t count, uint32_t results[]);
+
+/** Get the latencies of the RPCs between all the boxes.
+ *
+ * uVisor keeps the latencies only if it was built with `UVISOR_RPC_STATS`, and
+ * only the public box can read them. See `uvisor_rpc_stats_t`.
+ *
+ * @param stats[out] The latencies
+ * @returns          Zero on success, or `UVISOR_ERROR_NOT_IMPLEMENTED` if
+ *                   uVisor doesn't keep the latencies, or
+ *                   `UVISOR_ERROR_INVALID_BOX_ID` if the calling box is not
+ *                   the public box
+ */
+static UVISOR_FORCEINLINE int uvisor_rpc_get_stats(uvisor_rpc_stats_t * stats)
+{
+    return uvisor_api.rpc_get_stats(stats);
+}
+
+/** Deliver what the calling box queued for another box right away.
+ *
+ * uVisor normally delivers the RPCs, RPC results, IPC messages and channel
+ * wake ups of a box on its next thread switch. This call delivers the ones
+ * for the given box at once, so that a thread of that box waiting for them
+ * can run as soon as the calling thread blocks or is preempted. The ones for
+ * other boxes stay queued until the next thread switch.
+ *
+ * @param box_id  the id of the box to deliver to
+ * @returns       Zero on success, or `UVISOR_ERROR_INVALID_BOX_ID` if the box
+ *                does not exist or is the calling box
+ */
+static UVISOR_FORCEINLINE int uvisor_box_kick(int box_id)
+{
+    return uvisor_api.box_kick(box_id);
+}
+
 #endif /* __UVISOR_API_RPC_H__ */
@@ -20,6 +20,7 @@
 #include "api/inc/pool_queue_exports.h"
 #include "api/inc/uvisor_semaphore_exports.h"
 #include "api/inc/rpc_gateway_exports.h"
+#include "api/inc/uvisor_spinlock_exports.h"
 #include "api/inc/vmpu_exports.h"
 
 typedef uint32_t (*TFN_Ptr)(uint32_t, uint32_t, uint32_t, uint32_t);
@@ -59,8 +60,35 @@ typedef enum {
     UVISOR_RPC_MESSAGE_STATE_READY_TO_SEND, /* send function, nobody */
     UVISOR_RPC_MESSAGE_STATE_SENT, /* uvisor, uvisor */
     UVISOR_RPC_MESSAGE_STATE_DONE, /* waitfor_fngroup function, uvisor when delivers back */
+    UVISOR_RPC_MESSAGE_STATE_REJECTED, /* uvisor when the buffers are not valid, nobody */
 } uvisor_rpc_message_state_t;
 
+/* The maximum number of buffers an RPC can pass by reference. */
+#ifndef UVISOR_RPC_BUFFER_COUNT
+#define UVISOR_RPC_BUFFER_COUNT (2)
+#endif
+
+/* How the callee uses a buffer passed by reference. */
+#define UVISOR_RPC_BUFFER_IN    (1UL << 0) /* The callee reads the buffer. */
+#define UVISOR_RPC_BUFFER_OUT   (1UL << 1) /* The callee writes the buffer. */
+#define UVISOR_RPC_BUFFER_INOUT (UVISOR_RPC_BUFFER_IN | UVISOR_RPC_BUFFER_OUT)
+
+/* A buffer of the caller box that the callee box accesses in place during an
+ * RPC. */
+typedef struct uvisor_rpc_buffer {
+    const void * address;
+    uint32_t size;
+
+    /* UVISOR_RPC_BUFFER_IN, UVISOR_RPC_BUFFER_OUT or UVISOR_RPC_BUFFER_INOUT */
+    uint32_t direction;
+} uvisor_rpc_buffer_t;
+
+/* Measure the latency of the RPCs in uVisor. uVisor and uvisor-lib must be
+ * built with the same value, as this changes the layout of the messages. */
+#ifndef UVISOR_RPC_STATS
+#define UVISOR_RPC_STATS 0
+#endif
+
 typedef struct uvisor_rpc_message {
     /* NOTE: These are set by the caller, and read by the callee. */
     uint32_t p0;
@@ -92,8 +120,88 @@ typedef struct uvisor_rpc_message {
     uvisor_rpc_message_state_t state;
 
     uint32_t result;
+
+    /* NOTE: These are only used in the outgoing queue of the caller. */
+    /* The slot of the first message of the batch this message was sent in, or
+     * UVISOR_POOL_SLOT_INVALID if the message was sent on its own. */
+    uvisor_pool_slot_t batch_slot;
+
+    /* In the first message of a batch, the number of messages of the batch
+     * that haven't completed yet. uVisor posts to the semaphore of the first
+     * message only once this reaches zero. */
+    uint32_t batch_pending;
+
+    /* The buffers passed by reference. uVisor validates them and grants the
+     * callee box access to them until the RPC completes. */
+    uint32_t buffer_count;
+    uvisor_rpc_buffer_t buffers[UVISOR_RPC_BUFFER_COUNT];
+
+    /* The completion queue uVisor adds the message to when the RPC completes,
+     * instead of posting to the semaphore of the message, or NULL. */
+    struct uvisor_rpc_completion_queue * completion_queue;
+
+#if UVISOR_RPC_STATS
+    /* NOTE: These are only used by uVisor, in the outgoing queue of the
+     * caller, and only as numbers. The caller clears queued_at when sending. */
+    /* The time uVisor first found the message in the queue, or 0 */
+    uint32_t queued_at;
+    /* The time uVisor delivered the message to the callee box */
+    uint32_t delivered_at;
+    /* The target function the message was delivered for */
+    uint32_t target;
+#endif
 } uvisor_rpc_message_t;
 
+/* The number of (calling box, target function) pairs the RPC latencies are
+ * kept for. RPCs of further pairs are only counted as dropped. */
+#ifndef UVISOR_RPC_STATS_ENTRIES
+#define UVISOR_RPC_STATS_ENTRIES (8)
+#endif
+
+/* The latencies are counted in power-of-two buckets of CPU cycles. Bucket 0
+ * holds the latencies below 2^(UVISOR_RPC_STATS_BUCKET_SHIFT + 1) cycles,
+ * bucket i > 0 the ones from 2^(UVISOR_RPC_STATS_BUCKET_SHIFT + i) cycles, and
+ * the last bucket all the longer ones too. */
+#define UVISOR_RPC_STATS_BUCKETS (16)
+#define UVISOR_RPC_STATS_BUCKET_SHIFT (6)
+
+#define UVISOR_RPC_STATS_MAGIC 0x53435052 /* "RPCS" */
+
+typedef struct uvisor_rpc_stats_entry {
+    /* The target function, or 0 if the entry is free */
+    uint32_t target;
+    uint32_t caller_box;
+
+    /* The number of RPCs recorded, and the longest total latency */
+    uint32_t count;
+    uint32_t max;
+
+    /* From uVisor finding the message in the outgoing queue of the caller
+     * box to its delivery to the callee box */
+    uint32_t wait[UVISOR_RPC_STATS_BUCKETS];
+
+    /* From the delivery to uVisor taking the result from the done queue of
+     * the callee box */
+    uint32_t service[UVISOR_RPC_STATS_BUCKETS];
+
+    /* Both of the above */
+    uint32_t total[UVISOR_RPC_STATS_BUCKETS];
+} uvisor_rpc_stats_entry_t;
+
+/* The RPC latencies, as copied by `rpc_get_stats`. The layout only uses 32-bit
+ * words, so that a memory dump of it can be decoded on the host. */
+typedef struct uvisor_rpc_stats {
+    uint32_t magic;
+    uint32_t entry_count;
+    uint32_t bucket_count;
+    uint32_t bucket_shift;
+
+    /* The number of RPCs not recorded because all the entries were taken */
+    uint32_t dropped;
+
+    uvisor_rpc_stats_entry_t entries[UVISOR_RPC_STATS_ENTRIES];
+} uvisor_rpc_stats_t;
+
 typedef struct uvisor_rpc_fn_group {
     /* A pointer to the function group */
     TFN_Ptr const * fn_ptr_array;
@@ -103,40 +211,91 @@ typedef struct uvisor_rpc_fn_group {
     UvisorSemaphore semaphore;
 } uvisor_rpc_fn_group_t;
 
+/* The default number of slots of the RPC queues of a box. Each box can set
+ * its own, see UVISOR_BOX_RPC_OUTGOING_SLOTS in box_config.h. */
 #define UVISOR_RPC_OUTGOING_MESSAGE_SLOTS (8)
 
 #define UVISOR_RPC_INCOMING_MESSAGE_SLOTS (8)
 
 #define UVISOR_RPC_FN_GROUP_SLOTS (8)
 
-#define UVISOR_RPC_OUTGOING_MESSAGE_TYPE(slots) \
-    struct { \
-        uvisor_pool_queue_t queue; \
-        uvisor_pool_t pool; \
-        uvisor_pool_queue_entry_t entries[slots]; \
-        uvisor_rpc_message_t messages[slots]; \
-    }
+/* The maximum number of slots of the RPC message queues of a box. */
+#define UVISOR_RPC_MESSAGE_SLOTS_MAX (64)
 
-#define UVISOR_RPC_INCOMING_MESSAGE_TYPE(slots) \
-    struct { \
-        uvisor_pool_queue_t todo_queue; \
-        uvisor_pool_queue_t done_queue; \
-        uvisor_pool_t pool; \
-        uvisor_pool_queue_entry_t entries[slots]; \
-        uvisor_rpc_message_t messages[slots]; \
-    }
+/* The maximum number of function group slots of a box. The function groups
+ * that handle a function are kept as a 32-bit mask in the function index. */
+#define UVISOR_RPC_FN_GROUP_SLOTS_MAX (32)
 
-#define UVISOR_RPC_FN_GROUP_TYPE(slots) \
-    struct { \
-        uvisor_pool_queue_t queue; \
-        uvisor_pool_t pool; \
-        uvisor_pool_queue_entry_t entries[slots]; \
-        uvisor_rpc_fn_group_t fn_groups[slots]; \
-    }
+/* A queue of the completed asynchronous RPCs of a box, which one thread waits
+ * on for many RPCs at once. A box never has more RPCs outstanding than it has
+ * outgoing message slots, and a slot is only freed once its completion has
+ * been taken from the queue, so the queue can't overflow. */
+typedef struct uvisor_rpc_completion_queue {
+    /* Posted by uVisor when it adds a completion to an empty queue */
+    UvisorSemaphore semaphore;
 
-typedef UVISOR_RPC_OUTGOING_MESSAGE_TYPE(UVISOR_RPC_OUTGOING_MESSAGE_SLOTS) uvisor_rpc_outgoing_message_queue_t;
-typedef UVISOR_RPC_INCOMING_MESSAGE_TYPE(UVISOR_RPC_INCOMING_MESSAGE_SLOTS) uvisor_rpc_incoming_message_queue_t;
-typedef UVISOR_RPC_FN_GROUP_TYPE(UVISOR_RPC_FN_GROUP_SLOTS) uvisor_rpc_fn_group_queue_t;
+    /* Number of completions added, only written by uVisor */
+    volatile uint32_t head;
+
+    /* Number of completions taken, only written by the waiting thread */
+    volatile uint32_t tail;
+
+    /* The outgoing message slots of the completed RPCs */
+    uvisor_pool_slot_t slots[UVISOR_RPC_MESSAGE_SLOTS_MAX];
+} uvisor_rpc_completion_queue_t;
+
+/* Number of distinct target functions the function index can hold. This must
+ * be a power of two, and should be well above the number of functions the
+ * function groups of a box handle, to keep the lookups short. */
+#ifndef UVISOR_RPC_FN_INDEX_SLOTS
+#define UVISOR_RPC_FN_INDEX_SLOTS (64)
+#endif
+
+typedef struct uvisor_rpc_fn_index_entry {
+    /* The target function, or NULL if the entry is free */
+    TFN_Ptr fn;
+
+    /* The function group slots that can handle the function, one bit per
+     * slot */
+    uint32_t fn_groups;
+} uvisor_rpc_fn_index_entry_t;
+
+/* Open addressing hash table from target functions to the function groups
+ * that handle them. Entries are only ever added, in the same order in which
+ * the function groups are allocated. The box threads adding entries hold the
+ * lock, while lookups don't need it. */
+typedef struct uvisor_rpc_fn_index {
+    volatile uvisor_rpc_fn_index_entry_t entries[UVISOR_RPC_FN_INDEX_SLOTS];
+
+    /* Set when a function didn't fit into the index. Lookups of functions not
+     * in the index then need to search the function groups. */
+    volatile uint32_t overflow;
+
+    UvisorSpinlock lock;
+} uvisor_rpc_fn_index_t;
+
+/* The queues of the RPC BSS section of a box. The pools of the queues are
+ * laid out after the uvisor_rpc_t in the section, each sized for the number
+ * of slots of the box, in the order of UVISOR_RPC_SIZE. */
+typedef struct uvisor_rpc_outgoing_message_queue {
+    uvisor_pool_queue_t queue;
+    uvisor_rpc_message_t * messages;
+    /* Posted when a slot is freed while threads wait for one */
+    UvisorSemaphore slot_semaphore;
+    /* The number of threads waiting for a free slot */
+    volatile uint32_t slot_waiters;
+} uvisor_rpc_outgoing_message_queue_t;
+
+typedef struct uvisor_rpc_incoming_message_queue {
+    uvisor_pool_queue_t todo_queue;
+    uvisor_pool_queue_t done_queue;
+    uvisor_rpc_message_t * messages;
+} uvisor_rpc_incoming_message_queue_t;
+
+typedef struct uvisor_rpc_fn_group_queue {
+    uvisor_pool_queue_t queue;
+    uvisor_rpc_fn_group_t * fn_groups;
+} uvisor_rpc_fn_group_queue_t;
 
 typedef struct uvisor_rpc_t {
     /* Outgoing message queue */
@@ -148,6 +307,9 @@ typedef struct uvisor_rpc_t {
     /* Function group queue */
     uvisor_rpc_fn_group_queue_t fn_group_queue;
 
+    /* Index of the functions handled by the function groups */
+    uvisor_rpc_fn_index_t fn_index;
+
     /* Counter to avoid waiting on the same RPC result twice by accident. */
     uint32_t result_counter;
 } uvisor_rpc_t;
@@ -157,4 +319,107 @@ static inline uvisor_rpc_t * uvisor_rpc(UvisorBoxIndex * const index)
     return (uvisor_rpc_t *) index->bss.address_of.rpc;
 }
 
+/* The size of the RPC BSS section of a box with the given numbers of slots */
+#define UVISOR_RPC_SIZE(outgoing_slots, incoming_slots, fn_group_slots) \
+    (__UVISOR_POOL_ROUND(sizeof(uvisor_rpc_t)) + \
+     UVISOR_POOL_SIZE(sizeof(uvisor_rpc_message_t), (outgoing_slots)) + \
+     UVISOR_POOL_SIZE(sizeof(uvisor_rpc_message_t), (incoming_slots)) + \
+     UVISOR_POOL_SIZE(sizeof(uvisor_rpc_fn_group_t), (fn_group_slots)))
+
+/* Lay out the pools of the RPC queues of a box after its uvisor_rpc_t, as
+ * sized by UVISOR_RPC_SIZE, and initialize the queues. The semaphores are not
+ * initialized. Return 0 on success, non-zero otherwise. */
+static inline int uvisor_rpc_queues_init(uvisor_rpc_t * rpc, const UvisorBoxQueueSlots * slots)
+{
+    uint8_t * next = (uint8_t *) rpc + __UVISOR_POOL_ROUND(sizeof(uvisor_rpc_t));
+    uvisor_pool_t * pool;
+
+    /* uVisor is the only consumer of the outgoing message queue. */
+    pool = (uvisor_pool_t *) next;
+    rpc->outgoing_message_queue.messages = (uvisor_rpc_message_t *) uvisor_pool_array(pool, slots->rpc_outgoing);
+    next += UVISOR_POOL_SIZE(sizeof(uvisor_rpc_message_t), slots->rpc_outgoing);
+    if (uvisor_pool_queue_init_mode(&rpc->outgoing_message_queue.queue, pool,
+                                    rpc->outgoing_message_queue.messages, sizeof(uvisor_rpc_message_t),
+                                    slots->rpc_outgoing, UVISOR_POOL_QUEUE_MODE_MPSC)) {
+        return -1;
+    }
+
+    /* The todo and done queues share the incoming message pool. The todo
+     * queue has multiple consumers (the handler threads), but uVisor is the
+     * only consumer of the done queue. */
+    pool = (uvisor_pool_t *) next;
+    rpc->incoming_message_queue.messages = (uvisor_rpc_message_t *) uvisor_pool_array(pool, slots->rpc_incoming);
+    next += UVISOR_POOL_SIZE(sizeof(uvisor_rpc_message_t), slots->rpc_incoming);
+    if (uvisor_pool_queue_init(&rpc->incoming_message_queue.todo_queue, pool,
+                               rpc->incoming_message_queue.messages, sizeof(uvisor_rpc_message_t),
+                               slots->rpc_incoming)) {
+        return -1;
+    }
+    if (uvisor_pool_queue_init_mode(&rpc->incoming_message_queue.done_queue, pool,
+                                    rpc->incoming_message_queue.messages, sizeof(uvisor_rpc_message_t),
+                                    slots->rpc_incoming, UVISOR_POOL_QUEUE_MODE_MPSC)) {
+        return -1;
+    }
+
+    pool = (uvisor_pool_t *) next;
+    rpc->fn_group_queue.fn_groups = (uvisor_rpc_fn_group_t *) uvisor_pool_array(pool, slots->rpc_fn_group);
+    if (uvisor_pool_queue_init(&rpc->fn_group_queue.queue, pool,
+                               rpc->fn_group_queue.fn_groups, sizeof(uvisor_rpc_fn_group_t),
+                               slots->rpc_fn_group)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static inline uint32_t uvisor_rpc_fn_index_hash(TFN_Ptr fn)
+{
+    /* Drop the Thumb bit and keep the middle bits of a multiplicative hash. */
+    return ((uint32_t) (((uint32_t) fn >> 1) * 2654435761UL)) >> 16;
+}
+
+/* Return the function group slots that handle a function, one bit per slot,
+ * or 0 if the function is not in the index. */
+static inline uint32_t uvisor_rpc_fn_index_lookup(const uvisor_rpc_fn_index_t * fn_index, TFN_Ptr fn)
+{
+    uint32_t hash = uvisor_rpc_fn_index_hash(fn);
+    uint32_t i;
+
+    for (i = 0; i < UVISOR_RPC_FN_INDEX_SLOTS; i++) {
+        const volatile uvisor_rpc_fn_index_entry_t * entry = &fn_index->entries[(hash + i) & (UVISOR_RPC_FN_INDEX_SLOTS - 1)];
+        TFN_Ptr entry_fn = entry->fn;
+        if (entry_fn == fn) {
+            return entry->fn_groups;
+        }
+        if (entry_fn == NULL) {
+            break;
+        }
+    }
+    return 0;
+}
+
+/* Add a function group slot to the entry of a function, with the index lock
+ * held. Return non-zero if the index is full. */
+static inline int uvisor_rpc_fn_index_add(uvisor_rpc_fn_index_t * fn_index, TFN_Ptr fn, uvisor_pool_slot_t slot)
+{
+    uint32_t hash = uvisor_rpc_fn_index_hash(fn);
+    uint32_t i;
+
+    for (i = 0; i < UVISOR_RPC_FN_INDEX_SLOTS; i++) {
+        volatile uvisor_rpc_fn_index_entry_t * entry = &fn_index->entries[(hash + i) & (UVISOR_RPC_FN_INDEX_SLOTS - 1)];
+        if (entry->fn == fn) {
+            entry->fn_groups |= 1UL << slot;
+            return 0;
+        }
+        if (entry->fn == NULL) {
+            /* Publish the function only after its function groups, as
+             * lookups don't take the lock. */
+            entry->fn_groups = 1UL << slot;
+            entry->fn = fn;
+            return 0;
+        }
+    }
+    return -1;
+}
+
 #endif
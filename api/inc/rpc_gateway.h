@@ -116,6 +116,65 @@
         uvisor_rpc_result_t (*gw_name)(__VA_ARGS__) __attribute__((section(".rodata"))) = (uvisor_rpc_result_t (*)(__VA_ARGS__)) ((uint32_t) &gw_name ## _rpc_gateway + 1); \
     UVISOR_EXTERN_C_END
 
+/** Direct RPC Gateway
+ *
+ * This macro declares a new function pointer (with no name mangling) named
+ * `gw_name` to perform a direct remote procedure call (RPC) to the target
+ * function given by `fn_name`. A direct RPC does not go through the RPC
+ * queues: uVisor switches to the callee box and runs the target function
+ * right away, in the calling thread, on the stack of the callee box. The
+ * return value is handed back in registers.
+ *
+ * Only use direct RPCs for short target functions that never block. The
+ * calling thread cannot be preempted while the target function runs, and
+ * uVisor halts if the target function tries to switch threads. Direct RPCs
+ * can only be called from threads, not from interrupt handlers, from the box
+ * initialization or from other direct RPCs, and the target function must not
+ * be in the calling box.
+ *
+ * @note On ARMv8-M, direct RPCs fall back to synchronous RPCs, so the callee
+ * box must also serve the target function with `rpc_fncall_waitfor`.
+ *
+ * Create function with following signature:
+ * UVISOR_EXTERN fn_ret gw_name(uint32_t a, uint32_t b);
+ *
+ * @param box_name[in] The name of the source box as declared in
+ *                     `UVISOR_BOX_CONFIG`
+ * @param gw_name[in]  The new, callable function pointer for initiating an RPC from the caller's box
+ * @param fn_name[in]  The function that will run in the callee's box as an RPC target
+ * @param fn_ret[in]   The return type of the function being designated as an
+ *                     RPC target
+ * @param __VA_ARGS__  The type of each parameter passed to the target
+ *                     function. There can be up to 4 parameters in a target
+ *                     function. Each parameter must be no more than uint32_t
+ *                     in size. If the RPC target function accepts no
+ *                     arguments, pass `void` here.
+ */
+#define UVISOR_BOX_RPC_GATEWAY_DIRECT(box_name, gw_name, fn_name, fn_ret, ...) \
+    UVISOR_STATIC_ASSERT(sizeof(fn_ret) <= sizeof(uint32_t), gw_name ## _return_type_too_big); \
+    _UVISOR_BOX_RPC_GATEWAY_ARG_CHECK(gw_name, __VA_ARGS__) \
+    _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_DECL(fn_name, gw_name ## _rpc_gateway, __VA_ARGS__) \
+    /* Instanstiate the gateway. This gets resolved at link-time. */ \
+    UVISOR_EXTERN TRPCGateway const gw_name ## _rpc_gateway = { \
+        .ldr_pc   = LDR_PC_PC_IMM_OPCODE(__UVISOR_OFFSETOF(TRPCGateway, ldr_pc), \
+                                         __UVISOR_OFFSETOF(TRPCGateway, caller)), \
+        .magic    = UVISOR_RPC_GATEWAY_MAGIC_DIRECT, \
+        .box_ptr  = (uint32_t) &box_name ## _cfg_ptr, \
+        .target = (uint32_t) fn_name, \
+        .caller = (uint32_t) _sgw_direct_ ## fn_name, \
+    }; \
+    _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER(fn_name, gw_name ## _rpc_gateway, __VA_ARGS__) \
+    \
+    /* Pointer to the gateway we just created. The pointer is located in a
+     * discoverable linker section. */ \
+    __attribute__((section(".keep.uvisor.rpc_gateway_ptr"))) \
+    uint32_t const gw_name ## _rpc_gateway_ptr = (uint32_t) &gw_name ## _rpc_gateway; \
+    \
+    /* Declare the actual gateway. */ \
+    UVISOR_EXTERN_C_BEGIN \
+        fn_ret (*gw_name)(__VA_ARGS__) __attribute__((section(".rodata"))) = (fn_ret (*)(__VA_ARGS__)) ((uint32_t) &gw_name ## _rpc_gateway + 1); \
+    UVISOR_EXTERN_C_END
+
 #define _UVISOR_BOX_RPC_GATEWAY_ARG_CHECK(gw_name, ...) \
     __UVISOR_BOX_MACRO(__VA_ARGS__, _UVISOR_BOX_RPC_GATEWAY_ARG_CHECK_4, \
                                     _UVISOR_BOX_RPC_GATEWAY_ARG_CHECK_3, \
@@ -261,6 +320,65 @@
         return rpc_fncall_async(p0, p1, p2, p3, &gateway); \
     }
 
+#define _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_DECL(fn_name, gateway, ...) \
+    __UVISOR_BOX_MACRO(__VA_ARGS__, _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_4_DECL, \
+                                    _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_3_DECL, \
+                                    _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_2_DECL, \
+                                    _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_1_DECL, \
+                                    _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_0_DECL)(fn_name, gateway, __VA_ARGS__)
+
+#define _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER(fn_name, gateway, ...) \
+    __UVISOR_BOX_MACRO(__VA_ARGS__, _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_4, \
+                                    _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_3, \
+                                    _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_2, \
+                                    _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_1, \
+                                    _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_0)(fn_name, gateway, __VA_ARGS__)
+
+#define _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_0_DECL(fn_name, gateway, ...) \
+    static uint32_t _sgw_direct_ ## fn_name(void);
+
+#define _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_0(fn_name, gateway, ...) \
+    static uint32_t _sgw_direct_ ## fn_name(void) \
+    { \
+        return rpc_fncall_direct(0, 0, 0, 0, &gateway); \
+    }
+
+#define _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_1_DECL(fn_name, gateway, ...) \
+    static uint32_t _sgw_direct_ ## fn_name(uint32_t p0);
+
+#define _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_1(fn_name, gateway, ...) \
+    static uint32_t _sgw_direct_ ## fn_name(uint32_t p0) \
+    { \
+        return rpc_fncall_direct(p0, 0, 0, 0, &gateway); \
+    }
+
+#define _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_2_DECL(fn_name, gateway, ...) \
+    static uint32_t _sgw_direct_ ## fn_name(uint32_t p0, uint32_t p1);
+
+#define _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_2(fn_name, gateway, ...) \
+    static uint32_t _sgw_direct_ ## fn_name(uint32_t p0, uint32_t p1) \
+    { \
+        return rpc_fncall_direct(p0, p1, 0, 0, &gateway); \
+    }
+
+#define _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_3_DECL(fn_name, gateway, ...) \
+    static uint32_t _sgw_direct_ ## fn_name(uint32_t p0, uint32_t p1, uint32_t p2);
+
+#define _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_3(fn_name, gateway, ...) \
+    static uint32_t _sgw_direct_ ## fn_name(uint32_t p0, uint32_t p1, uint32_t p2) \
+    { \
+        return rpc_fncall_direct(p0, p1, p2, 0, &gateway); \
+    }
+
+#define _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_4_DECL(fn_name, gateway, ...) \
+    static uint32_t _sgw_direct_ ## fn_name(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3);
+
+#define _UVISOR_BOX_RPC_GATEWAY_DIRECT_CALLER_4(fn_name, gateway, ...) \
+    static uint32_t _sgw_direct_ ## fn_name(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3) \
+    { \
+        return rpc_fncall_direct(p0, p1, p2, p3, &gateway); \
+    }
+
 /* This function is private to uvisor-lib, but needs to be publicly visible for
  * the RPC gateway creation macros to work. */
 UVISOR_EXTERN uint32_t rpc_fncall_sync(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3, const TRPCGateway * gateway);
@@ -269,4 +387,8 @@ UVISOR_EXTERN uint32_t rpc_fncall_sync(uint32_t p0, uint32_t p1, uint32_t p2, ui
  * the RPC gateway creation macros to work. */
 UVISOR_EXTERN uvisor_rpc_result_t rpc_fncall_async(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3, const TRPCGateway * gateway);
 
+/* This function is private to uvisor-lib, but needs to be publicly visible for
+ * the RPC gateway creation macros to work. */
+UVISOR_EXTERN uint32_t rpc_fncall_direct(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3, const TRPCGateway * gateway);
+
 #endif /* __UVISOR_API_RPC_GATEWAY_H__ */
@@ -42,4 +42,15 @@ typedef struct RPCGateway {
     uint32_t caller; /* This is not for use by anything other than the ldr_pc. It's like a pretend literal pool. */
 } UVISOR_PACKED UVISOR_ALIGN(4) TRPCGateway;
 
+/* Return true if and only if a callee box serves RPCs through the given
+ * gateway from its incoming message queue. Direct gateways end up there when
+ * the caller cannot call them directly, and are served like synchronous
+ * ones. */
+static UVISOR_FORCEINLINE int rpc_gateway_is_queued(const TRPCGateway * gateway)
+{
+    return gateway->magic == UVISOR_RPC_GATEWAY_MAGIC_ASYNC ||
+           gateway->magic == UVISOR_RPC_GATEWAY_MAGIC_SYNC ||
+           gateway->magic == UVISOR_RPC_GATEWAY_MAGIC_DIRECT;
+}
+
 #endif /* __UVISOR_API_RPC_GATEWAY_EXPORTS_H__ */
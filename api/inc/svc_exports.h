@@ -96,6 +96,8 @@
 #define UVISOR_SVC_ID_REGISTER_GATEWAY    UVISOR_SVC_FIXED_TABLE(3, 0)
 #define UVISOR_SVC_ID_BOX_INIT_FIRST      UVISOR_SVC_FIXED_TABLE(4, 0)
 #define UVISOR_SVC_ID_BOX_INIT_NEXT       UVISOR_SVC_FIXED_TABLE(5, 0)
+#define UVISOR_SVC_ID_RPC_DIRECT_IN       UVISOR_SVC_FIXED_TABLE(6, 4)
+#define UVISOR_SVC_ID_RPC_DIRECT_OUT      UVISOR_SVC_FIXED_TABLE(7, 0)
 
 /* SVC immediate values for hardcoded table (call from privileged) */
 #define UVISOR_SVC_ID_UNVIC_IN         UVISOR_SVC_FIXED_TABLE(0, 0)
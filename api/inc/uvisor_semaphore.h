@@ -30,4 +30,8 @@ UVISOR_EXTERN int __uvisor_semaphore_pend(UvisorSemaphore * semaphore, uint32_t
 /* This function is safe to call from interrupt context. */
 UVISOR_EXTERN int __uvisor_semaphore_post(UvisorSemaphore * semaphore);
 
+/* Return the current time, in the same milliseconds as the pend timeouts. The
+ * value wraps around. */
+UVISOR_EXTERN uint32_t __uvisor_semaphore_time_ms(void);
+
 #endif
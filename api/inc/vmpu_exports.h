@@ -92,7 +92,7 @@
 
 #define UVISOR_PAD32(x)             (32 - (sizeof(x) & ~0x1FUL))
 #define UVISOR_BOX_MAGIC            0x42CFB66FUL
-#define UVISOR_BOX_VERSION          100
+#define UVISOR_BOX_VERSION          101
 #define UVISOR_STACK_BAND_SIZE      128
 #define UVISOR_MEM_SIZE_ROUND(x)    UVISOR_REGION_ROUND_UP(x)
 
@@ -166,6 +166,15 @@ typedef struct uvisor_bss_sections_t {
 /* The number of per-box BSS sections. */
 #define UVISOR_BSS_SECTIONS_COUNT (sizeof(UvisorBssSections) / sizeof(uint32_t))
 
+/* The number of slots of the RPC and IPC queues of a box. */
+typedef struct uvisor_box_queue_slots_t {
+    uint8_t rpc_outgoing;
+    uint8_t rpc_incoming;
+    uint8_t rpc_fn_group;
+    uint8_t ipc_send;
+    uint8_t ipc_recv;
+} UVISOR_PACKED UvisorBoxQueueSlots;
+
 /* Compile-time per-box configuration table
  * Each box has one of this table in flash. Every other data structure that this
  * table might point to must be in flash as well. The uVisor core must check the
@@ -195,8 +204,28 @@ typedef struct {
     const char * const box_namespace;
     const UvisorBoxAclItem * const acl_list;
     const uint32_t acl_count;
+
+    /* The RPC and IPC BSS sections are sized for these. */
+    const UvisorBoxQueueSlots queue_slots;
 } UVISOR_PACKED UvisorBoxConfig;
 
+/* Queues of a box that uVisor drains on thread switches. */
+typedef enum {
+    UVISOR_BOX_DOORBELL_RPC_OUTGOING = 0,
+    UVISOR_BOX_DOORBELL_RPC_DONE,
+    UVISOR_BOX_DOORBELL_IPC_SEND,
+    UVISOR_BOX_DOORBELL_CHANNEL,
+} UvisorBoxDoorbell;
+
+/* Doorbells of a box, one byte per queue. The box rings a doorbell with a
+ * plain byte store after it queues work for uVisor, so that box threads
+ * preempting each other cannot lose a doorbell. uVisor checks all of them
+ * with a single load. */
+typedef union {
+    uint32_t any;
+    uint8_t queue[4];
+} UVISOR_PACKED UvisorBoxDoorbells;
+
 /* Enumeration-time per-box index table
  * Each box has one of this table in SRAM. The index tables are initialized at
  * box enumeration time and are then managed by the secure boxes themselves. */
@@ -223,6 +252,10 @@ typedef struct {
 
     /* Pointer to the box config */
     const UvisorBoxConfig * config;
+
+    /* Doorbells for the queues uVisor drains on thread switches.
+     * uVisor skips the queues whose doorbell has not been rung. */
+    volatile UvisorBoxDoorbells doorbells;
 } UVISOR_PACKED UvisorBoxIndex;
 
 /*
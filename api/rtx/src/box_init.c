@@ -44,65 +44,55 @@ void __uvisor_initialize_rpc_queues(void)
 
     UvisorBoxIndex * const index = &__uvisor_ps->index;
 
+    const UvisorBoxQueueSlots * slots = &index->config->queue_slots;
+    uvisor_rpc_t * rpc = uvisor_rpc(index);
     uvisor_pool_slot_t i;
 
-    uvisor_rpc_outgoing_message_queue_t * rpc_outgoing_msg_queue = &(uvisor_rpc(index)->outgoing_message_queue);
-    uvisor_rpc_incoming_message_queue_t * rpc_incoming_msg_queue = &(uvisor_rpc(index)->incoming_message_queue);
-    uvisor_rpc_fn_group_queue_t * rpc_fn_group_queue = &(uvisor_rpc(index)->fn_group_queue);
+    /* Lay the RPC queues out with the number of slots configured for the box. */
+    if (uvisor_rpc_queues_init(rpc, slots)) {
+        uvisor_error(USER_NOT_ALLOWED);
+    }
 
-    /* Initialize the outgoing RPC message queue. */
-    if (uvisor_pool_queue_init(&rpc_outgoing_msg_queue->queue,
-                               &rpc_outgoing_msg_queue->pool,
-                               rpc_outgoing_msg_queue->messages,
-                               sizeof(*rpc_outgoing_msg_queue->messages),
-                               UVISOR_RPC_OUTGOING_MESSAGE_SLOTS)) {
+    /* Initialize the semaphore of the threads waiting for a free outgoing
+     * message slot. It counts up to one post per slot. */
+    if (__uvisor_semaphore_init(&rpc->outgoing_message_queue.slot_semaphore, slots->rpc_outgoing, 0)) {
         uvisor_error(USER_NOT_ALLOWED);
     }
 
     /* Initialize all the result semaphores. */
-    for (i = 0; i < UVISOR_RPC_OUTGOING_MESSAGE_SLOTS; i++) {
-        UvisorSemaphore * semaphore = &rpc_outgoing_msg_queue->messages[i].semaphore;
+    for (i = 0; i < slots->rpc_outgoing; i++) {
+        UvisorSemaphore * semaphore = &rpc->outgoing_message_queue.messages[i].semaphore;
         if (__uvisor_semaphore_init(semaphore, 1, 0)) {
             uvisor_error(USER_NOT_ALLOWED);
         }
     }
 
-    /* Initialize the incoming RPC message queues. */
-    if (uvisor_pool_queue_init(&rpc_incoming_msg_queue->todo_queue,
-                               &rpc_incoming_msg_queue->pool,
-                               rpc_incoming_msg_queue->messages,
-                               sizeof(*rpc_incoming_msg_queue->messages),
-                               UVISOR_RPC_INCOMING_MESSAGE_SLOTS)) {
-        uvisor_error(USER_NOT_ALLOWED);
-    }
-    /* This is a double init of the pool. We need a function that just inits
-     * the queue, not the pool, and init everybody separately. */
-    if (uvisor_pool_queue_init(&rpc_incoming_msg_queue->done_queue,
-                               &rpc_incoming_msg_queue->pool,
-                               rpc_incoming_msg_queue->messages,
-                               sizeof(*rpc_incoming_msg_queue->messages),
-                               UVISOR_RPC_INCOMING_MESSAGE_SLOTS)) {
-        uvisor_error(USER_NOT_ALLOWED);
-    }
-
-    /* Initialize the function group pool. */
-    if (uvisor_pool_queue_init(&rpc_fn_group_queue->queue,
-                               &rpc_fn_group_queue->pool,
-                               rpc_fn_group_queue->fn_groups,
-                               sizeof(*rpc_fn_group_queue->fn_groups),
-                               UVISOR_RPC_FN_GROUP_SLOTS)) {
-        uvisor_error(USER_NOT_ALLOWED);
-    }
+    /* Initialize the index of the functions handled by the function groups. */
+    uvisor_spin_init(&rpc->fn_index.lock);
 
     /* Initialize all the function group semaphores. */
-    for (i = 0; i < UVISOR_RPC_FN_GROUP_SLOTS; i++) {
-        UvisorSemaphore * semaphore = &rpc_fn_group_queue->fn_groups[i].semaphore;
+    for (i = 0; i < slots->rpc_fn_group; i++) {
+        UvisorSemaphore * semaphore = &rpc->fn_group_queue.fn_groups[i].semaphore;
         if (__uvisor_semaphore_init(semaphore, 1, 0)) {
             uvisor_error(USER_NOT_ALLOWED);
         }
     }
 }
 
+void __uvisor_initialize_ipc_waiters(void)
+{
+    uvisor_ipc_t * ipc = uvisor_ipc(&__uvisor_ps->index);
+    int i;
+
+    /* Initialize the semaphores of the threads waiting for IPC operations to
+     * complete. */
+    for (i = 0; i < UVISOR_IPC_WAITER_SLOTS; i++) {
+        if (__uvisor_semaphore_init(&ipc->waiters[i].semaphore, 1, 0)) {
+            uvisor_error(USER_NOT_ALLOWED);
+        }
+    }
+}
+
 /* This function is called by uVisor in unprivileged mode. On this OS, we
  * create box main threads for the box. */
 void __uvisor_lib_box_init(void * lib_config)
@@ -112,6 +102,7 @@ void __uvisor_lib_box_init(void * lib_config)
     osThreadAttr_t thread_attr = { 0 };
 
     __uvisor_initialize_rpc_queues();
+    __uvisor_initialize_ipc_waiters();
 
     thread_attr.name = "uvisor_box_main_thread";
     thread_attr.priority = box_main->priority;
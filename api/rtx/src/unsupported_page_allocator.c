@@ -31,6 +31,7 @@
 #define vmpu_public_flash_addr(...) 1
 #define vmpu_sram_addr(...) 1
 #define vmpu_public_sram_addr(...) 1
+#define vmpu_mpu_invalidate_pages() {}
 #define HALT_ERROR(id, ...) {}
 #define UVISOR_PAGE_ALLOCATOR_MUTEX_AQUIRE  page_allocator_mutex_aquire()
 #define UVISOR_PAGE_ALLOCATOR_MUTEX_RELEASE osMutexRelease(g_page_allocator_mutex_id)
@@ -39,6 +40,10 @@
 /* Forward declaration of the page allocator API. */
 int page_allocator_malloc(UvisorPageTable * const table);
 int page_allocator_free(const UvisorPageTable * const table);
+int page_allocator_clean(uint32_t max_pages);
+int page_allocator_get_stats(UvisorPageStats * const stats);
+int page_allocator_share(const UvisorPageTable * const table, int dst_box, uint32_t acl);
+int page_allocator_revoke(const UvisorPageTable * const table, int dst_box);
 
 int uvisor_page_malloc(UvisorPageTable *const table)
 {
@@ -50,6 +55,26 @@ int uvisor_page_free(const UvisorPageTable *const table)
     return page_allocator_free(table);
 }
 
+int uvisor_page_clean(uint32_t max_pages)
+{
+    return page_allocator_clean(max_pages);
+}
+
+int uvisor_page_get_stats(UvisorPageStats *const stats)
+{
+    return page_allocator_get_stats(stats);
+}
+
+int uvisor_page_share(const UvisorPageTable *const table, int dst_box, uint32_t acl)
+{
+    return page_allocator_share(table, dst_box, acl);
+}
+
+int uvisor_page_revoke(const UvisorPageTable *const table, int dst_box)
+{
+    return page_allocator_revoke(table, dst_box);
+}
+
 /* Implement mutex for page allocator. */
 static osMutexId_t g_page_allocator_mutex_id = NULL;
 static osRtxMutex_t g_page_allocator_mutex_data;
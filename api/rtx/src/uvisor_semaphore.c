@@ -49,3 +49,9 @@ int __uvisor_semaphore_post(UvisorSemaphore * s) {
     uvisor_semaphore_internal_t * semaphore = (uvisor_semaphore_internal_t *) s;
     return osSemaphoreRelease(semaphore->id);
 }
+
+uint32_t __uvisor_semaphore_time_ms(void)
+{
+    /* The pend timeouts are passed to RTX as ticks, too. */
+    return osKernelGetTickCount();
+}
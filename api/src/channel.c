@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "api/inc/api.h"
+#include "api/inc/box_id.h"
+#include "api/inc/channel.h"
+#include "api/inc/channel_exports.h"
+#include "api/inc/halt_exports.h"
+#include "api/inc/page_allocator.h"
+#include "api/inc/uvisor_semaphore.h"
+#include "api/inc/vmpu_exports.h"
+#include <string.h>
+
+extern UvisorBoxIndex * const __uvisor_ps;
+
+/* Return the size of the data of a ring. */
+static uint32_t channel_size(void)
+{
+    return uvisor_get_page_size() - sizeof(UvisorChannelRing);
+}
+
+int uvisor_channel_create(UvisorChannelRing * ring, int consumer_box)
+{
+    UvisorPageTable table = {
+        .page_size = uvisor_get_page_size(),
+        .page_count = 1,
+        .page_origins = {ring},
+    };
+    int ret;
+
+    memset(ring, 0, sizeof(*ring));
+
+    ret = uvisor_page_share(&table, consumer_box, UVISOR_TACL_UREAD | UVISOR_TACL_UWRITE);
+    if (ret) {
+        return ret;
+    }
+    ret = uvisor_api.channel_create(ring, consumer_box);
+    if (ret) {
+        uvisor_page_revoke(&table, consumer_box);
+    }
+    return ret;
+}
+
+int uvisor_channel_attach(UvisorChannelRing * ring, UvisorSemaphore * semaphore)
+{
+    return uvisor_api.channel_attach(ring, semaphore);
+}
+
+int uvisor_channel_close(UvisorChannelRing * ring)
+{
+    UvisorPageTable table = {
+        .page_size = uvisor_get_page_size(),
+        .page_count = 1,
+        .page_origins = {ring},
+    };
+    int consumer_box = uvisor_api.channel_close(ring);
+
+    if (consumer_box < 0) {
+        return consumer_box;
+    }
+
+    /* The producer takes the page of the ring back from the consumer. */
+    if (consumer_box != uvisor_box_id_self()) {
+        return uvisor_page_revoke(&table, consumer_box);
+    }
+    return 0;
+}
+
+int uvisor_channel_write(UvisorChannelRing * ring, const void * data, size_t len)
+{
+    int ret = uvisor_channel_ring_write(ring, channel_size(), data, len);
+    if (ret == 1) {
+        /* The ring became non-empty. Have uVisor wake the consumer up on the
+         * next thread switch. */
+        __uvisor_ps->doorbells.queue[UVISOR_BOX_DOORBELL_CHANNEL] = 1;
+        ret = 0;
+    }
+    return ret;
+}
+
+int uvisor_channel_read(UvisorChannelRing * ring, void * data, size_t len)
+{
+    return uvisor_channel_ring_read(ring, channel_size(), data, len);
+}
+
+size_t uvisor_channel_available(UvisorChannelRing * ring)
+{
+    uint32_t size = channel_size();
+    uint32_t head = ring->head;
+    uint32_t tail = ring->tail;
+    uint32_t used;
+
+    if (head >= 2 * size || tail >= 2 * size) {
+        return 0;
+    }
+    used = uvisor_channel_ring_distance(tail, head, size);
+    return used <= size ? used : 0;
+}
+
+int uvisor_channel_wait(UvisorChannelRing * ring, UvisorSemaphore * semaphore, uint32_t timeout_ms)
+{
+    /* The semaphore may have been posted for data that was already read, so
+     * check the ring again after each wake up. */
+    while (uvisor_channel_ring_is_empty(ring)) {
+        if (__uvisor_semaphore_pend(semaphore, timeout_ms)) {
+            return UVISOR_ERROR_TIMEOUT;
+        }
+    }
+    return 0;
+}
@@ -19,6 +19,7 @@
 #include "api/inc/halt_exports.h"
 #include "api/inc/linker_exports.h"
 #include "api/inc/pool_queue_exports.h"
+#include "api/inc/uvisor_semaphore.h"
 #include "api/inc/uvisor_spinlock_exports.h"
 #include "api/inc/vmpu_exports.h"
 #include <string.h>
@@ -31,12 +32,12 @@ static UvisorSpinlock * ipc_tokens_lock(void)
     return &uvisor_ipc(__uvisor_ps)->tokens_lock;
 }
 
-static uint32_t * ipc_allocated_tokens(void)
+static uvisor_ipc_tokens_t * ipc_allocated_tokens(void)
 {
     return &uvisor_ipc(__uvisor_ps)->allocated_tokens;
 }
 
-static uint32_t * ipc_completed_tokens(void)
+static uvisor_ipc_tokens_t * ipc_completed_tokens(void)
 {
     return &uvisor_ipc(__uvisor_ps)->completed_tokens;
 }
@@ -61,78 +62,147 @@ static uvisor_ipc_io_t * ipc_recv_array(void)
     return uvisor_ipc(__uvisor_ps)->recv_queue.io;
 }
 
+static uvisor_ipc_port_index_t * ipc_recv_port_index(void)
+{
+    return &uvisor_ipc(__uvisor_ps)->recv_queue.port_index;
+}
+
 /** Allocate a token
  * @param    tokens[in,out] allocate an available token from tokens, atomically modifying tokens
  * @return   the token, or 0 if no token available */
-uint32_t ipc_allocate_token(uint32_t * tokens)
-{
-    uint32_t token;
-    uint32_t bit;
-
-    /* Read the current tokens and allocate a new token. Both reading and
-     * allocating must be done while holding the spin lock to prevent two (or
-     * more) concurrent allocations from grabbing the same token. */
-    uvisor_spin_lock(ipc_tokens_lock());
-    /* FIXME Optimize, to lessen the time holding the spin lock. */
-    bit = 0x1;
-    while (*tokens & bit) {
-        bit <<= 1;
+uint32_t ipc_allocate_token(uvisor_ipc_tokens_t * tokens)
+{
+    int i;
+
+    /* Claim the first free bit of each word with an exclusive load and store,
+     * so that concurrent allocations never grab the same token and don't need
+     * the tokens lock. A failed claim retries with the word it found. */
+    for (i = 0; i < UVISOR_IPC_TOKEN_WORDS; i++) {
+        uint32_t * word = &tokens->words[i];
+        uint32_t allocated = *word;
+
+        while (~allocated) {
+            uint32_t bit = __builtin_ctz(~allocated);
+            uint32_t found = __sync_val_compare_and_swap(word, allocated, allocated | (1UL << bit));
+            if (found == allocated) {
+                return i * 32 + bit + 1;
+            }
+            allocated = found;
+        }
     }
-    token = bit;
-    *tokens |= token; /* Allocate the token. */
-    uvisor_spin_unlock(ipc_tokens_lock());
 
-    /* NOTE: This function depends on UVISOR_IPC_INVALID_TOKEN being defined to
-     * 0. This is because if no bits are available in the bitfield, this
-     * function returns 0. In order for the user of this API to interpret this
-     * failure correctly, UVISOR_IPC_INVALID_TOKEN must be 0. */
-    UVISOR_STATIC_ASSERT(UVISOR_IPC_INVALID_TOKEN == 0, UVISOR_IPC_INVALID_TOKEN_should_be_zero);
-    return token;
+    return UVISOR_IPC_INVALID_TOKEN;
 }
 
 /** Free tokens
- *  The token lock must have been already acquired
  * @param    tokens[in,out] free the specified tokens_to_free from tokens, atomically modifying tokens
- * @param    tokens_to_free[in] the tokens to free (represented by bits) */
-void ipc_free_tokens(uint32_t * tokens, uint32_t tokens_to_free)
+ * @param    tokens_to_free[in] the tokens to free */
+void ipc_free_tokens(uvisor_ipc_tokens_t * tokens, const uvisor_ipc_tokens_t * tokens_to_free)
 {
-    *tokens &= ~tokens_to_free;
+    int i;
+
+    for (i = 0; i < UVISOR_IPC_TOKEN_WORDS; i++) {
+        if (tokens_to_free->words[i]) {
+            __sync_fetch_and_and(&tokens->words[i], ~tokens_to_free->words[i]);
+        }
+    }
 }
 
-static void ipc_free_allocated_completed_tokens(uint32_t tokens)
+static void ipc_free_allocated_completed_tokens(const uvisor_ipc_tokens_t * tokens)
 {
     ipc_free_tokens(ipc_allocated_tokens(), tokens);
     ipc_free_tokens(ipc_completed_tokens(), tokens);
 }
 
-static int ipc_waitfor(int (*cond)(uint32_t have, uint32_t expect), uint32_t wait_tokens, uint32_t * done_tokens, uint32_t timeout_ms)
+/* Claim a free waiter for the tokens. The tokens lock must have been already
+ * acquired. Return NULL if all the waiters are taken. */
+static uvisor_ipc_waiter_t * ipc_claim_waiter(const uvisor_ipc_tokens_t * wait_tokens)
 {
-    uint32_t completed_tokens;
+    uvisor_ipc_waiter_t * waiters = uvisor_ipc(__uvisor_ps)->waiters;
+    int i;
+
+    for (i = 0; i < UVISOR_IPC_WAITER_SLOTS; i++) {
+        if (uvisor_ipc_tokens_empty(&waiters[i].tokens)) {
+            waiters[i].tokens = *wait_tokens;
+            return &waiters[i];
+        }
+    }
+    return NULL;
+}
+
+static int ipc_waitfor(bool (*cond)(const uvisor_ipc_tokens_t * have, const uvisor_ipc_tokens_t * expect),
+                       const uvisor_ipc_tokens_t * wait_tokens, uvisor_ipc_tokens_t * done_tokens, uint32_t timeout_ms)
+{
+    uvisor_ipc_waiter_t * waiter = NULL;
+    uvisor_ipc_tokens_t completed_tokens;
     bool condition_met;
+    int status = 0;
+    int i;
+
+    /* The timeout covers the whole wait, however many times we wake up. */
+    const uint32_t start_ms = __uvisor_semaphore_time_ms();
+    uint32_t remaining_ms = timeout_ms;
+
     for (;;) {
         uvisor_spin_lock(ipc_tokens_lock());
-        /* Check we are not waiting for some unallocated tokens */
-        if ((wait_tokens & *ipc_allocated_tokens()) != wait_tokens) {
-            uvisor_spin_unlock(ipc_tokens_lock());
-            return UVISOR_ERROR_INVALID_PARAMETERS;
+        /* Check we are not waiting for some unallocated tokens. The tokens
+         * we wait for can't be allocated or freed by anyone else meanwhile. */
+        for (i = 0; i < UVISOR_IPC_TOKEN_WORDS; i++) {
+            if ((wait_tokens->words[i] & ipc_allocated_tokens()->words[i]) != wait_tokens->words[i]) {
+                status = UVISOR_ERROR_INVALID_PARAMETERS;
+                break;
+            }
+            /* Read the current tokens and clear any we were waiting on. */
+            completed_tokens.words[i] = ipc_completed_tokens()->words[i] & wait_tokens->words[i];
         }
-        /* Read the current tokens and clear any we were waiting on. */
-        completed_tokens = *ipc_completed_tokens() & wait_tokens;
-        condition_met = cond(completed_tokens, wait_tokens);
+        if (status) {
+            break;
+        }
+        condition_met = cond(&completed_tokens, wait_tokens);
         if (condition_met) {
             /* Clear the tokens we were waiting on. */
-            ipc_free_allocated_completed_tokens(completed_tokens);
+            ipc_free_allocated_completed_tokens(&completed_tokens);
+            break;
+        }
+        if (timeout_ms != UVISOR_WAIT_FOREVER) {
+            uint32_t elapsed_ms = __uvisor_semaphore_time_ms() - start_ms;
+            remaining_ms = elapsed_ms < timeout_ms ? timeout_ms - elapsed_ms : 0;
+        }
+        if (remaining_ms == 0) {
+            status = UVISOR_ERROR_TIMEOUT;
+            break;
+        }
+        /* Register as a waiter in the same critical section as the check, so
+         * that uVisor posts to us for any token completed from now on. */
+        if (!waiter) {
+            waiter = ipc_claim_waiter(wait_tokens);
+            if (!waiter) {
+                /* All the waiters are taken. */
+                status = UVISOR_ERROR_OUT_OF_STRUCTURES;
+                break;
+            }
         }
         uvisor_spin_unlock(ipc_tokens_lock());
 
-        if (condition_met) {
+        /* Sleep until uVisor completes one of the tokens. A post left over
+         * from the previous user of the waiter only wakes us up early, and we
+         * go back to sleep for the time that is left. */
+        if (__uvisor_semaphore_pend(&waiter->semaphore, remaining_ms)) {
+            uvisor_spin_lock(ipc_tokens_lock());
+            status = UVISOR_ERROR_TIMEOUT;
             break;
         }
+    }
 
-        /* FIXME Non-zero timeout not implemented for now. */
-        if (timeout_ms == 0) {
-            return UVISOR_ERROR_TIMEOUT;
-        }
+    /* Release the waiter. Any post it still holds only causes a spurious wake
+     * up of its next user. */
+    if (waiter) {
+        uvisor_ipc_tokens_clear(&waiter->tokens);
+    }
+    uvisor_spin_unlock(ipc_tokens_lock());
+
+    if (status) {
+        return status;
     }
 
     /* Communicate which tokens actually finished. */
@@ -142,28 +212,43 @@ static int ipc_waitfor(int (*cond)(uint32_t have, uint32_t expect), uint32_t wai
 }
 
 /* We have at least one of what we expect. */
-static int any(uint32_t have, uint32_t expect)
+static bool any(const uvisor_ipc_tokens_t * have, const uvisor_ipc_tokens_t * expect)
 {
-    return have & expect;
+    int i;
+
+    for (i = 0; i < UVISOR_IPC_TOKEN_WORDS; i++) {
+        if (have->words[i] & expect->words[i]) {
+            return true;
+        }
+    }
+    return false;
 }
 
 /* We have at least all of what we expect (and maybe more). */
-static int all(uint32_t have, uint32_t expect)
+static bool all(const uvisor_ipc_tokens_t * have, const uvisor_ipc_tokens_t * expect)
 {
-    return (have & expect) == expect;
+    int i;
+
+    for (i = 0; i < UVISOR_IPC_TOKEN_WORDS; i++) {
+        if ((have->words[i] & expect->words[i]) != expect->words[i]) {
+            return false;
+        }
+    }
+    return true;
 }
 
-int ipc_waitforany(uint32_t wait_tokens, uint32_t * done_tokens, uint32_t timeout_ms)
+int ipc_waitforany(const uvisor_ipc_tokens_t * wait_tokens, uvisor_ipc_tokens_t * done_tokens, uint32_t timeout_ms)
 {
     return ipc_waitfor(any, wait_tokens, done_tokens, timeout_ms);
 }
 
-int ipc_waitforall(uint32_t wait_tokens, uint32_t * done_tokens, uint32_t timeout_ms)
+int ipc_waitforall(const uvisor_ipc_tokens_t * wait_tokens, uvisor_ipc_tokens_t * done_tokens, uint32_t timeout_ms)
 {
     return ipc_waitfor(all, wait_tokens, done_tokens, timeout_ms);
 }
 
-static int ipc_io(uvisor_ipc_desc_t * desc, const void * msg,
+/* Post an IO in a queue. Receive IOs are also added to the port index. */
+static int ipc_io(uvisor_ipc_desc_t * desc, const void * msg, uint32_t flags,
                   uvisor_pool_queue_t * queue, uvisor_ipc_io_t * array, uvisor_ipc_io_state_t new_state)
 {
     uvisor_pool_slot_t slot;
@@ -194,19 +279,45 @@ static int ipc_io(uvisor_ipc_desc_t * desc, const void * msg,
     io->desc = desc;
     io->msg = (void *) msg;
     io->state = new_state;
+    io->flags = flags;
 
     /* Place the IPC request into the outgoing queue. */
     uvisor_pool_queue_enqueue(queue, slot);
 
+    /* uVisor finds receive IOs through the port index. They must be in the
+     * queue before they are in the index. */
+    if (new_state == UVISOR_IPC_IO_STATE_READY_TO_RECV) {
+        uvisor_ipc_port_index_push(UVISOR_GET_NS_ALIAS(ipc_recv_port_index()), io, slot);
+    }
+
     return 0;
 }
 
+static int ipc_send_flags(uvisor_ipc_desc_t * desc, const void * msg, uint32_t flags)
+{
+    int status = ipc_io(desc, msg, flags, ipc_send_queue(), ipc_send_array(), UVISOR_IPC_IO_STATE_READY_TO_SEND);
+    if (!status) {
+        __uvisor_ps->doorbells.queue[UVISOR_BOX_DOORBELL_IPC_SEND] = 1;
+    }
+    return status;
+}
+
 int ipc_send(uvisor_ipc_desc_t * desc, const void * msg)
 {
-    return ipc_io(desc, msg, ipc_send_queue(), ipc_send_array(), UVISOR_IPC_IO_STATE_READY_TO_SEND);
+    return ipc_send_flags(desc, msg, 0);
 }
 
 int ipc_recv(uvisor_ipc_desc_t * desc, void * msg)
 {
-    return ipc_io(desc, msg, ipc_recv_queue(), ipc_recv_array(), UVISOR_IPC_IO_STATE_READY_TO_RECV);
+    return ipc_io(desc, msg, 0, ipc_recv_queue(), ipc_recv_array(), UVISOR_IPC_IO_STATE_READY_TO_RECV);
+}
+
+int ipc_send_page(uvisor_ipc_desc_t * desc, void * page)
+{
+    return ipc_send_flags(desc, page, UVISOR_IPC_FLAG_PAGE);
+}
+
+int ipc_recv_page(uvisor_ipc_desc_t * desc, void ** page)
+{
+    return ipc_io(desc, page, UVISOR_IPC_FLAG_PAGE, ipc_recv_queue(), ipc_recv_array(), UVISOR_IPC_IO_STATE_READY_TO_RECV);
 }
@@ -35,6 +35,11 @@ int uvisor_pool_queue_init(uvisor_pool_queue_t * pool_queue, uvisor_pool_t * poo
     return uvisor_api.pool_queue_init(pool_queue, pool, array, stride, num);
 }
 
+int uvisor_pool_queue_init_mode(uvisor_pool_queue_t * pool_queue, uvisor_pool_t * pool, void * array, size_t stride, size_t num, uint8_t mode)
+{
+    return uvisor_api.pool_queue_init_mode(pool_queue, pool, array, stride, num, mode);
+}
+
 uvisor_pool_slot_t uvisor_pool_allocate(uvisor_pool_t * pool)
 {
     return uvisor_api.pool_allocate(pool);
@@ -45,6 +50,16 @@ uvisor_pool_slot_t uvisor_pool_try_allocate(uvisor_pool_t * pool)
     return uvisor_api.pool_try_allocate(pool);
 }
 
+size_t uvisor_pool_allocate_n(uvisor_pool_t * pool, uvisor_pool_slot_t * slots, size_t count)
+{
+    return uvisor_api.pool_allocate_n(pool, slots, count);
+}
+
+size_t uvisor_pool_try_allocate_n(uvisor_pool_t * pool, uvisor_pool_slot_t * slots, size_t count)
+{
+    return uvisor_api.pool_try_allocate_n(pool, slots, count);
+}
+
 void uvisor_pool_queue_enqueue(uvisor_pool_queue_t * pool_queue, uvisor_pool_slot_t slot)
 {
     uvisor_api.pool_queue_enqueue(pool_queue, slot);
@@ -55,6 +70,11 @@ int uvisor_pool_queue_try_enqueue(uvisor_pool_queue_t * pool_queue, uvisor_pool_
     return uvisor_api.pool_queue_try_enqueue(pool_queue, slot);
 }
 
+int uvisor_pool_queue_try_enqueue_batch(uvisor_pool_queue_t * pool_queue, const uvisor_pool_slot_t * slots, size_t count)
+{
+    return uvisor_api.pool_queue_try_enqueue_batch(pool_queue, slots, count);
+}
+
 uvisor_pool_slot_t uvisor_pool_free(uvisor_pool_t * pool, uvisor_pool_slot_t slot)
 {
     return uvisor_api.pool_free(pool, slot);
@@ -85,6 +105,11 @@ uvisor_pool_slot_t uvisor_pool_queue_try_dequeue_first(uvisor_pool_queue_t * poo
     return uvisor_api.pool_queue_try_dequeue_first(pool_queue);
 }
 
+size_t uvisor_pool_queue_try_dequeue_batch(uvisor_pool_queue_t * pool_queue, uvisor_pool_slot_t * slots, size_t max)
+{
+    return uvisor_api.pool_queue_try_dequeue_batch(pool_queue, slots, max);
+}
+
 uvisor_pool_slot_t uvisor_pool_queue_find_first(uvisor_pool_queue_t * pool_queue, TQueryFN_Ptr query_fn, void * context)
 {
     return uvisor_api.pool_queue_find_first(pool_queue,query_fn, context);
@@ -20,11 +20,17 @@
 #include "api/inc/vmpu_exports.h"
 #include "api/inc/pool_queue_exports.h"
 #include "api/inc/error.h"
+#include "api/inc/svc_exports.h"
 #include "api/inc/uvisor_semaphore.h"
 #include <string.h>
 
 extern UvisorBoxIndex * const __uvisor_ps;
 
+static uvisor_rpc_outgoing_message_queue_t * outgoing_messages(void)
+{
+    return &(uvisor_rpc(__uvisor_ps)->outgoing_message_queue);
+}
+
 static uvisor_pool_queue_t * outgoing_message_queue(void)
 {
     return &(uvisor_rpc(__uvisor_ps)->outgoing_message_queue.queue);
@@ -65,22 +71,60 @@ static uvisor_rpc_fn_group_t * fn_group_array(void)
     return uvisor_rpc(__uvisor_ps)->fn_group_queue.fn_groups;
 }
 
+static uvisor_rpc_fn_index_t * fn_index(void)
+{
+    return &(uvisor_rpc(__uvisor_ps)->fn_index);
+}
+
+/* Claim a slot in the outgoing queue, sleeping up to `timeout_ms` for one to
+ * be freed. The timeout restarts each time a slot is freed but taken by
+ * another thread. Return the slot, or an invalid slot on timeout. */
+static uvisor_pool_slot_t allocate_outgoing_slot(uint32_t timeout_ms)
+{
+    uvisor_rpc_outgoing_message_queue_t * outgoing = outgoing_messages();
+    uvisor_pool_slot_t slot;
+
+    slot = uvisor_pool_queue_allocate(&outgoing->queue);
+    if (slot < outgoing->queue.pool->num || timeout_ms == 0) {
+        return slot;
+    }
+
+    /* Count this thread as waiting before trying again, so that a slot freed
+     * in between posts to the semaphore. */
+    __sync_add_and_fetch(&outgoing->slot_waiters, 1);
+    while ((slot = uvisor_pool_queue_allocate(&outgoing->queue)) >= outgoing->queue.pool->num) {
+        if (__uvisor_semaphore_pend(&outgoing->slot_semaphore, timeout_ms)) {
+            break;
+        }
+    }
+    __sync_sub_and_fetch(&outgoing->slot_waiters, 1);
+
+    return slot;
+}
+
 /* Place a message into the outgoing queue. `timeout_ms` is how long to wait
  * for a slot in the outgoing queue before giving up. `msg_slot` is set to the
- * slot of the message that was allocated. Returns non-zero on failure. */
-static int send_outgoing_rpc(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3, const TRPCGateway * gateway, uint32_t timeout_ms,
+ * slot of the message that was allocated. `buffers` are passed by reference,
+ * and may be NULL if `buffer_count` is 0. The message completes into `cq`
+ * unless it is NULL. Returns non-zero on failure: `UVISOR_ERROR_TIMEOUT` if
+ * no slot was freed in time, or `UVISOR_ERROR_OUT_OF_STRUCTURES` if there was
+ * no free slot and `timeout_ms` is 0. */
+static int send_outgoing_rpc(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3, const TRPCGateway * gateway,
+                             const uvisor_rpc_buffer_t buffers[], size_t buffer_count,
+                             uvisor_rpc_completion_queue_t * cq, uint32_t timeout_ms,
                              uvisor_rpc_result_t * cookie)
 {
     uint32_t counter;
     uvisor_rpc_message_t * msg;
     uvisor_pool_slot_t slot;
+    size_t i;
 
     /* Claim a slot in the outgoing RPC queue. */
-    slot = uvisor_pool_queue_allocate(outgoing_message_queue());
+    slot = allocate_outgoing_slot(timeout_ms);
     if (slot >= outgoing_message_queue()->pool->num) {
-        /* No slots available in incoming queue. We asked for a free slot but
-         * didn't get one. */
-        return -1;
+        /* No slots available in outgoing queue. We asked for a free slot but
+         * didn't get one in time. */
+        return timeout_ms ? UVISOR_ERROR_TIMEOUT : UVISOR_ERROR_OUT_OF_STRUCTURES;
     }
 
     /* Atomically increment the counter. */
@@ -93,12 +137,24 @@ static int send_outgoing_rpc(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3,
     msg->p2 = p2;
     msg->p3 = p3;
     msg->gateway = gateway;
-    msg->wait_cookie = uvisor_result_build(counter, slot);
-    msg->match_cookie = msg->wait_cookie;
+    msg->match_cookie = uvisor_result_build(counter, slot);
+    /* The messages completing into a completion queue can't be waited for
+     * one by one. */
+    msg->wait_cookie = cq ? uvisor_result_build(UVISOR_RESULT_INVALID_COUNTER, slot) : msg->match_cookie;
     msg->state = UVISOR_RPC_MESSAGE_STATE_READY_TO_SEND;
+    msg->batch_slot = UVISOR_POOL_SLOT_INVALID;
+    msg->buffer_count = buffer_count;
+    for (i = 0; i < buffer_count; i++) {
+        msg->buffers[i] = buffers[i];
+    }
+    msg->completion_queue = cq;
+#if UVISOR_RPC_STATS
+    msg->queued_at = 0;
+#endif
 
     /* Put the slot into the queue. */
     uvisor_pool_queue_enqueue(outgoing_message_queue(), slot);
+    __uvisor_ps->doorbells.queue[UVISOR_BOX_DOORBELL_RPC_OUTGOING] = 1;
 
     /* Notify the caller of this function of the slot that was allocated for
      * sending this RPC message. */
@@ -123,6 +179,11 @@ static void free_outgoing_msg(uvisor_pool_slot_t msg_slot)
         uvisor_error(USER_NOT_ALLOWED);
     }
     uvisor_pool_queue_free(outgoing_message_queue(), msg_slot);
+
+    /* Wake up a thread waiting for a free slot, if any. */
+    if (outgoing_messages()->slot_waiters) {
+        __uvisor_semaphore_post(&outgoing_messages()->slot_semaphore);
+    }
 }
 
 uint32_t rpc_fncall_sync(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3, const TRPCGateway * gateway)
@@ -139,7 +200,7 @@ uint32_t rpc_fncall_sync(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3, con
     do {
         /* Because this is the sync function, we use wait forever to wait for an
          * available message slot. */
-        status = send_outgoing_rpc(p0, p1, p2, p3, gateway, UVISOR_WAIT_FOREVER, &cookie);
+        status = send_outgoing_rpc(p0, p1, p2, p3, gateway, NULL, 0, NULL, UVISOR_WAIT_FOREVER, &cookie);
     } while (status);
     msg_slot = uvisor_result_slot(cookie);
 
@@ -158,6 +219,73 @@ uint32_t rpc_fncall_sync(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3, con
     return result_value;
 }
 
+int rpc_fncall_sync_buffers(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3, const TRPCGateway * gateway,
+                            const uvisor_rpc_buffer_t buffers[], size_t buffer_count, uint32_t * ret)
+{
+    int status;
+    uvisor_rpc_result_t cookie;
+    uvisor_pool_slot_t msg_slot;
+    uvisor_rpc_message_t * msg;
+
+    if (buffer_count > UVISOR_RPC_BUFFER_COUNT) {
+        return UVISOR_ERROR_INVALID_PARAMETERS;
+    }
+
+    /* Loop until sending the RPC message succeeds. */
+    do {
+        status = send_outgoing_rpc(p0, p1, p2, p3, gateway, buffers, buffer_count, NULL, UVISOR_WAIT_FOREVER, &cookie);
+    } while (status);
+    msg_slot = uvisor_result_slot(cookie);
+
+    /* Wait forever for a result, like the synchronous RPC. */
+    do {
+        status = wait_for_rpc_result(msg_slot, UVISOR_WAIT_FOREVER);
+    } while (status);
+
+    /* uVisor completes the RPC without calling it if it can't grant the
+     * callee access to the buffers. */
+    msg = &outgoing_message_array()[msg_slot];
+    if (msg->state == UVISOR_RPC_MESSAGE_STATE_REJECTED) {
+        status = UVISOR_ERROR_INVALID_PARAMETERS;
+    } else if (ret) {
+        *ret = msg->result;
+    }
+
+    free_outgoing_msg(msg_slot);
+
+    return status;
+}
+
+/* Call a direct RPC gateway synchronously. On ARMv7-M the call goes straight
+ * through an SVCall; on ARMv8-M it falls back to the RPC queues. */
+uint32_t rpc_fncall_direct(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3, const TRPCGateway * gateway)
+{
+#if defined(ARCH_CORE_ARMv8M) || defined(TARGET_M33)
+    /* Direct RPCs are not supported on ARMv8-M yet, so we go through the RPC
+     * queues instead. */
+    return rpc_fncall_sync(p0, p1, p2, p3, gateway);
+#else
+    register uint32_t r0 asm("r0") = p0;
+    register uint32_t r1 asm("r1") = p1;
+    register uint32_t r2 asm("r2") = p2;
+    register uint32_t r3 asm("r3") = p3;
+    register uint32_t r12 asm("r12") = (uint32_t) gateway;
+
+    /* The gateway is passed in r12, which is stacked by the SVCall together
+     * with the parameters. uVisor runs the target function in the callee box
+     * and hands its return value back in r0. All other registers are
+     * preserved. */
+    asm volatile(
+        "svc %[svc_id]\n"
+        : "+r" (r0)
+        : "r" (r1), "r" (r2), "r" (r3), "r" (r12),
+          [svc_id] "I" (UVISOR_SVC_ID_RPC_DIRECT_IN)
+        : "memory"
+    );
+    return r0;
+#endif
+}
+
 /* Start an asynchronous RPC. After this call successfully completes, the
  * caller can, at any time in any thread, wait on the result object to get the
  * result of the call. */
@@ -168,7 +296,7 @@ uvisor_rpc_result_t rpc_fncall_async(uint32_t p0, uint32_t p1, uint32_t p2, uint
 
     /* Don't wait any length of time for an outgoing message slot. If there is
      * no slot available, return immediately with a non-zero status. */
-    status = send_outgoing_rpc(p0, p1, p2, p3, gateway, 0, &cookie);
+    status = send_outgoing_rpc(p0, p1, p2, p3, gateway, NULL, 0, NULL, 0, &cookie);
     if (status) {
         return status;
     }
@@ -207,6 +335,148 @@ int rpc_fncall_wait(uvisor_rpc_result_t result, uint32_t timeout_ms, uint32_t *
     return 0;
 }
 
+int rpc_completion_queue_init(uvisor_rpc_completion_queue_t * cq)
+{
+    cq->head = 0;
+    cq->tail = 0;
+
+    /* uVisor only posts to the semaphore when the queue was empty, so one
+     * pending post is enough to wake up the waiting thread. */
+    return __uvisor_semaphore_init(&cq->semaphore, 1, 0);
+}
+
+int rpc_fncall_async_completion(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3, const TRPCGateway * gateway,
+                                uvisor_rpc_completion_queue_t * cq, uvisor_rpc_result_t * result)
+{
+    /* Don't wait any length of time for an outgoing message slot, like the
+     * asynchronous RPC. */
+    return send_outgoing_rpc(p0, p1, p2, p3, gateway, NULL, 0, cq, 0, result);
+}
+
+size_t rpc_completion_wait(uvisor_rpc_completion_queue_t * cq, uint32_t timeout_ms,
+                           uvisor_rpc_completion_t out[], size_t max)
+{
+    uvisor_pool_slot_t msg_slot;
+    uvisor_rpc_message_t * msg;
+    size_t count = 0;
+
+    if (max == 0) {
+        return 0;
+    }
+
+    /* The semaphore may still hold a post for completions that were already
+     * taken, so check the queue again after each wake up. */
+    while (cq->head == cq->tail) {
+        if (__uvisor_semaphore_pend(&cq->semaphore, timeout_ms)) {
+            return 0;
+        }
+    }
+
+    while (count < max && cq->tail != cq->head) {
+        msg_slot = cq->slots[cq->tail % UVISOR_RPC_MESSAGE_SLOTS_MAX];
+        if (msg_slot >= outgoing_message_queue()->pool->num) {
+            uvisor_error(USER_NOT_ALLOWED);
+        }
+        msg = &outgoing_message_array()[msg_slot];
+        out[count].result = msg->match_cookie;
+        out[count].value = msg->result;
+        count++;
+
+        /* Take the completion before freeing its slot, as the slot may be
+         * reused for an RPC that completes into the same queue. */
+        cq->tail++;
+        free_outgoing_msg(msg_slot);
+    }
+
+    return count;
+}
+
+int rpc_fncall_batch(const uvisor_rpc_call_t calls[], size_t count, uint32_t results[])
+{
+    uvisor_pool_slot_t slots[UVISOR_RPC_MESSAGE_SLOTS_MAX];
+    uvisor_rpc_message_t * msg;
+    uvisor_rpc_message_t * first;
+    uint32_t counter;
+    size_t i;
+    int status;
+
+    if (count == 0) {
+        return 0;
+    }
+    if (count > UVISOR_ARRAY_COUNT(slots)) {
+        return UVISOR_ERROR_INVALID_PARAMETERS;
+    }
+
+    /* Claim all the slots of the batch in the outgoing RPC queue at once. */
+    if (uvisor_pool_queue_allocate_n(outgoing_message_queue(), slots, count) != count) {
+        return UVISOR_ERROR_OUT_OF_STRUCTURES;
+    }
+
+    /* The batch is completed through its first message. */
+    first = &outgoing_message_array()[slots[0]];
+    first->batch_pending = count;
+
+    /* Populate the messages. */
+    for (i = 0; i < count; i++) {
+        counter = __sync_add_and_fetch(result_counter(), UVISOR_RESULT_COUNTER_INCREMENT);
+
+        msg = &outgoing_message_array()[slots[i]];
+        msg->p0 = calls[i].p0;
+        msg->p1 = calls[i].p1;
+        msg->p2 = calls[i].p2;
+        msg->p3 = calls[i].p3;
+        msg->gateway = calls[i].gateway;
+        /* The messages of a batch can't be waited for one by one. */
+        msg->wait_cookie = uvisor_result_build(UVISOR_RESULT_INVALID_COUNTER, slots[i]);
+        msg->match_cookie = uvisor_result_build(counter, slots[i]);
+        msg->state = UVISOR_RPC_MESSAGE_STATE_READY_TO_SEND;
+        msg->batch_slot = slots[0];
+        msg->buffer_count = 0;
+        msg->completion_queue = NULL;
+#if UVISOR_RPC_STATS
+        msg->queued_at = 0;
+#endif
+    }
+
+    /* Put the whole batch into the queue. This never fails in MPSC mode, which
+     * the outgoing RPC queue is in. */
+    if (uvisor_pool_queue_try_enqueue_batch(outgoing_message_queue(), slots, count)) {
+        uvisor_error(USER_NOT_ALLOWED);
+    }
+    __uvisor_ps->doorbells.queue[UVISOR_BOX_DOORBELL_RPC_OUTGOING] = 1;
+
+    /* Wait forever for the last RPC of the batch to finish. */
+    do {
+        status = wait_for_rpc_result(slots[0], UVISOR_WAIT_FOREVER);
+    } while (status);
+
+    /* All the results are valid now. */
+    for (i = 0; i < count; i++) {
+        results[i] = outgoing_message_array()[slots[i]].result;
+        free_outgoing_msg(slots[i]);
+    }
+
+    return 0;
+}
+
+static void add_function_group_to_index(const TFN_Ptr fn_ptr_array[], size_t fn_count, uvisor_pool_slot_t slot)
+{
+    uvisor_rpc_fn_index_t * index = fn_index();
+    size_t i;
+
+    UVISOR_STATIC_ASSERT(UVISOR_RPC_FN_GROUP_SLOTS_MAX <= 32, UVISOR_RPC_FN_GROUP_SLOTS_MAX_must_fit_in_fn_groups);
+
+    uvisor_spin_lock(&index->lock);
+    for (i = 0; i < fn_count; i++) {
+        if (fn_ptr_array[i] && uvisor_rpc_fn_index_add(index, fn_ptr_array[i], slot)) {
+            /* The function groups must be searched for the functions that
+             * didn't fit. */
+            index->overflow = 1;
+        }
+    }
+    uvisor_spin_unlock(&index->lock);
+}
+
 static uvisor_rpc_fn_group_t * allocate_function_group(const TFN_Ptr fn_ptr_array[], size_t fn_count)
 {
     uvisor_pool_slot_t slot;
@@ -224,6 +494,10 @@ static uvisor_rpc_fn_group_t * allocate_function_group(const TFN_Ptr fn_ptr_arra
     fn_group->fn_ptr_array = fn_ptr_array;
     fn_group->fn_count = fn_count;
 
+    /* Add the functions to the index before the function group is queued, so
+     * that uVisor can wake it up as soon as it can be found. */
+    add_function_group_to_index(fn_ptr_array, fn_count, slot);
+
     uvisor_pool_queue_enqueue(fn_group_queue(), slot);
 
     return fn_group;
@@ -252,6 +526,7 @@ static uvisor_rpc_fn_group_t * get_function_group(const TFN_Ptr fn_ptr_array[],
 typedef struct query_for_fn_group_context {
     const TFN_Ptr *fn_ptr_array;
     size_t fn_count;
+    uvisor_pool_slot_t fn_group_slot;
 } query_for_fn_group_context_t;
 
 static int query_for_fn_group(uvisor_pool_slot_t slot, void * context)
@@ -260,9 +535,16 @@ static int query_for_fn_group(uvisor_pool_slot_t slot, void * context)
     uvisor_rpc_message_t * msg = &incoming_message_array()[slot];
     size_t i;
 
-    /* See if the target is for a function we can handle.
-     * FIXME Optimize this search for large numbers of target functions per
-     * box. */
+    /* See if the target is for a function we can handle. */
+    uint32_t fn_groups = uvisor_rpc_fn_index_lookup(fn_index(), (TFN_Ptr) msg->gateway->target);
+    if (fn_groups) {
+        return (fn_groups >> query_context->fn_group_slot) & 1;
+    }
+    if (!fn_index()->overflow) {
+        return 0;
+    }
+
+    /* The function may not have fit into the index. */
     for (i = 0; i < query_context->fn_count; ++i) {
         if ((TFN_Ptr) msg->gateway->target == query_context->fn_ptr_array[i]) {
             /* Yes, we can handle this function call. */
@@ -282,6 +564,7 @@ static int handle_incoming_rpc(uvisor_rpc_fn_group_t * fn_group, int * box_id_ca
 
     context.fn_ptr_array = fn_group->fn_ptr_array;
     context.fn_count = fn_group->fn_count;
+    context.fn_group_slot = fn_group - fn_group_array();
 
     msg_slot = uvisor_pool_queue_find_first(incoming_message_todo_queue(), query_for_fn_group, &context);
     if (msg_slot >= incoming_message_todo_queue()->pool->num) {
@@ -304,8 +587,7 @@ static int handle_incoming_rpc(uvisor_rpc_fn_group_t * fn_group, int * box_id_ca
 
     /* Verify the RPC gateway magic, for pure paranoia and detecting bugs
      * reasons. */
-    if (!(msg->gateway->magic == UVISOR_RPC_GATEWAY_MAGIC_ASYNC ||
-          msg->gateway->magic == UVISOR_RPC_GATEWAY_MAGIC_SYNC)) {
+    if (!rpc_gateway_is_queued(msg->gateway)) {
         /* The gateway was not valid, so we aren't going to handle this RPC
          * message. */
         return 0;
@@ -326,6 +608,7 @@ static int handle_incoming_rpc(uvisor_rpc_fn_group_t * fn_group, int * box_id_ca
 
     /* Send the result back to the caller. */
     uvisor_pool_queue_enqueue(incoming_message_done_queue(), msg_slot);
+    __uvisor_ps->doorbells.queue[UVISOR_BOX_DOORBELL_RPC_DONE] = 1;
 
     return 1;
 }
@@ -86,6 +86,8 @@ int uvisor_lib_init(void)
 
     extern void __uvisor_initialize_rpc_queues(void);
     __uvisor_initialize_rpc_queues();
+    extern void __uvisor_initialize_ipc_waiters(void);
+    __uvisor_initialize_ipc_waiters();
 
     return 0;
 }
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __CHANNEL_H__
+#define __CHANNEL_H__
+
+#include "api/inc/channel_exports.h"
+#include "api/inc/uvisor_semaphore_exports.h"
+
+/* Set up a channel from the active box to another box, through a ring at the
+ * start of a page of the active box that is already shared with the other
+ * box for reading and writing.
+ * @returns 0 on success or a negative error code. */
+int channel_create(UvisorChannelRing * ring, int consumer_box);
+
+/* Attach a semaphore of the active box to a channel to it. uVisor posts to
+ * the semaphore every time the ring of the channel becomes non-empty.
+ * @returns 0 on success or a negative error code. */
+int channel_attach(UvisorChannelRing * ring, UvisorSemaphore * semaphore);
+
+/* Forget about a channel. Either of its boxes can close it.
+ * @returns the id of the consumer box on success, so that the producer can
+ * revoke the page of the ring from it, or a negative error code. */
+int channel_close(UvisorChannelRing * ring);
+
+/* Wake up the consumers of the channels of the active box whose rings became
+ * non-empty since the last drain. */
+void channel_drain(void);
+
+/* Same as channel_drain, for the channels to one box only. */
+void channel_drain_to(int consumer_box);
+
+#endif
@@ -38,10 +38,22 @@ typedef struct {
 
     int (*page_malloc)(UvisorPageTable * const table);
     int (*page_free)(const UvisorPageTable * const table);
+    int (*page_clean)(uint32_t max_pages);
+    int (*page_get_stats)(UvisorPageStats * const stats);
+    int (*page_share)(const UvisorPageTable * const table, int dst_box, uint32_t acl);
+    int (*page_revoke)(const UvisorPageTable * const table, int dst_box);
 
     int (*box_namespace)(int box_id, char *box_namespace, size_t length);
     int (*box_id_for_namespace)(int * const box_id, const char * const box_namespace);
 
+    int (*rpc_get_stats)(uvisor_rpc_stats_t * stats);
+
+    int (*channel_create)(UvisorChannelRing * ring, int consumer_box);
+    int (*channel_attach)(UvisorChannelRing * ring, UvisorSemaphore * semaphore);
+    int (*channel_close)(UvisorChannelRing * ring);
+
+    int (*box_kick)(int box_id);
+
     void (*debug_init)(const TUvisorDebugDriver * const driver);
     void (*error)(THaltUserError reason);
     void (*vmpu_mem_invalidate)(void);
@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __DOORBELL_H__
+#define __DOORBELL_H__
+
+/* Deliver the RPCs, RPC results, IPC messages and channel wake ups of the
+ * active box to another box right away, instead of on the next thread switch.
+ * The ones for other boxes are left for the next thread switch.
+ * @returns 0 on success or `UVISOR_ERROR_INVALID_BOX_ID`. */
+int doorbell_kick(int dst_box);
+
+#endif
@@ -17,7 +17,23 @@
 #ifndef __IPC_H__
 #define __IPC_H__
 
+#include "api/inc/vmpu_exports.h"
+#include <stdint.h>
+
+/* See `UVISOR_DRAIN_STATS` in rpc.h. */
+#ifndef UVISOR_DRAIN_STATS
+#define UVISOR_DRAIN_STATS 0
+#endif
+
+#if UVISOR_DRAIN_STATS
+/* Number of IPC queue drains that were skipped. */
+extern uint32_t g_ipc_drain_skipped;
+#endif
+
 void ipc_drain_queue(void);
-void ipc_box_init(uint8_t box_init);
+/* Same as ipc_drain_queue, for the messages to one box only. */
+void ipc_drain_queue_to(int recv_box);
+/* Initialize the IPC queues of a box, with the given numbers of slots. */
+void ipc_box_init(uint8_t box_id, UvisorBoxQueueSlots const * slots);
 
 #endif
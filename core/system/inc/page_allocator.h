@@ -49,16 +49,89 @@ int page_allocator_malloc(UvisorPageTable * const table);
  */
 int page_allocator_free(const UvisorPageTable * const table);
 
+/* Share the pages of a table owned by the calling box with another box.
+ * Pages can be shared with several boxes at once. They stay shared until they
+ * are revoked or freed by the calling box.
+ * @param table     the page table, like it is passed to `page_allocator_free`
+ * @param dst_box   the box to share the pages with
+ * @param acl       `UVISOR_TACL_UREAD`, optionally with `UVISOR_TACL_UWRITE`
+ * @returns Non-zero on failure with failure class `UVISOR_ERROR_CLASS_PAGE`. See `UVISOR_ERROR_PAGE_*`.
+ */
+int page_allocator_share(const UvisorPageTable * const table, int dst_box, uint32_t acl);
+
+/* Take the pages of a table owned by the calling box away from another box.
+ * @returns Non-zero on failure with failure class `UVISOR_ERROR_CLASS_PAGE`. See `UVISOR_ERROR_PAGE_*`.
+ */
+int page_allocator_revoke(const UvisorPageTable * const table, int dst_box);
+
+/* Share the page containing a buffer, owned by one box, with another box for
+ * the duration of an RPC. The buffer must lie in a single page. Pages that are
+ * already shared with the box by `page_allocator_share` are left as they are.
+ * Granting a page again only ever widens the access to it.
+ * @param src_box   the box owning the page
+ * @param dst_box   the box to grant the page to
+ * @param address   the start of the buffer
+ * @param size      the size of the buffer
+ * @param acl       `UVISOR_TACL_UREAD`, optionally with `UVISOR_TACL_UWRITE`
+ * @returns Non-zero on failure with failure class `UVISOR_ERROR_CLASS_PAGE`. See `UVISOR_ERROR_PAGE_*`.
+ */
+int page_allocator_grant(int src_box, int dst_box, uint32_t address, uint32_t size, uint32_t acl);
+
+/* Check that `page_allocator_grant` would succeed, without granting anything.
+ * @returns Non-zero on failure with failure class `UVISOR_ERROR_CLASS_PAGE`. See `UVISOR_ERROR_PAGE_*`.
+ */
+int page_allocator_check_grant(int src_box, int dst_box, uint32_t address, uint32_t size, uint32_t acl);
+
+/* Take a page granted with `page_allocator_grant` away from a box again.
+ * @param dst_box   the box the page was granted to
+ * @param address   an address in the page
+ */
+void page_allocator_ungrant(int dst_box, uint32_t address);
+
+/* Move a page owned by one box to another box, which owns it from then on.
+ * The page is taken away from the boxes it is shared with, like when it is
+ * freed.
+ * @param src_box   the box owning the page
+ * @param dst_box   the box to move the page to
+ * @param address   the start of the page
+ * @returns Non-zero on failure with failure class `UVISOR_ERROR_CLASS_PAGE`. See `UVISOR_ERROR_PAGE_*`.
+ */
+int page_allocator_transfer(int src_box, int dst_box, uint32_t address);
+
+/* Check that `page_allocator_transfer` would succeed, without moving anything.
+ * @returns Non-zero on failure with failure class `UVISOR_ERROR_CLASS_PAGE`. See `UVISOR_ERROR_PAGE_*`.
+ */
+int page_allocator_check_transfer(int src_box, int dst_box, uint32_t address);
+
+/* Zero free pages in advance, so that they need not be zeroed when they are
+ * allocated. At most `UVISOR_PAGE_CLEAN_MAX_COUNT` pages are zeroed per call.
+ * @param max_pages the maximum number of pages to zero
+ * @returns the number of free pages that still need zeroing
+ */
+int page_allocator_clean(uint32_t max_pages);
+
+/* Get the page zeroing statistics.
+ * @param stats[out] the statistics
+ * @returns Non-zero on failure with failure class `UVISOR_ERROR_CLASS_PAGE`. See `UVISOR_ERROR_PAGE_*`.
+ */
+int page_allocator_get_stats(UvisorPageStats * const stats);
+
 /* Map an address to a page index.
  * @return page index or `UVISOR_PAGE_UNUSED` if address does not belong to page heap.
  */
-uint8_t page_allocator_get_page_from_address(uint32_t address);
+page_index_t page_allocator_get_page_from_address(uint32_t address);
 
 /* Contains the configured page size. */
 extern uint32_t g_page_size;
 /* Points to the beginning of the page heap. */
 extern const void * g_page_heap_start;
+/* Points to the end of the page heap. */
+extern const void * g_page_heap_end;
+/* Contains the number of free pages that have not been zeroed. */
+extern page_index_t g_page_count_dirty;
 /* Contains the page usage mapped by owner. */
 extern uint32_t g_page_owner_map[UVISOR_MAX_BOXES][UVISOR_PAGE_MAP_COUNT];
+/* Contains the pages shared with each box for reading only. */
+extern uint32_t g_page_read_only_map[UVISOR_MAX_BOXES][UVISOR_PAGE_MAP_COUNT];
 
 #endif /* __PAGE_ALLOCATOR_H__ */
@@ -24,7 +24,8 @@
 /* We can only protect a small number of pages efficiently, so there should be
  * a relatively low limit to the number of pages.
  * By default a maximum of 16 pages are allowed. This can only be overwritten
- * by the porting engineer for the current platform. */
+ * by the porting engineer for the current platform, up to a few thousand
+ * pages. */
 #ifndef UVISOR_PAGE_MAX_COUNT
 #define UVISOR_PAGE_MAX_COUNT (16UL)
 #endif
@@ -37,17 +38,57 @@
 #define UVISOR_PAGE_SIZE_MINIMUM (1024UL)
 #endif
 
+/* The maximum number of pages zeroed by a single call to
+ * `page_allocator_clean`. This bounds the time spent in the call. */
+#ifndef UVISOR_PAGE_CLEAN_MAX_COUNT
+#define UVISOR_PAGE_CLEAN_MAX_COUNT (1UL)
+#endif
+
+/* Pages can only be shared read-only if the memory protection unit can make
+ * them read-only. The ARMv8-M SAU can only make memory secure or non-secure. */
+#ifndef UVISOR_PAGE_SHARE_READ_ONLY
+#if defined(ARCH_MPU_ARMv8M)
+#define UVISOR_PAGE_SHARE_READ_ONLY 0
+#else
+#define UVISOR_PAGE_SHARE_READ_ONLY 1
+#endif
+#endif
+
+/* Use the page fault history to pick the octet of the page map new pages are
+ * placed in. This requires the page fault counters of uVisor. */
+#ifndef UVISOR_PAGE_FAULT_HINT
+#if defined(UVISOR_PRESENT) && (UVISOR_PRESENT == 1)
+#define UVISOR_PAGE_FAULT_HINT 1
+#else
+#define UVISOR_PAGE_FAULT_HINT 0
+#endif
+#endif
+
 /* Defines the number of uint32_t page owner masks in the owner map.
  * +8 is used for ARMv7-M MPUs, where a shift of up to 7-bits may be required
  * to align MPU regions. */
 #define UVISOR_PAGE_MAP_COUNT ((UVISOR_PAGE_MAX_COUNT + 31 + 8) / 32)
 
+/* Defines the number of uint32_t words in the page usage summary, which
+ * contains one bit for each word of the page usage map. */
+#define UVISOR_PAGE_SUMMARY_COUNT ((UVISOR_PAGE_MAP_COUNT + 31) / 32)
+
+/* Every bit of the page map must be addressable by a page index. */
+#if (UVISOR_PAGE_MAP_COUNT * 32) >= 0xFFFF
+#error "UVISOR_PAGE_MAX_COUNT is too large for a 16-bit page index."
+#endif
+
 /* The page box_id is the box id which is 8-bit large. */
 typedef uint8_t page_owner_t;
+/* The page index is 16-bit large. */
+typedef uint16_t page_index_t;
+/* The page index of addresses outside of the page heap. */
+#define UVISOR_PAGE_UNUSED ((page_index_t) -1)
+
 /* Contains the total number of available pages. */
-extern uint8_t g_page_count_total;
+extern page_index_t g_page_count_total;
 /* Contains the shift of the page owner mask. */
-extern uint8_t g_page_map_shift;
+extern page_index_t g_page_map_shift;
 /* Contains the ARMv7-MPU rounded page end. */
 extern uint32_t g_page_head_end_rounded;
 
@@ -55,20 +96,20 @@ extern uint32_t g_page_head_end_rounded;
  * @param map   an array of `uint32_t` containing the page map
  * @param page  the index of the page to be set
  */
-static inline void page_allocator_map_set(uint32_t * const map, uint8_t page)
+static inline void page_allocator_map_set(uint32_t * const map, page_index_t page)
 {
-    page += g_page_map_shift;
-    map[page / 32] |= (1UL << (page % 32));
+    const uint32_t bit = page + g_page_map_shift;
+    map[bit / 32] |= (1UL << (bit % 32));
 }
 
 /** Clears the page bit in the page map array.
  * @param map   an array of `uint32_t` containing the page map
  * @param page  the index of the page to be set
  */
-static inline void page_allocator_map_clear(uint32_t * const map, uint8_t page)
+static inline void page_allocator_map_clear(uint32_t * const map, page_index_t page)
 {
-    page += g_page_map_shift;
-    map[page / 32] &= ~(1UL << (page % 32));
+    const uint32_t bit = page + g_page_map_shift;
+    map[bit / 32] &= ~(1UL << (bit % 32));
 }
 
 /** Check if the page bit is set int the page map array.
@@ -77,10 +118,10 @@ static inline void page_allocator_map_clear(uint32_t * const map, uint8_t page)
  * @retval 0    if page bit is not set
  * @retval 1    if page bit is set
  */
-static inline int page_allocator_map_get(const uint32_t * const map, uint8_t page)
+static inline int page_allocator_map_get(const uint32_t * const map, page_index_t page)
 {
-    page += g_page_map_shift;
-    return (map[page / 32] >> (page % 32)) & 0x1;
+    const uint32_t bit = page + g_page_map_shift;
+    return (map[bit / 32] >> (bit % 32)) & 0x1;
 }
 
 #endif /* __PAGE_ALLOCATOR_CONFIG_H__ */
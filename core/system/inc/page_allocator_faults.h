@@ -18,15 +18,16 @@
 #define __PAGE_ALLOCATOR_FAULTS_H__
 
 #include "api/inc/page_allocator_exports.h"
+#include "page_allocator_config.h"
 
 /** Resets the fault count on a page. */
-void page_allocator_reset_faults(uint8_t page);
+void page_allocator_reset_faults(page_index_t page);
 
 /** Registers a fault on a page. */
-void page_allocator_register_fault(uint8_t page);
+void page_allocator_register_fault(page_index_t page);
 
 /** @returns the number of faults on this page. */
-uint32_t page_allocator_get_faults(uint8_t page);
+uint32_t page_allocator_get_faults(page_index_t page);
 
 /** Check if a box is allowed to access a address range.
  * Note that the address range must be contained inside one page.
@@ -41,6 +42,14 @@ uint32_t page_allocator_get_faults(uint8_t page);
  */
 int page_allocator_check_range_for_box(int box_id, uint32_t start_addr, uint32_t end_addr);
 
+/** Check if a page has been shared with a box for reading only.
+ *
+ * @param box_id    the id of the box to query for
+ * @param address   the address to locate in the page heap
+ * @returns non-zero if the address is in a page shared read-only with the box
+ */
+int page_allocator_is_read_only(int box_id, uint32_t address);
+
 /** Map an address to the start and end addresses of a page.
  * If the address is not part of any page, or the page does not belong to the
  * active box or box 0 an error is returned and `start`, `end` and `page` are invalid.
@@ -51,11 +60,13 @@ int page_allocator_check_range_for_box(int box_id, uint32_t start_addr, uint32_t
  * @param[out] page         the physical page index of the found page
  * @returns Non-zero on failure with failure class `UVISOR_ERROR_CLASS_PAGE`. See `UVISOR_ERROR_PAGE_*`.
  */
-int page_allocator_get_active_region_for_address(uint32_t address, uint32_t * start_addr, uint32_t * end_addr, uint8_t * page);
+int page_allocator_get_active_region_for_address(uint32_t address, uint32_t * start_addr, uint32_t * end_addr, page_index_t * page);
 
 /** Map an address to an 8-bit page mask.
  * If the address is not part of any page, or the page does not belong to the
  * active box or box 0 an error is returned and `mask`, `index` and `page` are invalid.
+ * The mask only contains the pages with the same access permissions as the
+ * found page, see `page_allocator_is_read_only`.
  *
  * Example with 12 pages:
  *  - map:  0b11111111'11110000'00000000'00000000
@@ -68,7 +79,7 @@ int page_allocator_get_active_region_for_address(uint32_t address, uint32_t * st
  * @param[out] page         the physical page index of the found page
  * @returns Non-zero on failure with failure class `UVISOR_ERROR_CLASS_PAGE`. See `UVISOR_ERROR_PAGE_*`.
  */
-int page_allocator_get_active_mask_for_address(uint32_t address, uint8_t * mask, uint8_t * index, uint8_t * page);
+int page_allocator_get_active_mask_for_address(uint32_t address, uint8_t * mask, page_index_t * index, page_index_t * page);
 
 typedef enum
 {
@@ -90,7 +101,7 @@ typedef enum
  * @retval 0            stop iteration after this callback.
  * @retval !0           continue iteration after this callback.
  */
-typedef int (*PageAllocatorIteratorCallback)(uint32_t start_addr, uint32_t end_addr, uint8_t page);
+typedef int (*PageAllocatorIteratorCallback)(uint32_t start_addr, uint32_t end_addr, page_index_t page);
 
 /* Iterate over all pages belonging to the active box or box 0 and execute the callback.ss
  *
@@ -98,7 +109,7 @@ typedef int (*PageAllocatorIteratorCallback)(uint32_t start_addr, uint32_t end_a
  * @param direction forward or backwards direction.
  * @return          number of callbacks, or if `NULL` passed as callback, number of active pages.
  */
-uint8_t page_allocator_iterate_active_pages(PageAllocatorIteratorCallback callback, PageAllocatorIteratorDirection direction);
+page_index_t page_allocator_iterate_active_pages(PageAllocatorIteratorCallback callback, PageAllocatorIteratorDirection direction);
 
 /** Callback for iterating over 8-bit page masks.
  *
@@ -121,14 +132,15 @@ uint8_t page_allocator_iterate_active_pages(PageAllocatorIteratorCallback callba
  * @retval 0            stop iteration after this callback.
  * @retval !0           continue iteration after this callback.
  */
-typedef int (*PageAllocatorIteratorMaskCallback)(uint8_t mask, uint8_t index);
+typedef int (*PageAllocatorIteratorMaskCallback)(uint8_t mask, page_index_t index);
 
 /* Iterate over all page masks belonging to the active box or box 0 and execute the callback.
+ * Pages shared read-only with the active box are not part of the masks.
  *
  * @param callback  the function to execute on every page mask. Returns number of active page masks if `NULL`.
  * @param direction forward or backwards direction.
  * @return          number of callbacks, or if `NULL` passed as callback, number of active page masks.
  */
-uint8_t page_allocator_iterate_active_page_masks(PageAllocatorIteratorMaskCallback callback, PageAllocatorIteratorDirection direction);
+page_index_t page_allocator_iterate_active_page_masks(PageAllocatorIteratorMaskCallback callback, PageAllocatorIteratorDirection direction);
 
 #endif /* __PAGE_ALLOCATOR_FAULTS_H__ */
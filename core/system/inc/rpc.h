@@ -17,7 +17,88 @@
 #ifndef __RPC_H__
 #define __RPC_H__
 
+#include "api/inc/rpc_exports.h"
+#include "api/inc/rpc_gateway_exports.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Count the queue drains that are skipped because the doorbell of the queue
+ * has not been rung. This is meant for host builds, to keep the skip path of
+ * the thread switch down to a load and a branch on the target. */
+#ifndef UVISOR_DRAIN_STATS
+#define UVISOR_DRAIN_STATS 0
+#endif
+
+#if UVISOR_DRAIN_STATS
+/* Number of RPC queue drains that were skipped. */
+extern uint32_t g_rpc_drain_skipped;
+
+/* Number of messages taken out of the outgoing RPC queues for good, and the
+ * number of drains they were kept back for, in total and at most. */
+extern uint32_t g_rpc_wait_count;
+extern uint32_t g_rpc_wait_total;
+extern uint32_t g_rpc_wait_max;
+#endif
+
+#if UVISOR_RPC_STATS
+/* The RPC latencies are measured with the DWT cycle counter by default. */
+#ifndef UVISOR_RPC_STATS_NOW
+#define UVISOR_RPC_STATS_TIMER_INIT() \
+    do { \
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk; \
+        DWT->CYCCNT = 0; \
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk; \
+    } while (0)
+#define UVISOR_RPC_STATS_NOW() (DWT->CYCCNT)
+#endif
+#endif
+
 void drain_message_queue(void);
 void drain_result_queue(void);
 
+/* Same as drain_message_queue and drain_result_queue, for the messages to one
+ * box only. */
+void drain_message_queue_to(int callee_box);
+void drain_result_queue_to(int caller_box);
+
+/** Copy the RPC latencies to box memory.
+ *
+ * Only the public box can read the latencies, as they tell about the RPCs
+ * between all the boxes.
+ *
+ * @param stats[out]    Latencies, in memory of the calling box
+ * @returns 0 on success, UVISOR_ERROR_NOT_IMPLEMENTED if uVisor was built
+ *          without `UVISOR_RPC_STATS`, or UVISOR_ERROR_INVALID_BOX_ID if the
+ *          calling box is not the public box.
+ */
+int rpc_get_stats(uvisor_rpc_stats_t * stats);
+
+/** Get the callee box of a direct RPC gateway.
+ *
+ * @param gateway[in]   Gateway as passed by the calling box
+ * @returns the ID of the callee box, or -1 if the gateway is not a valid
+ *          direct RPC gateway.
+ */
+int rpc_direct_callee_box_id(const TRPCGateway * gateway);
+
+#if defined(ARCH_CORE_ARMv7M)
+/** Start a direct RPC by running its target function in the callee box.
+ * @warning This function trusts the SVCall parameters that are passed to it.
+ * @param svc_sp[in]    Unprivileged stack pointer at the time of the SVCall
+ * @param svc_pc[in]    Program counter at the time of the SVCall
+ */
+void UVISOR_NAKED rpc_direct_in(uint32_t svc_sp, uint32_t svc_pc);
+
+/** Return from the target function of a direct RPC to the caller.
+ * @warning This function trusts the SVCall parameters that are passed to it.
+ * @param svc_sp[in]    Unprivileged stack pointer at the time of the SVCall
+ */
+void UVISOR_NAKED rpc_direct_out(uint32_t svc_sp);
+
+/** Check whether the target function of a direct RPC is running.
+ * @returns true if a direct RPC is in progress, false otherwise.
+ */
+bool rpc_direct_is_active(void);
+#endif /* defined(ARCH_CORE_ARMv7M) */
+
 #endif/*__RPC_H__*/
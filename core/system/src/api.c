@@ -18,12 +18,15 @@
 #include "api/inc/api.h"
 #include "api/inc/uvisor_spinlock_exports.h"
 #include "box_init.h"
+#include "channel.h"
 #include "debug.h"
+#include "doorbell.h"
 #include "halt.h"
 #include "svc.h"
 #include "virq.h"
 #include "vmpu.h"
 #include "page_allocator.h"
+#include "rpc.h"
 #include "thread.h"
 #include "box_init.h"
 
@@ -83,8 +86,20 @@ transition_np_to_p(vmpu_mem_invalidate, void, vmpu_mpu_invalidate, void);
 transition_np_to_p(box_namespace,        int,  vmpu_box_namespace_from_id, int         box_id,       char *       box_namespace, size_t length);
 transition_np_to_p(box_id_for_namespace, int,  vmpu_box_id_from_namespace, int * const box_id, const char * const box_namespace);
 
+transition_np_to_p(rpc_get_stats, int, rpc_get_stats, uvisor_rpc_stats_t * stats);
+
+transition_np_to_p(channel_create, int, channel_create, UvisorChannelRing * ring, int consumer_box);
+transition_np_to_p(channel_attach, int, channel_attach, UvisorChannelRing * ring, UvisorSemaphore * semaphore);
+transition_np_to_p(channel_close,  int, channel_close,  UvisorChannelRing * ring);
+
+transition_np_to_p(box_kick, int, doorbell_kick, int box_id);
+
 transition_np_to_p(page_malloc, int,  page_allocator_malloc,       UvisorPageTable * const table);
 transition_np_to_p(page_free,   int,  page_allocator_free,   const UvisorPageTable * const table);
+transition_np_to_p(page_clean,     int, page_allocator_clean,     uint32_t max_pages);
+transition_np_to_p(page_get_stats, int, page_allocator_get_stats, UvisorPageStats * const stats);
+transition_np_to_p(page_share,  int,  page_allocator_share,  const UvisorPageTable * const table, int dst_box, uint32_t acl);
+transition_np_to_p(page_revoke, int,  page_allocator_revoke, const UvisorPageTable * const table, int dst_box);
 
 transition_np_to_p(irq_set_vector,    void,     virq_isr_set,          uint32_t irqn, uint32_t vector);
 transition_np_to_p(irq_get_vector,    uint32_t, virq_isr_get,          uint32_t irqn);
@@ -134,10 +149,22 @@ const UvisorApi __uvisor_api = {
 
     .page_malloc = page_malloc_transition,
     .page_free = page_free_transition,
+    .page_clean = page_clean_transition,
+    .page_get_stats = page_get_stats_transition,
+    .page_share = page_share_transition,
+    .page_revoke = page_revoke_transition,
 
     .box_namespace = box_namespace_transition,
     .box_id_for_namespace = box_id_for_namespace_transition,
 
+    .rpc_get_stats = rpc_get_stats_transition,
+
+    .channel_create = channel_create_transition,
+    .channel_attach = channel_attach_transition,
+    .channel_close = channel_close_transition,
+
+    .box_kick = box_kick_transition,
+
     .debug_init = debug_init_transition,
     .error = error_transition,
     .start = start_transition,
@@ -158,6 +185,11 @@ const UvisorApi __uvisor_api = {
     .pool_queue_try_dequeue_first = uvisor_pool_queue_try_dequeue_first,
     .pool_queue_find_first = uvisor_pool_queue_find_first,
     .pool_queue_try_find_first = uvisor_pool_queue_try_find_first,
+    .pool_queue_init_mode = uvisor_pool_queue_init_mode,
+    .pool_queue_try_enqueue_batch = uvisor_pool_queue_try_enqueue_batch,
+    .pool_queue_try_dequeue_batch = uvisor_pool_queue_try_dequeue_batch,
+    .pool_allocate_n = uvisor_pool_allocate_n,
+    .pool_try_allocate_n = uvisor_pool_try_allocate_n,
 
     .spin_init = uvisor_spin_init,
     .spin_trylock = uvisor_spin_trylock,
@@ -29,7 +29,7 @@ void box_init(uint8_t box_id, UvisorBoxConfig const * box_cfgtbl)
     state->remaining_ms = 100;
 
     /* Initialize IPC for the box. */
-    ipc_box_init(box_id);
+    ipc_box_init(box_id, &box_cfgtbl->queue_slots);
 
     /* Set the initial state for a box. Box 0 doesn't need its initial
      * state set here, as box 0 is already running. */
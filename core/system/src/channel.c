@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <uvisor.h>
+#include "api/inc/channel_exports.h"
+#include "api/inc/vmpu_exports.h"
+#include "channel.h"
+#include "context.h"
+#include "page_allocator.h"
+#include "page_allocator_faults.h"
+#include "semaphore.h"
+#include "vmpu.h"
+#include "vmpu_mpu.h"
+
+typedef struct {
+    /* Ring of the channel, in a page of the producer box, or NULL if the slot
+     * is free */
+    UvisorChannelRing * ring;
+
+    uint8_t producer_box;
+    uint8_t consumer_box;
+
+    /* Semaphore of the consumer box, or NULL until the consumer attaches */
+    UvisorSemaphore * semaphore;
+
+    /* Number of wake ups of the ring seen by the last drain */
+    uint32_t wake_ups;
+} Channel;
+
+static Channel g_channels[UVISOR_CHANNEL_SLOTS];
+
+static UvisorBoxIndex * box_index(uint8_t box_id)
+{
+    return (UvisorBoxIndex *) g_context_current_states[box_id].bss;
+}
+
+static Channel * channel_find(const UvisorChannelRing * ring)
+{
+    int i;
+
+    for (i = 0; i < UVISOR_CHANNEL_SLOTS; i++) {
+        if (g_channels[i].ring == ring) {
+            return &g_channels[i];
+        }
+    }
+    return NULL;
+}
+
+/* Return whether a box can read and write the whole page of a ring. */
+static bool channel_ring_is_ok(int box_id, const UvisorChannelRing * ring)
+{
+    return vmpu_buffer_access_is_ok(box_id, ring, g_page_size) &&
+           !page_allocator_is_read_only(box_id, (uint32_t) ring);
+}
+
+int channel_create(UvisorChannelRing * ring, int consumer_box)
+{
+    int producer_box = g_active_box;
+    Channel * channel;
+
+    if (consumer_box < 0 || consumer_box >= g_vmpu_box_count || consumer_box == producer_box) {
+        return UVISOR_ERROR_INVALID_BOX_ID;
+    }
+
+    /* The ring must fill a whole page, which both boxes can write to. */
+    if (ring == NULL || page_allocator_get_page_from_address((uint32_t) ring) == UVISOR_PAGE_UNUSED ||
+        ((uint32_t) ring - (uint32_t) g_page_heap_start) % g_page_size != 0) {
+        return UVISOR_ERROR_PAGE_INVALID_PAGE_ORIGIN;
+    }
+    if (!channel_ring_is_ok(producer_box, ring) || !channel_ring_is_ok(consumer_box, ring)) {
+        return UVISOR_ERROR_PAGE_INVALID_PAGE_OWNER;
+    }
+
+    if (channel_find(ring)) {
+        return UVISOR_ERROR_INVALID_PARAMETERS;
+    }
+    channel = channel_find(NULL);
+    if (!channel) {
+        return UVISOR_ERROR_OUT_OF_STRUCTURES;
+    }
+
+    channel->ring = ring;
+    channel->producer_box = producer_box;
+    channel->consumer_box = consumer_box;
+    channel->semaphore = NULL;
+    channel->wake_ups = UVISOR_GET_S_ALIAS(ring)->wake_ups;
+    return 0;
+}
+
+int channel_attach(UvisorChannelRing * ring, UvisorSemaphore * semaphore)
+{
+    Channel * channel = channel_find(ring);
+
+    if (ring == NULL || !channel || channel->consumer_box != g_active_box) {
+        return UVISOR_ERROR_INVALID_PARAMETERS;
+    }
+    if (!vmpu_buffer_access_is_ok(g_active_box, semaphore, sizeof(*semaphore))) {
+        return UVISOR_ERROR_INVALID_PARAMETERS;
+    }
+
+    channel->semaphore = semaphore;
+    return 0;
+}
+
+int channel_close(UvisorChannelRing * ring)
+{
+    Channel * channel = channel_find(ring);
+
+    if (ring == NULL || !channel ||
+        (channel->producer_box != g_active_box && channel->consumer_box != g_active_box)) {
+        return UVISOR_ERROR_INVALID_PARAMETERS;
+    }
+
+    channel->ring = NULL;
+    return channel->consumer_box;
+}
+
+/* Wake up the consumers of the channels of the active box, or only one
+ * consumer box if consumer_box_only is not -1. */
+static void channel_drain_for(int consumer_box_only)
+{
+    UvisorBoxIndex * index = UVISOR_GET_S_ALIAS(box_index(g_active_box));
+    bool left_out = false;
+    int i;
+
+    /* The producer rings the doorbell every time one of its rings becomes
+     * non-empty. Clear it before draining, as writes from now on ring it
+     * again. */
+    if (!index->doorbells.queue[UVISOR_BOX_DOORBELL_CHANNEL]) {
+        return;
+    }
+    index->doorbells.queue[UVISOR_BOX_DOORBELL_CHANNEL] = 0;
+
+    for (i = 0; i < UVISOR_CHANNEL_SLOTS; i++) {
+        Channel * channel = &g_channels[i];
+        if (channel->ring == NULL || channel->producer_box != g_active_box || channel->semaphore == NULL) {
+            continue;
+        }
+
+        /* Either box may have given up its access to the ring, or the
+         * consumer its semaphore, since the last drain. */
+        if (!channel_ring_is_ok(channel->producer_box, channel->ring) ||
+            !channel_ring_is_ok(channel->consumer_box, channel->ring) ||
+            !vmpu_buffer_access_is_ok(channel->consumer_box, channel->semaphore, sizeof(*channel->semaphore))) {
+            channel->ring = NULL;
+            continue;
+        }
+
+        /* Post once however many times the ring became non-empty, as the
+         * consumer reads all the data available when it wakes up. */
+        uint32_t wake_ups = UVISOR_GET_S_ALIAS(channel->ring)->wake_ups;
+        if (wake_ups == channel->wake_ups) {
+            continue;
+        }
+        if (consumer_box_only >= 0 && channel->consumer_box != consumer_box_only) {
+            left_out = true;
+            continue;
+        }
+        channel->wake_ups = wake_ups;
+        semaphore_post(UVISOR_GET_S_ALIAS(channel->semaphore));
+    }
+
+    /* Wake up the other consumers on the next drain. */
+    if (left_out) {
+        index->doorbells.queue[UVISOR_BOX_DOORBELL_CHANNEL] = 1;
+    }
+}
+
+void channel_drain(void)
+{
+    channel_drain_for(-1);
+}
+
+void channel_drain_to(int consumer_box)
+{
+    channel_drain_for(consumer_box);
+}
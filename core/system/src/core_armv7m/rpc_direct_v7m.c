@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <uvisor.h>
+#include "api/inc/rpc_gateway_exports.h"
+#include "context.h"
+#include "halt.h"
+#include "rpc.h"
+#include "svc.h"
+#include "vmpu.h"
+
+/** State of the direct RPC in progress
+ * @internal
+ * Direct RPCs cannot be nested, so there is at most one in progress at any
+ * time.
+ */
+typedef struct {
+    /* Whether a direct RPC is in progress. */
+    bool active;
+
+    /* Stack pointer of the calling box, as it was before the RPC.
+     * The context switch overwrites it with the stack pointer of the calling
+     * thread, which must not be used for anything else once the thread runs
+     * again. */
+    uint32_t caller_box_sp;
+
+    /* Value of BASEPRI before the RPC. */
+    uint32_t basepri;
+} RpcDirectState;
+
+static RpcDirectState g_rpc_direct;
+
+bool rpc_direct_is_active(void)
+{
+    return g_rpc_direct.active;
+}
+
+/** Thunk function for the direct RPC return
+ * @internal
+ * The target function returns here, in the callee box, and hands its return
+ * value over to uVisor in r0.
+ */
+static void UVISOR_NAKED rpc_direct_thunk(void)
+{
+    UVISOR_SVC(UVISOR_SVC_ID_RPC_DIRECT_OUT, "");
+}
+
+/** Perform a context switch-in to the callee box of a direct RPC.
+ *
+ * @internal
+ *
+ * This function is implemented as a wrapper, needed to make sure that the lr
+ * register doesn't get polluted and to provide context privacy during a context
+ * switch. The actual function is ::rpc_direct_context_switch_in. The
+ * callee-saved registers of the caller are kept on the MSP until the RPC
+ * returns, in ::rpc_direct_out. */
+void UVISOR_NAKED rpc_direct_in(uint32_t svc_sp, uint32_t svc_pc)
+{
+    /* According to the ARM ABI, r0 and r1 will have the following values when
+     * this function is called:
+     *   r0 = svc_sp
+     *   r1 = svc_pc */
+    asm volatile(
+        "push {r4 - r11}\n"                     /* Store the callee-saved registers on the MSP (privileged). */
+        "push {lr}\n"                           /* Preserve the lr register. */
+        "bl   rpc_direct_context_switch_in\n"   /* rpc_direct_context_switch_in(svc_sp, svc_pc) */
+        "pop  {lr}\n"                           /* Restore the lr register. */
+        "mov  r4,  #0\n"                        /* Clear r4  */
+        "mov  r5,  #0\n"                        /* Clear r5  */
+        "mov  r6,  #0\n"                        /* Clear r6  */
+        "mov  r7,  #0\n"                        /* Clear r7  */
+        "mov  r8,  #0\n"                        /* Clear r8  */
+        "mov  r9,  #0\n"                        /* Clear r9  */
+        "mov  r10, #0\n"                        /* Clear r10 */
+        "mov  r11, #0\n"                        /* Clear r11 */
+        "bx   lr\n"                             /* Return. Note: Callee-saved registers are not popped here. */
+                                                /* The target function will be executed after this. */
+        :: "r" (svc_sp), "r" (svc_pc)
+    );
+}
+
+/** Perform a context switch-in to the callee box of a direct RPC.
+ *
+ * @internal
+ *
+ * This function implements ::rpc_direct_in, which is instead only a wrapper.
+ * The target function runs in the calling thread, on the stack of the callee
+ * box, with all the interrupts that could lead to a thread switch masked.
+ * Since this only happens from threads, all the box stacks are unused.
+ *
+ * @param svc_sp[in]    Unprivileged stack pointer at the time of the SVCall
+ * @param svc_pc[in]    Program counter at the time of the SVCall */
+void rpc_direct_context_switch_in(uint32_t svc_sp, uint32_t svc_pc)
+{
+    /* Direct RPCs must start from a thread, not from an interrupt, a box
+     * initialization or another direct RPC, all of which run on the stack of
+     * a box. */
+    if (context_state_previous() != NULL) {
+        HALT_ERROR(NOT_ALLOWED, "Direct RPCs can only be called from threads.");
+    }
+
+    /* The stack pointer provided to us as an input comes from an SVC
+     * exception. We must check that it corresponds to a full frame that the
+     * source box can access. */
+    /* This function halts if it finds an error. */
+    uint32_t src_sp = context_validate_exc_sf(svc_sp);
+
+    /* The gateway is passed in the stacked r12. */
+    TRPCGateway const * const gateway = (TRPCGateway const *) ((uint32_t *) src_sp)[4];
+    int dst_id = rpc_direct_callee_box_id(gateway);
+    if (dst_id < 0) {
+        HALT_ERROR(PERMISSION_DENIED, "Direct RPC gateway 0x%08X not allowed.", (uint32_t) gateway);
+    }
+    if (dst_id == g_active_box) {
+        HALT_ERROR(NOT_ALLOWED, "Direct RPC gateway 0x%08X calls into the calling box.", (uint32_t) gateway);
+    }
+
+    /* Keep any thread switch from happening while the target function runs,
+     * like the box initialization does. */
+    g_rpc_direct.basepri = __get_BASEPRI();
+    __set_BASEPRI(__UVISOR_NVIC_MIN_PRIORITY << (8U - __NVIC_PRIO_BITS));
+    g_rpc_direct.caller_box_sp = g_context_current_states[g_active_box].sp;
+    g_rpc_direct.active = true;
+
+    /* Forge a stack frame for the target function, with all 4 parameters. The
+     * target function returns to the thunk. */
+    uint32_t dst_sp = context_forge_exc_sf(src_sp, dst_id, gateway->target, (uint32_t) rpc_direct_thunk, xPSR_T_Msk,
+                                           CONTEXT_SWITCH_FUNCTION_MAX_NARGS);
+
+    /* Perform the context switch-in to the callee box. */
+    /* This function halts if it finds an error. */
+    context_switch_in(CONTEXT_SWITCH_FUNCTION_GATEWAY, dst_id, src_sp, dst_sp);
+}
+
+/** Perform a context switch-out from the callee box of a direct RPC.
+ *
+ * @internal
+ *
+ * This function is implemented as a wrapper, needed to make sure that the lr
+ * register doesn't get polluted. The actual function is
+ * ::rpc_direct_context_switch_out. The wrapper restores the callee-saved
+ * registers of the caller, which were saved by ::rpc_direct_in. */
+void UVISOR_NAKED rpc_direct_out(uint32_t svc_sp)
+{
+    /* According to the ARM ABI, r0 will have the following value when this
+     * function is called:
+     *   r0 = svc_sp */
+    asm volatile(
+        "push {lr}\n"                           /* Save the lr register for later. */
+        "bl   rpc_direct_context_switch_out\n"  /* rpc_direct_context_switch_out(svc_sp) */
+        "pop  {lr}\n"                           /* Restore the lr register. */
+        "pop  {r4 - r11}\n"                     /* Restore the previously saved callee-saved registers. */
+        "bx   lr\n"                             /* Return to the caller, still in unprivileged mode. */
+        :: "r" (svc_sp)
+    );
+}
+
+/** Perform a context switch-out from the callee box of a direct RPC.
+ *
+ * @internal
+ *
+ * This function implements ::rpc_direct_out, which is instead only a wrapper.
+ *
+ * @param svc_sp[in]    Unprivileged stack pointer at the time of the SVCall,
+ *                      which is issued by the thunk the target function
+ *                      returns to */
+void rpc_direct_context_switch_out(uint32_t svc_sp)
+{
+    TContextPreviousState * previous_state = context_state_previous();
+    if (!g_rpc_direct.active || previous_state == NULL || previous_state->type != CONTEXT_SWITCH_FUNCTION_GATEWAY) {
+        HALT_ERROR(NOT_ALLOWED, "No direct RPC to return from.");
+    }
+
+    /* The return value of the target function is in the stacked r0. */
+    uint32_t dst_sp = context_validate_exc_sf(svc_sp);
+    uint32_t result = ((uint32_t *) dst_sp)[0];
+
+    /* Discard the unneeded exception stack frame from the callee box stack.
+     * The callee box is the currently active one. */
+    context_discard_exc_sf(g_active_box, dst_sp);
+
+    /* Perform the context switch back to the caller. */
+    context_switch_out(CONTEXT_SWITCH_FUNCTION_GATEWAY);
+    g_context_current_states[g_active_box].sp = g_rpc_direct.caller_box_sp;
+
+    /* Hand the return value to the caller in its stacked r0. The stack frame
+     * was validated when the RPC started. */
+    ((uint32_t *) previous_state->src_sp)[0] = result;
+
+    g_rpc_direct.active = false;
+    __set_BASEPRI(g_rpc_direct.basepri);
+}
@@ -16,13 +16,16 @@
  */
 #include <uvisor.h>
 #include "box_init.h"
+#include "channel.h"
 #include "debug.h"
+#include "doorbell.h"
 #include "halt.h"
 #include "svc.h"
 #include "virq.h"
 #include "vmpu.h"
 #include "vmpu_mpu.h"
 #include "page_allocator.h"
+#include "rpc.h"
 
 /* these symbols are linked in this scope from the ASM code in __svc_irq and
  * are needed for sanity checks */
@@ -57,10 +60,22 @@ const UvisorSvcTarget g_svc_vtor_tbl = {
 
     .page_malloc = page_allocator_malloc,
     .page_free = page_allocator_free,
+    .page_clean = page_allocator_clean,
+    .page_get_stats = page_allocator_get_stats,
+    .page_share = page_allocator_share,
+    .page_revoke = page_allocator_revoke,
 
     .box_namespace = vmpu_box_namespace_from_id,
     .box_id_for_namespace = vmpu_box_id_from_namespace,
 
+    .rpc_get_stats = rpc_get_stats,
+
+    .channel_create = channel_create,
+    .channel_attach = channel_attach,
+    .channel_close = channel_close,
+
+    .box_kick = doorbell_kick,
+
     .debug_init = debug_register_driver,
     .error = halt_user_error,
 
@@ -141,8 +156,8 @@ void UVISOR_NAKED SVCall_IRQn_Handler(void)
         ".word  register_gateway_perform_operation\n"
         ".word  box_init_first\n"
         ".word  box_init_next\n"
-        ".word  __svc_not_implemented\n"
-        ".word  __svc_not_implemented\n"
+        ".word  rpc_direct_in\n"
+        ".word  rpc_direct_out\n"
         ".word  __svc_not_implemented\n"
         ".word  __svc_not_implemented\n"
         ".word  __svc_not_implemented\n"
@@ -16,10 +16,12 @@
  */
 #include <uvisor.h>
 #include "debug.h"
+#include "channel.h"
 #include "ipc.h"
 #include "exc_return.h"
 #include "halt.h"
 #include "context.h"
+#include "page_allocator.h"
 #include "vmpu.h"
 
 /* The box to switch to when the current one runs out of time. */
@@ -41,6 +43,14 @@ static void dispatch(int dst_box_id, int src_box_id, saved_reg_t * reg)
     /* Deliver any IPC messages. */
     ipc_drain_queue();
 
+    /* Wake up the consumers of any channels. */
+    channel_drain();
+
+    /* Zero some free pages in advance, so that allocations need not. */
+    if (g_page_count_dirty) {
+        page_allocator_clean(UVISOR_PAGE_CLEAN_MAX_COUNT);
+    }
+
     /* There are four cases to handle saving and restoring core registers from.
      *
      * 1. Coming from S side, going to NS (b9). Save information from
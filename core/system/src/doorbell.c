@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <uvisor.h>
+#include "api/inc/vmpu_exports.h"
+#include "channel.h"
+#include "context.h"
+#include "doorbell.h"
+#include "ipc.h"
+#include "rpc.h"
+#include "vmpu.h"
+
+int doorbell_kick(int dst_box)
+{
+    UvisorBoxIndex * index = (UvisorBoxIndex *) *(__uvisor_config.uvisor_box_context);
+
+    if (dst_box < 0 || dst_box >= g_vmpu_box_count || dst_box == g_active_box) {
+        return UVISOR_ERROR_INVALID_BOX_ID;
+    }
+
+    /* Deliver what the active box queued for the destination box, like on a
+     * thread switch. Posting to the semaphore of a waiting thread of the
+     * destination box lets the RTOS switch to it when the SVC returns, or as
+     * soon as the calling thread blocks. */
+    if (index->doorbells.any) {
+        drain_message_queue_to(dst_box);
+        drain_result_queue_to(dst_box);
+        ipc_drain_queue_to(dst_box);
+        channel_drain_to(dst_box);
+    }
+    return 0;
+}
@@ -23,10 +23,16 @@
 #include "halt.h"
 #include "ipc.h"
 #include "linker.h"
+#include "page_allocator.h"
+#include "semaphore.h"
 #include "vmpu.h"
 #include "vmpu_mpu.h"
 #include <string.h>
 
+#if UVISOR_DRAIN_STATS
+uint32_t g_ipc_drain_skipped;
+#endif
+
 static UvisorBoxIndex * box_index(uint8_t box_id)
 {
     return (UvisorBoxIndex *) g_context_current_states[box_id].bss;
@@ -52,6 +58,11 @@ static int recv_match(uvisor_pool_slot_t slot, void * context)
         return 0; /* The receive IO is not ready */
     }
 
+    /* Pages are only sent to receive IOs that expect a page. */
+    if ((send_io->flags ^ recv_io->flags) & UVISOR_IPC_FLAG_PAGE) {
+        return 0;
+    }
+
     /* Source box ID permitted, or any box permitted to send? */
     if (send_box_id != recv_desc->box_id)
     {
@@ -109,15 +120,29 @@ static int put_it_back(uvisor_pool_queue_t * queue, uvisor_pool_slot_t slot)
      return status;
 }
 
-/* Fulfil the IPC request pair. Copy and update the descriptors. Clear the
- * tokens. Return 0 on success, non-zero otherwise.
+/* Complete a token and wake up the threads of its box waiting for it. The
+ * tokens lock of the box must be held. */
+static void ipc_complete(uvisor_ipc_t * ipc, uint32_t token)
+{
+    int i;
+
+    uvisor_ipc_tokens_add(&ipc->completed_tokens, token);
+    for (i = 0; i < UVISOR_IPC_WAITER_SLOTS; i++) {
+        if (uvisor_ipc_tokens_has(&ipc->waiters[i].tokens, token)) {
+            semaphore_post(&ipc->waiters[i].semaphore);
+        }
+    }
+}
+
+/* Fulfil the IPC request pair. Copy the message, or move its page, and update
+ * the descriptors. Clear the tokens. Return 0 on success, non-zero otherwise.
  *
  * This function assumes that the relevant objects and buffers involved have
  * been checked and found properly accessible by the relevant boxes.
  * */
 static int ipc_deliver(uvisor_ipc_t * send_ipc, uvisor_ipc_t * recv_ipc,
                        uvisor_ipc_io_t * send_io, uvisor_ipc_io_t * recv_io,
-                       int send_box_id)
+                       int send_box_id, int recv_box_id)
 {
     int status = -1;
     uvisor_ipc_desc_t * send_desc = send_io->desc;
@@ -142,12 +167,23 @@ static int ipc_deliver(uvisor_ipc_t * send_ipc, uvisor_ipc_t * recv_ipc,
     }
 
     size_t len = send_desc->len;
-    memcpy(recv_io->msg, send_io->msg, len);
-    send_ipc->completed_tokens |= send_desc->token;
+    if (send_io->flags & UVISOR_IPC_FLAG_PAGE) {
+        /* Move the page to the receiving box and hand it its address, instead
+         * of copying the message. This was checked to succeed before. */
+        page_allocator_transfer(send_box_id, recv_box_id, (uint32_t) send_io->msg);
+        *((uint32_t *) recv_io->msg) = (uint32_t) send_io->msg;
+
+        /* The page may still be mapped by the MPU for the sending box, which
+         * is the active one. */
+        vmpu_mpu_invalidate_pages();
+    } else {
+        memcpy(recv_io->msg, send_io->msg, len);
+    }
+    ipc_complete(send_ipc, send_desc->token);
 
     recv_desc->box_id = send_box_id;
     recv_desc->len = send_desc->len;
-    recv_ipc->completed_tokens |= recv_desc->token;
+    ipc_complete(recv_ipc, recv_desc->token);
 
     status = 0;
 
@@ -160,43 +196,272 @@ done:
     return status;
 }
 
-static bool ipc_is_ok(int box_id, const uvisor_ipc_t * ipc) {
-    return ipc &&
-           vmpu_buffer_access_is_ok(box_id, ipc, sizeof(*ipc));
+/* Move the receive IOs the box pushed onto the incoming stack of a bucket to
+ * the end of the bucket list, in the order they were pushed. The iteration
+ * limits protect against corrupted links. */
+static void ipc_port_index_collect(uvisor_ipc_port_index_t * index, uvisor_ipc_io_t * recv_array,
+                                   uvisor_pool_slot_t num, uint32_t bucket)
+{
+    uvisor_pool_slot_t slot;
+    uvisor_pool_slot_t first = UVISOR_POOL_SLOT_INVALID;
+    uvisor_pool_slot_t last;
+    uvisor_pool_slot_t iterated = 0;
+
+    /* Take the whole incoming stack at once. */
+    do {
+        slot = *((volatile uvisor_pool_slot_t *) &index->incoming[bucket]);
+        if (slot == UVISOR_POOL_SLOT_INVALID) {
+            return;
+        }
+    } while (!__sync_bool_compare_and_swap(&index->incoming[bucket], slot, UVISOR_POOL_SLOT_INVALID));
+
+    /* The stack is in reverse push order. Reverse it in place. */
+    last = slot;
+    while (slot < num && iterated < num) {
+        uvisor_pool_slot_t next = recv_array[slot].port_next;
+        recv_array[slot].port_next = first;
+        first = slot;
+        slot = next;
+        iterated++;
+    }
+    if (last >= num) {
+        return;
+    }
+
+    uvisor_pool_slot_t tail = index->tail[bucket];
+    if (tail < num) {
+        recv_array[tail].port_next = first;
+    } else {
+        index->head[bucket] = first;
+    }
+    index->tail[bucket] = last;
 }
 
-static bool ipc_io_array_is_ok(int box_id, const uvisor_ipc_io_t * array) {
-    UVISOR_STATIC_ASSERT(UVISOR_IPC_SEND_SLOTS == UVISOR_IPC_RECV_SLOTS, UVISOR_IPC_SEND_SLOTS_should_be_equal_to_UVISOR_IPC_RECV_SLOTS);
+/* Find the first receive IO in a bucket list that matches the send IO. Return
+ * its slot and the slot before it in the list, or UVISOR_POOL_SLOT_INVALID if
+ * no receive IO matches. */
+static uvisor_pool_slot_t ipc_port_index_find(uvisor_ipc_port_index_t * index, uvisor_pool_slot_t num,
+                                              uint32_t bucket, recv_match_context_t * context,
+                                              uvisor_pool_slot_t * prev)
+{
+    uvisor_pool_slot_t slot;
+    uvisor_pool_slot_t iterated = 0;
+
+    ipc_port_index_collect(index, context->recv_array, num, bucket);
 
-    return array &&
-           vmpu_buffer_access_is_ok(box_id, array, sizeof(*array) * UVISOR_IPC_SEND_SLOTS);
+    *prev = UVISOR_POOL_SLOT_INVALID;
+    for (slot = index->head[bucket]; slot < num && iterated < num; iterated++) {
+        if (recv_match(slot, context)) {
+            return slot;
+        }
+        *prev = slot;
+        slot = context->recv_array[slot].port_next;
+    }
+    return UVISOR_POOL_SLOT_INVALID;
 }
 
+/* Remove a receive IO found by `ipc_port_index_find` from its bucket list. */
+static void ipc_port_index_remove(uvisor_ipc_port_index_t * index, uvisor_ipc_io_t * recv_array,
+                                  uvisor_pool_slot_t num, uint32_t bucket, uvisor_pool_slot_t slot,
+                                  uvisor_pool_slot_t prev)
+{
+    uvisor_pool_slot_t next = recv_array[slot].port_next;
+
+    if (prev < num) {
+        recv_array[prev].port_next = next;
+    } else {
+        index->head[bucket] = next;
+    }
+    if (index->tail[bucket] == slot) {
+        index->tail[bucket] = prev;
+    }
+}
+
+static bool ipc_is_ok(int box_id, const uvisor_ipc_t * ipc) {
+    return ipc &&
+           vmpu_buffer_access_is_ok(box_id, ipc, sizeof(*ipc));
+}
+
+/* Return true iff the pool queue, its pool and all the slots of its pool are
+ * accessible to the box. The number of slots depends on the box, so it is
+ * only bounded. */
 static bool pool_queue_is_ok(int box_id, const uvisor_pool_queue_t * queue) {
     return queue &&
            vmpu_buffer_access_is_ok(box_id, queue, sizeof(*queue)) &&
            queue->pool &&
            vmpu_buffer_access_is_ok(box_id, queue->pool, sizeof(*queue->pool)) &&
+           queue->pool->num <= UVISOR_IPC_SLOTS_MAX &&
+           queue->pool->stride == sizeof(uvisor_ipc_io_t) &&
+           vmpu_buffer_access_is_ok(box_id, queue->pool->management_array,
+                                    sizeof(*queue->pool->management_array) * queue->pool->num) &&
            vmpu_buffer_access_is_ok(box_id, queue->pool->array, queue->pool->stride * queue->pool->num);
 }
 
-static bool ipc_io_is_ok(int box_id, const uvisor_ipc_io_t * io) {
+/* Return true iff the IO array of a pool queue that passed `pool_queue_is_ok`
+ * is the array of its pool. */
+static bool ipc_io_array_is_ok(const uvisor_pool_queue_t * queue, const uvisor_ipc_io_t * array) {
+    return array &&
+           array == queue->pool->array;
+}
+
+/* A page receive IO only takes the address of the page, not the message. */
+static bool ipc_io_is_ok(int box_id, const uvisor_ipc_io_t * io, bool recv) {
     return io &&
            vmpu_buffer_access_is_ok(box_id, io, sizeof(*io)) &&
            io->desc &&
            vmpu_buffer_access_is_ok(box_id, io->desc, sizeof(*(io->desc))) &&
-           vmpu_buffer_access_is_ok(box_id, io->msg, io->desc->len);
+           vmpu_buffer_access_is_ok(box_id, io->msg,
+                                    (recv && (io->flags & UVISOR_IPC_FLAG_PAGE)) ? sizeof(uint32_t) : io->desc->len);
 }
 
-void ipc_drain_queue(void)
+/* Deliver a send IO of the send box to a matching receive IO of the
+ * destination box, unless recv_box_only is not -1 and names another box.
+ * Return 0 if the send IO was delivered or discarded, or non-zero if it must
+ * stay in the send queue to be delivered later. */
+static int ipc_deliver_io(uvisor_ipc_t * send_ipc, uvisor_ipc_io_t * send_io, int send_box_id, int recv_box_only)
+{
+    uvisor_pool_slot_t recv_slot;
+
+    /* Verify that the send IO request is OK to use. */
+    if (!ipc_io_is_ok(send_box_id, send_io, false)) {
+        /* The IO is not entirely within the send box. Ignore it, and don't
+         * put it back. This shouldn't happen in a non-malicious box. */
+        return 0;
+    }
+
+    uvisor_ipc_desc_t * send_desc = send_io->desc;
+
+    /* Ready to send? */
+    if (send_io->state != UVISOR_IPC_IO_STATE_READY_TO_SEND) {
+        return 1; /* Try the next message */
+    }
+
+    /* Look up the receiving box. */
+    const int recv_box_id = send_desc->box_id;
+    if (recv_box_id < 0 || recv_box_id >= g_vmpu_box_count) {
+        /* Ignore messages sent to boxes we don't know. */
+        return 0;
+    }
+    if (recv_box_only >= 0 && recv_box_id != recv_box_only) {
+        return 1; /* Leave it for the next drain. */
+    }
+
+    /* A page must be owned by the send box, and hold the whole message. */
+    if ((send_io->flags & UVISOR_IPC_FLAG_PAGE) &&
+        (send_desc->len > g_page_size ||
+         page_allocator_check_transfer(send_box_id, recv_box_id, (uint32_t) send_io->msg))) {
+        /* Ignore the page, and don't put it back. This shouldn't happen in a
+         * non-malicious box. */
+        return 0;
+    }
+
+    /*
+     * Verify that the receive IPC structures are OK to use.
+     */
+    uvisor_ipc_t * recv_ipc = UVISOR_GET_S_ALIAS(uvisor_ipc(box_index(recv_box_id)));
+    if (!ipc_is_ok(recv_box_id, recv_ipc)) {
+        /* This shouldn't happen in a non-malicious box. */
+        return 1; /* Try the next send IO. */
+    }
+
+    uvisor_pool_queue_t * recv_queue = &recv_ipc->recv_queue.queue;
+    if (!pool_queue_is_ok(recv_box_id, recv_queue)) {
+        /* This shouldn't happen in a non-malicious box. */
+        return 1; /* Try the next send IO. */
+    }
+
+    uvisor_ipc_io_t * recv_array = recv_ipc->recv_queue.io;
+    if (!ipc_io_array_is_ok(recv_queue, recv_array)) {
+        /* This shouldn't happen in a non-malicious box. */
+        return 1; /* Try the next send IO. */
+    }
+
+    /* Find the first recv IO posted on the port that allows from this
+     * sender. */
+    uvisor_ipc_port_index_t * port_index = &recv_ipc->recv_queue.port_index;
+    uvisor_pool_slot_t num = recv_queue->pool->num;
+    uint32_t bucket = uvisor_ipc_port_bucket(send_desc->port);
+    uvisor_pool_slot_t prev_slot;
+    recv_match_context_t context = {send_box_id, send_io, recv_array};
+    recv_slot = ipc_port_index_find(port_index, num, bucket, &context, &prev_slot);
+    /* Was a receive request available to match the send request? */
+    if (recv_slot >= num) {
+        /* No recv request was available. Try the next send request. */
+        return 1;
+    }
+
+    uvisor_pool_slot_t found_slot = recv_slot;
+    recv_slot = uvisor_pool_queue_try_dequeue(recv_queue, recv_slot);
+    if (recv_slot >= recv_queue->pool->num) {
+        /* The recv IO is in the port index but not in the recv queue. The
+         * box only adds recv IOs to the index after queueing them, so this
+         * shouldn't happen in a non-malicious box. */
+        ipc_port_index_remove(port_index, recv_array, num, bucket, found_slot, prev_slot);
+        return 1;
+    }
+
+    /* We have a send and receive request pair. Do the copying and updating
+     * of the descriptor, and clearing of the token. */
+    uvisor_ipc_io_t * recv_io = &recv_array[recv_slot];
+    if (!ipc_io_is_ok(recv_box_id, recv_io, true)) {
+        /* The IO is not entirely within the send box. Ignore it, and don't
+         * put it back. */
+        ipc_port_index_remove(port_index, recv_array, num, bucket, recv_slot, prev_slot);
+        return 1;
+    }
+
+    if (ipc_deliver(send_ipc, recv_ipc, send_io, recv_io, send_box_id, recv_box_id)) {
+        /* The message couldn't be delivered at this time. The receive IO
+         * keeps its place in the port index. */
+        put_it_back(recv_queue, recv_slot);
+        return 1;
+    }
+    ipc_port_index_remove(port_index, recv_array, num, bucket, recv_slot, prev_slot);
+
+#ifndef NDEBUG
+    uvisor_ipc_desc_t * recv_desc = recv_io->desc;
+#endif
+    DPRINTF("Delivered [b%d].t0x%08x to [b%d:s%d].t0x%08x\r\n", send_box_id, send_desc->token, recv_box_id, recv_slot, recv_desc->token);
+
+    /* Free the receive slot, as we have consumed the IO. */
+    recv_slot = uvisor_pool_queue_try_free(recv_queue, recv_slot);
+    if (recv_slot >= recv_queue->pool->num) {
+        /* The pool is busy. This should never happen. We were able to dequeue
+         * the receive IO, but weren't able to free it. It is bad to take down
+         * the entire system. It is also bad to never free slots in the
+         * receive queue. However, if we could dequeue the slot we should have
+         * no trouble freeing the slot here. */
+        assert(false);
+    }
+
+    return 0;
+}
+
+/* Deliver the send IOs of the active box, or only those to one box if
+ * recv_box_only is not -1. */
+static void ipc_drain(int recv_box_only)
 {
     uint8_t send_box_id = g_active_box;
-    int first_slot = -1;
+    UvisorBoxIndex * send_index = UVISOR_GET_S_ALIAS(box_index(send_box_id));
+    uvisor_pool_slot_t slots[UVISOR_IPC_SLOTS_MAX];
+    size_t kept = 0;
+    size_t count;
+
+    /* Skip the send queue unless the box has sent something since the last
+     * drain. Clear the doorbell before draining, as sends queued from now on
+     * ring it again. */
+    if (!send_index->doorbells.queue[UVISOR_BOX_DOORBELL_IPC_SEND]) {
+#if UVISOR_DRAIN_STATS
+        g_ipc_drain_skipped++;
+#endif
+        return;
+    }
+    send_index->doorbells.queue[UVISOR_BOX_DOORBELL_IPC_SEND] = 0;
 
     /*
      * Verify that the send IPC structures are OK to use.
      */
-    uvisor_ipc_t * send_ipc = UVISOR_GET_S_ALIAS(uvisor_ipc(box_index(send_box_id)));
+    uvisor_ipc_t * send_ipc = UVISOR_GET_S_ALIAS(uvisor_ipc(send_index));
     if (!ipc_is_ok(send_box_id, send_ipc)) {
         /* This shouldn't happen in a non-malicious box. */
         return;
@@ -209,173 +474,85 @@ void ipc_drain_queue(void)
     }
 
     uvisor_ipc_io_t * send_array = send_ipc->send_queue.io;
-    if (!ipc_io_array_is_ok(send_box_id, send_array)) {
+    if (!ipc_io_array_is_ok(send_queue, send_array)) {
         /* This shouldn't happen in a non-malicious box. */
         return;
     }
 
     /*
-     * Loop over all outgoing messages for this box, looking for a matching
-     * receive in a destination box. If any matches are found, deliver the
-     * matching outgoing messages.
+     * Take all outgoing messages for this box out of the send queue in
+     * batches, looking for a matching receive in a destination box. If any
+     * matches are found, deliver the matching outgoing messages. The messages
+     * that can't be delivered now are kept at the start of the slots array,
+     * in queue order, until they are all put back at once.
      */
-    do {
-        uvisor_pool_slot_t send_slot;
-        uvisor_pool_slot_t recv_slot;
-
-        /* Get the first item in the send queue. */
-        send_slot = uvisor_pool_queue_try_dequeue_first(send_queue);
-        if (send_slot >= send_queue->pool->num) {
-            /* The queue is empty or busy. */
-            break;
-        }
-
-        /* If we have seen this slot before, stop processing the queue. */
-        if (first_slot == -1) {
-            first_slot = send_slot;
-        } else if (send_slot == first_slot) {
-            put_it_back(send_queue, send_slot);
-
-            /* Stop looping, because the system needs to continue running so
-             * the recv messages can get processed to free up more room. */
-            break;
-        }
-
-        /* Verify that the send IO request is OK to use. */
-        uvisor_ipc_io_t * send_io = &send_array[send_slot];
-        if (!ipc_io_is_ok(send_box_id, send_io)) {
-            /* The IO is not entirely within the send box. Ignore it, and don't
-             * put it back. This shouldn't happen in a non-malicious box. */
-            continue;
-        }
-
-        uvisor_ipc_desc_t * send_desc = send_io->desc;
-
-        /* Ready to send? */
-        if (send_io->state != UVISOR_IPC_IO_STATE_READY_TO_SEND) {
-            put_it_back(send_queue, send_slot);
-            continue; /* Try the next message */
-        }
-
-        /* Look up the receiving box. */
-        const int recv_box_id = send_desc->box_id;
-        if (recv_box_id < 0 || recv_box_id >= g_vmpu_box_count) {
-            /* Ignore messages sent to boxes we don't know. */
-            continue;
-        }
-
-        /*
-         * Verify that the receive IPC structures are OK to use.
-         */
-        uvisor_ipc_t * recv_ipc = UVISOR_GET_S_ALIAS(uvisor_ipc(box_index(recv_box_id)));
-        if (!ipc_is_ok(recv_box_id, recv_ipc)) {
-            /* This shouldn't happen in a non-malicious box. */
-            put_it_back(send_queue, send_slot);
-            continue; /* Try the next send IO. */
-        }
-
-        uvisor_pool_queue_t * recv_queue = &recv_ipc->recv_queue.queue;
-        if (!pool_queue_is_ok(recv_box_id, recv_queue)) {
-            /* This shouldn't happen in a non-malicious box. */
-            put_it_back(send_queue, send_slot);
-            continue; /* Try the next send IO. */
-        }
-
-        uvisor_ipc_io_t * recv_array = recv_ipc->recv_queue.io;
-        if (!ipc_io_array_is_ok(recv_box_id, recv_array)) {
-            /* This shouldn't happen in a non-malicious box. */
-            put_it_back(send_queue, send_slot);
-            continue; /* Try the next send IO. */
-        }
-
-        /* Find the first recv IO in the recv_queue that matches the port and
-         * allows from this sender. */
-        recv_match_context_t context = {send_box_id, send_io, recv_array};
-        recv_slot = uvisor_pool_queue_try_find_first(recv_queue, recv_match, &context);
-        /* Was a receive request available to match the send request? */
-        if (recv_slot >= recv_queue->pool->num) {
-            /* No recv request was available. Try the next send request. */
-            put_it_back(send_queue, send_slot);
-            continue;
-        }
-
-        recv_slot = uvisor_pool_queue_try_dequeue(recv_queue, recv_slot);
-        if (recv_slot >= recv_queue->pool->num) {
-            /* In between finding a recv slot and trying to dequeue it,
-             * somebody else dequeued it. */
-            put_it_back(send_queue, send_slot);
-            continue;
-        }
-
-        /* We have a send and receive request pair. Do the copying and updating
-         * of the descriptor, and clearing of the token. */
-        uvisor_ipc_io_t * recv_io = &recv_array[recv_slot];
-        if (!ipc_io_is_ok(recv_box_id, recv_io)) {
-            /* The IO is not entirely within the send box. Ignore it, and don't
-             * put it back. */
-            put_it_back(send_queue, send_slot);
-            continue;
+    while (kept < UVISOR_ARRAY_COUNT(slots) &&
+           (count = uvisor_pool_queue_try_dequeue_batch(send_queue, &slots[kept], UVISOR_ARRAY_COUNT(slots) - kept)) > 0) {
+        size_t end = kept + count;
+        size_t i;
+
+        for (i = kept; i < end; i++) {
+            uvisor_pool_slot_t send_slot = slots[i];
+            if (send_slot >= send_queue->pool->num) {
+                /* The queue is corrupted. Drop the slot. */
+                continue;
+            }
+
+            if (ipc_deliver_io(send_ipc, &send_array[send_slot], send_box_id, recv_box_only)) {
+                slots[kept++] = send_slot;
+                continue;
+            }
+
+            /* Free the send slot, as we have consumed the IO. */
+            if (uvisor_pool_queue_try_free(send_queue, send_slot) >= send_queue->pool->num) {
+                /* The pool is busy. This should never happen. We were able to
+                 * dequeue the send IO, but weren't able to free it. It is bad
+                 * to take down the entire system. It is also bad to never free
+                 * slots in the send queue. However, if we could dequeue the
+                 * slot we should have no trouble freeing the slot here. */
+                assert(false);
+            }
         }
+    }
 
-        if (ipc_deliver(send_ipc, recv_ipc, send_io, recv_io, send_box_id)) {
-            /* The message couldn't be delivered at this time. */
-            put_it_back(send_queue, send_slot);
-            put_it_back(recv_queue, recv_slot);
-            continue;
+    /* Put the undelivered messages back into the send queue, in their
+     * original order, so that they are retried on the next drain. */
+    if (kept) {
+        if (uvisor_pool_queue_try_enqueue_batch(send_queue, slots, kept)) {
+            /* We could dequeue the send IOs, but couldn't put them back. This
+             * shouldn't happen. */
+            assert(false);
         }
+        send_index->doorbells.queue[UVISOR_BOX_DOORBELL_IPC_SEND] = 1;
+    }
+}
 
-        /* We were able to send a message, so reset the first slot counter if
-         * we sent the first slot. */
-        if (first_slot == send_slot) {
-            first_slot = -1;
-        }
+void ipc_drain_queue(void)
+{
+    ipc_drain(-1);
+}
 
-#ifndef NDEBUG
-        uvisor_ipc_desc_t * recv_desc = recv_io->desc;
-#endif
-        DPRINTF("Delivered [b%d:s%d].t0x%08x to [b%d:s%d].t0x%08x\r\n", send_box_id, send_slot, send_desc->token, recv_box_id, recv_slot, recv_desc->token);
-
-        /* Free the slots, as we have consumed the IOs. */
-        send_slot = uvisor_pool_queue_try_free(send_queue, send_slot);
-        recv_slot = uvisor_pool_queue_try_free(recv_queue, recv_slot);
-        if ((send_slot >= send_queue->pool->num) ||
-            (recv_slot >= recv_queue->pool->num)) {
-            /* The queue is empty or busy. This should never happen. We were
-             * able to dequeue a result message, but weren't able to free the
-             * result message. It is bad to take down the entire system. It is
-             * also bad to never free slots in the outgoing result queue.
-             * However, if we could dequeue the slot we should have no trouble
-             * freeing the slot here. */
-            assert(false);
-        }
-    } while (1);
+void ipc_drain_queue_to(int recv_box)
+{
+    ipc_drain(recv_box);
 }
 
-void ipc_box_init(uint8_t box_id)
+void ipc_box_init(uint8_t box_id, UvisorBoxQueueSlots const * slots)
 {
     uvisor_ipc_t * ipc = UVISOR_GET_S_ALIAS(uvisor_ipc(box_index(box_id)));
-    uvisor_ipc_send_queue_t * send_queue = &ipc->send_queue;
-    uvisor_ipc_recv_queue_t * recv_queue = &ipc->recv_queue;
+    int i;
 
-    /* Initialize the IPC send queue. */
-    if (uvisor_pool_queue_init(&send_queue->queue,
-                               &send_queue->pool,
-                               send_queue->io,
-                               sizeof(*send_queue->io),
-                               UVISOR_IPC_SEND_SLOTS)) {
-        HALT_ERROR(NOT_ALLOWED, "Failed to init IPC send queue");
-    }
-
-    /* Initialize the IPC receive queue. */
-    if (uvisor_pool_queue_init(&recv_queue->queue,
-                               &recv_queue->pool,
-                               recv_queue->io,
-                               sizeof(*recv_queue->io),
-                               UVISOR_IPC_RECV_SLOTS)) {
-        HALT_ERROR(NOT_ALLOWED, "Failed to init IPC recv queue");
+    /* Initialize the IPC send and receive queues. */
+    if (uvisor_ipc_queues_init(ipc, slots)) {
+        HALT_ERROR(NOT_ALLOWED, "Failed to init IPC queues");
     }
 
     uvisor_spin_init(&ipc->tokens_lock);
-    ipc->allocated_tokens = 0;
-    ipc->completed_tokens = 0;
+    uvisor_ipc_tokens_clear(&ipc->allocated_tokens);
+    uvisor_ipc_tokens_clear(&ipc->completed_tokens);
+
+    /* The semaphores of the waiters are initialized by the box itself. */
+    for (i = 0; i < UVISOR_IPC_WAITER_SLOTS; i++) {
+        uvisor_ipc_tokens_clear(&ipc->waiters[i].tokens);
+    }
 }
@@ -17,6 +17,7 @@
 #include <uvisor.h>
 #include "debug.h"
 #include "page_allocator.h"
+#include "rpc.h"
 #if defined(ARCH_CORE_ARMv7M)
 #include "priv_sys_hooks.h"
 #endif /* defined(ARCH_CORE_ARMv7M) */
@@ -49,6 +50,11 @@ UVISOR_NOINLINE void uvisor_init_post(void)
     /* Initialize the page allocator. */
     page_allocator_init(__uvisor_config.page_start, __uvisor_config.page_end, __uvisor_config.page_size);
 
+#if UVISOR_RPC_STATS
+    /* Start the timer the RPC latencies are measured with. */
+    UVISOR_RPC_STATS_TIMER_INIT();
+#endif
+
 #if defined(ARCH_CORE_ARMv7M)
     /* Initialize the SVCall interface. */
     svc_init();
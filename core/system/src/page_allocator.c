@@ -25,6 +25,7 @@
 #include "page_allocator_faults.h"
 #include "vmpu_unpriv_access.h"
 #include "vmpu.h"
+#include "vmpu_mpu.h"
 #include "halt.h"
 #include "context.h"
 
@@ -36,7 +37,6 @@
  * SVC call, which automagically serializes access to it. */
 #define UVISOR_PAGE_ALLOCATOR_MUTEX_AQUIRE  {}
 #define UVISOR_PAGE_ALLOCATOR_MUTEX_RELEASE {}
-#define UVISOR_PAGE_UNUSED UVISOR_BOX_ID_INVALID
 
 #endif /* defined(UVISOR_PRESENT) && (UVISOR_PRESENT == 1) */
 
@@ -44,8 +44,26 @@
 
 /* Contains the page usage mapped by owner. */
 uint32_t g_page_owner_map[UVISOR_MAX_BOXES][UVISOR_PAGE_MAP_COUNT];
+/* Contains the pages shared with each box by other boxes. */
+uint32_t g_page_shared_map[UVISOR_MAX_BOXES][UVISOR_PAGE_MAP_COUNT];
+/* Contains the pages shared with each box for reading only. */
+uint32_t g_page_read_only_map[UVISOR_MAX_BOXES][UVISOR_PAGE_MAP_COUNT];
+/* Contains the pages shared with each box only for the duration of an RPC. */
+static uint32_t g_page_granted_map[UVISOR_MAX_BOXES][UVISOR_PAGE_MAP_COUNT];
+/* Number of pages shared with other boxes, counted once per box. */
+static uint32_t g_page_count_shared;
 /* Contains total page usage. */
 uint32_t g_page_usage_map[UVISOR_PAGE_MAP_COUNT];
+/* Contains one bit for each word of the page usage map without free pages. */
+uint32_t g_page_usage_summary[UVISOR_PAGE_SUMMARY_COUNT];
+/* Contains the free pages that have not been zeroed since they were freed. */
+uint32_t g_page_dirty_map[UVISOR_PAGE_MAP_COUNT];
+/* Contains the number of free pages that have not been zeroed. */
+page_index_t g_page_count_dirty;
+/* Contains the number of pages handed out that had been zeroed in advance. */
+uint32_t g_page_count_prezeroed;
+/* Contains the number of pages zeroed while handing them out. */
+uint32_t g_page_count_zeroed_sync;
 /* Contains the configured page size. */
 uint32_t g_page_size;
 /* Points to the beginning of the page heap. */
@@ -53,16 +71,18 @@ const void * g_page_heap_start;
 /* Points to the end of the page heap. */
 const void * g_page_heap_end;
 /* Contains the number of free pages. */
-uint8_t g_page_count_free;
+page_index_t g_page_count_free;
+/* Contains the number of pages owned by each box. */
+page_index_t g_page_count_owned[UVISOR_MAX_BOXES];
 /* Contains the total number of available pages. */
-uint8_t g_page_count_total;
+page_index_t g_page_count_total;
 /* Contains the shift of the page owner mask. */
-uint8_t g_page_map_shift;
+page_index_t g_page_map_shift;
 /* Contains the rounded up page end address for ARMv7-M MPU region alignment. */
 uint32_t g_page_head_end_rounded;
 
 /* Helper function maps pointer to page id, or UVISOR_PAGE_UNUSED. */
-uint8_t page_allocator_get_page_from_address(uint32_t address)
+page_index_t page_allocator_get_page_from_address(uint32_t address)
 {
     /* Range check the returned pointer. */
     if (address < (uint32_t) g_page_heap_start || address >= (uint32_t) g_page_heap_end) {
@@ -72,6 +92,284 @@ uint8_t page_allocator_get_page_from_address(uint32_t address)
     return (address - (uint32_t) g_page_heap_start) / g_page_size;
 }
 
+/* Helper function returns the mask of the bits in a word of a bitmap that lie
+ * between the first and one past the last bit given. */
+static inline uint32_t page_allocator_map_word_mask(uint32_t word, uint32_t first_bit, uint32_t last_bit)
+{
+    const uint32_t low = (first_bit > word * 32) ? (first_bit - word * 32) : 0;
+    const uint32_t high = (last_bit - word * 32 >= 32) ? 32 : (last_bit - word * 32);
+    const uint32_t high_mask = (high == 32) ? 0xFFFFFFFFUL : ((1UL << high) - 1);
+    return high_mask & ~((1UL << low) - 1);
+}
+
+/* Helper function marks the usage map word of a page as having free pages. */
+static inline void page_allocator_summary_clear(page_index_t page)
+{
+    const uint32_t word = (page + g_page_map_shift) / 32;
+    g_page_usage_summary[word / 32] &= ~(1UL << (word % 32));
+}
+
+/* Page placement preferences, in the order in which they are tried.
+ * On ARMv7-M only one octet of the page map (8 pages) is mapped into the MPU
+ * at a time, so the pages visible to a box are clustered into as few octets as
+ * possible. */
+typedef enum {
+    /* Octets that already contain pages visible to the box. */
+    PAGE_PLACEMENT_OWNED_OCTET = 0,
+    /* Octets without any used pages. */
+    PAGE_PLACEMENT_EMPTY_OCTET,
+    /* Any free page. */
+    PAGE_PLACEMENT_ANY,
+    PAGE_PLACEMENT_COUNT
+} PagePlacement;
+
+/* Helper function sets all the bits of each non-zero octet of a word. */
+static inline uint32_t page_allocator_octet_mask(uint32_t bits)
+{
+    bits |= (bits >> 4) & 0x0F0F0F0FUL;
+    bits |= (bits >> 2) & 0x03030303UL;
+    bits |= (bits >> 1) & 0x01010101UL;
+    return (bits & 0x01010101UL) * 0xFF;
+}
+
+/* Helper function returns the free pages of a usage map word. */
+static inline uint32_t page_allocator_free_mask(uint32_t word)
+{
+    const uint32_t first_bit = g_page_map_shift;
+    const uint32_t last_bit = g_page_map_shift + g_page_count_total;
+    return ~g_page_usage_map[word] & page_allocator_map_word_mask(word, first_bit, last_bit);
+}
+
+/* Helper function returns the free pages of a usage map word that satisfy a
+ * placement preference for a box. */
+static inline uint32_t page_allocator_placement_mask(uint32_t word, page_owner_t box_id, PagePlacement placement)
+{
+    const uint32_t free_mask = page_allocator_free_mask(word);
+    switch (placement) {
+        case PAGE_PLACEMENT_OWNED_OCTET:
+            return free_mask & page_allocator_octet_mask(g_page_owner_map[box_id][word]);
+        case PAGE_PLACEMENT_EMPTY_OCTET:
+            return free_mask & ~page_allocator_octet_mask(g_page_usage_map[word]);
+        default:
+            return free_mask;
+    }
+}
+
+/* Helper function claims up to count pages out of a usage map word for a box,
+ * and writes their addresses to the page table. Pages that have been zeroed in
+ * advance are claimed first, otherwise pages are claimed in ascending order.
+ * @returns the number of pages claimed */
+static uint32_t page_allocator_claim_pages(uint32_t word, uint32_t mask, uint32_t count, page_owner_t box_id,
+                                           void * * page_table)
+{
+    uint32_t clean_mask = mask & ~g_page_dirty_map[word];
+    uint32_t dirty_mask = mask & g_page_dirty_map[word];
+    uint32_t claimed_mask = 0;
+    uint32_t claimed = 0;
+    for (; (clean_mask | dirty_mask) && (claimed < count); claimed++) {
+        uint32_t * const next_mask = clean_mask ? &clean_mask : &dirty_mask;
+        const uint32_t bit = __builtin_ctz(*next_mask);
+        const page_index_t page = word * 32 + bit - g_page_map_shift;
+        /* Remember this page as claimed and move on to the next one. */
+        claimed_mask |= (1UL << bit);
+        *next_mask &= *next_mask - 1;
+        /* Reset the fault count for this page. */
+        page_allocator_reset_faults(page);
+        /* Get the pointer to the page. */
+        void * ptr = (void *) g_page_heap_start + page * g_page_size;
+        /* Zero the entire page before handing it out, unless that was already
+         * done in advance. */
+        if (next_mask == &dirty_mask) {
+            memset(ptr, 0, g_page_size);
+            g_page_count_zeroed_sync++;
+            g_page_count_dirty--;
+        } else {
+            g_page_count_prezeroed++;
+        }
+        /* Write the pages address to the table in the first page. */
+        page_table_write((uint32_t) &page_table[claimed], (uint32_t) ptr);
+        DPRINTF("uvisor_page_malloc: Found an empty page 0x%08x entry at index %u\n", (unsigned int) ptr, page);
+    }
+    if (!claimed_mask) {
+        return 0;
+    }
+
+    /* Remember the claimed pages as used. */
+    g_page_usage_map[word] |= claimed_mask;
+    g_page_dirty_map[word] &= ~claimed_mask;
+    /* Skip this word in future searches if it has no free pages left. */
+    if (!page_allocator_free_mask(word)) {
+        g_page_usage_summary[word / 32] |= (1UL << (word % 32));
+    }
+    /* Pages of box 0 are accessible to all other boxes! */
+    if (box_id == 0) {
+        uint32_t ii = 0;
+        for (; ii < UVISOR_MAX_BOXES; ii++) {
+            g_page_owner_map[ii][word] |= claimed_mask;
+        }
+    } else {
+        /* Otherwise, remember ownership only for active box. */
+        g_page_owner_map[box_id][word] |= claimed_mask;
+    }
+    g_page_count_owned[box_id] += claimed;
+    return claimed;
+}
+
+/* Helper function checks if a page is owned by a box, as opposed to being
+ * shared with it by another box, or being a page of box 0. */
+static int page_allocator_is_owner(page_owner_t box_id, page_index_t page)
+{
+    if (!page_allocator_map_get(g_page_owner_map[box_id], page) ||
+        page_allocator_map_get(g_page_shared_map[box_id], page)) {
+        return 0;
+    }
+    /* Pages of box 0 are visible to all other boxes, but only box 0 owns them. */
+    return (box_id == 0) ||
+           !page_allocator_map_get(g_page_owner_map[0], page) ||
+           page_allocator_map_get(g_page_shared_map[0], page);
+}
+
+/* Helper function removes a page from a box it is shared with. */
+static void page_allocator_unshare(page_owner_t box_id, page_index_t page)
+{
+    if (page_allocator_map_get(g_page_shared_map[box_id], page)) {
+        page_allocator_map_clear(g_page_owner_map[box_id], page);
+        page_allocator_map_clear(g_page_shared_map[box_id], page);
+        page_allocator_map_clear(g_page_read_only_map[box_id], page);
+        page_allocator_map_clear(g_page_granted_map[box_id], page);
+        g_page_count_shared--;
+    }
+}
+
+/* Helper function checks that all the pages of a page table are owned by a
+ * box.
+ * @returns Non-zero on failure with failure class `UVISOR_ERROR_CLASS_PAGE`. See `UVISOR_ERROR_PAGE_*`. */
+static int page_allocator_check_table(const UvisorPageTable * const table, page_owner_t box_id, uint32_t * const page_count)
+{
+    *page_count = page_table_read((uint32_t) &(table->page_count));
+    uint32_t page_size = page_table_read((uint32_t) &(table->page_size));
+    if (page_size != g_page_size) {
+        DPRINTF("uvisor_page_share: FAIL: Requested page size %uB is not the configured page size %uB!\n\n", page_size, g_page_size);
+        return UVISOR_ERROR_PAGE_INVALID_PAGE_SIZE;
+    }
+    if (*page_count == 0) {
+        DPRINTF("uvisor_page_share: FAIL: Pointer table is empty!\n\n");
+        return UVISOR_ERROR_PAGE_INVALID_PAGE_COUNT;
+    }
+    if (*page_count > (unsigned) (g_page_count_total - g_page_count_free)) {
+        DPRINTF("uvisor_page_share: FAIL: Pointer table too large!\n\n");
+        return UVISOR_ERROR_PAGE_INVALID_PAGE_TABLE;
+    }
+
+    void * const * page_table = &(table->page_origins[0]);
+    uint32_t ii = 0;
+    for (; ii < *page_count; ii++) {
+        void * page = (void *) page_table_read((uint32_t) &page_table[ii]);
+        page_index_t page_index = page_allocator_get_page_from_address((uint32_t) page);
+        if (page_index == UVISOR_PAGE_UNUSED) {
+            DPRINTF("uvisor_page_share: FAIL: Pointer 0x%08x does not belong to any page!\n\n", (unsigned int) page);
+            return UVISOR_ERROR_PAGE_INVALID_PAGE_ORIGIN;
+        }
+        if (!page_allocator_is_owner(box_id, page_index)) {
+            DPRINTF("uvisor_page_share: FAIL: Page %u is not owned by box %u!\n\n", page_index, box_id);
+            return UVISOR_ERROR_PAGE_INVALID_PAGE_OWNER;
+        }
+    }
+    return UVISOR_ERROR_PAGE_OK;
+}
+
+/* Helper function checks if any pages are visible to a box. */
+static inline int page_allocator_box_has_pages(page_owner_t box_id)
+{
+    return g_page_count_owned[box_id] || g_page_count_owned[0];
+}
+
+/* Helper function returns the index of the first usage map word at or after
+ * the given one that has free pages, or the number of words in use if there
+ * is none. */
+static uint32_t page_allocator_next_free_word(uint32_t word)
+{
+    const uint32_t last_word = (g_page_map_shift + g_page_count_total + 31) / 32;
+    while (word < last_word) {
+        const uint32_t summary = word / 32;
+        const uint32_t not_full = ~g_page_usage_summary[summary] & ~((1UL << (word % 32)) - 1);
+        if (not_full) {
+            word = summary * 32 + __builtin_ctz(not_full);
+            break;
+        }
+        word = (summary + 1) * 32;
+    }
+    return (word < last_word) ? word : last_word;
+}
+
+/* Helper function finds the octet of the page map in which all of a small
+ * allocation fits best, preferring octets with pages visible to the box over
+ * empty ones. Among the octets visible to the box, the one with the most
+ * page faults is preferred if UVISOR_PAGE_FAULT_HINT is enabled, as that is
+ * the window the box uses most.
+ * @returns the mask of the octet's free pages in its usage map word, or 0 if
+ *          there is no octet with enough free pages */
+static uint32_t page_allocator_find_octet(page_owner_t box_id, uint32_t count, uint32_t * const found_word)
+{
+    const uint32_t last_word = (g_page_map_shift + g_page_count_total + 31) / 32;
+    const int has_pages = page_allocator_box_has_pages(box_id);
+    uint32_t best_mask = 0;
+    uint32_t best_score = 0;
+
+    uint32_t word = page_allocator_next_free_word(g_page_map_shift / 32);
+    for (; word < last_word; word = page_allocator_next_free_word(word + 1)) {
+        const uint32_t owned_octets = page_allocator_octet_mask(g_page_owner_map[box_id][word]);
+        /* Once an empty octet was found, only visible octets can beat it. */
+        if (!owned_octets && best_score) {
+            continue;
+        }
+        const uint32_t used_octets = page_allocator_octet_mask(g_page_usage_map[word]);
+        /* Skip words without visible or empty octets. */
+        if (!owned_octets && !~used_octets) {
+            continue;
+        }
+        const uint32_t free_mask = page_allocator_free_mask(word);
+        uint32_t octet = 0;
+        for (; octet < 32; octet += 8) {
+            const uint32_t octet_mask = free_mask & (0xFFUL << octet);
+            if ((uint32_t) __builtin_popcount(octet_mask) < count) {
+                continue;
+            }
+            /* Score the octet. Visible octets always beat empty ones. */
+            uint32_t score;
+            if (owned_octets & (1UL << octet)) {
+                score = 2;
+#if UVISOR_PAGE_FAULT_HINT
+                uint32_t owned_mask = g_page_owner_map[box_id][word] & (0xFFUL << octet);
+                for (; owned_mask; owned_mask &= owned_mask - 1) {
+                    score += page_allocator_get_faults(word * 32 + __builtin_ctz(owned_mask) - g_page_map_shift);
+                }
+#else
+                /* The first visible octet cannot be beaten. */
+                *found_word = word;
+                return octet_mask;
+#endif /* UVISOR_PAGE_FAULT_HINT */
+            } else if (!(used_octets & (1UL << octet))) {
+                /* Without visible pages, the first empty octet cannot be
+                 * beaten. */
+                if (!has_pages) {
+                    *found_word = word;
+                    return octet_mask;
+                }
+                score = 1;
+            } else {
+                continue;
+            }
+            if (score > best_score) {
+                best_score = score;
+                best_mask = octet_mask;
+                *found_word = word;
+            }
+        }
+    }
+    return best_mask;
+}
+
 void page_allocator_init(void * const heap_start, void * const heap_end, const uint32_t * const page_size)
 {
     if (!page_size || !vmpu_public_flash_addr((uint32_t) page_size)) {
@@ -114,19 +412,21 @@ void page_allocator_init(void * const heap_start, void * const heap_end, const u
     g_page_heap_start = (void *) start;
 
     /* How many pages can we fit in here? */
+    uint32_t page_count;
     if (start > (0xFFFFFFFFUL - g_page_size) || (start + g_page_size) > (uint32_t) heap_end) {
-        g_page_count_total = 0;
+        page_count = 0;
     } else {
-        g_page_count_total = ((uint32_t) heap_end - start) / g_page_size;
+        page_count = ((uint32_t) heap_end - start) / g_page_size;
     }
     /* Clamp page count to table size. */
-    if (g_page_count_total > UVISOR_PAGE_MAX_COUNT) {
-        DPRINTF("uvisor_page_init: Clamping available page count from %u to %u!\n", g_page_count_total, UVISOR_PAGE_MAX_COUNT);
+    if (page_count > UVISOR_PAGE_MAX_COUNT) {
+        DPRINTF("uvisor_page_init: Clamping available page count from %u to %u!\n", page_count, UVISOR_PAGE_MAX_COUNT);
         /* Move the heap start address forward so that the last clamped page is located nearest to the heap end. */
-        g_page_heap_start += (g_page_count_total - UVISOR_PAGE_MAX_COUNT) * g_page_size;
+        g_page_heap_start += (page_count - UVISOR_PAGE_MAX_COUNT) * g_page_size;
         /* Clamp the page count. */
-        g_page_count_total = UVISOR_PAGE_MAX_COUNT;
+        page_count = UVISOR_PAGE_MAX_COUNT;
     }
+    g_page_count_total = page_count;
     g_page_count_free = g_page_count_total;
     /* Remember the end of the heap. */
     g_page_heap_end = g_page_heap_start + g_page_count_total * g_page_size;
@@ -148,7 +448,24 @@ void page_allocator_init(void * const heap_start, void * const heap_end, const u
 
     /* Force a reset of owner and usage page maps. */
     memset(g_page_owner_map, 0, sizeof(g_page_owner_map));
+    memset(g_page_shared_map, 0, sizeof(g_page_shared_map));
+    memset(g_page_read_only_map, 0, sizeof(g_page_read_only_map));
+    memset(g_page_granted_map, 0, sizeof(g_page_granted_map));
+    g_page_count_shared = 0;
     memset(g_page_usage_map, 0, sizeof(g_page_usage_map));
+    memset(g_page_usage_summary, 0, sizeof(g_page_usage_summary));
+    memset(g_page_count_owned, 0, sizeof(g_page_count_owned));
+
+    /* The initial content of all pages is unknown. */
+    const uint32_t first_bit = g_page_map_shift;
+    const uint32_t last_bit = g_page_map_shift + g_page_count_total;
+    uint32_t word = 0;
+    for (; word < UVISOR_PAGE_MAP_COUNT; word++) {
+        g_page_dirty_map[word] = (word * 32 < last_bit) ? page_allocator_map_word_mask(word, first_bit, last_bit) : 0;
+    }
+    g_page_count_dirty = g_page_count_total;
+    g_page_count_prezeroed = 0;
+    g_page_count_zeroed_sync = 0;
 }
 
 int page_allocator_malloc(UvisorPageTable * const table)
@@ -184,35 +501,31 @@ int page_allocator_malloc(UvisorPageTable * const table)
     /* Point to the first entry in the table. */
     void * * page_table = &(table->page_origins[0]);
 
-    /* Iterate through the page table and find the empty pages. */
-    uint32_t page = 0;
-    for (; (page < g_page_count_total) && pages_required; page++) {
-        /* If the page is unused, map_get returns zero. */
-        if (!page_allocator_map_get(g_page_usage_map, page)) {
-            /* Remember this page as used. */
-            page_allocator_map_set(g_page_usage_map, page);
-            /* Pages of box 0 are accessible to all other boxes! */
-            if (box_id == 0) {
-                uint32_t ii = 0;
-                for (; ii < UVISOR_MAX_BOXES; ii++) {
-                    page_allocator_map_set(g_page_owner_map[ii], page);
-                }
-            } else {
-                /* Otherwise, remember ownership only for active box. */
-                page_allocator_map_set(g_page_owner_map[box_id], page);
-            }
-            /* Reset the fault count for this page. */
-            page_allocator_reset_faults(page);
-            /* Get the pointer to the page. */
-            void * ptr = (void *) g_page_heap_start + page * g_page_size;
-            /* Zero the entire page before handing it out. */
-            memset(ptr, 0, g_page_size);
-            /* Write the pages address to the table in the first page. */
-            page_table_write((uint32_t) page_table, (uint32_t) ptr);
-            page_table++;
-            /* One less page required. */
-            pages_required--;
-            DPRINTF("uvisor_page_malloc: Found an empty page 0x%08x entry at index %u\n", (unsigned int) ptr, page);
+    /* Try to fit small allocations into a single octet of the page map first,
+     * so that they can be covered by a single MPU window. */
+    if (pages_required <= 8) {
+        uint32_t word;
+        const uint32_t mask = page_allocator_find_octet(box_id, pages_required, &word);
+        if (mask) {
+            const uint32_t claimed = page_allocator_claim_pages(word, mask, pages_required, box_id, page_table);
+            page_table += claimed;
+            pages_required -= claimed;
+        }
+    }
+
+    /* Otherwise, spread the pages with decreasing placement preference.
+     * The usage summary is used to skip the words of the usage map without
+     * free pages, and all the pages found in a word are claimed at once. */
+    const uint32_t last_word = (g_page_map_shift + g_page_count_total + 31) / 32;
+    /* There are no visible octets to prefer if the box sees no pages. */
+    PagePlacement placement = page_allocator_box_has_pages(box_id) ? PAGE_PLACEMENT_OWNED_OCTET : PAGE_PLACEMENT_EMPTY_OCTET;
+    for (; (placement < PAGE_PLACEMENT_COUNT) && pages_required; placement++) {
+        uint32_t word = page_allocator_next_free_word(g_page_map_shift / 32);
+        for (; (word < last_word) && pages_required; word = page_allocator_next_free_word(word + 1)) {
+            const uint32_t mask = page_allocator_placement_mask(word, box_id, placement);
+            const uint32_t claimed = page_allocator_claim_pages(word, mask, pages_required, box_id, page_table);
+            page_table += claimed;
+            pages_required -= claimed;
         }
     }
     DPRINTF("uvisor_page_malloc: %u free pages remaining.\n\n", g_page_count_free);
@@ -249,6 +562,10 @@ int page_allocator_free(const UvisorPageTable * const table)
 
     /* Get the calling box id. */
     const page_owner_t box_id = g_active_box;
+    /* The freed pages may still be mapped by the MPU for the calling box, which
+     * could then keep writing to them after they have been zeroed. The pages
+     * that remain are faulted back in. */
+    vmpu_mpu_invalidate_pages();
     /* Iterate over the table and validate each pointer. */
     void * const * page_table = &(table->page_origins[0]);
 
@@ -256,7 +573,7 @@ int page_allocator_free(const UvisorPageTable * const table)
     for (; table_size > 0; page_table++, table_size--) {
         void * page = (void *) page_table_read((uint32_t) page_table);
         /* Compute the index for the pointer. */
-        uint8_t page_index = page_allocator_get_page_from_address((uint32_t) page);
+        page_index_t page_index = page_allocator_get_page_from_address((uint32_t) page);
         /* Range check the returned pointer. */
         if (page_index == UVISOR_PAGE_UNUSED) {
             DPRINTF("uvisor_page_free: FAIL: Pointer 0x%08x does not belong to any page!\n\n", (unsigned int) page);
@@ -264,9 +581,21 @@ int page_allocator_free(const UvisorPageTable * const table)
             return UVISOR_ERROR_PAGE_INVALID_PAGE_ORIGIN;
         }
         /* Check if the page belongs to the caller. */
-        if (page_allocator_map_get(g_page_owner_map[box_id], page_index)) {
+        if (page_allocator_is_owner(box_id, page_index)) {
+            /* Take the page away from the boxes it is shared with. */
+            if (g_page_count_shared) {
+                uint32_t jj = 0;
+                for (; jj < UVISOR_MAX_BOXES; jj++) {
+                    page_allocator_unshare(jj, page_index);
+                }
+            }
             /* Clear the owner and usage page maps for this page. */
             page_allocator_map_clear(g_page_usage_map, page_index);
+            page_allocator_summary_clear(page_index);
+            /* The page needs to be zeroed before it is handed out again. */
+            page_allocator_map_set(g_page_dirty_map, page_index);
+            g_page_count_dirty++;
+            g_page_count_owned[box_id]--;
             /* If the page was owned by box 0, we need to remove it from all other boxes! */
             if (box_id == 0) {
                 uint32_t ii = 0;
@@ -296,3 +625,266 @@ int page_allocator_free(const UvisorPageTable * const table)
     UVISOR_PAGE_ALLOCATOR_MUTEX_RELEASE;
     return UVISOR_ERROR_PAGE_OK;
 }
+
+int page_allocator_clean(uint32_t max_pages)
+{
+    UVISOR_PAGE_ALLOCATOR_MUTEX_AQUIRE;
+    /* Bound the time spent in here, independently of the caller. */
+    if (max_pages > UVISOR_PAGE_CLEAN_MAX_COUNT) {
+        max_pages = UVISOR_PAGE_CLEAN_MAX_COUNT;
+    }
+
+    const uint32_t last_word = (g_page_map_shift + g_page_count_total + 31) / 32;
+    uint32_t word = page_allocator_next_free_word(g_page_map_shift / 32);
+    for (; (word < last_word) && max_pages && g_page_count_dirty; word = page_allocator_next_free_word(word + 1)) {
+        uint32_t dirty_mask = g_page_dirty_map[word] & ~g_page_usage_map[word];
+        for (; dirty_mask && max_pages; max_pages--) {
+            const uint32_t bit = __builtin_ctz(dirty_mask);
+            const page_index_t page = word * 32 + bit - g_page_map_shift;
+            dirty_mask &= dirty_mask - 1;
+            memset((void *) g_page_heap_start + page * g_page_size, 0, g_page_size);
+            g_page_dirty_map[word] &= ~(1UL << bit);
+            g_page_count_dirty--;
+        }
+    }
+
+    const int remaining = g_page_count_dirty;
+    UVISOR_PAGE_ALLOCATOR_MUTEX_RELEASE;
+    return remaining;
+}
+
+int page_allocator_get_stats(UvisorPageStats * const stats)
+{
+    UVISOR_PAGE_ALLOCATOR_MUTEX_AQUIRE;
+    page_table_write((uint32_t) &(stats->free_count), g_page_count_free);
+    page_table_write((uint32_t) &(stats->dirty_count), g_page_count_dirty);
+    page_table_write((uint32_t) &(stats->prezeroed_count), g_page_count_prezeroed);
+    page_table_write((uint32_t) &(stats->zeroed_sync_count), g_page_count_zeroed_sync);
+    UVISOR_PAGE_ALLOCATOR_MUTEX_RELEASE;
+    return UVISOR_ERROR_PAGE_OK;
+}
+
+int page_allocator_share(const UvisorPageTable * const table, int dst_box, uint32_t acl)
+{
+    UVISOR_PAGE_ALLOCATOR_MUTEX_AQUIRE;
+    /* Get the calling box id. */
+    const page_owner_t box_id = g_active_box;
+    /* The pages of box 0 are already visible to all boxes. */
+    if (box_id == 0 || dst_box == box_id || !vmpu_is_box_id_valid(dst_box)) {
+        DPRINTF("uvisor_page_share: FAIL: Cannot share pages of box %u with box %i!\n\n", box_id, dst_box);
+        UVISOR_PAGE_ALLOCATOR_MUTEX_RELEASE;
+        return UVISOR_ERROR_PAGE_INVALID_BOX_ID;
+    }
+    /* Pages can be shared for reading, or for reading and writing. */
+    if (!(acl & UVISOR_TACL_UREAD) || (acl & ~(UVISOR_TACL_UREAD | UVISOR_TACL_UWRITE)) ||
+        (!UVISOR_PAGE_SHARE_READ_ONLY && !(acl & UVISOR_TACL_UWRITE))) {
+        DPRINTF("uvisor_page_share: FAIL: Pages cannot be shared with ACL 0x%08x!\n\n", (unsigned int) acl);
+        UVISOR_PAGE_ALLOCATOR_MUTEX_RELEASE;
+        return UVISOR_ERROR_PAGE_INVALID_ACL;
+    }
+
+    /* Only share the pages if all of them belong to the caller. */
+    uint32_t page_count;
+    int error = page_allocator_check_table(table, box_id, &page_count);
+    if (error) {
+        UVISOR_PAGE_ALLOCATOR_MUTEX_RELEASE;
+        return error;
+    }
+
+    void * const * page_table = &(table->page_origins[0]);
+    uint32_t ii = 0;
+    for (; ii < page_count; ii++) {
+        page_index_t page = page_allocator_get_page_from_address(page_table_read((uint32_t) &page_table[ii]));
+        if (!page_allocator_map_get(g_page_shared_map[dst_box], page)) {
+            page_allocator_map_set(g_page_owner_map[dst_box], page);
+            page_allocator_map_set(g_page_shared_map[dst_box], page);
+            g_page_count_shared++;
+        }
+        if (acl & UVISOR_TACL_UWRITE) {
+            page_allocator_map_clear(g_page_read_only_map[dst_box], page);
+        } else {
+            page_allocator_map_set(g_page_read_only_map[dst_box], page);
+        }
+        DPRINTF("uvisor_page_share: Sharing page %u of box %u with box %i\n", page, box_id, dst_box);
+    }
+
+    UVISOR_PAGE_ALLOCATOR_MUTEX_RELEASE;
+    return UVISOR_ERROR_PAGE_OK;
+}
+
+int page_allocator_revoke(const UvisorPageTable * const table, int dst_box)
+{
+    UVISOR_PAGE_ALLOCATOR_MUTEX_AQUIRE;
+    /* Get the calling box id. */
+    const page_owner_t box_id = g_active_box;
+    if (dst_box == box_id || !vmpu_is_box_id_valid(dst_box)) {
+        DPRINTF("uvisor_page_revoke: FAIL: Cannot revoke pages of box %u from box %i!\n\n", box_id, dst_box);
+        UVISOR_PAGE_ALLOCATOR_MUTEX_RELEASE;
+        return UVISOR_ERROR_PAGE_INVALID_BOX_ID;
+    }
+
+    /* Only revoke the pages if all of them belong to the caller. */
+    uint32_t page_count;
+    int error = page_allocator_check_table(table, box_id, &page_count);
+    if (error) {
+        UVISOR_PAGE_ALLOCATOR_MUTEX_RELEASE;
+        return error;
+    }
+
+    void * const * page_table = &(table->page_origins[0]);
+    uint32_t ii = 0;
+    for (; ii < page_count; ii++) {
+        page_index_t page = page_allocator_get_page_from_address(page_table_read((uint32_t) &page_table[ii]));
+        /* Pages that were not shared with the box are ignored. */
+        page_allocator_unshare(dst_box, page);
+    }
+
+    UVISOR_PAGE_ALLOCATOR_MUTEX_RELEASE;
+    return UVISOR_ERROR_PAGE_OK;
+}
+
+/* Helper function checks that the buffer lies in a single page of one box
+ * that can be granted to another box with the given ACL, and returns the page.
+ * @returns Non-zero on failure with failure class `UVISOR_ERROR_CLASS_PAGE`. See `UVISOR_ERROR_PAGE_*`. */
+static int page_allocator_check_grant_page(int src_box, int dst_box, uint32_t address, uint32_t size, uint32_t acl,
+                                           page_index_t * const page)
+{
+    *page = page_allocator_get_page_from_address(address);
+    if (*page == UVISOR_PAGE_UNUSED || size == 0 || address + size - 1 < address ||
+        page_allocator_get_page_from_address(address + size - 1) != *page) {
+        return UVISOR_ERROR_PAGE_INVALID_PAGE_ORIGIN;
+    }
+    /* The pages of box 0 are already visible to all boxes. */
+    if (src_box == 0 || src_box == dst_box || !page_allocator_is_owner(src_box, *page)) {
+        return UVISOR_ERROR_PAGE_INVALID_PAGE_OWNER;
+    }
+    /* A page the box shared for good must already allow the requested
+     * access. */
+    if (page_allocator_map_get(g_page_shared_map[dst_box], *page) &&
+        !page_allocator_map_get(g_page_granted_map[dst_box], *page) &&
+        (acl & UVISOR_TACL_UWRITE) && page_allocator_map_get(g_page_read_only_map[dst_box], *page)) {
+        return UVISOR_ERROR_PAGE_INVALID_ACL;
+    }
+    return UVISOR_ERROR_PAGE_OK;
+}
+
+int page_allocator_check_grant(int src_box, int dst_box, uint32_t address, uint32_t size, uint32_t acl)
+{
+    UVISOR_PAGE_ALLOCATOR_MUTEX_AQUIRE;
+    page_index_t page;
+    int error = page_allocator_check_grant_page(src_box, dst_box, address, size, acl, &page);
+    UVISOR_PAGE_ALLOCATOR_MUTEX_RELEASE;
+    return error;
+}
+
+int page_allocator_grant(int src_box, int dst_box, uint32_t address, uint32_t size, uint32_t acl)
+{
+    UVISOR_PAGE_ALLOCATOR_MUTEX_AQUIRE;
+    page_index_t page;
+    int error = page_allocator_check_grant_page(src_box, dst_box, address, size, acl, &page);
+    if (error) {
+        UVISOR_PAGE_ALLOCATOR_MUTEX_RELEASE;
+        return error;
+    }
+
+    /* A page the box shared for good is left alone. */
+    if (page_allocator_map_get(g_page_shared_map[dst_box], page) &&
+        !page_allocator_map_get(g_page_granted_map[dst_box], page)) {
+        UVISOR_PAGE_ALLOCATOR_MUTEX_RELEASE;
+        return UVISOR_ERROR_PAGE_OK;
+    }
+
+    /* Several RPCs may grant the same page, so the access is only ever
+     * widened here. */
+    if (!page_allocator_map_get(g_page_granted_map[dst_box], page)) {
+        page_allocator_map_set(g_page_owner_map[dst_box], page);
+        page_allocator_map_set(g_page_shared_map[dst_box], page);
+        page_allocator_map_set(g_page_granted_map[dst_box], page);
+        g_page_count_shared++;
+        if (UVISOR_PAGE_SHARE_READ_ONLY && !(acl & UVISOR_TACL_UWRITE)) {
+            page_allocator_map_set(g_page_read_only_map[dst_box], page);
+        }
+    } else if (acl & UVISOR_TACL_UWRITE) {
+        page_allocator_map_clear(g_page_read_only_map[dst_box], page);
+    }
+    DPRINTF("uvisor_page_grant: Granting page %u of box %i to box %i\n", page, src_box, dst_box);
+
+    UVISOR_PAGE_ALLOCATOR_MUTEX_RELEASE;
+    return UVISOR_ERROR_PAGE_OK;
+}
+
+void page_allocator_ungrant(int dst_box, uint32_t address)
+{
+    UVISOR_PAGE_ALLOCATOR_MUTEX_AQUIRE;
+    page_index_t page = page_allocator_get_page_from_address(address);
+    /* Pages shared for good are not affected. */
+    if (page != UVISOR_PAGE_UNUSED && page_allocator_map_get(g_page_granted_map[dst_box], page)) {
+        page_allocator_unshare(dst_box, page);
+    }
+    UVISOR_PAGE_ALLOCATOR_MUTEX_RELEASE;
+}
+
+/* Helper function checks that an address is the start of a page owned by one
+ * box that can be moved to another box, and returns the page.
+ * @returns Non-zero on failure with failure class `UVISOR_ERROR_CLASS_PAGE`. See `UVISOR_ERROR_PAGE_*`. */
+static int page_allocator_check_transfer_page(int src_box, int dst_box, uint32_t address, page_index_t * const page)
+{
+    *page = page_allocator_get_page_from_address(address);
+    if (*page == UVISOR_PAGE_UNUSED || address != (uint32_t) g_page_heap_start + *page * g_page_size) {
+        return UVISOR_ERROR_PAGE_INVALID_PAGE_ORIGIN;
+    }
+    if (src_box == dst_box || !vmpu_is_box_id_valid(dst_box)) {
+        return UVISOR_ERROR_PAGE_INVALID_BOX_ID;
+    }
+    if (!page_allocator_is_owner(src_box, *page)) {
+        return UVISOR_ERROR_PAGE_INVALID_PAGE_OWNER;
+    }
+    return UVISOR_ERROR_PAGE_OK;
+}
+
+int page_allocator_check_transfer(int src_box, int dst_box, uint32_t address)
+{
+    UVISOR_PAGE_ALLOCATOR_MUTEX_AQUIRE;
+    page_index_t page;
+    int error = page_allocator_check_transfer_page(src_box, dst_box, address, &page);
+    UVISOR_PAGE_ALLOCATOR_MUTEX_RELEASE;
+    return error;
+}
+
+int page_allocator_transfer(int src_box, int dst_box, uint32_t address)
+{
+    UVISOR_PAGE_ALLOCATOR_MUTEX_AQUIRE;
+    page_index_t page;
+    int error = page_allocator_check_transfer_page(src_box, dst_box, address, &page);
+    if (error) {
+        UVISOR_PAGE_ALLOCATOR_MUTEX_RELEASE;
+        return error;
+    }
+
+    /* Take the page away from the boxes it is shared with. */
+    if (g_page_count_shared) {
+        uint32_t ii = 0;
+        for (; ii < UVISOR_MAX_BOXES; ii++) {
+            page_allocator_unshare(ii, page);
+        }
+    }
+
+    /* The page is now only in the owner map of the source box, or of all boxes
+     * if box 0 owns it. The same goes for the destination box afterwards. */
+    uint32_t ii = 0;
+    for (; ii < UVISOR_MAX_BOXES; ii++) {
+        if (dst_box == 0 || ii == (uint32_t) dst_box) {
+            page_allocator_map_set(g_page_owner_map[ii], page);
+        } else {
+            page_allocator_map_clear(g_page_owner_map[ii], page);
+        }
+    }
+    g_page_count_owned[src_box]--;
+    g_page_count_owned[dst_box]++;
+    /* The fault count of the page was about the source box. */
+    page_allocator_reset_faults(page);
+    DPRINTF("uvisor_page_transfer: Moving page %u of box %i to box %i\n", page, src_box, dst_box);
+
+    UVISOR_PAGE_ALLOCATOR_MUTEX_RELEASE;
+    return UVISOR_ERROR_PAGE_OK;
+}
@@ -24,23 +24,22 @@
 
 /* Maps the number of faults to a page. */
 uint32_t g_page_fault_table[UVISOR_PAGE_MAX_COUNT];
-#define UVISOR_PAGE_UNUSED UVISOR_BOX_ID_INVALID
 
-void page_allocator_reset_faults(uint8_t page)
+void page_allocator_reset_faults(page_index_t page)
 {
     if (page < g_page_count_total) {
         g_page_fault_table[page] = 0;
     }
 }
 
-void page_allocator_register_fault(uint8_t page)
+void page_allocator_register_fault(page_index_t page)
 {
     if (page < g_page_count_total) {
         g_page_fault_table[page]++;
     }
 }
 
-uint32_t page_allocator_get_faults(uint8_t page)
+uint32_t page_allocator_get_faults(page_index_t page)
 {
     if (page < g_page_count_total) {
         return g_page_fault_table[page];
@@ -51,8 +50,8 @@ uint32_t page_allocator_get_faults(uint8_t page)
 
 int page_allocator_check_range_for_box(int box_id, uint32_t start_addr, uint32_t end_addr)
 {
-    uint8_t pa = page_allocator_get_page_from_address(start_addr);
-    uint8_t pe = page_allocator_get_page_from_address(end_addr);
+    page_index_t pa = page_allocator_get_page_from_address(start_addr);
+    page_index_t pe = page_allocator_get_page_from_address(end_addr);
     if (pa != pe) {
         /* Range is spread of two or more pages, we're not testing that! */
         return UVISOR_ERROR_PAGE_INVALID_PAGE_OWNER;
@@ -65,12 +64,18 @@ int page_allocator_check_range_for_box(int box_id, uint32_t start_addr, uint32_t
     return UVISOR_ERROR_PAGE_INVALID_PAGE_ORIGIN;
 }
 
-int page_allocator_get_active_region_for_address(uint32_t address, uint32_t * start_addr, uint32_t * end_addr, uint8_t * page)
+int page_allocator_is_read_only(int box_id, uint32_t address)
+{
+    page_index_t p = page_allocator_get_page_from_address(address);
+    return p != UVISOR_PAGE_UNUSED && page_allocator_map_get(g_page_read_only_map[box_id], p);
+}
+
+int page_allocator_get_active_region_for_address(uint32_t address, uint32_t * start_addr, uint32_t * end_addr, page_index_t * page)
 {
     const page_owner_t box_id = g_active_box;
 
     /* Compute the page id. */
-    uint8_t p = page_allocator_get_page_from_address(address);
+    page_index_t p = page_allocator_get_page_from_address(address);
     if (p == UVISOR_PAGE_UNUSED) {
         /* This address does not correspond to any page. */
         return UVISOR_ERROR_PAGE_INVALID_PAGE_ORIGIN;
@@ -87,11 +92,11 @@ int page_allocator_get_active_region_for_address(uint32_t address, uint32_t * st
     return UVISOR_ERROR_PAGE_OK;
 }
 
-int page_allocator_get_active_mask_for_address(uint32_t address, uint8_t * mask, uint8_t * index, uint8_t * page)
+int page_allocator_get_active_mask_for_address(uint32_t address, uint8_t * mask, page_index_t * index, page_index_t * page)
 {
     const page_owner_t box_id = g_active_box;
     /* Compute the page id. */
-    uint8_t p = page_allocator_get_page_from_address(address);
+    page_index_t p = page_allocator_get_page_from_address(address);
     if (p == UVISOR_PAGE_UNUSED) {
         /* This address does not correspond to any page. */
         return UVISOR_ERROR_PAGE_INVALID_PAGE_ORIGIN;
@@ -101,17 +106,24 @@ int page_allocator_get_active_mask_for_address(uint32_t address, uint8_t * mask,
         return UVISOR_ERROR_PAGE_INVALID_PAGE_OWNER;
     }
     *page = p;
-    /* Compute the page mask and index. */
-    p += g_page_map_shift;
-    *mask = (uint8_t) (g_page_owner_map[box_id][p / 32] >> ((p % 32) & ~7));
-    *index = p / 8;
+    /* Compute the page mask and index. Only the pages with the same access
+     * permissions as the found page are part of the mask. */
+    const uint32_t bit = p + g_page_map_shift;
+    uint32_t word = g_page_owner_map[box_id][bit / 32];
+    if (page_allocator_map_get(g_page_read_only_map[box_id], p)) {
+        word &= g_page_read_only_map[box_id][bit / 32];
+    } else {
+        word &= ~g_page_read_only_map[box_id][bit / 32];
+    }
+    *mask = (uint8_t) (word >> ((bit % 32) & ~7));
+    *index = bit / 8;
 
     return UVISOR_ERROR_PAGE_OK;
 }
 
-uint8_t page_allocator_iterate_active_pages(PageAllocatorIteratorCallback callback, PageAllocatorIteratorDirection direction)
+page_index_t page_allocator_iterate_active_pages(PageAllocatorIteratorCallback callback, PageAllocatorIteratorDirection direction)
 {
-    uint8_t ii, index, count = 0;
+    page_index_t ii, index, count = 0;
     uint32_t start_addr, end_addr;
     const page_owner_t box_id = g_active_box;
 
@@ -139,11 +151,12 @@ uint8_t page_allocator_iterate_active_pages(PageAllocatorIteratorCallback callba
     return count;
 }
 
-uint8_t page_allocator_iterate_active_page_masks(PageAllocatorIteratorMaskCallback callback, PageAllocatorIteratorDirection direction)
+page_index_t page_allocator_iterate_active_page_masks(PageAllocatorIteratorMaskCallback callback, PageAllocatorIteratorDirection direction)
 {
-    uint8_t ii, index, mask, count = 0;
+    page_index_t ii, index, count = 0;
+    uint8_t mask;
     const page_owner_t box_id = g_active_box;
-    const uint8_t page_count_octets = ((g_page_count_total + 7) / 8);
+    const page_index_t page_count_octets = ((g_page_count_total + 7) / 8);
 
     for (ii = 0; ii < page_count_octets; ii++) {
         if (direction < 0) {
@@ -151,7 +164,8 @@ uint8_t page_allocator_iterate_active_page_masks(PageAllocatorIteratorMaskCallba
         } else {
             index = (UVISOR_PAGE_MAP_COUNT * 4 - page_count_octets) + ii;
         }
-        mask = (uint8_t) (g_page_owner_map[box_id][index / 4] >> ((index % 4) * 8));
+        /* Pages shared read-only are left to the fault handler. */
+        mask = (uint8_t) ((g_page_owner_map[box_id][index / 4] & ~g_page_read_only_map[box_id][index / 4]) >> ((index % 4) * 8));
         if (mask) {
             count++;
             if (callback) {
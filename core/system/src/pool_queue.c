@@ -56,6 +56,15 @@ int uvisor_pool_init(uvisor_pool_t * pool, void * array, size_t stride, size_t n
 
 int uvisor_pool_queue_init(uvisor_pool_queue_t * pool_queue, uvisor_pool_t * pool, void * array, size_t stride, size_t num)
 {
+    return uvisor_pool_queue_init_mode(pool_queue, pool, array, stride, num, UVISOR_POOL_QUEUE_MODE_LOCKED);
+}
+
+int uvisor_pool_queue_init_mode(uvisor_pool_queue_t * pool_queue, uvisor_pool_t * pool, void * array, size_t stride, size_t num, uint8_t mode)
+{
+    if (mode != UVISOR_POOL_QUEUE_MODE_LOCKED && mode != UVISOR_POOL_QUEUE_MODE_MPSC) {
+        return -1;
+    }
+
     int pool_init_ret = uvisor_pool_init(pool, array, stride, num);
     if (pool_init_ret) {
         return pool_init_ret;
@@ -63,6 +72,8 @@ int uvisor_pool_queue_init(uvisor_pool_queue_t * pool_queue, uvisor_pool_t * poo
     pool_queue->magic = UVISOR_POOL_QUEUE_MAGIC;
     pool_queue->head = UVISOR_POOL_SLOT_INVALID;
     pool_queue->tail = UVISOR_POOL_SLOT_INVALID;
+    pool_queue->mode = mode;
+    pool_queue->incoming = UVISOR_POOL_SLOT_INVALID;
 
     /* Force saving of NS alias, so no matter where the pool queue is init, the
      * NS side doesn't have to adjust the address to access. */
@@ -95,6 +106,29 @@ static uvisor_pool_slot_t pool_alloc(uvisor_pool_t * pool)
     return fresh;
 }
 
+/* Remove count elements from the front of the free list, or none at all if
+ * there are fewer than count free elements. Return the number of elements
+ * allocated. */
+static size_t pool_alloc_n(uvisor_pool_t * pool, uvisor_pool_slot_t * slots, size_t count)
+{
+    uvisor_pool_slot_t slot = pool->first_free;
+    size_t i;
+
+    /* Check that the free list is long enough before taking anything from it.
+     * The allocated count is only kept for debugging, so don't rely on it. */
+    for (i = 0; i < count; i++) {
+        if (slot >= pool->num) {
+            return 0;
+        }
+        slot = pool->management_array[slot].dequeued.next;
+    }
+    for (i = 0; i < count; i++) {
+        slots[i] = pool_alloc(pool);
+    }
+
+    return count;
+}
+
 /* Add an element to the back of the queue. */
 static void enqueue(uvisor_pool_queue_t * pool_queue, uvisor_pool_slot_t slot)
 {
@@ -119,6 +153,70 @@ static void enqueue(uvisor_pool_queue_t * pool_queue, uvisor_pool_slot_t slot)
     pool_queue->tail = slot;
 }
 
+/* Push slots onto the incoming stack of an MPSC queue, in order. Any number of
+ * producers can push concurrently, also with the consumer. */
+static void mpsc_push(uvisor_pool_queue_t * pool_queue, const uvisor_pool_slot_t * slots, size_t count)
+{
+    uvisor_pool_t * pool = UVISOR_AUTO_NS_ALIAS(pool_queue->pool);
+    uvisor_pool_queue_entry_t * first_entry = &pool->management_array[slots[0]];
+    uvisor_pool_slot_t incoming;
+    size_t i;
+
+    /* Link the slots in reverse order, so that they can be pushed at once. */
+    first_entry->queued.prev = UVISOR_POOL_SLOT_INVALID;
+    for (i = 1; i < count; i++) {
+        uvisor_pool_queue_entry_t * slot_entry = &pool->management_array[slots[i]];
+        slot_entry->queued.next = slots[i - 1];
+        slot_entry->queued.prev = UVISOR_POOL_SLOT_INVALID;
+    }
+
+    /* The slots are not visible to the consumer until the compare-and-swap
+     * succeeds, which is also a full memory barrier. */
+    do {
+        incoming = *((volatile uvisor_pool_slot_t *) &pool_queue->incoming);
+        first_entry->queued.next = incoming;
+    } while (!__sync_bool_compare_and_swap(&pool_queue->incoming, incoming, slots[count - 1]));
+}
+
+/* Move all the slots pushed so far by the producers of an MPSC queue to the
+ * end of the queue, in the order they were pushed. Only the consumer can call
+ * this. */
+static void mpsc_collect(uvisor_pool_queue_t * pool_queue)
+{
+    uvisor_pool_t * pool = UVISOR_AUTO_NS_ALIAS(pool_queue->pool);
+    uvisor_pool_slot_t slot;
+    uvisor_pool_slot_t first = UVISOR_POOL_SLOT_INVALID;
+    uvisor_pool_slot_t iterated = 0;
+
+    /* Take the whole incoming stack at once. Pushing only ever replaces the
+     * top of the stack, so this is not subject to the ABA problem. */
+    do {
+        slot = *((volatile uvisor_pool_slot_t *) &pool_queue->incoming);
+        if (slot == UVISOR_POOL_SLOT_INVALID) {
+            return;
+        }
+    } while (!__sync_bool_compare_and_swap(&pool_queue->incoming, slot, UVISOR_POOL_SLOT_INVALID));
+
+    /* The stack is in reverse push order. Reverse it in place. The iteration
+     * limit protects against corrupted links. */
+    while (slot < pool->num && iterated <= UVISOR_POOL_MAX_VALID) {
+        uvisor_pool_queue_entry_t * entry = &pool->management_array[slot];
+        uvisor_pool_slot_t next = entry->queued.next;
+        entry->queued.next = first;
+        first = slot;
+        slot = next;
+        iterated++;
+    }
+
+    /* Append the slots to the queue. */
+    slot = first;
+    while (slot != UVISOR_POOL_SLOT_INVALID) {
+        uvisor_pool_slot_t next = pool->management_array[slot].queued.next;
+        enqueue(pool_queue, slot);
+        slot = next;
+    }
+}
+
 uvisor_pool_slot_t uvisor_pool_allocate(uvisor_pool_t * pool)
 {
     /* uvisor should try lock. users should wait forever... */
@@ -143,11 +241,38 @@ uvisor_pool_slot_t uvisor_pool_try_allocate(uvisor_pool_t * pool)
     return fresh;
 }
 
+size_t uvisor_pool_allocate_n(uvisor_pool_t * pool, uvisor_pool_slot_t * slots, size_t count)
+{
+    uvisor_spin_lock(&pool->spinlock);
+    size_t allocated = pool_alloc_n(pool, slots, count);
+    uvisor_spin_unlock(&pool->spinlock);
+
+    return allocated;
+}
+
+size_t uvisor_pool_try_allocate_n(uvisor_pool_t * pool, uvisor_pool_slot_t * slots, size_t count)
+{
+    bool locked = uvisor_spin_trylock(&pool->spinlock);
+    if (!locked) {
+        /* We didn't get the lock. */
+        return 0;
+    }
+    size_t allocated = pool_alloc_n(pool, slots, count);
+    uvisor_spin_unlock(&pool->spinlock);
+
+    return allocated;
+}
+
 void uvisor_pool_queue_enqueue(uvisor_pool_queue_t * pool_queue, uvisor_pool_slot_t slot)
 {
     uvisor_pool_t * pool = UVISOR_AUTO_NS_ALIAS(pool_queue->pool);
 
     if (slot != UVISOR_POOL_SLOT_INVALID) {
+        if (pool_queue->mode == UVISOR_POOL_QUEUE_MODE_MPSC) {
+            mpsc_push(pool_queue, &slot, 1);
+            return;
+        }
+
         uvisor_spin_lock(&pool->spinlock);
         enqueue(pool_queue, slot);
         uvisor_spin_unlock(&pool->spinlock);
@@ -159,6 +284,11 @@ int uvisor_pool_queue_try_enqueue(uvisor_pool_queue_t * pool_queue, uvisor_pool_
     uvisor_pool_t * pool = UVISOR_AUTO_NS_ALIAS(pool_queue->pool);
 
     if (slot != UVISOR_POOL_SLOT_INVALID) {
+        if (pool_queue->mode == UVISOR_POOL_QUEUE_MODE_MPSC) {
+            mpsc_push(pool_queue, &slot, 1);
+            return 0;
+        }
+
         bool locked = uvisor_spin_trylock(&pool->spinlock);
         if (!locked) {
             /* We couldn't lock. */
@@ -171,6 +301,38 @@ int uvisor_pool_queue_try_enqueue(uvisor_pool_queue_t * pool_queue, uvisor_pool_
     return 0;
 }
 
+int uvisor_pool_queue_try_enqueue_batch(uvisor_pool_queue_t * pool_queue, const uvisor_pool_slot_t * slots, size_t count)
+{
+    uvisor_pool_t * pool = UVISOR_AUTO_NS_ALIAS(pool_queue->pool);
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (slots[i] >= pool->num) {
+            return -1;
+        }
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    if (pool_queue->mode == UVISOR_POOL_QUEUE_MODE_MPSC) {
+        mpsc_push(pool_queue, slots, count);
+        return 0;
+    }
+
+    bool locked = uvisor_spin_trylock(&pool->spinlock);
+    if (!locked) {
+        /* We couldn't lock. */
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        enqueue(pool_queue, slots[i]);
+    }
+    uvisor_spin_unlock(&pool->spinlock);
+
+    return 0;
+}
+
 static void pool_free(uvisor_pool_t * pool, uvisor_pool_slot_t slot)
 {
     uvisor_pool_queue_entry_t * slot_entry = &pool->management_array[slot];
@@ -258,25 +420,15 @@ uvisor_pool_slot_t uvisor_pool_try_free(uvisor_pool_t * pool, uvisor_pool_slot_t
     return slot;
 }
 
-uvisor_pool_slot_t uvisor_pool_queue_try_dequeue(uvisor_pool_queue_t * pool_queue, uvisor_pool_slot_t slot)
+/* Dequeue the specified slot, unless it is already dequeued or freed. */
+static uvisor_pool_slot_t try_dequeue(uvisor_pool_queue_t * pool_queue, uvisor_pool_slot_t slot)
 {
     uvisor_pool_t * pool = UVISOR_AUTO_NS_ALIAS(pool_queue->pool);
+    uvisor_pool_queue_entry_t * slot_entry = &pool->management_array[slot];
 
-    /* TODO refactor with uvisor_pool_free */
-    if (slot >= pool->num) {
-        return UVISOR_POOL_SLOT_INVALID;
-    }
-
-    uvisor_pool_queue_entry_t * slot_entry = &pool_queue->pool->management_array[slot];
-    bool locked = uvisor_spin_trylock(&pool->spinlock);
-    if (!locked) {
-        /* We didn't get the lock. */
-        return UVISOR_POOL_SLOT_INVALID;
-    }
     uvisor_pool_slot_t state = slot_entry->dequeued.state;
     if (state == UVISOR_POOL_SLOT_IS_FREE || state == UVISOR_POOL_SLOT_IS_DEQUEUED) {
         /* Already dequeued or freed. Return. */
-        uvisor_spin_unlock(&pool->spinlock);
         return state;
     }
 
@@ -285,6 +437,30 @@ uvisor_pool_slot_t uvisor_pool_queue_try_dequeue(uvisor_pool_queue_t * pool_queu
         /* Dequeue the slot. */
         dequeue(pool_queue, slot);
     }
+
+    return slot;
+}
+
+uvisor_pool_slot_t uvisor_pool_queue_try_dequeue(uvisor_pool_queue_t * pool_queue, uvisor_pool_slot_t slot)
+{
+    uvisor_pool_t * pool = UVISOR_AUTO_NS_ALIAS(pool_queue->pool);
+
+    /* TODO refactor with uvisor_pool_free */
+    if (slot >= pool->num) {
+        return UVISOR_POOL_SLOT_INVALID;
+    }
+
+    if (pool_queue->mode == UVISOR_POOL_QUEUE_MODE_MPSC) {
+        mpsc_collect(pool_queue);
+        return try_dequeue(pool_queue, slot);
+    }
+
+    bool locked = uvisor_spin_trylock(&pool->spinlock);
+    if (!locked) {
+        /* We didn't get the lock. */
+        return UVISOR_POOL_SLOT_INVALID;
+    }
+    slot = try_dequeue(pool_queue, slot);
     uvisor_spin_unlock(&pool->spinlock);
 
     return slot;
@@ -299,20 +475,13 @@ uvisor_pool_slot_t uvisor_pool_queue_dequeue(uvisor_pool_queue_t * pool_queue, u
         return UVISOR_POOL_SLOT_INVALID;
     }
 
-    uvisor_pool_queue_entry_t * slot_entry = &pool_queue->pool->management_array[slot];
-    uvisor_spin_lock(&pool->spinlock);
-    uvisor_pool_slot_t state = slot_entry->dequeued.state;
-    if (state == UVISOR_POOL_SLOT_IS_FREE || state == UVISOR_POOL_SLOT_IS_DEQUEUED) {
-        /* Already dequeued or freed. Return. */
-        uvisor_spin_unlock(&pool->spinlock);
-        return state;
+    if (pool_queue->mode == UVISOR_POOL_QUEUE_MODE_MPSC) {
+        mpsc_collect(pool_queue);
+        return try_dequeue(pool_queue, slot);
     }
 
-    /* If the queue is non-empty: */
-    if (pool_queue->head != UVISOR_POOL_SLOT_INVALID) {
-        /* Dequeue the slot. */
-        dequeue(pool_queue, slot);
-    }
+    uvisor_spin_lock(&pool->spinlock);
+    slot = try_dequeue(pool_queue, slot);
     uvisor_spin_unlock(&pool->spinlock);
 
     return slot;
@@ -338,6 +507,11 @@ uvisor_pool_slot_t uvisor_pool_queue_dequeue_first(uvisor_pool_queue_t * pool_qu
     uvisor_pool_slot_t slot;
     uvisor_pool_t * pool = UVISOR_AUTO_NS_ALIAS(pool_queue->pool);
 
+    if (pool_queue->mode == UVISOR_POOL_QUEUE_MODE_MPSC) {
+        mpsc_collect(pool_queue);
+        return try_dequeue_first(pool_queue);
+    }
+
     uvisor_spin_lock(&pool->spinlock);
     slot = try_dequeue_first(pool_queue);
     uvisor_spin_unlock(&pool->spinlock);
@@ -350,6 +524,11 @@ uvisor_pool_slot_t uvisor_pool_queue_try_dequeue_first(uvisor_pool_queue_t * poo
     uvisor_pool_slot_t slot;
     uvisor_pool_t * pool = UVISOR_AUTO_NS_ALIAS(pool_queue->pool);
 
+    if (pool_queue->mode == UVISOR_POOL_QUEUE_MODE_MPSC) {
+        mpsc_collect(pool_queue);
+        return try_dequeue_first(pool_queue);
+    }
+
     bool locked = uvisor_spin_trylock(&pool->spinlock);
     if (!locked) {
         /* We didn't get the lock. */
@@ -361,6 +540,57 @@ uvisor_pool_slot_t uvisor_pool_queue_try_dequeue_first(uvisor_pool_queue_t * poo
     return slot;
 }
 
+/* Remove up to max slots from the front of the queue, unlinking them all at
+ * once. */
+static size_t try_dequeue_batch(uvisor_pool_queue_t * pool_queue, uvisor_pool_slot_t * slots, size_t max)
+{
+    uvisor_pool_t * pool = UVISOR_AUTO_NS_ALIAS(pool_queue->pool);
+    uvisor_pool_slot_t slot = pool_queue->head;
+    size_t count = 0;
+
+    while (count < max && slot < pool->num) {
+        uvisor_pool_queue_entry_t * slot_entry = &pool->management_array[slot];
+        slots[count++] = slot;
+        slot = slot_entry->queued.next;
+
+        slot_entry->dequeued.next = UVISOR_POOL_SLOT_INVALID;
+        slot_entry->dequeued.state = UVISOR_POOL_SLOT_IS_DEQUEUED;
+    }
+
+    /* Link the rest of the queue to the head. A link past the end of the pool
+     * also ends the queue. */
+    if (slot >= pool->num) {
+        pool_queue->head = UVISOR_POOL_SLOT_INVALID;
+        pool_queue->tail = UVISOR_POOL_SLOT_INVALID;
+    } else {
+        pool_queue->head = slot;
+        pool->management_array[slot].queued.prev = UVISOR_POOL_SLOT_INVALID;
+    }
+
+    return count;
+}
+
+size_t uvisor_pool_queue_try_dequeue_batch(uvisor_pool_queue_t * pool_queue, uvisor_pool_slot_t * slots, size_t max)
+{
+    size_t count;
+    uvisor_pool_t * pool = UVISOR_AUTO_NS_ALIAS(pool_queue->pool);
+
+    if (pool_queue->mode == UVISOR_POOL_QUEUE_MODE_MPSC) {
+        mpsc_collect(pool_queue);
+        return try_dequeue_batch(pool_queue, slots, max);
+    }
+
+    bool locked = uvisor_spin_trylock(&pool->spinlock);
+    if (!locked) {
+        /* We didn't get the lock. */
+        return 0;
+    }
+    count = try_dequeue_batch(pool_queue, slots, max);
+    uvisor_spin_unlock(&pool->spinlock);
+
+    return count;
+}
+
 static uvisor_pool_slot_t find_first(uvisor_pool_queue_t * pool_queue,
                                      TQueryFN_Ptr query_fn, void * context)
 {
@@ -374,12 +604,11 @@ static uvisor_pool_slot_t find_first(uvisor_pool_queue_t * pool_queue,
     {
         uvisor_pool_queue_entry_t * entry = &pool->management_array[slot];
 
-        /* NOTE: The query function is called with the queue spinlock held, so
-         * be careful. */
+        /* NOTE: For locked queues, the query function is called with the
+         * queue spinlock held, so be careful. */
         int query_result = query_fn(slot, context);
 
         if (query_result) {
-            uvisor_spin_unlock(&pool->spinlock);
             return slot;
         }
 
@@ -397,6 +626,11 @@ uvisor_pool_slot_t uvisor_pool_queue_try_find_first(uvisor_pool_queue_t * pool_q
     uvisor_pool_slot_t slot;
     uvisor_pool_t * pool = UVISOR_AUTO_NS_ALIAS(pool_queue->pool);
 
+    if (pool_queue->mode == UVISOR_POOL_QUEUE_MODE_MPSC) {
+        mpsc_collect(pool_queue);
+        return find_first(pool_queue, query_fn, context);
+    }
+
     bool locked = uvisor_spin_trylock(&pool->spinlock);
     if (!locked) {
         /* We didn't get the lock. */
@@ -414,6 +648,11 @@ uvisor_pool_slot_t uvisor_pool_queue_find_first(uvisor_pool_queue_t * pool_queue
     uvisor_pool_slot_t slot;
     uvisor_pool_t * pool = UVISOR_AUTO_NS_ALIAS(pool_queue->pool);
 
+    if (pool_queue->mode == UVISOR_POOL_QUEUE_MODE_MPSC) {
+        mpsc_collect(pool_queue);
+        return find_first(pool_queue, query_fn, context);
+    }
+
     uvisor_spin_lock(&pool->spinlock);
     slot = find_first(pool_queue, query_fn, context);
     uvisor_spin_unlock(&pool->spinlock);
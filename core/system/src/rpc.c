@@ -23,20 +23,181 @@
 #include "api/inc/register_gateway.h"
 #include "context.h"
 #include "halt.h"
+#include "page_allocator.h"
+#include "page_allocator_faults.h"
+#include "rpc.h"
 #include "vmpu.h"
+#include "vmpu_mpu.h"
 
-/* Wake up all the potential handlers for this RPC target. Return number of
- * handlers posted to. */
-static int wake_up_handlers_for_target(const TFN_Ptr function, int box_id)
+#if UVISOR_DRAIN_STATS
+uint32_t g_rpc_drain_skipped;
+uint32_t g_rpc_wait_count;
+uint32_t g_rpc_wait_total;
+uint32_t g_rpc_wait_max;
+
+/* Number of drains each outgoing message has been kept back for so far. */
+static uint32_t g_rpc_wait[UVISOR_MAX_BOXES][UVISOR_RPC_MESSAGE_SLOTS_MAX];
+
+static void rpc_wait_record(int caller_box, uvisor_pool_slot_t caller_slot, int kept)
+{
+    if (caller_slot >= UVISOR_RPC_MESSAGE_SLOTS_MAX) {
+        return;
+    }
+    uint32_t * wait = &g_rpc_wait[caller_box][caller_slot];
+    if (kept) {
+        (*wait)++;
+        return;
+    }
+    g_rpc_wait_count++;
+    g_rpc_wait_total += *wait;
+    if (*wait > g_rpc_wait_max) {
+        g_rpc_wait_max = *wait;
+    }
+    *wait = 0;
+}
+#endif
+
+#if UVISOR_RPC_STATS
+static uvisor_rpc_stats_t g_rpc_stats = {
+    .magic = UVISOR_RPC_STATS_MAGIC,
+    .entry_count = UVISOR_RPC_STATS_ENTRIES,
+    .bucket_count = UVISOR_RPC_STATS_BUCKETS,
+    .bucket_shift = UVISOR_RPC_STATS_BUCKET_SHIFT,
+};
+
+/* Return the current time, never 0, which means "not stamped yet". */
+static uint32_t rpc_stats_now(void)
+{
+    uint32_t now = UVISOR_RPC_STATS_NOW();
+    return now ? now : 1;
+}
+
+static uint32_t rpc_stats_bucket(uint32_t cycles)
+{
+    uint32_t log2 = 31 - __CLZ(cycles | 1);
+    if (log2 <= UVISOR_RPC_STATS_BUCKET_SHIFT) {
+        return 0;
+    }
+    log2 -= UVISOR_RPC_STATS_BUCKET_SHIFT;
+    return log2 < UVISOR_RPC_STATS_BUCKETS ? log2 : UVISOR_RPC_STATS_BUCKETS - 1;
+}
+
+/* Record the latency of an RPC whose result was just returned. The stamps are
+ * read from the outgoing message of the caller box, which can only skew the
+ * latencies of its own RPCs. */
+static void rpc_stats_record(const uvisor_rpc_message_t * caller_msg, int caller_box)
+{
+    uint32_t target = caller_msg->target;
+    uint32_t wait = caller_msg->delivered_at - caller_msg->queued_at;
+    uint32_t service = rpc_stats_now() - caller_msg->delivered_at;
+    uvisor_rpc_stats_entry_t * entry;
+    size_t i;
+
+    if (target == 0) {
+        return;
+    }
+
+    for (i = 0; i < UVISOR_RPC_STATS_ENTRIES; i++) {
+        entry = &g_rpc_stats.entries[i];
+        if (entry->target == 0) {
+            entry->target = target;
+            entry->caller_box = caller_box;
+            break;
+        }
+        if (entry->target == target && entry->caller_box == caller_box) {
+            break;
+        }
+    }
+    if (i == UVISOR_RPC_STATS_ENTRIES) {
+        g_rpc_stats.dropped++;
+        return;
+    }
+
+    entry->count++;
+    if (wait + service > entry->max) {
+        entry->max = wait + service;
+    }
+    entry->wait[rpc_stats_bucket(wait)]++;
+    entry->service[rpc_stats_bucket(service)]++;
+    entry->total[rpc_stats_bucket(wait + service)]++;
+}
+#endif
+
+/* The number of RPCs into a box that can hold grants of buffers passed by
+ * reference at the same time. The incoming message queues of the boxes can be
+ * much larger, so the grants are not kept per incoming message slot. */
+#ifndef UVISOR_RPC_GRANT_SLOTS
+#define UVISOR_RPC_GRANT_SLOTS (8)
+#endif
+
+/* The buffers of the caller box granted to a callee box for an RPC, until the
+ * RPC completes. */
+typedef struct {
+    /* The incoming message slot of the RPC in the callee box */
+    uvisor_pool_slot_t callee_slot;
+    uint8_t caller_box;
+    /* The number of buffers granted, or 0 if the record is free */
+    uint8_t count;
+    uint8_t acl[UVISOR_RPC_BUFFER_COUNT];
+    uint32_t address[UVISOR_RPC_BUFFER_COUNT];
+} RpcGrant;
+
+/* The grants of the RPCs delivered to each box. */
+static RpcGrant g_rpc_grants[UVISOR_MAX_BOXES][UVISOR_RPC_GRANT_SLOTS];
+
+/* Check the doorbell of a queue of the active box and clear it before the
+ * queue is drained. Return 0 if the queue can be skipped. */
+static int doorbell_take(UvisorBoxIndex * index, UvisorBoxDoorbell doorbell)
+{
+    if (!index->doorbells.queue[doorbell]) {
+#if UVISOR_DRAIN_STATS
+        g_rpc_drain_skipped++;
+#endif
+        return 0;
+    }
+    /* Work queued from now on rings the doorbell again. */
+    index->doorbells.queue[doorbell] = 0;
+    return 1;
+}
+
+/* Post to a semaphore `count` times. */
+static void semaphore_post_n(UvisorSemaphore * semaphore, uint32_t count)
+{
+    while (count--) {
+        semaphore_post(semaphore);
+    }
+}
+
+/* Wake up all the potential handlers for this RPC target, `count` times each,
+ * once for every message delivered for the target. Return number of handlers
+ * posted to. */
+static int wake_up_handlers_for_target(const TFN_Ptr function, int box_id, uint32_t count)
 {
     int num_posted = 0;
 
     UvisorBoxIndex * index = (UvisorBoxIndex *) g_context_current_states[box_id].bss;
     uvisor_pool_queue_t * fn_group_queue = &(uvisor_rpc(index)->fn_group_queue.queue);
-    uvisor_rpc_fn_group_t * fn_group_array = uvisor_rpc(index)->fn_group_queue.fn_groups;
+    uvisor_rpc_fn_group_t * fn_group_array = (uvisor_rpc_fn_group_t *) fn_group_queue->pool->array;
+    uvisor_rpc_fn_index_t * fn_index = &(uvisor_rpc(index)->fn_index);
+
+    /* Look the function up in the index of the callee box first. The index is
+     * written by the box, so only the slots inside the pool are posted to. A
+     * bad index only ever delays the RPCs into the box itself. */
+    uint32_t fn_groups = uvisor_rpc_fn_index_lookup(fn_index, function);
+    if (fn_groups || !fn_index->overflow) {
+        while (fn_groups) {
+            uvisor_pool_slot_t slot = __builtin_ctz(fn_groups);
+            fn_groups &= fn_groups - 1;
+            if (slot < fn_group_queue->pool->num) {
+                semaphore_post_n(&fn_group_array[slot].semaphore, count);
+                ++num_posted;
+            }
+        }
+        return num_posted;
+    }
 
-    /* Wake up all known waiters for this function. Search for the function in
-     * all known function groups. We have to search through all function groups
+    /* The function may not have fit into the index. Wake up all known waiters
+     * for this function. Search for the function in all known function groups. We have to search through all function groups
      * (not just those currently waiting for messages) because we want the RTOS
      * to be able to pick the highest priority waiter to schedule to run. Some
      * waiters will wake up and find they have nothing to do if a higher
@@ -54,7 +215,7 @@ static int wake_up_handlers_for_target(const TFN_Ptr function, int box_id)
             /* If function is found: */
             if (fn_ptr_array[i] == function) {
                 /* Wake up the waiter. */
-                semaphore_post(&fn_group->semaphore);
+                semaphore_post_n(&fn_group->semaphore, count);
                 ++num_posted;
             }
         }
@@ -86,22 +247,22 @@ static int callee_box_id(const TRPCGateway * gateway)
     return box_id;
 }
 
-static int put_it_back(uvisor_pool_queue_t * queue, uvisor_pool_slot_t slot)
+static int put_them_back(uvisor_pool_queue_t * queue, const uvisor_pool_slot_t * slots, size_t count)
 {
     int status;
-    status = uvisor_pool_queue_try_enqueue(queue, slot);
+    status = uvisor_pool_queue_try_enqueue_batch(queue, slots, count);
     if (status) {
-        /* We could dequeue an RPC message, but couldn't put it back. */
+        /* We could dequeue the RPC messages, but couldn't put them back. */
         /* It is bad to take down the entire system. It is also bad
          * to lose messages due to not being able to put them back in
-         * the queue. However, if we could dequeue the slot
-         * we should have no trouble enqueuing the slot here. */
+         * the queue. However, if we could dequeue the slots
+         * we should have no trouble enqueuing the slots here. */
         assert(false);
     }
 
-    /* Note that we don't have to modify the message in the queue, since it'll
-     * still be valid. Nobody else will have run at the same time that could
-     * have messed it up. */
+    /* Note that we don't have to modify the messages in the queue, since
+     * they'll still be valid. Nobody else will have run at the same time that
+     * could have messed them up. */
 
      return status;
 }
@@ -117,7 +278,10 @@ static int is_valid_rpc_gateway(const TRPCGateway * const gateway)
     }
 
     /* Gateway needs to have good magic. */
-    if (!(gateway->magic == UVISOR_RPC_GATEWAY_MAGIC_ASYNC || gateway->magic == UVISOR_RPC_GATEWAY_MAGIC_SYNC)) {
+    /* Note: Direct gateways are also accepted here, because they are called
+     * through the RPC queues where direct RPCs are not supported. */
+    if (!(gateway->magic == UVISOR_RPC_GATEWAY_MAGIC_ASYNC || gateway->magic == UVISOR_RPC_GATEWAY_MAGIC_SYNC ||
+          gateway->magic == UVISOR_RPC_GATEWAY_MAGIC_DIRECT)) {
         return 0;
     }
 
@@ -142,6 +306,14 @@ static int is_valid_rpc_gateway(const TRPCGateway * const gateway)
     return 1;
 }
 
+int rpc_direct_callee_box_id(const TRPCGateway * gateway)
+{
+    if (!is_valid_rpc_gateway(gateway) || gateway->magic != UVISOR_RPC_GATEWAY_MAGIC_DIRECT) {
+        return -1;
+    }
+    return callee_box_id(gateway);
+}
+
 /* Return true if and only if the queue is entirely within the box specified by
  * the provided box_id. */
 static int is_valid_queue(uvisor_pool_queue_t * queue, int box_id)
@@ -173,6 +345,12 @@ static int is_valid_queue(uvisor_pool_queue_t * queue, int box_id)
         return 0;
     }
 
+    /* The number of slots depends on the box, so it is only bounded. The
+     * slots are accessed as messages. */
+    if (queue->pool->num > UVISOR_RPC_MESSAGE_SLOTS_MAX || queue->pool->stride != sizeof(uvisor_rpc_message_t)) {
+        return 0;
+    }
+
     uint32_t man_array_start = (uint32_t) queue->pool->management_array;
     uint32_t man_array_end = man_array_start + sizeof(*queue->pool->management_array) * queue->pool->num;
     int man_array_is_valid = (man_array_start >= bss_start) && (man_array_end <= bss_end);
@@ -191,13 +369,400 @@ static int is_valid_queue(uvisor_pool_queue_t * queue, int box_id)
     return 1;
 }
 
-void drain_message_queue(void)
+/* Return the page ACL a callee box needs for a buffer passed by reference. */
+static uint32_t buffer_acl(const uvisor_rpc_buffer_t * buffer)
+{
+    return (buffer->direction & UVISOR_RPC_BUFFER_OUT) ? UVISOR_TACL_UREAD | UVISOR_TACL_UWRITE : UVISOR_TACL_UREAD;
+}
+
+/* Return true iff the buffers passed by reference with a message are valid:
+ * The caller box must be able to access each buffer, and the callee box must
+ * either be able to access it already, or it must lie in a page of the caller
+ * box that can be granted to the callee box. */
+static int is_valid_buffers(uvisor_rpc_message_t * caller_msg, int caller_box, int callee_box)
+{
+    uint32_t count = caller_msg->buffer_count;
+    uint32_t i;
+
+    if (count > UVISOR_RPC_BUFFER_COUNT) {
+        return 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        /* Copy the descriptor, as the caller box owns the message. */
+        uvisor_rpc_buffer_t buffer = caller_msg->buffers[i];
+
+        if (!buffer.direction || (buffer.direction & ~UVISOR_RPC_BUFFER_INOUT)) {
+            return 0;
+        }
+        if (!vmpu_buffer_access_is_ok(caller_box, buffer.address, buffer.size)) {
+            return 0;
+        }
+        if (page_allocator_check_grant(caller_box, callee_box, (uint32_t) buffer.address, buffer.size,
+                                       buffer_acl(&buffer)) == UVISOR_ERROR_PAGE_OK) {
+            continue;
+        }
+        if (!vmpu_buffer_access_is_ok(callee_box, buffer.address, buffer.size)) {
+            return 0;
+        }
+        if ((buffer.direction & UVISOR_RPC_BUFFER_OUT) && page_allocator_is_read_only(callee_box, (uint32_t) buffer.address)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Return how many of the messages, from the start of `caller_slots`, can be
+ * delivered to the callee box with a free grant record for each message that
+ * passes buffers by reference. */
+static size_t grantable_messages(uvisor_rpc_message_t * caller_array, const uvisor_pool_slot_t * caller_slots, size_t count,
+                                 int callee_box)
+{
+    size_t free_grants = 0;
+    size_t i;
+
+    for (i = 0; i < UVISOR_RPC_GRANT_SLOTS; i++) {
+        if (!g_rpc_grants[callee_box][i].count) {
+            free_grants++;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        if (caller_array[caller_slots[i]].buffer_count) {
+            if (!free_grants) {
+                break;
+            }
+            free_grants--;
+        }
+    }
+    return i;
+}
+
+/* Grant a callee box access to the buffers passed by reference with a message
+ * delivered to it, and remember them until the RPC completes. The buffers must
+ * have been validated with `is_valid_buffers`, and a grant record must have
+ * been reserved with `grantable_messages`. */
+static void grant_buffers(uvisor_rpc_message_t * caller_msg, int caller_box, int callee_box, uvisor_pool_slot_t callee_slot)
+{
+    uint32_t count = caller_msg->buffer_count;
+    RpcGrant * grant = NULL;
+    uint32_t i;
+
+    for (i = 0; i < UVISOR_RPC_GRANT_SLOTS; i++) {
+        if (!g_rpc_grants[callee_box][i].count) {
+            grant = &g_rpc_grants[callee_box][i];
+            break;
+        }
+    }
+    if (!grant) {
+        /* No grant record was reserved. This should never happen. */
+        assert(false);
+        return;
+    }
+    grant->callee_slot = callee_slot;
+    grant->caller_box = caller_box;
+    grant->count = 0;
+
+    for (i = 0; i < count && i < UVISOR_RPC_BUFFER_COUNT; i++) {
+        uvisor_rpc_buffer_t buffer = caller_msg->buffers[i];
+        uint32_t acl = buffer_acl(&buffer);
+        if (page_allocator_grant(caller_box, callee_box, (uint32_t) buffer.address, buffer.size, acl) == UVISOR_ERROR_PAGE_OK) {
+            grant->address[grant->count] = (uint32_t) buffer.address;
+            grant->acl[grant->count] = acl;
+            grant->count++;
+        }
+    }
+}
+
+/* Take the buffers granted for an RPC away from the callee box again. */
+static void release_buffers(int callee_box, uvisor_pool_slot_t callee_slot)
+{
+    RpcGrant * grant = NULL;
+    uint32_t slot;
+    uint32_t i;
+
+    for (slot = 0; slot < UVISOR_RPC_GRANT_SLOTS; slot++) {
+        if (g_rpc_grants[callee_box][slot].count && g_rpc_grants[callee_box][slot].callee_slot == callee_slot) {
+            grant = &g_rpc_grants[callee_box][slot];
+            break;
+        }
+    }
+    if (!grant) {
+        return;
+    }
+    for (i = 0; i < grant->count; i++) {
+        page_allocator_ungrant(callee_box, grant->address[i]);
+    }
+    grant->count = 0;
+
+    /* Other RPCs into the box may still need some of the same pages. Their
+     * grants are renewed, unless the caller box freed the pages meanwhile. */
+    for (slot = 0; slot < UVISOR_RPC_GRANT_SLOTS; slot++) {
+        grant = &g_rpc_grants[callee_box][slot];
+        for (i = 0; i < grant->count; i++) {
+            page_allocator_grant(grant->caller_box, callee_box, grant->address[i], 1, grant->acl[i]);
+        }
+    }
+
+    /* The pages may still be mapped by the MPU. */
+    if (callee_box == g_active_box) {
+        vmpu_mpu_invalidate_pages();
+    }
+}
+
+/* Return the callee box of a message from the caller box, or -1 if the
+ * message is not valid and must be discarded. */
+static int message_callee_box(uvisor_rpc_message_t * caller_msg)
+{
+    /* Validate the gateway */
+    const TRPCGateway * const gateway = caller_msg->gateway;
+    if (!is_valid_rpc_gateway(gateway)) {
+        /* The RPC gateway is not valid. Don't put the message back onto
+         * the queue. Move on to next items. On a non-malicious system, the
+         * gateway should always be valid here. */
+        assert(false);
+        return -1;
+    }
+
+    /* Look up the callee box. */
+    const int callee_box = callee_box_id(gateway);
+    if (callee_box < 0) {
+        /* This shouldn't happen, because the gateway was already verified.
+         * */
+        assert(false);
+        return -1;
+    }
+
+    return callee_box;
+}
+
+/* Deliver messages from the caller box to the todo queue of the callee box.
+ * All the messages are for the same callee box. The callee slots for them are
+ * allocated and enqueued together, and the handlers of each target function
+ * are woken up in one go.
+ * Return the number of messages, from the start of `caller_slots`, that were
+ * delivered or discarded. The other messages must stay in the caller queue to
+ * be delivered later. */
+static size_t deliver_messages(uvisor_rpc_message_t * caller_array, const uvisor_pool_slot_t * caller_slots, size_t count,
+                               int caller_box, int callee_box)
+{
+    UvisorBoxIndex * callee_index = (UvisorBoxIndex *) g_context_current_states[callee_box].bss;
+    uvisor_pool_queue_t * callee_queue = &(uvisor_rpc(callee_index)->incoming_message_queue.todo_queue);
+    uvisor_rpc_message_t * callee_array = (uvisor_rpc_message_t *) callee_queue->pool->array;
+    uvisor_pool_slot_t callee_slots[UVISOR_RPC_MESSAGE_SLOTS_MAX];
+    size_t delivered;
+    size_t i;
+    size_t j;
+
+    /* Verify that the callee queue is entirely in callee box BSS. We check the
+     * entire queue instead of just the message we are interested in, because
+     * we want to validate the queue before we attempt any operations on it,
+     * like allocating. */
+    if (!is_valid_queue(callee_queue, callee_box))
+    {
+        /* The callee's todo queue is not valid. This shouldn't happen in a
+         * non-malicious system. Don't put the caller's messages back into
+         * the queue; this is the same behavior (from the caller's
+         * perspective) as a malicious box never completing RPCs. */
+        assert(false);
+        return count;
+    }
+
+    /* Only deliver the messages that can get the grant records they may
+     * need. */
+    count = grantable_messages(caller_array, caller_slots, count, callee_box);
+    if (count == 0) {
+        return 0;
+    }
+
+    /* Place the messages into the callee box queue. All the slots are
+     * allocated at once if there is room for them. Otherwise, as many messages
+     * as fit are delivered, in order. */
+    delivered = uvisor_pool_queue_try_allocate_n(callee_queue, callee_slots, count);
+    while (delivered < count && uvisor_pool_queue_try_allocate_n(callee_queue, &callee_slots[delivered], 1)) {
+        delivered++;
+    }
+
+    /* If there was no room in the callee queue or the queue is busy: */
+    if (delivered == 0) {
+        /* Keep the messages in the caller queue. This applies backpressure on
+         * the caller when the callee is too busy. Note that no data needs to
+         * be copied; only the caller queue's management array is modified. */
+        return 0;
+    }
+
+    /* Deliver the messages. */
+    for (i = 0; i < delivered; i++) {
+        uvisor_rpc_message_t * caller_msg = &caller_array[caller_slots[i]];
+        uvisor_rpc_message_t * callee_msg = &callee_array[callee_slots[i]];
+
+        callee_msg->p0 = caller_msg->p0;
+        callee_msg->p1 = caller_msg->p1;
+        callee_msg->p2 = caller_msg->p2;
+        callee_msg->p3 = caller_msg->p3;
+        callee_msg->gateway = caller_msg->gateway;
+        /* Set the ID of the calling box in the message. */
+        callee_msg->other_box_id = caller_box;
+        callee_msg->match_cookie = caller_msg->match_cookie;
+        callee_msg->state = UVISOR_RPC_MESSAGE_STATE_SENT;
+    }
+
+    /* Enqueue the messages */
+    int status = uvisor_pool_queue_try_enqueue_batch(callee_queue, callee_slots, delivered);
+    /* We should always be able to enqueue, since we were able to
+     * allocate the slots. Nobody else should have been able to run and
+     * take the spin lock. */
+    if (status) {
+        /* We were able to get the callee RPC slots allocated, but
+         * couldn't enqueue the messages. It is bad to take down the
+         * entire system. It is also bad to keep the allocated slots
+         * around. However, if we couldn't enqueue the slots, we'll have
+         * a hard time freeing them, since that requires the same lock.
+         * */
+        assert(false);
+
+        /* Keep the messages in the caller queue, as we may be able to
+         * enqueue the messages when we try again later. */
+        return 0;
+    }
+
+#if UVISOR_RPC_STATS
+    uint32_t delivered_at = rpc_stats_now();
+#endif
+    for (i = 0; i < delivered; i++) {
+        uvisor_rpc_message_t * caller_msg = &caller_array[caller_slots[i]];
+        if (caller_msg->buffer_count) {
+            grant_buffers(caller_msg, caller_box, callee_box, callee_slots[i]);
+        }
+        caller_msg->other_box_id = callee_box;
+        caller_msg->state = UVISOR_RPC_MESSAGE_STATE_SENT;
+#if UVISOR_RPC_STATS
+        caller_msg->delivered_at = delivered_at;
+        caller_msg->target = (uint32_t) caller_msg->gateway->target;
+#endif
+    }
+
+    /* Poke anybody waiting on calls to the target functions, once per
+     * message. If nobody is waiting, the items will remain in the incoming
+     * queue. The first time a rpc_fncall_waitfor is called for a function
+     * group, rpc_fncall_waitfor will check to see if there are any messages
+     * it can handle from before the function group existed. The handlers of
+     * a target function are only looked up at its first message. */
+    for (i = 0; i < delivered; i++) {
+        TFN_Ptr target = (TFN_Ptr) caller_array[caller_slots[i]].gateway->target;
+        uint32_t target_count = 0;
+
+        for (j = 0; j < delivered; j++) {
+            if ((TFN_Ptr) caller_array[caller_slots[j]].gateway->target == target) {
+                if (j < i) {
+                    /* This target was already handled. */
+                    break;
+                }
+                target_count++;
+            }
+        }
+        if (target_count) {
+            wake_up_handlers_for_target(target, callee_box, target_count);
+        }
+    }
+
+    return delivered;
+}
+
+/* Add an outgoing message that was completed to its completion queue, and
+ * wake up the thread waiting on the queue if it was empty. */
+static void push_completion(uvisor_rpc_completion_queue_t * cq, uvisor_pool_slot_t caller_slot, int caller_box)
+{
+    /* The completion queue can be anywhere in the caller box memory. */
+    if (!vmpu_buffer_access_is_ok(caller_box, cq, sizeof(*cq))) {
+        /* The completion queue is not valid. This shouldn't happen in a
+         * non-malicious system. */
+        assert(false);
+        return;
+    }
+
+    uint32_t head = cq->head;
+    uint32_t tail = cq->tail;
+    if (head - tail >= UVISOR_RPC_MESSAGE_SLOTS_MAX) {
+        /* The queue holds more completions than the caller can have
+         * outstanding RPCs. This shouldn't happen in a non-malicious
+         * system. */
+        assert(false);
+        return;
+    }
+    cq->slots[head % UVISOR_RPC_MESSAGE_SLOTS_MAX] = caller_slot;
+    cq->head = head + 1;
+
+    /* The waiting thread takes all the completions in the queue when it wakes
+     * up, so it only needs waking up for the first one. The post fails if
+     * the semaphore is still posted from earlier, which is harmless. */
+    if (head == tail) {
+        semaphore_post(&cq->semaphore);
+    }
+}
+
+/* Wake up the caller box thread waiting for an outgoing message that was
+ * completed, or rejected. */
+static void complete_message(uvisor_pool_queue_t * caller_queue, uvisor_rpc_message_t * caller_msg, int caller_box)
+{
+    uvisor_rpc_message_t * caller_array = (uvisor_rpc_message_t *) caller_queue->pool->array;
+
+    if (caller_msg->completion_queue) {
+        push_completion(caller_msg->completion_queue, caller_msg - caller_array, caller_box);
+        return;
+    }
+
+    /* The messages of a batch are completed together, through the first
+     * message of the batch, when the last of them is done. */
+    if (caller_msg->batch_slot != UVISOR_POOL_SLOT_INVALID) {
+        if (caller_msg->batch_slot >= caller_queue->pool->num) {
+            /* The batch is not valid. This shouldn't happen in a
+             * non-malicious system. */
+            assert(false);
+            return;
+        }
+        caller_msg = &caller_array[caller_msg->batch_slot];
+        if (caller_msg->batch_pending == 0 || --caller_msg->batch_pending) {
+            /* Wait for the rest of the batch. */
+            return;
+        }
+    }
+
+    /* Post to the result semaphore, ignoring errors. */
+    int status;
+    status = semaphore_post(&caller_msg->semaphore);
+    if (status) {
+        /* We couldn't post to the result semaphore. We shouldn't really
+         * bring down the entire system if one box messes up its own
+         * semaphore. In a non-malicious system, this should never happen.
+         * */
+        assert(false);
+    }
+}
+
+/* Deliver the messages of the outgoing queue of the active box to their
+ * callee boxes, or only to one callee box if callee_box is not -1. The other
+ * messages stay in the queue for the next drain. */
+static void drain_messages(int callee_box_only)
 {
     UvisorBoxIndex * caller_index = (UvisorBoxIndex *) *__uvisor_config.uvisor_box_context;
     uvisor_pool_queue_t * caller_queue = &(uvisor_rpc(caller_index)->outgoing_message_queue.queue);
     uvisor_rpc_message_t * caller_array = (uvisor_rpc_message_t *) caller_queue->pool->array;
     int caller_box = g_active_box;
-    int first_slot = -1;
+    uvisor_pool_slot_t slots[UVISOR_RPC_MESSAGE_SLOTS_MAX];
+    int8_t callee_boxes[UVISOR_RPC_MESSAGE_SLOTS_MAX];
+    /* A bit is set for each callee box a message could not be delivered to
+     * during this drain, or which is left out of it. Later messages to these
+     * boxes are kept back too, so that the messages from a caller to a callee
+     * stay in order, while the messages to other callees go ahead. */
+    uint32_t blocked_boxes = callee_box_only < 0 ? 0 : ~(1UL << callee_box_only);
+    size_t kept = 0;
+    size_t count;
+
+    if (!doorbell_take(caller_index, UVISOR_BOX_DOORBELL_RPC_OUTGOING)) {
+        return;
+    }
 
     /* Verify that the caller queue is entirely in caller box BSS. We check the
      * entire queue instead of just the message we are interested in, because
@@ -211,148 +776,207 @@ void drain_message_queue(void)
         return;
     }
 
-    /* For each message in the queue: */
-    do {
-        uvisor_pool_slot_t caller_slot;
+    /* Take the messages out of the queue in batches. The messages that can't
+     * be delivered now are kept at the start of the slots array, in queue
+     * order, until they are all put back at once. */
+    /* NOTE: We only dequeue the messages from the queue. We don't free them
+     * from the pool. The caller will free the messages from the pool after
+     * finish waiting for the RPCs to finish. */
+    while (kept < UVISOR_ARRAY_COUNT(slots) &&
+           (count = uvisor_pool_queue_try_dequeue_batch(caller_queue, &slots[kept], UVISOR_ARRAY_COUNT(slots) - kept)) > 0) {
+        size_t end = kept + count;
+        size_t i;
+        size_t j;
 
-        /* NOTE: We only dequeue the message from the queue. We don't free
-         * the message from the pool. The caller will free the message from the
-         * pool after finish waiting for the RPC to finish. */
-        caller_slot = uvisor_pool_queue_try_dequeue_first(caller_queue);
-        if (caller_slot >= caller_queue->pool->num) {
-            /* The queue is empty or busy. */
-            break;
+        for (i = kept; i < end; i++) {
+            if (slots[i] >= caller_queue->pool->num) {
+                /* The queue is corrupted. Drop the slot. */
+                callee_boxes[i] = -1;
+                continue;
+            }
+            uvisor_rpc_message_t * caller_msg = &caller_array[slots[i]];
+#if UVISOR_RPC_STATS
+            if (caller_msg->queued_at == 0) {
+                caller_msg->queued_at = rpc_stats_now();
+            }
+#endif
+            callee_boxes[i] = message_callee_box(caller_msg);
+            if (callee_boxes[i] >= 0 && caller_msg->buffer_count &&
+                !is_valid_buffers(caller_msg, caller_box, callee_boxes[i])) {
+                /* Complete the message right away, without calling the
+                 * target function. */
+                caller_msg->state = UVISOR_RPC_MESSAGE_STATE_REJECTED;
+                complete_message(caller_queue, caller_msg, caller_box);
+                callee_boxes[i] = -1;
+            }
         }
 
-        /* If we have seen this slot before, stop processing the queue. */
-        if (first_slot == -1) {
-            first_slot = caller_slot;
-        } else if (caller_slot == first_slot) {
-            put_it_back(caller_queue, caller_slot);
+        /* Deliver each run of messages to the same callee box together. */
+        i = kept;
+        while (i < end) {
+            int callee_box = callee_boxes[i];
+            size_t run = i + 1;
+            size_t delivered;
 
-            /* Stop looping, because the system needs to continue running so
-             * the callee messages can get processed to free up more room.
-             * */
-            break;
+            while (run < end && callee_boxes[run] == callee_box) {
+                run++;
+            }
+
+            if (callee_box < 0) {
+                /* Discard the invalid messages. */
+                delivered = run - i;
+            } else if (blocked_boxes & (1UL << callee_box)) {
+                /* Don't overtake a message kept back for the same callee
+                 * box. */
+                delivered = 0;
+            } else {
+                delivered = deliver_messages(caller_array, &slots[i], run - i, caller_box, callee_box);
+                if (delivered < run - i) {
+                    blocked_boxes |= 1UL << callee_box;
+                }
+            }
+
+            for (j = i; j < run; j++) {
+                int keep = j - i >= delivered;
+#if UVISOR_DRAIN_STATS
+                rpc_wait_record(caller_box, slots[j], keep);
+#endif
+                if (keep) {
+                    slots[kept++] = slots[j];
+                }
+            }
+            i = run;
         }
+    }
 
-        /* We would like to finish processing all messages in the queue, even
-         * if one can't be delivered now. We currently just stop when we can't
-         * deliver one message and never attempt the rest. */
+    /* Put the undelivered messages back into the caller queue, in their
+     * original order, so that they are retried on the next drain. */
+    if (kept) {
+        put_them_back(caller_queue, slots, kept);
+        caller_index->doorbells.queue[UVISOR_BOX_DOORBELL_RPC_OUTGOING] = 1;
+    }
+}
 
-        uvisor_rpc_message_t * caller_msg = &caller_array[caller_slot];
+void drain_message_queue(void)
+{
+    drain_messages(-1);
+}
 
-        /* Validate the gateway */
-        const TRPCGateway * const gateway = caller_msg->gateway;
-        if (!is_valid_rpc_gateway(gateway)) {
-            /* The RPC gateway is not valid. Don't put the message back onto
-             * the queue. Move on to next items. On a non-malicious system, the
-             * gateway should always be valid here. */
-            assert(false);
-            continue;
-        }
+void drain_message_queue_to(int callee_box)
+{
+    drain_messages(callee_box);
+}
 
-        /* Look up the callee box. */
-        const int callee_box = callee_box_id(gateway);
-        if (callee_box < 0) {
-            /* This shouldn't happen, because the gateway was already verified.
-             * */
-            assert(false);
-            continue;
-        }
+/* Return the result of an RPC from the done queue of the callee box to the
+ * outgoing message of the caller box, and free the callee message. */
+static void return_result(uvisor_pool_queue_t * callee_queue, uvisor_pool_slot_t callee_slot, int callee_box)
+{
+    uvisor_rpc_message_t * callee_array = (uvisor_rpc_message_t *) callee_queue->pool->array;
+    uvisor_rpc_message_t * callee_msg = &callee_array[callee_slot];
 
-        UvisorBoxIndex * callee_index = (UvisorBoxIndex *) g_context_current_states[callee_box].bss;
-        uvisor_pool_queue_t * callee_queue = &(uvisor_rpc(callee_index)->incoming_message_queue.todo_queue);
-        uvisor_rpc_message_t * callee_array = (uvisor_rpc_message_t *) callee_queue->pool->array;
-
-        /* Verify that the callee queue is entirely in callee box BSS. We check the
-         * entire queue instead of just the message we are interested in, because
-         * we want to validate the queue before we attempt any operations on it,
-         * like allocating. */
-        if (!is_valid_queue(callee_queue, callee_box))
-        {
-            /* The callee's todo queue is not valid. This shouldn't happen in a
-             * non-malicious system. Don't put the caller's message back into
-             * the queue; this is the same behavior (from the caller's
-             * perspective) as a malicious box never completing RPCs. */
-            assert(false);
-            continue;
-        }
+    /* The callee box is done with the buffers of the RPC. */
+    release_buffers(callee_box, callee_slot);
 
-        /* Place the message into the callee box queue. */
-        uvisor_pool_slot_t callee_slot = uvisor_pool_queue_try_allocate(callee_queue);
-
-        /* If the queue is not busy and there is space in the callee queue: */
-        if (callee_slot < callee_queue->pool->num)
-        {
-            int status;
-            uvisor_rpc_message_t * callee_msg = &callee_array[callee_slot];
-
-            /* Deliver the message. */
-            callee_msg->p0 = caller_msg->p0;
-            callee_msg->p1 = caller_msg->p1;
-            callee_msg->p2 = caller_msg->p2;
-            callee_msg->p3 = caller_msg->p3;
-            callee_msg->gateway = caller_msg->gateway;
-            /* Set the ID of the calling box in the message. */
-            callee_msg->other_box_id = caller_box;
-            callee_msg->match_cookie = caller_msg->match_cookie;
-            callee_msg->state = UVISOR_RPC_MESSAGE_STATE_SENT;
-
-            caller_msg->other_box_id = callee_box;
-            caller_msg->state = UVISOR_RPC_MESSAGE_STATE_SENT;
-
-            /* Enqueue the message */
-            status = uvisor_pool_queue_try_enqueue(callee_queue, callee_slot);
-            /* We should always be able to enqueue, since we were able to
-             * allocate the slot. Nobody else should have been able to run and
-             * take the spin lock. */
-            if (status) {
-                /* We were able to get the callee RPC slot allocated, but
-                 * couldn't enqueue the message. It is bad to take down the
-                 * entire system. It is also bad to keep the allocated slot
-                 * around. However, if we couldn't enqueue the slot, we'll have
-                 * a hard time freeing it, since that requires the same lock.
-                 * */
-                assert(false);
-
-                /* Put the message back into the queue, as we may be able to
-                 * enqueue the message when we try again later. This is likely
-                 * to fail as well, if we couldn't enqueue the message. However,
-                 * if we can't put it back now, there is nothing we can do and
-                 * the message must be lost. */
-                put_it_back(caller_queue, caller_slot);
-                continue;
-            }
+    /* Look up the origin message. This should have been remembered
+     * by uVisor when it did the initial delivery. */
+    uvisor_pool_slot_t caller_slot = uvisor_result_slot(callee_msg->match_cookie);
 
-            /* Poke anybody waiting on calls to this target function. If nobody
-             * is waiting, the item will remain in the incoming queue. The
-             * first time a rpc_fncall_waitfor is called for a function group,
-             * rpc_fncall_waitfor will check to see if there are any messages
-             * it can handle from before the function group existed. */
-            wake_up_handlers_for_target((TFN_Ptr)gateway->target, callee_box);
-        }
 
-        /* If there was no room in the callee queue: */
-        if (callee_slot >= callee_queue->pool->num)
-        {
-            /* Put the message back into the caller queue. This applies
-             * backpressure on the caller when the callee is too busy. Note
-             * that no data needs to be copied; only the caller queue's
-             * management array is modified. */
-            put_it_back(caller_queue, caller_slot);
-        }
-    } while (1);
+    /* Based on the origin message, look up the box to return the result to
+     * (caller box). */
+    const int caller_box = callee_msg->other_box_id;
+
+    UvisorBoxIndex * caller_index = (UvisorBoxIndex *) g_context_current_states[caller_box].bss;
+    uvisor_pool_queue_t * caller_queue = &(uvisor_rpc(caller_index)->outgoing_message_queue.queue);
+    uvisor_rpc_message_t * caller_array = (uvisor_rpc_message_t *) caller_queue->pool->array;
+
+    /* Verify that the caller queue is entirely in caller box BSS. We check the
+     * entire queue instead of just the message we are interested in, because
+     * we want to validate the queue before we attempt any operations on it. */
+    if (!is_valid_queue(caller_queue, caller_box))
+    {
+        /* The caller's outgoing queue is not valid. The caller queue is
+         * messed up. This shouldn't happen in a non-malicious system.
+         * Discard the result message (not retrying later), because the
+         * caller is malicious. */
+        assert(false);
+        return;
+    }
+
+    uvisor_rpc_message_t * caller_msg = &caller_array[caller_slot];
+
+    /* Verify that the caller box is waiting for the callee box to complete
+     * the RPC in this slot. */
+
+    /* Other box ID must be same. */
+    if (caller_msg->other_box_id != callee_box) {
+        /* The caller isn't waiting for this box to complete it. This
+         * shouldn't happen in a non-malicious system. */
+        assert(false);
+        return;
+    }
+
+    /* The caller must be waiting for a box to complete this slot. */
+    if (caller_msg->state != UVISOR_RPC_MESSAGE_STATE_SENT)
+    {
+        /* The caller isn't waiting for any box to complete it. This
+         * shouldn't happen in a non-malicious system. */
+        assert(false);
+        return;
+    }
+
+    /* The match_cookie must be same. */
+    if (caller_msg->match_cookie != callee_msg->match_cookie) {
+        /* The match cookies didn't match. This shouldn't happen in a
+         * non-malicious system. */
+        assert(false);
+        return;
+    }
+
+    /* Copy the result to the message in the caller box outgoing message
+     * queue. */
+    caller_msg->result = callee_msg->result;
+    callee_msg->state = UVISOR_RPC_MESSAGE_STATE_IDLE;
+    caller_msg->state = UVISOR_RPC_MESSAGE_STATE_DONE;
+
+    /* Now that we've copied the result, we can free the message from the
+     * callee queue. The callee (the one sending result messages) doesn't
+     * care about the message after they post it to their outgoing result
+     * queue. */
+    callee_slot = uvisor_pool_queue_try_free(callee_queue, callee_slot);
+    if (callee_slot >= callee_queue->pool->num) {
+        /* The pool is busy. This should never happen. We were able to dequeue
+         * a result message, but weren't able to free the result message. It
+         * is bad to take down the entire system. It is also bad to never free
+         * slots in the outgoing result queue. However, if we could dequeue
+         * the slot we should have no trouble freeing the slot here. */
+        assert(false);
+    }
+
+#if UVISOR_RPC_STATS
+    rpc_stats_record(caller_msg, caller_box);
+#endif
+    complete_message(caller_queue, caller_msg, caller_box);
 }
 
-void drain_result_queue(void)
+/* Return the results of the done queue of the active box to their caller
+ * boxes, or only to one caller box if caller_box is not -1. The other results
+ * stay in the queue for the next drain. */
+static void drain_results(int caller_box_only)
 {
     UvisorBoxIndex * callee_index = (UvisorBoxIndex *) *__uvisor_config.uvisor_box_context;
     uvisor_pool_queue_t * callee_queue = &(uvisor_rpc(callee_index)->incoming_message_queue.done_queue);
     uvisor_rpc_message_t * callee_array = (uvisor_rpc_message_t *) callee_queue->pool->array;
+    uvisor_pool_slot_t slots[UVISOR_RPC_MESSAGE_SLOTS_MAX];
+    size_t kept = 0;
+    size_t count;
 
     int callee_box = g_active_box;
 
+    if (!doorbell_take(callee_index, UVISOR_BOX_DOORBELL_RPC_DONE)) {
+        return;
+    }
+
     /* Verify that the callee queue is entirely in caller box BSS. We check the
      * entire queue instead of just the message we are interested in, because
      * we want to validate the queue before we attempt any operations on it,
@@ -365,106 +989,63 @@ void drain_result_queue(void)
         return;
     }
 
-    /* For each message in the queue: */
-    do {
-        uvisor_pool_slot_t callee_slot;
-
-        /* Dequeue the first result message from the queue. */
-        callee_slot = uvisor_pool_queue_try_dequeue_first(callee_queue);
-        if (callee_slot >= callee_queue->pool->num) {
-            /* The queue is empty or busy. */
-            break;
-        }
-
-        uvisor_rpc_message_t * callee_msg = &callee_array[callee_slot];
-
-        /* Look up the origin message. This should have been remembered
-         * by uVisor when it did the initial delivery. */
-        uvisor_pool_slot_t caller_slot = uvisor_result_slot(callee_msg->match_cookie);
-
-
-        /* Based on the origin message, look up the box to return the result to
-         * (caller box). */
-        const int caller_box = callee_msg->other_box_id;
-
-        UvisorBoxIndex * caller_index = (UvisorBoxIndex *) g_context_current_states[caller_box].bss;
-        uvisor_pool_queue_t * caller_queue = &(uvisor_rpc(caller_index)->outgoing_message_queue.queue);
-        uvisor_rpc_message_t * caller_array = (uvisor_rpc_message_t *) caller_queue->pool->array;
-
-        /* Verify that the caller queue is entirely in caller box BSS. We check the
-         * entire queue instead of just the message we are interested in, because
-         * we want to validate the queue before we attempt any operations on it. */
-        if (!is_valid_queue(caller_queue, caller_box))
-        {
-            /* The caller's outgoing queue is not valid. The caller queue is
-             * messed up. This shouldn't happen in a non-malicious system.
-             * Discard the result message (not retrying later), because the
-             * caller is malicious. */
-            assert(false);
-            continue;
+    /* Dequeue the result messages from the queue in batches. The results for
+     * the caller boxes left out of this drain are kept at the start of the
+     * slots array until they are all put back at once. */
+    while (kept < UVISOR_ARRAY_COUNT(slots) &&
+           (count = uvisor_pool_queue_try_dequeue_batch(callee_queue, &slots[kept], UVISOR_ARRAY_COUNT(slots) - kept)) > 0) {
+        size_t end = kept + count;
+        size_t i;
+        for (i = kept; i < end; i++) {
+            if (slots[i] >= callee_queue->pool->num) {
+                continue;
+            }
+            if (caller_box_only >= 0 && callee_array[slots[i]].other_box_id != caller_box_only) {
+                slots[kept++] = slots[i];
+                continue;
+            }
+            return_result(callee_queue, slots[i], callee_box);
         }
+    }
+    if (kept) {
+        put_them_back(callee_queue, slots, kept);
+        callee_index->doorbells.queue[UVISOR_BOX_DOORBELL_RPC_DONE] = 1;
+    }
 
-        uvisor_rpc_message_t * caller_msg = &caller_array[caller_slot];
-
-        /* Verify that the caller box is waiting for the callee box to complete
-         * the RPC in this slot. */
+    /* The done queue shares its lock with the rest of the incoming message
+     * pool, so a box thread holding it may have kept us from draining it. */
+    if (callee_queue->head < callee_queue->pool->num) {
+        callee_index->doorbells.queue[UVISOR_BOX_DOORBELL_RPC_DONE] = 1;
+    }
+}
 
-        /* Other box ID must be same. */
-        if (caller_msg->other_box_id != callee_box) {
-            /* The caller isn't waiting for this box to complete it. This
-             * shouldn't happen in a non-malicious system. */
-            assert(false);
-            continue;
-        }
+void drain_result_queue(void)
+{
+    drain_results(-1);
+}
 
-        /* The caller must be waiting for a box to complete this slot. */
-        if (caller_msg->state != UVISOR_RPC_MESSAGE_STATE_SENT)
-        {
-            /* The caller isn't waiting for any box to complete it. This
-             * shouldn't happen in a non-malicious system. */
-            assert(false);
-            continue;
-        }
+void drain_result_queue_to(int caller_box)
+{
+    drain_results(caller_box);
+}
 
-        /* The match_cookie must be same. */
-        if (caller_msg->match_cookie != callee_msg->match_cookie) {
-            /* The match cookies didn't match. This shouldn't happen in a
-             * non-malicious system. */
-            assert(false);
-            continue;
-        }
+int rpc_get_stats(uvisor_rpc_stats_t * stats)
+{
+#if UVISOR_RPC_STATS
+    const uint32_t * words = (const uint32_t *) &g_rpc_stats;
+    size_t i;
 
-        /* Copy the result to the message in the caller box outgoing message
-         * queue. */
-        caller_msg->result = callee_msg->result;
-        callee_msg->state = UVISOR_RPC_MESSAGE_STATE_IDLE;
-        caller_msg->state = UVISOR_RPC_MESSAGE_STATE_DONE;
-
-        /* Now that we've copied the result, we can free the message from the
-         * callee queue. The callee (the one sending result messages) doesn't
-         * care about the message after they post it to their outgoing result
-         * queue. */
-        callee_slot = uvisor_pool_queue_try_free(callee_queue, callee_slot);
-        if (callee_slot >= callee_queue->pool->num) {
-            /* The queue is empty or busy. This should never happen. We were
-             * able to dequeue a result message, but weren't able to free the
-             * result message. It is bad to take down the entire system. It is
-             * also bad to never free slots in the outgoing result queue.
-             * However, if we could dequeue the slot we should have no trouble
-             * freeing the slot here. */
-            assert(false);
-            break;
-        }
+    if (g_active_box != 0) {
+        return UVISOR_ERROR_INVALID_BOX_ID;
+    }
 
-        /* Post to the result semaphore, ignoring errors. */
-        int status;
-        status = semaphore_post(&caller_msg->semaphore);
-        if (status) {
-            /* We couldn't post to the result semaphore. We shouldn't really
-             * bring down the entire system if one box messes up its own
-             * semaphore. In a non-malicious system, this should never happen.
-             * */
-            assert(false);
-        }
-    } while (1);
+    /* This faults if the destination is not in memory of the public box. */
+    for (i = 0; i < sizeof(g_rpc_stats) / sizeof(uint32_t); i++) {
+        vmpu_unpriv_uint32_write((uint32_t) stats + i * sizeof(uint32_t), words[i]);
+    }
+    return 0;
+#else
+    (void) stats;
+    return UVISOR_ERROR_NOT_IMPLEMENTED;
+#endif
 }
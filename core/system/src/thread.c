@@ -16,9 +16,11 @@
  */
 #include <uvisor.h>
 // #include "api/inc/vmpu_exports.h"
+#include "channel.h"
 #include "context.h"
 #include "halt.h"
 #include "ipc.h"
+#include "page_allocator.h"
 #include "vmpu.h"
 #include "rpc.h"
 
@@ -105,14 +107,34 @@ void thread_destroy(void * c)
 static void thread_switch_nonatomic(void * c)
 {
     UvisorThreadContext * context = c;
-    UvisorBoxIndex * index;
+    UvisorBoxIndex * index = (UvisorBoxIndex *) *(__uvisor_config.uvisor_box_context);
 
-    /* Drain any outgoing RPC queues */
-    drain_message_queue();
-    drain_result_queue();
+#if defined(ARCH_CORE_ARMv7M)
+    /* The target function of a direct RPC runs in the calling thread, so it
+     * must not block. */
+    if (rpc_direct_is_active()) {
+        HALT_ERROR(NOT_ALLOWED, "The target function of a direct RPC must not switch threads.");
+    }
+#endif /* defined(ARCH_CORE_ARMv7M) */
+
+    /* Only visit the queues of the active box if it has rung any of their
+     * doorbells since the last switch. */
+    if (index->doorbells.any) {
+        /* Drain any outgoing RPC queues */
+        drain_message_queue();
+        drain_result_queue();
+
+        /* Drain the IPC queue. */
+        ipc_drain_queue();
 
-    /* Drain the IPC queue. */
-    ipc_drain_queue();
+        /* Wake up the consumers of the channels the box writes to. */
+        channel_drain();
+    }
+
+    /* Zero some free pages in advance, so that allocations need not. */
+    if (g_page_count_dirty) {
+        page_allocator_clean(UVISOR_PAGE_CLEAN_MAX_COUNT);
+    }
 
     if (context == NULL) {
         return;
@@ -164,6 +164,9 @@ extern uint32_t vmpu_acl_static_region(uint8_t region, void* base, uint32_t size
 
 extern void vmpu_arch_init(void);
 extern void vmpu_arch_init_hw(void);
+/* Prepare the architecture-specific per-box state once all boxes have been
+ * enumerated and before switching to the first box. */
+extern void vmpu_arch_init_boxes(void);
 extern int  vmpu_init_pre(void);
 extern void vmpu_init_post(void);
 
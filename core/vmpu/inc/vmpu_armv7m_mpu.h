@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __VMPU_ARMV7M_MPU_H__
+#define __VMPU_ARMV7M_MPU_H__
+
+#include "vmpu_mpu.h"
+#include <stdint.h>
+
+/* set default MPU region count */
+#ifndef ARMv7M_MPU_REGIONS
+#define ARMv7M_MPU_REGIONS 8
+#endif/*ARMv7M_MPU_REGIONS*/
+
+/* All ARMv7-M cores with an MPU provide the RBAR_A1..A3 and RASR_A1..A3 alias
+ * registers. Set this to 0 to program the MPU regions one by one instead. */
+#ifndef ARMv7M_MPU_ALIASES
+#define ARMv7M_MPU_ALIASES 1
+#endif/*ARMv7M_MPU_ALIASES*/
+
+#define ARMv7M_MPU_REGIONS_STATIC 2
+#define ARMv7M_MPU_REGIONS_MAX (ARMv7M_MPU_REGIONS)
+
+/* RBAR value that selects an MPU region and sets its base address. */
+#define MPU_RBAR(region,addr)   (((uint32_t)(region))|MPU_RBAR_VALID_Msk|addr)
+
+/* Image of the MPU regions, as seen by the hardware.
+ * An image is built by pushing regions into it with the same round robin
+ * policy used for the MPU itself. Only the dynamic regions of an image are
+ * ever loaded into the MPU. */
+typedef struct {
+    uint32_t rbar[ARMv7M_MPU_REGIONS_MAX];
+    uint32_t rasr[ARMv7M_MPU_REGIONS_MAX];
+    uint8_t priority[ARMv7M_MPU_REGIONS_MAX];
+    /* Last slot used by the round robin scheduling. */
+    uint8_t slot;
+    /* Slot reserved for the page heap region, or 0 if there is none. */
+    uint8_t page_slot;
+    /* Number of regions pushed into the image. */
+    uint8_t pushes;
+} MpuImage;
+
+/** Reset an MPU image to the state the MPU is in after `vmpu_mpu_invalidate`.
+ *
+ * @param[out] image    MPU image to reset
+ */
+void vmpu_mpu_image_init(MpuImage * const image);
+
+/** Push a region into an MPU image with the given priority.
+ * This follows the same rules as `vmpu_mpu_push`, but it only changes the
+ * image, not the MPU.
+ *
+ * @param image     MPU image to modify
+ * @param region    MPU region to enable, `NULL` to reserve a disabled slot
+ * @param priority  region priority in the range of `1` to `255`
+ * @returns         the slot the region has been placed in
+ */
+uint8_t vmpu_mpu_image_push(MpuImage * const image, const MpuRegion * const region, uint8_t priority);
+
+/** Find the dynamic regions of an MPU image that differ from the loaded ones.
+ * The loaded image is updated to match the new one, including its page heap
+ * region.
+ *
+ * @param loaded[in,out]    MPU image currently loaded in the MPU
+ * @param image             MPU image to load
+ * @param page_region       MPU region to place in the page heap slot of the image
+ * @param writes[out]       RBAR/RASR pairs to write to the MPU, with room for
+ *                          all the dynamic regions
+ * @param disable[out]      mask of the slots in `writes` that are enabled in
+ *                          the MPU, and must be disabled before they are
+ *                          written
+ * @returns                 the number of values in `writes`
+ */
+int vmpu_mpu_image_diff(MpuImage * const loaded, const MpuImage * const image, const MpuRegion * const page_region,
+                        uint32_t * const writes, uint32_t * const disable);
+
+/** Load the dynamic regions of an MPU image into the MPU.
+ * Only the MPU slots that differ from the currently loaded ones are written.
+ *
+ * @param image         MPU image to load
+ * @param page_region   MPU region to place in the page heap slot of the image
+ */
+void vmpu_mpu_image_load(const MpuImage * const image, const MpuRegion * const page_region);
+
+/** Check whether an enabled dynamic MPU region gives read-only access to an
+ * address to unprivileged code.
+ *
+ * @param addr  address to check
+ * @returns     true if a read-only region covers the address
+ */
+bool vmpu_mpu_read_only_covers(uint32_t addr);
+
+/** Get the number of MPU register writes that were avoided by
+ * `vmpu_mpu_image_load`, compared to invalidating the MPU and pushing all the
+ * regions again.
+ *
+ * @returns the number of MPU register writes saved since boot
+ */
+uint32_t vmpu_mpu_get_writes_saved(void);
+
+/** Find the order in which to lay out MPU regions back-to-back so that the
+ * total memory used is minimized.
+ * Each region has a power-of-two size and must be aligned to a multiple of
+ * its own size.
+ *
+ * @param region_size[in]   size of each region
+ * @param count             number of regions
+ * @param start             address of the first available byte
+ * @param order[out]        indexes of the regions, in placement order
+ * @returns                 the amount of memory used, including padding
+ */
+uint32_t vmpu_order_regions(uint32_t const * const region_size, int count, uint32_t start, int * const order);
+
+#endif /* __VMPU_ARMV7M_MPU_H__ */
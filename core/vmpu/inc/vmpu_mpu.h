@@ -116,6 +116,11 @@ void vmpu_mpu_lock(void);
 /** Invalidate all configured MPU regions. */
 void vmpu_mpu_invalidate(void);
 
+/** Invalidate the MPU regions that map the page heap for the active box.
+ * All other MPU regions are left in place. Pages the box can still access are
+ * faulted back in on their next access. */
+void vmpu_mpu_invalidate_pages(void);
+
 /** Push a region into the MPU with the given priority.
  * A higher priority region replaces a lower priority region.
  * If no lower priority region can be found, the next viable region is replaced.
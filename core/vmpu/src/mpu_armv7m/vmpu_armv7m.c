@@ -22,7 +22,7 @@
 #include "svc.h"
 #include "virq.h"
 #include "vmpu.h"
-#include "vmpu_mpu.h"
+#include "vmpu_armv7m_mpu.h"
 #include "page_allocator_faults.h"
 #include "page_allocator.h"
 #include <stdbool.h>
@@ -85,12 +85,13 @@ uint32_t vmpu_fault_find_acl(uint32_t fault_addr, uint32_t size)
     return region->acl;
 }
 
-static int vmpu_mem_push_page_acl_iterator(uint8_t mask, uint8_t index);
+static void vmpu_mem_push_page_acl(uint8_t mask, page_index_t index, bool read_only);
 
 static int vmpu_fault_recovery_mpu(uint32_t pc, uint32_t sp, uint32_t fault_addr, uint32_t fault_status)
 {
     const MpuRegion *region;
-    uint8_t mask, index, page;
+    uint8_t mask;
+    page_index_t index, page;
 
     /* No recovery is possible if the MPU syndrome register is not valid or
      * this is not a stacking fault (where the MPU syndrome register would not
@@ -101,10 +102,18 @@ static int vmpu_fault_recovery_mpu(uint32_t pc, uint32_t sp, uint32_t fault_addr
     }
 
     if (page_allocator_get_active_mask_for_address(fault_addr, &mask, &index, &page) == UVISOR_ERROR_PAGE_OK) {
+        bool read_only = page_allocator_is_read_only(g_active_box, fault_addr);
+
+        /* The MPU does not tell reads and writes apart. If a read-only region
+         * already covers the address, only a write could have faulted. */
+        if (read_only && vmpu_mpu_read_only_covers(fault_addr)) {
+            return 0;
+        }
+
         /* Remember this fault. */
         page_allocator_register_fault(page);
 
-        vmpu_mem_push_page_acl_iterator(mask, UVISOR_PAGE_MAP_COUNT * 4 - 1 - index);
+        vmpu_mem_push_page_acl(mask, UVISOR_PAGE_MAP_COUNT * 4 - 1 - index, read_only);
     } else {
         /* Find region for faulting address. */
         if ((region = vmpu_fault_find_region(fault_addr)) == NULL) {
@@ -244,56 +253,102 @@ uint32_t vmpu_sys_mux_handler(uint32_t lr, uint32_t msp)
     return lr;
 }
 
-static int vmpu_mem_push_page_acl_iterator(uint8_t mask, uint8_t index)
+static void vmpu_mem_page_acl_region(MpuRegion * const region, uint8_t mask, page_index_t index, bool read_only)
 {
-    MpuRegion region;
     uint32_t size = g_page_size * 8;
     vmpu_region_translate_acl(
-        &region,
+        region,
         (g_page_head_end_rounded - size * (index + 1)),
         size,
-        UVISOR_TACLDEF_DATA | UVISOR_TACL_EXECUTE,
+        read_only ? (UVISOR_TACL_UREAD | UVISOR_TACL_SREAD) : (UVISOR_TACLDEF_DATA | UVISOR_TACL_EXECUTE),
         ~mask
     );
+}
+
+static void vmpu_mem_push_page_acl(uint8_t mask, page_index_t index, bool read_only)
+{
+    MpuRegion region;
+    vmpu_mem_page_acl_region(&region, mask, index, read_only);
     vmpu_mpu_push(&region, 100);
+}
+
+/* Page heap region of the box being switched to. */
+static MpuRegion g_vmpu_page_region;
+static bool g_vmpu_page_region_valid;
+
+static int vmpu_mem_get_page_acl_iterator(uint8_t mask, page_index_t index)
+{
+    vmpu_mem_page_acl_region(&g_vmpu_page_region, mask, index, false);
+    g_vmpu_page_region_valid = true;
     /* We do not add more than one region for the page heap. */
     return 0;
 }
 
-/* This function assumes that its inputs are validated. */
-/* FIXME: We've added very simple MPU region switching. - Optimize! */
-void vmpu_switch(uint8_t src_box, uint8_t dst_box)
+/* Precomputed MPU images for each box, without and with a page heap region. */
+static MpuImage g_vmpu_box_image[UVISOR_MAX_BOXES][2];
+
+static void vmpu_box_image_build(uint8_t box_id, MpuImage * const image, bool page_heap)
 {
     uint32_t dst_count;
     const MpuRegion * region;
 
-    /* DPRINTF("switching from %i to %i\n\r", src_box, dst_box); */
-
-    vmpu_mpu_invalidate();
+    vmpu_mpu_image_init(image);
 
     /* Update target box first to make target stack available. */
-    vmpu_region_get_for_box(dst_box, &region, &dst_count);
+    vmpu_region_get_for_box(box_id, &region, &dst_count);
 
     /* Only write stack and context ACL for secure boxes. */
-    if (dst_box) {
+    if (box_id) {
         assert(dst_count);
         /* Push the stack and context protection ACL into ARMv7M_MPU_REGIONS_STATIC. */
-        vmpu_mpu_push(region, 255);
+        vmpu_mpu_image_push(image, region, 255);
         region++;
         dst_count--;
     }
 
-    /* Push one ACL for the page heap into place. */
-    page_allocator_iterate_active_page_masks(vmpu_mem_push_page_acl_iterator, PAGE_ALLOCATOR_ITERATOR_DIRECTION_BACKWARD);
-    /* g_mpu_slot may now have been incremented by one, if page heap is used by this box. */
+    /* Reserve one slot for the page heap. Its subregions mask is only known
+     * at switch time. */
+    if (page_heap) {
+        image->page_slot = vmpu_mpu_image_push(image, NULL, 100);
+    }
 
-    while (dst_count-- && vmpu_mpu_push(region++, 2));
+    while (dst_count--) {
+        vmpu_mpu_image_push(image, region++, 2);
+    }
 
-    if (!dst_box) {
+    if (!box_id) {
         /* Handle public box ACLs last. */
         vmpu_region_get_for_box(0, &region, &dst_count);
 
-        while (dst_count-- && vmpu_mpu_push(region++, 1));
+        while (dst_count--) {
+            vmpu_mpu_image_push(image, region++, 1);
+        }
+    }
+}
+
+void vmpu_arch_init_boxes(void)
+{
+    for (uint8_t box_id = 0; box_id < g_vmpu_box_count; ++box_id) {
+        vmpu_box_image_build(box_id, &g_vmpu_box_image[box_id][0], false);
+        vmpu_box_image_build(box_id, &g_vmpu_box_image[box_id][1], true);
+    }
+}
+
+/* This function assumes that its inputs are validated. */
+void vmpu_switch(uint8_t src_box, uint8_t dst_box)
+{
+    /* DPRINTF("switching from %i to %i\n\r", src_box, dst_box); */
+
+    /* Find the one page heap region of the target box, if any. */
+    g_vmpu_page_region_valid = false;
+    page_allocator_iterate_active_page_masks(vmpu_mem_get_page_acl_iterator, PAGE_ALLOCATOR_ITERATOR_DIRECTION_BACKWARD);
+
+    /* Only the MPU regions that differ from the ones currently loaded are
+     * written to the MPU. */
+    if (g_vmpu_page_region_valid) {
+        vmpu_mpu_image_load(&g_vmpu_box_image[dst_box][1], &g_vmpu_page_region);
+    } else {
+        vmpu_mpu_image_load(&g_vmpu_box_image[dst_box][0], NULL);
     }
 }
 
@@ -511,67 +566,47 @@ void vmpu_arch_init_hw(void)
     }
 }
 
-static void swap_boxes(int * const b1, int * const b2)
-{
-    uint32_t tmp = *b1;
-    *b1 = *b2;
-    *b2 = tmp;
-}
-
-static uint32_t __vmpu_order_boxes(int * const box_order, int * const best_order, int start, int end, uint32_t min_size)
+/* Find the order of the secure boxes in SRAM that minimizes the memory used.
+ * The public box (index 0) is not placed in the boxes SRAM and keeps its
+ * position. The function returns the total amount of SRAM used. */
+static uint32_t __vmpu_order_boxes(int * const best_order, int box_count)
 {
-    /* When a permutation is found, calculate the SRAM usage of the box
-     * configuration and save the configuration if it's the best so far. */
-    if (start == end) {
-        uint32_t sram_offset = (uint32_t) __uvisor_config.bss_boxes_start;
-        /* Skip the public box. */
-        for (int i = 1; i <= end; ++i) {
-            int index = box_order[i];
-            UvisorBoxConfig const * box_cfgtbl = ((UvisorBoxConfig const * *) __uvisor_config.cfgtbl_ptr_start)[index];
-            uint32_t bss_size = 0;
-            for (int j = 0; j < UVISOR_BSS_SECTIONS_COUNT; ++j) {
-                bss_size += box_cfgtbl->bss.sizes[j];
-            }
-            uint32_t stack_size = box_cfgtbl->stack_size;
-            /* This function automatically updates the sram_offset parameter to
-             * meet the MPU alignment requirements. */
-            uint32_t region_size = vmpu_acl_sram_region_size(&sram_offset, bss_size, stack_size);
-            sram_offset += region_size;
-        }
-        /* Update the best box configuration. */
-        uint32_t sram_size = sram_offset - (uint32_t) __uvisor_config.bss_boxes_start;
-        if (sram_size < min_size) {
-            min_size = sram_size;
-            for (int i = 0; i <= end; ++i) {
-                best_order[i] = box_order[i];
-            }
+    uint32_t region_size[UVISOR_MAX_BOXES];
+    int region_order[UVISOR_MAX_BOXES];
+
+    /* Compute the MPU region size of each secure box once. */
+    for (int index = 1; index < box_count; ++index) {
+        UvisorBoxConfig const * box_cfgtbl = ((UvisorBoxConfig const * *) __uvisor_config.cfgtbl_ptr_start)[index];
+        uint32_t bss_size = 0;
+        for (int j = 0; j < UVISOR_BSS_SECTIONS_COUNT; ++j) {
+            bss_size += box_cfgtbl->bss.sizes[j];
         }
+        /* Use the same stack size that vmpu_acl_sram will use later on. */
+        uint32_t stack_size = UVISOR_MIN_STACK(box_cfgtbl->stack_size);
+        /* An offset of 0 is aligned to any region size, so it is not changed. */
+        uint32_t region_start = 0;
+        region_size[index - 1] = vmpu_acl_sram_region_size(&region_start, bss_size, stack_size);
     }
 
-    /* Permute the boxes order. */
-    for (int i = start; i <= end; ++i) {
-        /* Swap, recurse, swap. */
-        swap_boxes(&box_order[start], &box_order[i]);
-        min_size = __vmpu_order_boxes(box_order, best_order, start + 1, end, min_size);
-        swap_boxes(&box_order[start], &box_order[i]);
+    uint32_t sram_size = vmpu_order_regions(region_size, box_count - 1,
+                                            (uint32_t) __uvisor_config.bss_boxes_start, region_order);
+    best_order[0] = 0;
+    for (int i = 1; i < box_count; ++i) {
+        best_order[i] = region_order[i - 1] + 1;
     }
-    return min_size;
+    return sram_size;
 }
 
 void vmpu_order_boxes(int * const best_order, int box_count)
 {
-    /* Start with the same order of configuration table pointers. */
-    int box_order[UVISOR_MAX_BOXES];
-    for (int i = 0; i < box_count; ++i) {
-        box_order[i] = i;
-    }
-    
     uint32_t total_sram_size = 0;
     if (box_count > 1) {
         /* Find the total amount of SRAM used by all the boxes.
          * This function also updates the best_order array with the configuration
          * that minimizes the SRAM usage. */
-        total_sram_size = __vmpu_order_boxes(box_order, best_order, 1, box_count - 1, UINT32_MAX);
+        total_sram_size = __vmpu_order_boxes(best_order, box_count);
+    } else if (box_count == 1) {
+        best_order[0] = 0;
     }
     /* This helper message allows people to work around the linker script
      * limitation that prevents us from allocating the correct amount of memory
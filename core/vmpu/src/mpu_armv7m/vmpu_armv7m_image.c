@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <uvisor.h>
+#include "vmpu_armv7m_mpu.h"
+#include <stdint.h>
+
+/* This file does not depend on the hardware, so that it can also be compiled
+ * for the host by the host benchmarks. */
+
+static uint32_t g_mpu_writes_saved;
+
+void vmpu_mpu_image_init(MpuImage * const image)
+{
+    for (uint8_t slot = 0; slot < ARMv7M_MPU_REGIONS_MAX; ++slot) {
+        image->rbar[slot] = MPU_RBAR(slot, 0);
+        image->rasr[slot] = 0;
+        image->priority[slot] = (slot < ARMv7M_MPU_REGIONS_STATIC) ? 255 : 0;
+    }
+    image->slot = ARMv7M_MPU_REGIONS_STATIC;
+    image->page_slot = 0;
+    image->pushes = 0;
+}
+
+uint8_t vmpu_mpu_image_push(MpuImage * const image, const MpuRegion * const region, uint8_t priority)
+{
+    if (!priority) priority = 1;
+
+    const uint8_t start_slot = image->slot;
+    uint8_t viable_slot = start_slot;
+    uint8_t slot;
+
+    do {
+        if (++image->slot >= ARMv7M_MPU_REGIONS_MAX) {
+            image->slot = ARMv7M_MPU_REGIONS_STATIC;
+        }
+
+        if (image->priority[image->slot] < priority) {
+            /* We can place this region in here. */
+            break;
+        }
+        viable_slot = image->slot;
+    }
+    while (image->slot != start_slot);
+
+    if (image->priority[image->slot] < priority) {
+        slot = image->slot;
+    } else {
+        /* We did not find a slot with a lower priority, so just take the next
+         * position that does not have the highest priority. */
+        slot = viable_slot;
+    }
+
+    uint32_t start = region ? region->start : 0;
+    image->rbar[slot] = MPU_RBAR(slot, start);
+    image->rasr[slot] = region ? region->config : 0;
+    image->priority[slot] = priority;
+    image->pushes++;
+
+    return slot;
+}
+
+int vmpu_mpu_image_diff(MpuImage * const loaded, const MpuImage * const image, const MpuRegion * const page_region,
+                        uint32_t * const writes, uint32_t * const disable)
+{
+    int count = 0;
+
+    *disable = 0;
+
+    for (uint8_t slot = ARMv7M_MPU_REGIONS_STATIC; slot < ARMv7M_MPU_REGIONS_MAX; ++slot) {
+        uint32_t rbar = image->rbar[slot];
+        uint32_t rasr = image->rasr[slot];
+        if (slot == image->page_slot && page_region) {
+            rbar = MPU_RBAR(slot, page_region->start);
+            rasr = page_region->config;
+        }
+
+        /* The base address of a disabled region is irrelevant. */
+        if (rasr != loaded->rasr[slot] || (rasr && rbar != loaded->rbar[slot])) {
+            if (loaded->rasr[slot]) {
+                *disable |= (1UL << slot);
+            }
+            writes[count++] = rbar;
+            writes[count++] = rasr;
+            loaded->rbar[slot] = rbar;
+            loaded->rasr[slot] = rasr;
+        }
+        loaded->priority[slot] = image->priority[slot];
+    }
+    loaded->slot = image->slot;
+
+    /* Invalidating the MPU takes 3 writes per dynamic region, and each pushed
+     * region takes another 2. Disabling a region first takes 2 writes. */
+    g_mpu_writes_saved += 3 * (ARMv7M_MPU_REGIONS_MAX - ARMv7M_MPU_REGIONS_STATIC) + 2 * image->pushes - count -
+                          2 * __builtin_popcount(*disable);
+
+    return count;
+}
+
+uint32_t vmpu_mpu_get_writes_saved(void)
+{
+    return g_mpu_writes_saved;
+}
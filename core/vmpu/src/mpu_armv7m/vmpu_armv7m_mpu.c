@@ -18,9 +18,10 @@
 #include "debug.h"
 #include "context.h"
 #include "halt.h"
+#include "page_allocator.h"
 #include "page_allocator_faults.h"
 #include "vmpu.h"
-#include "vmpu_mpu.h"
+#include "vmpu_armv7m_mpu.h"
 
 /* This file contains the configuration-specific symbols. */
 #include "configurations.h"
@@ -35,11 +36,6 @@
 #define ARMv7M_MPU_ALIGNMENT_BITS 5
 #endif/*ARMv7M_MPU_ALIGNMENT_BITS*/
 
-/* set default MPU region count */
-#ifndef ARMv7M_MPU_REGIONS
-#define ARMv7M_MPU_REGIONS 8
-#endif/*ARMv7M_MPU_REGIONS*/
-
 /* The ARMv7-M MPU has 8 MPU regions plus one background region.
  * Region 0 and 1 are used to unlock Application RAM and Flash.
  * When switching into a secure box, region 2 is used to protect the boxes
@@ -61,11 +57,7 @@
  * |    0    | <-- Application Flash unlock
  * +---------+
  */
-#define ARMv7M_MPU_REGIONS_STATIC 2
-#define ARMv7M_MPU_REGIONS_MAX (ARMv7M_MPU_REGIONS)
-
 /* MPU helper macros */
-#define MPU_RBAR(region,addr)   (((uint32_t)(region))|MPU_RBAR_VALID_Msk|addr)
 #define MPU_RBAR_RNR(addr)     (addr)
 
 typedef struct
@@ -78,8 +70,11 @@ static uint16_t g_mpu_region_count;
 static MpuRegion g_mpu_region[MPU_ACL_COUNT];
 static MpuRegionSlice g_mpu_box_region[UVISOR_MAX_BOXES];
 
-static uint8_t g_mpu_slot = ARMv7M_MPU_REGIONS_STATIC;
-static uint8_t g_mpu_priority[ARMv7M_MPU_REGIONS_MAX];
+/* Image of the regions currently loaded in the MPU. */
+static MpuImage g_mpu_image = {
+    .priority = {255, 255},
+    .slot = ARMv7M_MPU_REGIONS_STATIC,
+};
 
 /* various MPU flags */
 #define MPU_RASR_AP_PNO_UNO (0x00UL<<MPU_RASR_AP_Pos)
@@ -481,14 +476,15 @@ uint32_t vmpu_mpu_set_static_acl(uint8_t index, uint32_t start, uint32_t size,
     /* apply RASR & RBAR */
     MPU->RBAR = MPU_RBAR(index, region.start);
     MPU->RASR = region.config;
-    g_mpu_priority[index] = 255;
+    g_mpu_image.rbar[index] = MPU_RBAR(index, region.start);
+    g_mpu_image.rasr[index] = region.config;
+    g_mpu_image.priority[index] = 255;
 
     return rounded_size;
 }
 
 void vmpu_mpu_invalidate(void)
 {
-    g_mpu_slot = ARMv7M_MPU_REGIONS_STATIC;
     uint8_t slot = ARMv7M_MPU_REGIONS_STATIC;
     while (slot < ARMv7M_MPU_REGIONS_MAX) {
         /* We need to make sure that we disable an enabled MPU region before any
@@ -497,39 +493,101 @@ void vmpu_mpu_invalidate(void)
         MPU->RNR = slot;
         MPU->RASR = 0;
         MPU->RBAR = 0;
-        g_mpu_priority[slot] = 0;
         slot++;
     }
+    vmpu_mpu_image_init(&g_mpu_image);
 }
 
-bool vmpu_mpu_push(const MpuRegion * const region, uint8_t priority)
+/* Return the size of an enabled region from its RASR value. */
+static uint32_t vmpu_mpu_rasr_size(uint32_t rasr)
 {
-    if (!priority) priority = 1;
+    return 1UL << (((rasr & MPU_RASR_SIZE_Msk) >> MPU_RASR_SIZE_Pos) + 1);
+}
 
-    const uint8_t start_slot = g_mpu_slot;
-    uint8_t viable_slot = start_slot;
+void vmpu_mpu_invalidate_pages(void)
+{
+    const uint32_t heap_start = (uint32_t) g_page_heap_start;
+    const uint32_t heap_end = (uint32_t) g_page_heap_end;
 
-    do {
-        if (++g_mpu_slot >= ARMv7M_MPU_REGIONS_MAX) {
-            g_mpu_slot = ARMv7M_MPU_REGIONS_STATIC;
+    for (uint8_t slot = ARMv7M_MPU_REGIONS_STATIC; slot < ARMv7M_MPU_REGIONS_MAX; ++slot) {
+        uint32_t rasr = g_mpu_image.rasr[slot];
+        uint32_t start = g_mpu_image.rbar[slot] & MPU_RBAR_ADDR_Msk;
+        if (!(rasr & MPU_RASR_ENABLE_Msk) || start >= heap_end || start + vmpu_mpu_rasr_size(rasr) <= heap_start) {
+            continue;
         }
+        MPU->RNR = slot;
+        MPU->RASR = 0;
+        g_mpu_image.rasr[slot] = 0;
+        g_mpu_image.priority[slot] = 0;
+    }
+}
 
-        if (g_mpu_priority[g_mpu_slot] < priority) {
-            /* We can place this region in here. */
-            MPU->RBAR = MPU_RBAR(g_mpu_slot, region->start);
-            MPU->RASR = region->config;
-            g_mpu_priority[g_mpu_slot] = priority;
-            return true;
+bool vmpu_mpu_push(const MpuRegion * const region, uint8_t priority)
+{
+    uint8_t slot = vmpu_mpu_image_push(&g_mpu_image, region, priority);
+
+    MPU->RBAR = g_mpu_image.rbar[slot];
+    MPU->RASR = g_mpu_image.rasr[slot];
+
+    return true;
+}
+
+void vmpu_mpu_image_load(const MpuImage * const image, const MpuRegion * const page_region)
+{
+    /* RBAR/RASR pairs that need to be written to the MPU. */
+    uint32_t writes[2 * (ARMv7M_MPU_REGIONS_MAX - ARMv7M_MPU_REGIONS_STATIC)];
+    uint32_t disable;
+    int count = vmpu_mpu_image_diff(&g_mpu_image, image, page_region, writes, &disable);
+
+    /* We need to make sure that we disable an enabled MPU region before any
+     * other modification, so that it never has its new base address with its
+     * old size and permissions. */
+    while (disable) {
+        MPU->RNR = __builtin_ctz(disable);
+        MPU->RASR = 0;
+        disable &= disable - 1;
+    }
+
+    /* The RBAR values select the MPU region themselves, and all the regions
+     * that are written are disabled now, so they can be written in any
+     * order. */
+#if ARMv7M_MPU_ALIASES
+    /* Write up to 4 regions at a time through the alias registers. */
+    volatile uint32_t * const alias = &MPU->RBAR;
+    for (int i = 0; i < count; i += 8) {
+        int chunk = (count - i) < 8 ? (count - i) : 8;
+        for (int j = 0; j < chunk; ++j) {
+            alias[j] = writes[i + j];
         }
-        viable_slot = g_mpu_slot;
     }
-    while (g_mpu_slot != start_slot);
+#else
+    for (int i = 0; i < count; i += 2) {
+        MPU->RBAR = writes[i];
+        MPU->RASR = writes[i + 1];
+    }
+#endif /* ARMv7M_MPU_ALIASES */
+}
+
+bool vmpu_mpu_read_only_covers(uint32_t addr)
+{
+    for (uint8_t slot = ARMv7M_MPU_REGIONS_STATIC; slot < ARMv7M_MPU_REGIONS_MAX; ++slot) {
+        uint32_t rasr = g_mpu_image.rasr[slot];
+        uint32_t ap = rasr & MPU_RASR_AP_Msk;
+        if (!(rasr & MPU_RASR_ENABLE_Msk) || (ap != MPU_RASR_AP_PRW_URO && ap != MPU_RASR_AP_PRO_URO)) {
+            continue;
+        }
 
-    /* We did not find a slot with a lower priority, so just take the next
-     * position that does not have the highest priority. */
-    MPU->RBAR = MPU_RBAR(viable_slot, region->start);
-    MPU->RASR = region->config;
-    g_mpu_priority[viable_slot] = priority;
+        uint32_t size = vmpu_mpu_rasr_size(rasr);
+        uint32_t offset = addr - (g_mpu_image.rbar[slot] & MPU_RBAR_ADDR_Msk);
+        if (offset >= size) {
+            continue;
+        }
 
-    return true;
+        /* Subregions are only supported for regions of 256 bytes and up. */
+        if (size >= 256 && (rasr & (1UL << (MPU_RASR_SRD_Pos + offset / (size / 8))))) {
+            continue;
+        }
+        return true;
+    }
+    return false;
 }
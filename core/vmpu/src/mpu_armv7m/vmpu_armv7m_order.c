@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "vmpu_armv7m_mpu.h"
+#include <stdint.h>
+
+/* This file does not depend on the hardware, so that it can also be compiled
+ * for the host by the host benchmarks. */
+
+static uint32_t vmpu_order_align(uint32_t offset, uint32_t size)
+{
+    return (offset + size - 1) & ~(size - 1);
+}
+
+/* The regions are laid out back-to-back, each one aligned to its own size. At
+ * every step the planner picks, among the regions that are still unplaced, the
+ * one that can start the earliest; ties are broken in favour of the largest
+ * region. Since region sizes are powers of two, a region that fits at the
+ * current offset without padding leaves the offset aligned to its own size, so
+ * placing the largest of such regions first never makes the subsequent ones
+ * need more padding. When no region fits without padding, the one with the
+ * smallest alignment wastes the least memory.
+ * This yields the same memory usage as an exhaustive search over all the
+ * permutations of the regions in O(n^2) instead of O(n!) time. */
+uint32_t vmpu_order_regions(uint32_t const * const region_size, int count, uint32_t start, int * const order)
+{
+    uint32_t offset = start;
+
+    for (int i = 0; i < count; ++i) {
+        order[i] = i;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        int best = i;
+        uint32_t best_start = vmpu_order_align(offset, region_size[order[i]]);
+        for (int j = i + 1; j < count; ++j) {
+            uint32_t size = region_size[order[j]];
+            uint32_t region_start = vmpu_order_align(offset, size);
+            if (region_start < best_start ||
+                (region_start == best_start && size > region_size[order[best]])) {
+                best = j;
+                best_start = region_start;
+            }
+        }
+
+        /* Place the selected region next. */
+        int tmp = order[i];
+        order[i] = order[best];
+        order[best] = tmp;
+        offset = best_start + region_size[order[i]];
+    }
+
+    return offset - start;
+}
@@ -71,7 +71,7 @@ uint32_t vmpu_fault_find_acl(uint32_t fault_addr, uint32_t size)
     return region->acl;
 }
 
-static int vmpu_mem_push_page_acl_iterator(uint32_t start_addr, uint32_t end_addr, uint8_t page)
+static int vmpu_mem_push_page_acl_iterator(uint32_t start_addr, uint32_t end_addr, page_index_t page)
 {
     (void) page;
     MpuRegion region = {.start = start_addr, .end = end_addr, .config = 1};
@@ -83,7 +83,7 @@ int vmpu_fault_recovery_mpu(uint32_t pc, uint32_t sp, uint32_t fault_addr, uint3
 {
     const MpuRegion *region;
     uint32_t start_addr, end_addr;
-    uint8_t page;
+    page_index_t page;
 
     if (page_allocator_get_active_region_for_address(fault_addr, &start_addr, &end_addr, &page) == UVISOR_ERROR_PAGE_OK) {
         /* Remember this fault. */
@@ -334,3 +334,8 @@ void vmpu_order_boxes(int * const best_order, int box_count)
         best_order[i] = i;
     }
 }
+
+void vmpu_arch_init_boxes(void)
+{
+    /* Nothing to prepare, the MPU regions are computed at every switch. */
+}
@@ -18,6 +18,7 @@
 #include "debug.h"
 #include "context.h"
 #include "halt.h"
+#include "page_allocator.h"
 #include "page_allocator_faults.h"
 #include "vmpu.h"
 #include "vmpu_mpu.h"
@@ -358,6 +359,24 @@ void vmpu_mpu_invalidate(void)
     }
 }
 
+void vmpu_mpu_invalidate_pages(void)
+{
+    const uint32_t heap_start = (uint32_t) g_page_heap_start;
+    const uint32_t heap_end = (uint32_t) g_page_heap_end;
+
+    uint8_t slot = ARMv8M_SAU_REGIONS_STATIC;
+    for (; slot < ARMv8M_SAU_REGIONS_MAX; slot++) {
+        /* Page ACLs are pushed one page at a time. */
+        SAU->RNR = slot;
+        uint32_t start = SAU->RBAR;
+        if ((SAU->RLAR & SAU_RLAR_ENABLE_Msk) && start >= heap_start && start < heap_end) {
+            SAU->RLAR = 0;
+            SAU->RBAR = 0;
+            g_mpu_priority[slot] = 0;
+        }
+    }
+}
+
 static void vmpu_sau_add_region(const MpuRegion * const region, uint8_t slot, uint8_t priority)
 {
     SAU->RNR = slot;
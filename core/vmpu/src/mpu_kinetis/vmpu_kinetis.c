@@ -31,14 +31,18 @@
 
 uint32_t g_box_mem_pos;
 
-static int vmpu_fault_recovery_mpu(uint32_t pc, uint32_t sp, uint32_t fault_addr)
+static int vmpu_fault_recovery_mpu(uint32_t pc, uint32_t sp, uint32_t fault_addr, bool write)
 {
     uint32_t start_addr, end_addr;
-    uint8_t page;
+    page_index_t page;
 
     /* Check if the fault address is a page. */
     if (page_allocator_get_active_region_for_address(fault_addr, &start_addr, &end_addr, &page) == UVISOR_ERROR_PAGE_OK)
     {
+        if (write && page_allocator_is_read_only(g_active_box, fault_addr)) {
+            /* Writing to a read-only page. */
+            return -1;
+        }
         /* Remember this fault. */
         page_allocator_register_fault(page);
         DPRINTF("Page Fault for address 0x%08x at page %u [0x%08x, 0x%08x]\n", fault_addr, page, start_addr, end_addr);
@@ -129,9 +133,10 @@ uint32_t vmpu_sys_mux_handler(uint32_t lr, uint32_t msp)
                 /* If the fault comes from the MPU module, we don't use the
                  * bus fault syndrome register, but the MPU one. */
                 fault_addr = MPU->SP[slave_port].EAR;
+                bool write = MPU->SP[slave_port].EDR & MPU_EDR_ERW_MASK;
 
                 /* Check if we can recover from the MPU fault. */
-                if (!vmpu_fault_recovery_mpu(pc, sp, fault_addr)) {
+                if (!vmpu_fault_recovery_mpu(pc, sp, fault_addr, write)) {
                     /* We clear the bus fault status anyway. */
                     VMPU_SCB_BFSR = fault_status;
 
@@ -291,3 +296,8 @@ void vmpu_order_boxes(int * const best_order, int box_count)
         best_order[i] = i;
     }
 }
+
+void vmpu_arch_init_boxes(void)
+{
+    /* Nothing to prepare, the MPU regions are computed at every switch. */
+}
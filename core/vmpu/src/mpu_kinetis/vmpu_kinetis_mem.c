@@ -24,10 +24,12 @@
 
 /* This is the iterator callback for inserting all page heap ACLs into to the
  * MPU during `vmpu_mem_switch()`. */
-static int vmpu_mem_push_page_acl_iterator(uint32_t start_addr, uint32_t end_addr, uint8_t page)
+static int vmpu_mem_push_page_acl_iterator(uint32_t start_addr, uint32_t end_addr, page_index_t page)
 {
     (void) page;
-    MpuRegion region = {.start = start_addr, .end = end_addr, .config = 0x1E};
+    /* Pages shared read-only do not get user write access. */
+    uint32_t config = page_allocator_is_read_only(g_active_box, start_addr) ? 0x1C : 0x1E;
+    MpuRegion region = {.start = start_addr, .end = end_addr, .config = config};
     /* We only continue if we have not wrapped around the end of the MPU regions yet. */
     return vmpu_mpu_push(&region, 100);
 }
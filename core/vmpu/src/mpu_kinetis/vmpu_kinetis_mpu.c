@@ -18,6 +18,7 @@
 #include "debug.h"
 #include "context.h"
 #include "halt.h"
+#include "page_allocator.h"
 #include "page_allocator_faults.h"
 #include "vmpu.h"
 #include "vmpu_mpu.h"
@@ -439,6 +440,23 @@ void vmpu_mpu_invalidate(void)
     }
 }
 
+void vmpu_mpu_invalidate_pages(void)
+{
+    const uint32_t heap_start = (uint32_t) g_page_heap_start;
+    const uint32_t heap_end = (uint32_t) g_page_heap_end;
+
+    uint8_t slot = K64F_MPU_REGIONS_STATIC;
+    for (; slot < K64F_MPU_REGIONS_MAX; slot++) {
+        MPU_Region * mpu_region = (MPU_Region *) MPU->WORD[slot];
+        /* Page ACLs are pushed one page at a time. */
+        uint32_t start = mpu_region->STARTADDR;
+        if (mpu_region->CONTROL && start >= heap_start && start < heap_end) {
+            mpu_region->CONTROL = 0;
+            g_mpu_priority[slot] = 0;
+        }
+    }
+}
+
 bool vmpu_mpu_push(const MpuRegion * const region, uint8_t priority)
 {
     MPU_Region * mpu_region;
@@ -241,6 +241,29 @@ static void vmpu_check_sanity_box_cfgtbl(uint8_t box_id, UvisorBoxConfig const *
                    box_id, (uint32_t) box_cfgtbl, box_cfgtbl->bss.size_of.index, sizeof(UvisorBoxIndex));
     }
 
+    /* Check the number of slots of the RPC and IPC queues. */
+    const UvisorBoxQueueSlots * slots = &box_cfgtbl->queue_slots;
+    if (!slots->rpc_outgoing || slots->rpc_outgoing > UVISOR_RPC_MESSAGE_SLOTS_MAX ||
+        !slots->rpc_incoming || slots->rpc_incoming > UVISOR_RPC_MESSAGE_SLOTS_MAX ||
+        !slots->rpc_fn_group || slots->rpc_fn_group > UVISOR_RPC_FN_GROUP_SLOTS_MAX ||
+        !slots->ipc_send || slots->ipc_send > UVISOR_IPC_SLOTS_MAX ||
+        !slots->ipc_recv || slots->ipc_recv > UVISOR_IPC_SLOTS_MAX) {
+        HALT_ERROR(SANITY_CHECK_FAILED, "Box %i @0x%08X: Invalid number of RPC or IPC queue slots.\r\n",
+                   box_id, (uint32_t) box_cfgtbl);
+    }
+
+    /* Check that the RPC and IPC sections are large enough for the queues. */
+    uint32_t rpc_size = UVISOR_RPC_SIZE(slots->rpc_outgoing, slots->rpc_incoming, slots->rpc_fn_group);
+    if (box_cfgtbl->bss.size_of.rpc < rpc_size) {
+        HALT_ERROR(SANITY_CHECK_FAILED, "Box %i @0x%08X: RPC size (%uB) < size of the RPC queues (%uB).\r\n",
+                   box_id, (uint32_t) box_cfgtbl, box_cfgtbl->bss.size_of.rpc, rpc_size);
+    }
+    uint32_t ipc_size = UVISOR_IPC_SIZE(slots->ipc_send, slots->ipc_recv);
+    if (box_cfgtbl->bss.size_of.ipc < ipc_size) {
+        HALT_ERROR(SANITY_CHECK_FAILED, "Box %i @0x%08X: IPC size (%uB) < size of the IPC queues (%uB).\r\n",
+                   box_id, (uint32_t) box_cfgtbl, box_cfgtbl->bss.size_of.ipc, ipc_size);
+    }
+
     /* Check the minimal size of the box stack. */
     if (box_id != 0 && (box_cfgtbl->stack_size < UVISOR_MIN_STACK_SIZE)) {
         HALT_ERROR(SANITY_CHECK_FAILED, "Box %i @0x%08X: Stack size (%uB) < UVISOR_MIN_STACK_SIZE (%uB).\r\n",
@@ -321,6 +344,9 @@ static void vmpu_box_index_init(uint8_t box_id, UvisorBoxConfig const * const bo
 
     /* Point to the box config. */
     index->config = box_cfgtbl;
+
+    /* No work has been queued for uVisor yet. */
+    index->doorbells.any = 0;
 }
 
 static void vmpu_configure_box_peripherals(uint8_t box_id, UvisorBoxConfig const * const box_cfgtbl)
@@ -431,6 +457,9 @@ static void vmpu_enumerate_boxes(void)
         box_init(index, box_cfgtbl);
     }
 
+    /* Prepare the per-box MPU state. This is MPU-specific. */
+    vmpu_arch_init_boxes();
+
     /* Load box 0. */
     context_switch_in(CONTEXT_SWITCH_UNBOUND_FIRST, 0, 0, 0);
 
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include "api/inc/vmpu_exports.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/** State of a running benchmark.
+ *
+ * A benchmark runs its timed loop with `while (bench_keep_running(state))`.
+ * Setup work inside the loop can be excluded from the measurement with
+ * `bench_pause_timing` and `bench_resume_timing`. */
+typedef struct {
+    /* Benchmark argument, e.g. the number of boxes. */
+    int arg;
+
+    /* Number of iterations requested and done so far. */
+    uint64_t iterations;
+    uint64_t done;
+
+    /* Time spent in the timed sections, in nanoseconds. */
+    uint64_t elapsed_ns;
+    uint64_t started_ns;
+    bool running;
+} BenchState;
+
+typedef void (*BenchFunction)(BenchState * state);
+
+typedef struct {
+    const char * name;
+    BenchFunction function;
+    int arg;
+} Bench;
+
+/* Per-module lists of benchmarks, terminated by an entry with a NULL name. */
+extern const Bench g_bench_pool_queue[];
+extern const Bench g_bench_page_allocator[];
+extern const Bench g_bench_rpc[];
+extern const Bench g_bench_ipc[];
+extern const Bench g_bench_channel[];
+extern const Bench g_bench_vmpu[];
+
+/* Per-module checks run before the benchmarks. Return 0 on success. */
+int bench_pool_queue_check(void);
+int bench_page_allocator_check(void);
+int bench_rpc_check(void);
+int bench_ipc_check(void);
+int bench_channel_check(void);
+int bench_vmpu_check(void);
+
+uint64_t bench_now_ns(void);
+bool bench_keep_running(BenchState * state);
+void bench_pause_timing(BenchState * state);
+void bench_resume_timing(BenchState * state);
+
+/* Prevent the compiler from optimizing away a computed value. */
+#define bench_do_not_optimize(value) __asm__ volatile("" : : "g"(value) : "memory")
+
+/* Set up the box index, RPC and IPC queues of box_count boxes, and make box 0
+ * the active one. */
+void bench_boxes_init(int box_count);
+/* Same as bench_boxes_init, with the queue slots of each box, or NULL for the
+ * default ones. */
+void bench_boxes_init_slots(int box_count, const UvisorBoxQueueSlots * slots);
+void bench_box_switch(int box_id);
+UvisorBoxIndex * bench_box_index(int box_id);
+/* Address of the box configuration table pointer, as used in RPC gateways. */
+uint32_t bench_box_ptr(int box_id);
+
+/* Set up an empty page heap. The boxes must already be set up. */
+void bench_page_heap_reset(void);
+
+/* Allocate one page of the page heap for a box, which becomes the active one.
+ * Return the page. */
+void * bench_page_heap_alloc(int box_id);
+
+/* Number of posts to any semaphore. */
+extern uint32_t g_bench_semaphore_posts;
+/* The semaphore posted to last. */
+extern UvisorSemaphore * g_bench_semaphore_last;
+/* Number of MPU invalidations. */
+extern uint32_t g_bench_mpu_invalidations;
+/* Number of MPU invalidations of the page heap regions only. */
+extern uint32_t g_bench_mpu_page_invalidations;
+
+#endif /* __BENCH_H__ */
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __UVISOR_H__
+#define __UVISOR_H__
+
+/* Host replacement for core/uvisor.h.
+ * It provides the minimal subset of the core environment needed to compile
+ * the hardware-independent core sources for the host. */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "api/inc/uvisor_exports.h"
+
+#ifndef TRUE
+#define TRUE 1
+#endif/*TRUE*/
+
+#ifndef FALSE
+#define FALSE 0
+#endif/*FALSE*/
+
+/* Debug messages are type-checked but never printed. */
+#define DPRINTF(...) { if (0) { printf(__VA_ARGS__); } }
+
+#define UVISOR_NOINLINE    __attribute__((noinline))
+#define UVISOR_NAKED       __attribute__((naked))
+
+#define __CLZ __builtin_clz
+
+/* RBAR field used to build the ARMv7-M MPU images. */
+#define MPU_RBAR_VALID_Msk (1UL << 4)
+
+/* The RPC latencies are measured in ticks of a clock that only the checks
+ * advance. */
+extern uint32_t g_bench_cycles;
+#define UVISOR_RPC_STATS_TIMER_INIT() do {} while (0)
+#define UVISOR_RPC_STATS_NOW() (g_bench_cycles)
+
+#include "halt.h"
+#include "linker.h"
+
+#endif/*__UVISOR_H__*/
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __VMPU_H__
+#define __VMPU_H__
+
+/* Host replacement for core/vmpu/inc/vmpu.h.
+ * All the memories are considered public, and all buffers accessible. */
+
+#include "vmpu_unpriv_access.h"
+#include "api/inc/vmpu_exports.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+static UVISOR_FORCEINLINE int vmpu_public_flash_addr(uint32_t addr)
+{
+    return 1;
+}
+
+static UVISOR_FORCEINLINE int vmpu_flash_addr(uint32_t addr)
+{
+    return 1;
+}
+
+static UVISOR_FORCEINLINE int vmpu_public_sram_addr(uint32_t addr)
+{
+    return 1;
+}
+
+static UVISOR_FORCEINLINE int vmpu_sram_addr(uint32_t addr)
+{
+    return 1;
+}
+
+extern uint8_t g_vmpu_box_count;
+extern bool g_vmpu_boxes_counted;
+
+static UVISOR_FORCEINLINE bool vmpu_is_box_id_valid(uint8_t box_id)
+{
+    return box_id < g_vmpu_box_count;
+}
+
+extern int vmpu_is_region_size_valid(uint32_t size);
+extern uint32_t vmpu_round_up_region(uint32_t addr, uint32_t size);
+
+#endif /* __VMPU_H__ */
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Minimum time each benchmark runs for, in nanoseconds. */
+static uint64_t g_min_time_ns = 200000000ULL;
+
+static const Bench * const g_benches[] = {
+    g_bench_pool_queue,
+    g_bench_page_allocator,
+    g_bench_rpc,
+    g_bench_ipc,
+    g_bench_channel,
+    g_bench_vmpu,
+};
+
+uint64_t bench_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+void bench_pause_timing(BenchState * state)
+{
+    if (state->running) {
+        state->elapsed_ns += bench_now_ns() - state->started_ns;
+        state->running = false;
+    }
+}
+
+void bench_resume_timing(BenchState * state)
+{
+    if (!state->running) {
+        state->started_ns = bench_now_ns();
+        state->running = true;
+    }
+}
+
+bool bench_keep_running(BenchState * state)
+{
+    if (state->done == 0) {
+        bench_resume_timing(state);
+    }
+    if (state->done < state->iterations) {
+        state->done++;
+        return true;
+    }
+    bench_pause_timing(state);
+    return false;
+}
+
+/* Run a benchmark with an increasing number of iterations until it runs for
+ * long enough, then return the time per iteration. */
+static double bench_run(const Bench * bench, uint64_t * iterations)
+{
+    uint64_t n = 1;
+
+    while (1) {
+        BenchState state = {
+            .arg = bench->arg,
+            .iterations = n,
+        };
+        bench->function(&state);
+
+        if (state.elapsed_ns >= g_min_time_ns || n >= (1ULL << 40)) {
+            *iterations = n;
+            return (double) state.elapsed_ns / (double) n;
+        }
+
+        /* Estimate the number of iterations needed, with a 40% margin. */
+        double multiplier = state.elapsed_ns ? (1.4 * g_min_time_ns / state.elapsed_ns) : 10.0;
+        if (multiplier > 10.0) {
+            multiplier = 10.0;
+        }
+        uint64_t next = (uint64_t) (n * multiplier);
+        n = (next > n) ? next : n + 1;
+    }
+}
+
+static void usage(const char * name)
+{
+    fprintf(stderr, "Usage: %s [-t <min_time_ms>] [filter]\n", name);
+    fprintf(stderr, "Run the benchmarks whose name contains the filter string.\n");
+}
+
+int main(int argc, char * argv[])
+{
+    const char * filter = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            g_min_time_ns = strtoull(argv[++i], NULL, 0) * 1000000ULL;
+        } else if (argv[i][0] != '-' && !filter) {
+            filter = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    /* Make sure the algorithms under test are still correct before measuring
+     * them. */
+    if (bench_pool_queue_check() || bench_page_allocator_check() || bench_rpc_check() ||
+        bench_ipc_check() || bench_channel_check() || bench_vmpu_check()) {
+        return 1;
+    }
+
+    printf("%-48s %14s %14s\n", "Benchmark", "Time", "Iterations");
+    printf("%.*s\n", 78, "------------------------------------------------------------------------------");
+
+    for (size_t i = 0; i < sizeof(g_benches) / sizeof(g_benches[0]); ++i) {
+        for (const Bench * bench = g_benches[i]; bench->name; ++bench) {
+            char name[64];
+            if (bench->arg) {
+                snprintf(name, sizeof(name), "%s/%d", bench->name, bench->arg);
+            } else {
+                snprintf(name, sizeof(name), "%s", bench->name);
+            }
+            if (filter && !strstr(name, filter)) {
+                continue;
+            }
+
+            uint64_t iterations;
+            double ns = bench_run(bench, &iterations);
+            printf("%-48s %11.1f ns %14llu\n", name, ns, (unsigned long long) iterations);
+            fflush(stdout);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <uvisor.h>
+#include "api/inc/channel_exports.h"
+#include "bench.h"
+#include "channel.h"
+#include "doorbell.h"
+#include "page_allocator.h"
+#include "vmpu.h"
+#include <stdio.h>
+#include <string.h>
+
+#define BENCH_CHANNEL_FRAME_MAX 256
+
+static uint8_t g_bench_frame[BENCH_CHANNEL_FRAME_MAX];
+static uint8_t g_bench_frame_read[BENCH_CHANNEL_FRAME_MAX];
+static UvisorSemaphore g_bench_channel_semaphore;
+static UvisorPageTable g_bench_channel_table;
+
+/* Size of the data of a ring in a page of the bench page heap */
+static uint32_t bench_channel_size(void)
+{
+    return g_page_size - sizeof(UvisorChannelRing);
+}
+
+/* Set up a channel from box 1 to box 2 like the box-side API does, with the
+ * consumer attached. Return its ring. */
+static UvisorChannelRing * bench_channel_init(void)
+{
+    UvisorPageTable * table = &g_bench_channel_table;
+    bench_boxes_init(UVISOR_MAX_BOXES);
+    bench_page_heap_reset();
+    UvisorChannelRing * ring = bench_page_heap_alloc(1);
+    memset(ring, 0, sizeof(*ring));
+
+    /* Forget the channel left on the same page by the previous run. */
+    channel_close(ring);
+
+    table->page_size = g_page_size;
+    table->page_count = 1;
+    table->page_origins[0] = ring;
+    if (page_allocator_share(table, 2, UVISOR_TACL_UREAD | UVISOR_TACL_UWRITE) || channel_create(ring, 2)) {
+        HALT_ERROR(SANITY_CHECK_FAILED, "Cannot create the channel");
+    }
+    bench_box_switch(2);
+    if (channel_attach(ring, &g_bench_channel_semaphore)) {
+        HALT_ERROR(SANITY_CHECK_FAILED, "Cannot attach to the channel");
+    }
+    bench_box_switch(1);
+    return ring;
+}
+
+/* Write a frame to a ring and ring the doorbell if needed, like the box-side
+ * API does. */
+static int bench_channel_write(UvisorChannelRing * ring, const void * data, size_t len)
+{
+    int ret = uvisor_channel_ring_write(ring, bench_channel_size(), data, len);
+    if (ret == 1) {
+        bench_box_index(1)->doorbells.queue[UVISOR_BOX_DOORBELL_CHANNEL] = 1;
+        ret = 0;
+    }
+    return ret;
+}
+
+/* Time a producer writing a frame to a ring and a consumer reading it back,
+ * with no uVisor involvement. */
+static void bm_channel_write_read(BenchState * state)
+{
+    size_t len = state->arg;
+    UvisorChannelRing * ring = bench_channel_init();
+    uint32_t size = bench_channel_size();
+
+    while (bench_keep_running(state)) {
+        if (uvisor_channel_ring_write(ring, size, g_bench_frame, len) < 0 ||
+            uvisor_channel_ring_read(ring, size, g_bench_frame_read, len)) {
+            HALT_ERROR(SANITY_CHECK_FAILED, "Frame lost");
+        }
+    }
+}
+
+/* Time a frame that wakes the consumer up: the write to an empty ring, the
+ * drain on the next thread switch of the producer and the read. */
+static void bm_channel_wake(BenchState * state)
+{
+    size_t len = state->arg;
+    UvisorChannelRing * ring = bench_channel_init();
+    uint32_t size = bench_channel_size();
+
+    while (bench_keep_running(state)) {
+        bench_channel_write(ring, g_bench_frame, len);
+        channel_drain();
+        if (uvisor_channel_ring_read(ring, size, g_bench_frame_read, len)) {
+            HALT_ERROR(SANITY_CHECK_FAILED, "Frame lost");
+        }
+    }
+}
+
+/* Check that channels only connect boxes that can both write to the ring. */
+static int check_channel_create(void)
+{
+    UvisorChannelRing * ring = bench_channel_init();
+    UvisorChannelRing * other = bench_page_heap_alloc(1);
+
+    if (channel_create(other, 2) != UVISOR_ERROR_PAGE_INVALID_PAGE_OWNER ||
+        channel_create((UvisorChannelRing *) ((uint8_t *) other + 4), 2) != UVISOR_ERROR_PAGE_INVALID_PAGE_ORIGIN ||
+        channel_create(other, 1) != UVISOR_ERROR_INVALID_BOX_ID ||
+        channel_create(other, UVISOR_MAX_BOXES) != UVISOR_ERROR_INVALID_BOX_ID ||
+        channel_create(ring, 2) != UVISOR_ERROR_INVALID_PARAMETERS) {
+        printf("channel_create: bad channel created\n");
+        return 1;
+    }
+
+    /* Boxes that were never enumerated cannot be connected. */
+    g_vmpu_box_count = 3;
+    int ret = channel_create(other, 3);
+    g_vmpu_box_count = UVISOR_MAX_BOXES;
+    if (ret != UVISOR_ERROR_INVALID_BOX_ID) {
+        printf("channel_create: channel to a box that does not exist created\n");
+        return 1;
+    }
+
+    /* Only the consumer attaches, to its own semaphore. */
+    bench_box_switch(3);
+    if (channel_attach(ring, &g_bench_channel_semaphore) != UVISOR_ERROR_INVALID_PARAMETERS ||
+        channel_close(ring) != UVISOR_ERROR_INVALID_PARAMETERS) {
+        printf("channel_create: other box allowed to use the channel\n");
+        return 1;
+    }
+    bench_box_switch(2);
+    if (channel_attach(ring, (UvisorSemaphore *) other) != UVISOR_ERROR_INVALID_PARAMETERS) {
+        printf("channel_create: semaphore of the producer accepted\n");
+        return 1;
+    }
+
+    /* A revoked ring is dropped on the next drain. */
+    bench_box_switch(1);
+    uint32_t posts = g_bench_semaphore_posts;
+    page_allocator_revoke(&g_bench_channel_table, 2);
+    bench_channel_write(ring, g_bench_frame, 1);
+    channel_drain();
+    if (g_bench_semaphore_posts != posts || channel_close(ring) != UVISOR_ERROR_INVALID_PARAMETERS) {
+        printf("channel_create: revoked channel kept\n");
+        return 1;
+    }
+
+    /* Closing tells the producer which box to revoke the ring from. */
+    ring = bench_channel_init();
+    if (channel_close(ring) != 2) {
+        printf("channel_create: consumer box not returned on close\n");
+        return 1;
+    }
+
+    printf("channel_create: only boxes sharing the ring connected\n");
+    return 0;
+}
+
+/* Check that the consumer is only woken up when the ring becomes non-empty
+ * and that frames wrap around the end of the ring. */
+int bench_channel_check(void)
+{
+    UvisorChannelRing * ring = bench_channel_init();
+    uint32_t size = bench_channel_size();
+    uint32_t posts = g_bench_semaphore_posts;
+
+    for (size_t i = 0; i < sizeof(g_bench_frame); ++i) {
+        g_bench_frame[i] = i;
+    }
+
+    /* Two frames in a row wake the consumer up once. */
+    if (bench_channel_write(ring, g_bench_frame, 100) || bench_channel_write(ring, g_bench_frame, 100)) {
+        printf("channel: cannot write\n");
+        return 1;
+    }
+    channel_drain();
+    channel_drain();
+    if (g_bench_semaphore_posts - posts != 1 || g_bench_semaphore_last != &g_bench_channel_semaphore) {
+        printf("channel: %u wake ups for one empty ring\n", g_bench_semaphore_posts - posts);
+        return 1;
+    }
+
+    /* Frames written to a non-empty ring do not wake the consumer up. */
+    bench_box_switch(2);
+    uvisor_channel_ring_read(ring, size, g_bench_frame_read, 100);
+    bench_box_switch(1);
+    bench_channel_write(ring, g_bench_frame, 100);
+    channel_drain();
+    if (g_bench_semaphore_posts - posts != 1) {
+        printf("channel: consumer woken up for a non-empty ring\n");
+        return 1;
+    }
+
+    /* Fill the ring so that frames wrap around its end. */
+    uint32_t used = 200;
+    while (used + 100 <= size) {
+        bench_channel_write(ring, g_bench_frame, 100);
+        used += 100;
+    }
+    if (bench_channel_write(ring, g_bench_frame, size - used + 1) != UVISOR_ERROR_BUFFER_TOO_SMALL ||
+        bench_channel_write(ring, g_bench_frame, size - used)) {
+        printf("channel: bad room in the ring\n");
+        return 1;
+    }
+    for (int round = 0; round < 3; ++round) {
+        uint8_t frame[100];
+        memset(frame, 0, sizeof(frame));
+        if (uvisor_channel_ring_read(ring, size, frame, 100) || memcmp(frame, g_bench_frame, 100) ||
+            bench_channel_write(ring, g_bench_frame, 100)) {
+            printf("channel: frame corrupted around the end of the ring\n");
+            return 1;
+        }
+    }
+
+    /* Empty the ring. The next frame wakes the consumer up again, when the
+     * producer kicks the consumer box but not another box. */
+    while (!uvisor_channel_ring_is_empty(ring)) {
+        uvisor_channel_ring_read(ring, size, g_bench_frame_read, 1);
+    }
+    if (uvisor_channel_ring_read(ring, size, g_bench_frame_read, 1) != UVISOR_ERROR_BUFFER_TOO_SMALL) {
+        printf("channel: read from an empty ring\n");
+        return 1;
+    }
+    bench_channel_write(ring, g_bench_frame, 1);
+    doorbell_kick(3);
+    if (g_bench_semaphore_posts - posts != 1 || !bench_box_index(1)->doorbells.queue[UVISOR_BOX_DOORBELL_CHANNEL]) {
+        printf("channel: consumer woken up by a kick to another box\n");
+        return 1;
+    }
+    doorbell_kick(2);
+    if (g_bench_semaphore_posts - posts != 2) {
+        printf("channel: consumer not woken up for an empty ring\n");
+        return 1;
+    }
+
+    /* A consumer moving the tail out of the ring is caught. */
+    ring->tail = 2 * size;
+    if (bench_channel_write(ring, g_bench_frame, 1) != UVISOR_ERROR_INVALID_PARAMETERS) {
+        printf("channel: corrupted tail accepted\n");
+        return 1;
+    }
+
+    printf("channel: consumer woken up once per empty ring\n");
+    return check_channel_create();
+}
+
+const Bench g_bench_channel[] = {
+    {"channel_write_read", bm_channel_write_read, 16},
+    {"channel_write_read", bm_channel_write_read, BENCH_CHANNEL_FRAME_MAX},
+    {"channel_wake", bm_channel_wake, 16},
+    {NULL},
+};
@@ -0,0 +1,467 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <uvisor.h>
+#include "bench.h"
+#include "context.h"
+#include "page_allocator.h"
+#include "page_allocator_faults.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BENCH_PAGE_SIZE  1024
+#define BENCH_PAGE_COUNT UVISOR_PAGE_MAX_COUNT
+
+/* The page heap is aligned so that it fills whole ARMv7-M MPU regions. */
+static uint8_t g_bench_page_heap[BENCH_PAGE_SIZE * BENCH_PAGE_COUNT]
+    __attribute__((aligned(BENCH_PAGE_SIZE * 8)));
+static const uint32_t g_bench_page_size = BENCH_PAGE_SIZE;
+
+typedef struct {
+    uint32_t page_size;
+    uint32_t page_count;
+    void * page_origins[BENCH_PAGE_COUNT];
+} BenchPageTable;
+
+static BenchPageTable g_bench_table;
+static BenchPageTable g_bench_other_table;
+
+static void bench_page_heap_init(void)
+{
+    bench_boxes_init(UVISOR_MAX_BOXES);
+    bench_page_heap_reset();
+}
+
+/* Allocate the given number of pages for a box. */
+static void bench_page_malloc(BenchPageTable * table, int box_id, int count)
+{
+    bench_box_switch(box_id);
+    table->page_size = BENCH_PAGE_SIZE;
+    table->page_count = count;
+    if (page_allocator_malloc((UvisorPageTable *) table) != UVISOR_ERROR_PAGE_OK) {
+        HALT_ERROR(SANITY_CHECK_FAILED, "Cannot allocate %d pages for box %d", count, box_id);
+    }
+}
+
+void bench_page_heap_reset(void)
+{
+    page_allocator_init(g_bench_page_heap, g_bench_page_heap + sizeof(g_bench_page_heap), &g_bench_page_size);
+}
+
+void * bench_page_heap_alloc(int box_id)
+{
+    bench_page_malloc(&g_bench_other_table, box_id, 1);
+    return g_bench_other_table.page_origins[0];
+}
+
+static void bm_page_malloc_free(BenchState * state)
+{
+    bench_page_heap_init();
+    bench_box_switch(1);
+    g_bench_table.page_size = BENCH_PAGE_SIZE;
+    g_bench_table.page_count = state->arg;
+    while (bench_keep_running(state)) {
+        page_allocator_malloc((UvisorPageTable *) &g_bench_table);
+        page_allocator_free((UvisorPageTable *) &g_bench_table);
+    }
+}
+
+static void bm_page_malloc_free_box0(BenchState * state)
+{
+    bench_page_heap_init();
+    bench_box_switch(0);
+    g_bench_table.page_size = BENCH_PAGE_SIZE;
+    g_bench_table.page_count = state->arg;
+    while (bench_keep_running(state)) {
+        page_allocator_malloc((UvisorPageTable *) &g_bench_table);
+        page_allocator_free((UvisorPageTable *) &g_bench_table);
+    }
+}
+
+/* Allocate the last free page of an otherwise full page heap. */
+static void bm_page_malloc_free_last(BenchState * state)
+{
+    bench_page_heap_init();
+    bench_page_malloc(&g_bench_other_table, 2, BENCH_PAGE_COUNT - 1);
+    bench_box_switch(1);
+    g_bench_table.page_size = BENCH_PAGE_SIZE;
+    g_bench_table.page_count = 1;
+    while (bench_keep_running(state)) {
+        page_allocator_malloc((UvisorPageTable *) &g_bench_table);
+        page_allocator_free((UvisorPageTable *) &g_bench_table);
+    }
+}
+
+/* Allocate one page out of a page heap where only every other page is free. */
+static void bm_page_malloc_free_sparse(BenchState * state)
+{
+    bench_page_heap_init();
+    bench_page_malloc(&g_bench_other_table, 2, BENCH_PAGE_COUNT);
+    /* Free every other page, so that the free pages are spread over the whole
+     * page map. */
+    bench_box_switch(2);
+    for (int i = 0; i < BENCH_PAGE_COUNT / 2; ++i) {
+        g_bench_other_table.page_origins[i] = g_bench_other_table.page_origins[i * 2];
+    }
+    g_bench_other_table.page_count = BENCH_PAGE_COUNT / 2;
+    page_allocator_free((UvisorPageTable *) &g_bench_other_table);
+
+    bench_box_switch(1);
+    g_bench_table.page_size = BENCH_PAGE_SIZE;
+    g_bench_table.page_count = state->arg;
+    while (bench_keep_running(state)) {
+        page_allocator_malloc((UvisorPageTable *) &g_bench_table);
+        page_allocator_free((UvisorPageTable *) &g_bench_table);
+    }
+}
+
+/* Allocate pages that have been zeroed in advance. */
+static void bm_page_malloc_free_clean(BenchState * state)
+{
+    bench_page_heap_init();
+    bench_box_switch(1);
+    g_bench_table.page_size = BENCH_PAGE_SIZE;
+    g_bench_table.page_count = state->arg;
+    while (bench_keep_running(state)) {
+        bench_pause_timing(state);
+        while (page_allocator_clean(state->arg));
+        bench_resume_timing(state);
+        page_allocator_malloc((UvisorPageTable *) &g_bench_table);
+        page_allocator_free((UvisorPageTable *) &g_bench_table);
+    }
+}
+
+static void bm_page_share_revoke(BenchState * state)
+{
+    bench_page_heap_init();
+    bench_page_malloc(&g_bench_table, 1, state->arg);
+    while (bench_keep_running(state)) {
+        page_allocator_share((UvisorPageTable *) &g_bench_table, 2, UVISOR_TACL_UREAD);
+        page_allocator_revoke((UvisorPageTable *) &g_bench_table, 2);
+    }
+}
+
+static int bench_page_mask_iterator(uint8_t mask, page_index_t index)
+{
+    bench_do_not_optimize(mask);
+    return 1;
+}
+
+static void bm_page_iterate_active_page_masks(BenchState * state)
+{
+    bench_page_heap_init();
+    bench_page_malloc(&g_bench_table, 1, state->arg);
+    while (bench_keep_running(state)) {
+        page_index_t count = page_allocator_iterate_active_page_masks(bench_page_mask_iterator,
+                                                                 PAGE_ALLOCATOR_ITERATOR_DIRECTION_BACKWARD);
+        bench_do_not_optimize(count);
+    }
+}
+
+static void bm_page_get_active_mask_for_address(BenchState * state)
+{
+    bench_page_heap_init();
+    bench_page_malloc(&g_bench_table, 1, state->arg);
+    uint32_t address = (uint32_t) g_bench_table.page_origins[state->arg - 1];
+    while (bench_keep_running(state)) {
+        uint8_t mask;
+        page_index_t index, page;
+        int status = page_allocator_get_active_mask_for_address(address, &mask, &index, &page);
+        bench_do_not_optimize(status);
+    }
+}
+
+/* Page index of a page heap pointer. */
+static int bench_page_index(void * page)
+{
+    return ((uint8_t *) page - g_bench_page_heap) / BENCH_PAGE_SIZE;
+}
+
+/* Check that the pages of boxes with 8 pages or fewer are clustered into a
+ * single octet of the page map, i.e. into a single MPU window. */
+static int check_page_placement(void)
+{
+    static BenchPageTable tables[UVISOR_MAX_BOXES][4];
+
+    bench_page_heap_init();
+
+    /* Boxes 1 to 4 allocate 2 pages at a time, taking turns. */
+    for (int round = 0; round < 4; ++round) {
+        for (int box_id = 1; box_id < UVISOR_MAX_BOXES; ++box_id) {
+            bench_page_malloc(&tables[box_id][round], box_id, 2);
+        }
+    }
+    for (int box_id = 1; box_id < UVISOR_MAX_BOXES; ++box_id) {
+        int octet = bench_page_index(tables[box_id][0].page_origins[0]) / 8;
+        for (int round = 0; round < 4; ++round) {
+            for (int i = 0; i < 2; ++i) {
+                if (bench_page_index(tables[box_id][round].page_origins[i]) / 8 != octet) {
+                    printf("page_placement: pages of box %d spread over several octets\n", box_id);
+                    return 1;
+                }
+            }
+        }
+    }
+
+#if UVISOR_PAGE_FAULT_HINT
+    /* Box 1 owns pages in octets 0 and 2, and box 2 in octet 1. */
+    bench_page_heap_init();
+    bench_page_malloc(&tables[1][0], 1, 4);
+    bench_page_malloc(&tables[2][0], 2, 4);
+    bench_page_malloc(&tables[1][1], 1, 6);
+    if (bench_page_index(tables[1][1].page_origins[0]) != 16) {
+        printf("page_placement: pages not placed into an empty octet\n");
+        return 1;
+    }
+    /* New pages of box 1 go where box 1 faults most. */
+    for (int i = 0; i < 3; ++i) {
+        page_allocator_register_fault(16);
+    }
+    bench_page_malloc(&tables[1][2], 1, 2);
+    if (bench_page_index(tables[1][2].page_origins[0]) != 22) {
+        printf("page_placement: fault history ignored\n");
+        return 1;
+    }
+#endif /* UVISOR_PAGE_FAULT_HINT */
+
+    printf("page_placement: pages of %d boxes clustered into one octet each\n", UVISOR_MAX_BOXES - 1);
+    return 0;
+}
+
+/* Check that pages are zeroed when they are handed out, either in advance or
+ * during the allocation. */
+static int check_page_clean(void)
+{
+    static UvisorPageStats stats;
+
+    bench_page_heap_init();
+    bench_page_malloc(&g_bench_table, 1, 8);
+    memset(g_bench_table.page_origins[0], 0xA5, BENCH_PAGE_SIZE * 8);
+    bench_box_switch(1);
+    uint32_t page_invalidations = g_bench_mpu_page_invalidations;
+    page_allocator_free((UvisorPageTable *) &g_bench_table);
+
+    /* The freed pages are no longer mapped for the box that freed them. */
+    if (g_bench_mpu_page_invalidations == page_invalidations) {
+        printf("page_clean: freed pages left mapped\n");
+        return 1;
+    }
+
+    /* Zero all the free pages, one page per call. */
+    int calls = 0;
+    while (page_allocator_clean(BENCH_PAGE_COUNT)) {
+        calls++;
+    }
+    page_allocator_get_stats(&stats);
+    if (calls != BENCH_PAGE_COUNT - 1 || stats.dirty_count != 0 || stats.free_count != BENCH_PAGE_COUNT) {
+        printf("page_clean: %d calls left %u dirty pages\n", calls, stats.dirty_count);
+        return 1;
+    }
+
+    /* Pages that were zeroed in advance are preferred, and a dirty page is
+     * zeroed synchronously. */
+    bench_page_malloc(&g_bench_table, 1, 8);
+    bench_box_switch(1);
+    page_allocator_free((UvisorPageTable *) &g_bench_table);
+    page_allocator_clean(1);
+    memset(g_bench_page_heap + BENCH_PAGE_SIZE, 0xA5, BENCH_PAGE_SIZE * 7);
+    bench_page_malloc(&g_bench_table, 1, 8);
+    for (int i = 0; i < BENCH_PAGE_SIZE * 8; ++i) {
+        if (((uint8_t *) g_bench_table.page_origins[0])[i]) {
+            printf("page_clean: page %d not zeroed\n", i / BENCH_PAGE_SIZE);
+            return 1;
+        }
+    }
+    page_allocator_get_stats(&stats);
+    if (stats.prezeroed_count != 9 || stats.zeroed_sync_count != 15) {
+        printf("page_clean: %u pages zeroed in advance, %u during allocation\n",
+               stats.prezeroed_count, stats.zeroed_sync_count);
+        return 1;
+    }
+
+    printf("page_clean: pages zeroed in advance and on demand\n");
+    return 0;
+}
+
+static int g_bench_page_mask_bits;
+
+static int bench_page_mask_count_iterator(uint8_t mask, page_index_t index)
+{
+    g_bench_page_mask_bits += __builtin_popcount(mask);
+    return 1;
+}
+
+/* Check that shared pages are visible to the boxes they are shared with, with
+ * the right access, and that only their owner can free them. */
+static int check_page_share(void)
+{
+    static BenchPageTable read_only, read_write;
+
+    bench_page_heap_init();
+    bench_page_malloc(&g_bench_table, 1, 8);
+    bench_page_malloc(&g_bench_other_table, 2, 2);
+    read_only = g_bench_table;
+    read_only.page_count = 4;
+    read_write = g_bench_table;
+    read_write.page_count = 2;
+    memmove(read_write.page_origins, &g_bench_table.page_origins[4], 2 * sizeof(void *));
+
+    /* Box 1 shares 4 pages read-only and 2 pages read-write with box 2. */
+    bench_box_switch(1);
+    if (page_allocator_share((UvisorPageTable *) &read_only, 2, UVISOR_TACL_UREAD) ||
+        page_allocator_share((UvisorPageTable *) &read_write, 2, UVISOR_TACL_UREAD | UVISOR_TACL_UWRITE)) {
+        printf("page_share: cannot share pages\n");
+        return 1;
+    }
+    if (page_allocator_share((UvisorPageTable *) &read_only, 1, UVISOR_TACL_UREAD) != UVISOR_ERROR_PAGE_INVALID_BOX_ID ||
+        page_allocator_share((UvisorPageTable *) &read_only, 3, UVISOR_TACL_UWRITE) != UVISOR_ERROR_PAGE_INVALID_ACL ||
+        page_allocator_share((UvisorPageTable *) &g_bench_other_table, 3, UVISOR_TACL_UREAD) != UVISOR_ERROR_PAGE_INVALID_PAGE_OWNER) {
+        printf("page_share: invalid share accepted\n");
+        return 1;
+    }
+
+    /* Box 2 sees the pages, but can neither free nor share them. */
+    bench_box_switch(2);
+    if (page_allocator_free((UvisorPageTable *) &read_write) != UVISOR_ERROR_PAGE_INVALID_PAGE_OWNER ||
+        page_allocator_share((UvisorPageTable *) &read_write, 3, UVISOR_TACL_UREAD) != UVISOR_ERROR_PAGE_INVALID_PAGE_OWNER) {
+        printf("page_share: shared pages freed or shared again by box 2\n");
+        return 1;
+    }
+    uint32_t ro_address = (uint32_t) read_only.page_origins[0];
+    uint32_t rw_address = (uint32_t) read_write.page_origins[0];
+    uint8_t ro_mask, rw_mask;
+    page_index_t index, page;
+    if (!page_allocator_is_read_only(2, ro_address) || page_allocator_is_read_only(2, rw_address) ||
+        page_allocator_get_active_mask_for_address(ro_address, &ro_mask, &index, &page) ||
+        page_allocator_get_active_mask_for_address(rw_address, &rw_mask, &index, &page) ||
+        __builtin_popcount(ro_mask) != 4 || __builtin_popcount(rw_mask) != 2 || (ro_mask & rw_mask)) {
+        printf("page_share: wrong access for shared pages\n");
+        return 1;
+    }
+    /* The window loaded on box switches only contains the read-write pages. */
+    g_bench_page_mask_bits = 0;
+    page_allocator_iterate_active_page_masks(bench_page_mask_count_iterator, PAGE_ALLOCATOR_ITERATOR_DIRECTION_FORWARD);
+    if (g_bench_page_mask_bits != 4) {
+        printf("page_share: %d pages in the switch window\n", g_bench_page_mask_bits);
+        return 1;
+    }
+
+    /* Revoking and freeing pages takes them away from box 2. */
+    bench_box_switch(1);
+    page_allocator_revoke((UvisorPageTable *) &read_write, 2);
+    if (page_allocator_check_range_for_box(2, rw_address, rw_address) == UVISOR_ERROR_PAGE_OK ||
+        page_allocator_check_range_for_box(2, ro_address, ro_address) != UVISOR_ERROR_PAGE_OK) {
+        printf("page_share: pages not revoked\n");
+        return 1;
+    }
+    page_allocator_free((UvisorPageTable *) &g_bench_table);
+    if (page_allocator_check_range_for_box(2, ro_address, ro_address) == UVISOR_ERROR_PAGE_OK ||
+        page_allocator_is_read_only(2, ro_address)) {
+        printf("page_share: freed pages still shared\n");
+        return 1;
+    }
+
+    /* Box 1 sees the pages of box 0, but does not own them. */
+    bench_page_malloc(&g_bench_table, 0, 1);
+    bench_box_switch(1);
+    if (page_allocator_free((UvisorPageTable *) &g_bench_table) != UVISOR_ERROR_PAGE_INVALID_PAGE_OWNER) {
+        printf("page_share: box 1 freed a page of box 0\n");
+        return 1;
+    }
+
+    printf("page_share: pages shared read-only and read-write\n");
+    return 0;
+}
+
+/* Check that page allocations pick the lowest free pages, and that the pages of
+ * box 0 are shared with all the other boxes. */
+int bench_page_allocator_check(void)
+{
+    bench_page_heap_init();
+
+    /* Fill the heap, alternating between boxes 0 and 1, then free the pages of
+     * box 1 again. */
+    static BenchPageTable tables[BENCH_PAGE_COUNT];
+    for (int i = 0; i < BENCH_PAGE_COUNT; ++i) {
+        bench_page_malloc(&tables[i], i % 2, 1);
+        if (tables[i].page_origins[0] != g_bench_page_heap + i * BENCH_PAGE_SIZE) {
+            printf("page_malloc: page %d not allocated in order\n", i);
+            return 1;
+        }
+    }
+    bench_box_switch(1);
+    for (int i = 1; i < BENCH_PAGE_COUNT; i += 2) {
+        page_allocator_free((UvisorPageTable *) &tables[i]);
+    }
+
+    /* All the pages left are owned by box 0 and visible to all boxes. */
+    bench_page_malloc(&g_bench_table, 2, BENCH_PAGE_COUNT / 2);
+    for (int i = 0; i < BENCH_PAGE_COUNT; ++i) {
+        int box_id = (i % 2) ? 2 : 0;
+        if (i % 2 && g_bench_table.page_origins[i / 2] != g_bench_page_heap + i * BENCH_PAGE_SIZE) {
+            printf("page_malloc: page %d not reused in order\n", i);
+            return 1;
+        }
+        for (int box = 0; box < UVISOR_MAX_BOXES; ++box) {
+            int expected = (box_id == 0) || (box == box_id);
+            if (page_allocator_map_get(g_page_owner_map[box], i) != expected) {
+                printf("page_malloc: wrong owner map for page %d of box %d\n", i, box);
+                return 1;
+            }
+        }
+    }
+
+    /* The 8-page window of each page, as projected onto an MPU region with 8
+     * subregions, must contain the page. Box 2 also sees the pages of box 0,
+     * so all the subregions are enabled. */
+    bench_box_switch(2);
+    for (int i = 1; i < BENCH_PAGE_COUNT; i += 2) {
+        uint32_t address = (uint32_t) (g_bench_page_heap + i * BENCH_PAGE_SIZE);
+        uint8_t mask;
+        page_index_t index, page;
+        if (page_allocator_get_active_mask_for_address(address, &mask, &index, &page) != UVISOR_ERROR_PAGE_OK ||
+            page != i) {
+            printf("page_mask: no active mask for page %d\n", i);
+            return 1;
+        }
+        uint32_t window = g_page_head_end_rounded - BENCH_PAGE_SIZE * 8 * (UVISOR_PAGE_MAP_COUNT * 4 - index);
+        uint32_t subregion = (address - window) / BENCH_PAGE_SIZE;
+        if (address < window || subregion >= 8 || mask != 0xFF) {
+            printf("page_mask: wrong mask 0x%02x at index %u for page %d\n", mask, index, i);
+            return 1;
+        }
+    }
+
+    printf("page_malloc: %d pages allocated in order\n", BENCH_PAGE_COUNT);
+    return check_page_placement() || check_page_clean() || check_page_share();
+}
+
+const Bench g_bench_page_allocator[] = {
+    {"page_malloc_free", bm_page_malloc_free, 1},
+    {"page_malloc_free", bm_page_malloc_free, 4},
+    {"page_malloc_free", bm_page_malloc_free, BENCH_PAGE_COUNT},
+    {"page_malloc_free", bm_page_malloc_free, 8},
+    {"page_malloc_free_clean", bm_page_malloc_free_clean, 8},
+    {"page_malloc_free_box0", bm_page_malloc_free_box0, 1},
+    {"page_malloc_free_last", bm_page_malloc_free_last, 0},
+    {"page_malloc_free_sparse", bm_page_malloc_free_sparse, 1},
+    {"page_malloc_free_sparse", bm_page_malloc_free_sparse, BENCH_PAGE_COUNT / 2},
+    {"page_share_revoke", bm_page_share_revoke, 8},
+    {"page_iterate_active_page_masks", bm_page_iterate_active_page_masks, 4},
+    {"page_get_active_mask_for_address", bm_page_get_active_mask_for_address, 4},
+    {NULL},
+};
@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "api/inc/pool_queue_exports.h"
+#include "bench.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define BENCH_POOL_SLOTS 64
+
+static struct {
+    uvisor_pool_queue_t queue;
+    uvisor_pool_t pool;
+    uvisor_pool_queue_entry_t entries[BENCH_POOL_SLOTS];
+    uint32_t items[BENCH_POOL_SLOTS];
+} g_bench_queue;
+
+/* Initialize the queue in the given mode and enqueue count items in it, with
+ * value i in the i-th item. */
+static void bench_queue_fill_mode(int count, uint8_t mode)
+{
+    uvisor_pool_queue_init_mode(&g_bench_queue.queue, &g_bench_queue.pool, g_bench_queue.items,
+                                sizeof(*g_bench_queue.items), BENCH_POOL_SLOTS, mode);
+    for (int i = 0; i < count; ++i) {
+        uvisor_pool_slot_t slot = uvisor_pool_queue_allocate(&g_bench_queue.queue);
+        g_bench_queue.items[slot] = i;
+        uvisor_pool_queue_enqueue(&g_bench_queue.queue, slot);
+    }
+}
+
+static void bench_queue_fill(int count)
+{
+    bench_queue_fill_mode(count, UVISOR_POOL_QUEUE_MODE_LOCKED);
+}
+
+static void bm_pool_allocate_free(BenchState * state)
+{
+    bench_queue_fill(0);
+    while (bench_keep_running(state)) {
+        uvisor_pool_slot_t slot = uvisor_pool_queue_allocate(&g_bench_queue.queue);
+        uvisor_pool_queue_free(&g_bench_queue.queue, slot);
+    }
+}
+
+static void bm_pool_queue_enqueue_dequeue_first(BenchState * state)
+{
+    bench_queue_fill(state->arg);
+    while (bench_keep_running(state)) {
+        uvisor_pool_slot_t slot = uvisor_pool_queue_allocate(&g_bench_queue.queue);
+        uvisor_pool_queue_enqueue(&g_bench_queue.queue, slot);
+        slot = uvisor_pool_queue_dequeue_first(&g_bench_queue.queue);
+        uvisor_pool_queue_free(&g_bench_queue.queue, slot);
+    }
+}
+
+static void bm_pool_queue_try_enqueue_dequeue_first(BenchState * state)
+{
+    bench_queue_fill(state->arg);
+    while (bench_keep_running(state)) {
+        uvisor_pool_slot_t slot = uvisor_pool_queue_try_dequeue_first(&g_bench_queue.queue);
+        uvisor_pool_queue_try_enqueue(&g_bench_queue.queue, slot);
+    }
+}
+
+static void bm_pool_queue_dequeue_last(BenchState * state)
+{
+    bench_queue_fill(state->arg);
+    while (bench_keep_running(state)) {
+        uvisor_pool_slot_t slot = uvisor_pool_queue_dequeue(&g_bench_queue.queue, g_bench_queue.queue.tail);
+        uvisor_pool_queue_enqueue(&g_bench_queue.queue, slot);
+    }
+}
+
+static void bm_pool_queue_mpsc_enqueue_dequeue_first(BenchState * state)
+{
+    bench_queue_fill_mode(state->arg, UVISOR_POOL_QUEUE_MODE_MPSC);
+    while (bench_keep_running(state)) {
+        uvisor_pool_slot_t slot = uvisor_pool_queue_allocate(&g_bench_queue.queue);
+        uvisor_pool_queue_enqueue(&g_bench_queue.queue, slot);
+        slot = uvisor_pool_queue_dequeue_first(&g_bench_queue.queue);
+        uvisor_pool_queue_free(&g_bench_queue.queue, slot);
+    }
+}
+
+static void bm_pool_queue_mpsc_try_enqueue_dequeue_first(BenchState * state)
+{
+    bench_queue_fill_mode(state->arg, UVISOR_POOL_QUEUE_MODE_MPSC);
+    while (bench_keep_running(state)) {
+        uvisor_pool_slot_t slot = uvisor_pool_queue_try_dequeue_first(&g_bench_queue.queue);
+        uvisor_pool_queue_try_enqueue(&g_bench_queue.queue, slot);
+    }
+}
+
+/* Cycle all the items through the queue one at a time. */
+static void bm_pool_queue_try_dequeue_first_all(BenchState * state)
+{
+    uvisor_pool_slot_t slots[BENCH_POOL_SLOTS];
+    bench_queue_fill(state->arg);
+    while (bench_keep_running(state)) {
+        for (int i = 0; i < state->arg; ++i) {
+            slots[i] = uvisor_pool_queue_try_dequeue_first(&g_bench_queue.queue);
+        }
+        for (int i = 0; i < state->arg; ++i) {
+            uvisor_pool_queue_try_enqueue(&g_bench_queue.queue, slots[i]);
+        }
+    }
+}
+
+/* Cycle all the items through the queue in one batch. */
+static void bm_pool_queue_try_dequeue_batch_all(BenchState * state)
+{
+    uvisor_pool_slot_t slots[BENCH_POOL_SLOTS];
+    bench_queue_fill(state->arg);
+    while (bench_keep_running(state)) {
+        size_t count = uvisor_pool_queue_try_dequeue_batch(&g_bench_queue.queue, slots, BENCH_POOL_SLOTS);
+        uvisor_pool_queue_try_enqueue_batch(&g_bench_queue.queue, slots, count);
+    }
+}
+
+static int bench_query_last(uvisor_pool_slot_t slot, void * context)
+{
+    return g_bench_queue.items[slot] == *((uint32_t *) context);
+}
+
+static void bm_pool_queue_find_first(BenchState * state)
+{
+    uint32_t last = state->arg - 1;
+    bench_queue_fill(state->arg);
+    while (bench_keep_running(state)) {
+        uvisor_pool_slot_t slot = uvisor_pool_queue_find_first(&g_bench_queue.queue, bench_query_last, &last);
+        bench_do_not_optimize(slot);
+    }
+}
+
+const Bench g_bench_pool_queue[] = {
+    {"pool_allocate_free", bm_pool_allocate_free, 0},
+    {"pool_queue_enqueue_dequeue_first", bm_pool_queue_enqueue_dequeue_first, 0},
+    {"pool_queue_enqueue_dequeue_first", bm_pool_queue_enqueue_dequeue_first, 16},
+    {"pool_queue_try_enqueue_dequeue_first", bm_pool_queue_try_enqueue_dequeue_first, 16},
+    {"pool_queue_mpsc_enqueue_dequeue_first", bm_pool_queue_mpsc_enqueue_dequeue_first, 0},
+    {"pool_queue_mpsc_enqueue_dequeue_first", bm_pool_queue_mpsc_enqueue_dequeue_first, 16},
+    {"pool_queue_mpsc_try_enqueue_dequeue_first", bm_pool_queue_mpsc_try_enqueue_dequeue_first, 16},
+    {"pool_queue_dequeue_last", bm_pool_queue_dequeue_last, 16},
+    {"pool_queue_try_dequeue_first_all", bm_pool_queue_try_dequeue_first_all, 16},
+    {"pool_queue_try_dequeue_batch_all", bm_pool_queue_try_dequeue_batch_all, 16},
+    {"pool_queue_find_first", bm_pool_queue_find_first, 4},
+    {"pool_queue_find_first", bm_pool_queue_find_first, 16},
+    {"pool_queue_find_first", bm_pool_queue_find_first, 64},
+    {NULL},
+};
+
+/* MPSC stress test: Several producer threads enqueue numbered items into a
+ * small MPSC queue, while a single consumer dequeues them with all the
+ * consumer operations. Every item must be received exactly once, and the items
+ * of each producer in the order they were enqueued. */
+
+#define CHECK_MPSC_PRODUCERS 4
+#define CHECK_MPSC_ITEMS     100000
+#define CHECK_MPSC_SLOTS     16
+#define CHECK_MPSC_BATCH     4
+
+typedef struct {
+    uint32_t producer;
+    uint32_t sequence;
+} CheckMpscItem;
+
+static struct {
+    uvisor_pool_queue_t queue;
+    uvisor_pool_t pool;
+    uvisor_pool_queue_entry_t entries[CHECK_MPSC_SLOTS];
+    CheckMpscItem items[CHECK_MPSC_SLOTS];
+} g_check_mpsc;
+
+/* Set by the consumer to stop the producers early. */
+static volatile int g_check_mpsc_failed;
+
+static void * check_mpsc_producer(void * arg)
+{
+    uint32_t producer = (uint32_t) (uintptr_t) arg;
+
+    for (uint32_t sequence = 0; sequence < CHECK_MPSC_ITEMS; ++sequence) {
+        uvisor_pool_slot_t slot;
+        while ((slot = uvisor_pool_queue_try_allocate(&g_check_mpsc.queue)) >= CHECK_MPSC_SLOTS) {
+            if (g_check_mpsc_failed) {
+                return NULL;
+            }
+            sched_yield();
+        }
+        g_check_mpsc.items[slot].producer = producer;
+        g_check_mpsc.items[slot].sequence = sequence;
+
+        if (sequence & 1) {
+            uvisor_pool_queue_enqueue(&g_check_mpsc.queue, slot);
+        } else if (uvisor_pool_queue_try_enqueue(&g_check_mpsc.queue, slot)) {
+            printf("pool_queue_mpsc: try_enqueue failed\n");
+            g_check_mpsc_failed = 1;
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+static int check_mpsc_query_producer(uvisor_pool_slot_t slot, void * context)
+{
+    return g_check_mpsc.items[slot].producer == *((uint32_t *) context);
+}
+
+/* Dequeue up to CHECK_MPSC_BATCH items with one of the consumer operations. */
+static size_t check_mpsc_consume(uint32_t operation, uvisor_pool_slot_t * slots)
+{
+    uint32_t producer = operation % CHECK_MPSC_PRODUCERS;
+
+    switch (operation % 4) {
+        case 0:
+            slots[0] = uvisor_pool_queue_try_dequeue_first(&g_check_mpsc.queue);
+            break;
+        case 1:
+            slots[0] = uvisor_pool_queue_try_find_first(&g_check_mpsc.queue, check_mpsc_query_producer, &producer);
+            if (slots[0] < CHECK_MPSC_SLOTS && uvisor_pool_queue_try_dequeue(&g_check_mpsc.queue, slots[0]) != slots[0]) {
+                printf("pool_queue_mpsc: cannot dequeue slot %u\n", slots[0]);
+                g_check_mpsc_failed = 1;
+                return 0;
+            }
+            break;
+        case 2:
+            return uvisor_pool_queue_try_dequeue_batch(&g_check_mpsc.queue, slots, CHECK_MPSC_BATCH);
+        default:
+            slots[0] = uvisor_pool_queue_dequeue_first(&g_check_mpsc.queue);
+            break;
+    }
+    return slots[0] < CHECK_MPSC_SLOTS;
+}
+
+/* Check that a batch put back at the end of a locked queue keeps its order. */
+static int check_batch(void)
+{
+    uvisor_pool_slot_t slots[BENCH_POOL_SLOTS];
+
+    bench_queue_fill(16);
+    if (uvisor_pool_queue_try_dequeue_batch(&g_bench_queue.queue, slots, 5) != 5 ||
+        uvisor_pool_queue_try_enqueue_batch(&g_bench_queue.queue, slots, 5)) {
+        printf("pool_queue_batch: cannot move a batch\n");
+        return 1;
+    }
+    if (uvisor_pool_queue_try_dequeue_batch(&g_bench_queue.queue, slots, BENCH_POOL_SLOTS) != 16) {
+        printf("pool_queue_batch: items lost\n");
+        return 1;
+    }
+    for (uint32_t i = 0; i < 16; ++i) {
+        if (g_bench_queue.items[slots[i]] != (i + 5) % 16) {
+            printf("pool_queue_batch: item %u out of order\n", i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int bench_pool_queue_check(void)
+{
+    pthread_t producers[CHECK_MPSC_PRODUCERS];
+    uint32_t expected[CHECK_MPSC_PRODUCERS] = {0};
+    uint32_t received = 0;
+    uint32_t operation = 0;
+
+    if (check_batch()) {
+        return 1;
+    }
+
+    uvisor_pool_queue_init_mode(&g_check_mpsc.queue, &g_check_mpsc.pool, g_check_mpsc.items,
+                                sizeof(*g_check_mpsc.items), CHECK_MPSC_SLOTS, UVISOR_POOL_QUEUE_MODE_MPSC);
+    g_check_mpsc_failed = 0;
+
+    for (uintptr_t i = 0; i < CHECK_MPSC_PRODUCERS; ++i) {
+        pthread_create(&producers[i], NULL, check_mpsc_producer, (void *) i);
+    }
+
+    while (!g_check_mpsc_failed && received < CHECK_MPSC_PRODUCERS * CHECK_MPSC_ITEMS) {
+        uvisor_pool_slot_t slots[CHECK_MPSC_BATCH];
+        size_t count = check_mpsc_consume(operation++, slots);
+
+        if (count == 0) {
+            /* The queue is empty. */
+            sched_yield();
+            continue;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            CheckMpscItem * item = &g_check_mpsc.items[slots[i]];
+            if (item->producer >= CHECK_MPSC_PRODUCERS || item->sequence != expected[item->producer]) {
+                printf("pool_queue_mpsc: unexpected item %u from producer %u\n", item->sequence, item->producer);
+                g_check_mpsc_failed = 1;
+                break;
+            }
+            expected[item->producer]++;
+            received++;
+
+            uvisor_pool_queue_free(&g_check_mpsc.queue, slots[i]);
+        }
+    }
+
+    for (int i = 0; i < CHECK_MPSC_PRODUCERS; ++i) {
+        pthread_join(producers[i], NULL);
+    }
+
+    if (!g_check_mpsc_failed && (g_check_mpsc.pool.num_allocated != 0 || g_check_mpsc.queue.head != UVISOR_POOL_SLOT_INVALID)) {
+        printf("pool_queue_mpsc: queue not empty at the end\n");
+        g_check_mpsc_failed = 1;
+    }
+    if (g_check_mpsc_failed) {
+        return 1;
+    }
+
+    printf("pool_queue_mpsc: %u items from %d producers received in order\n", received, CHECK_MPSC_PRODUCERS);
+    return 0;
+}
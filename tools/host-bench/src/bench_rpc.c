@@ -0,0 +1,1035 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <uvisor.h>
+#include "api/inc/ipc_exports.h"
+#include "api/inc/register_gateway.h"
+#include "api/inc/rpc_exports.h"
+#include "api/inc/rpc_gateway_exports.h"
+#include "bench.h"
+#include "channel.h"
+#include "context.h"
+#include "doorbell.h"
+#include "ipc.h"
+#include "page_allocator_faults.h"
+#include "rpc.h"
+#include "vmpu.h"
+#include "vmpu_mpu.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+static uint32_t bench_rpc_target(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3)
+{
+    return p0 + p1 + p2 + p3;
+}
+
+/* One synchronous gateway per callee box. */
+static TRPCGateway g_bench_gateway[UVISOR_MAX_BOXES];
+
+/* Outgoing message slot of box 0 used for the RPC to each callee box. */
+static uvisor_pool_slot_t g_bench_rpc_slot[UVISOR_MAX_BOXES];
+
+static void bench_rpc_init_slots(int box_count, const UvisorBoxQueueSlots * slots)
+{
+    bench_boxes_init_slots(box_count, slots);
+
+    for (int box_id = 1; box_id < box_count; ++box_id) {
+        TRPCGateway * gateway = &g_bench_gateway[box_id];
+        gateway->ldr_pc = LDR_PC_PC_IMM_OPCODE(__UVISOR_OFFSETOF(TRPCGateway, ldr_pc),
+                                               __UVISOR_OFFSETOF(TRPCGateway, caller));
+        gateway->magic = UVISOR_RPC_GATEWAY_MAGIC_SYNC;
+        gateway->box_ptr = bench_box_ptr(box_id);
+        gateway->target = (uint32_t) bench_rpc_target;
+        gateway->caller = (uint32_t) bench_rpc_target;
+    }
+}
+
+static void bench_rpc_init(int box_count)
+{
+    bench_rpc_init_slots(box_count, NULL);
+}
+
+/* Number of functions in each function group registered by
+ * bench_rpc_register. */
+#define BENCH_RPC_GROUP_FNS 6
+
+/* Target functions of the function groups. Only their addresses are used. */
+static TFN_Ptr g_bench_fns[UVISOR_RPC_FN_GROUP_SLOTS][BENCH_RPC_GROUP_FNS];
+
+/* Register the given number of function groups in a box, like the first
+ * rpc_fncall_waitfor of each group does. The last function of the last group
+ * is the RPC target. */
+static void bench_rpc_register(int box_id, int group_count)
+{
+    uvisor_rpc_t * rpc = uvisor_rpc(bench_box_index(box_id));
+
+    for (int group = 0; group < group_count; ++group) {
+        for (int i = 0; i < BENCH_RPC_GROUP_FNS; ++i) {
+            g_bench_fns[group][i] = (TFN_Ptr) (uintptr_t) (0x1001 + 0x40 * (group * BENCH_RPC_GROUP_FNS + i));
+        }
+        if (group == group_count - 1) {
+            g_bench_fns[group][BENCH_RPC_GROUP_FNS - 1] = bench_rpc_target;
+        }
+
+        uvisor_pool_slot_t slot = uvisor_pool_queue_allocate(&rpc->fn_group_queue.queue);
+        uvisor_rpc_fn_group_t * fn_group = &rpc->fn_group_queue.fn_groups[slot];
+        fn_group->fn_ptr_array = g_bench_fns[group];
+        fn_group->fn_count = BENCH_RPC_GROUP_FNS;
+        uvisor_spin_lock(&rpc->fn_index.lock);
+        for (int i = 0; i < BENCH_RPC_GROUP_FNS; ++i) {
+            if (uvisor_rpc_fn_index_add(&rpc->fn_index, g_bench_fns[group][i], slot)) {
+                rpc->fn_index.overflow = 1;
+            }
+        }
+        uvisor_spin_unlock(&rpc->fn_index.lock);
+        uvisor_pool_queue_enqueue(&rpc->fn_group_queue.queue, slot);
+    }
+}
+
+/* Post an RPC from a caller box to another box that passes buffers by
+ * reference, like the box-side RPC API does. */
+static uvisor_pool_slot_t bench_rpc_post_buffers(int caller_box, int box_id, uint32_t p0,
+                                                 const uvisor_rpc_buffer_t * buffers, uint32_t buffer_count)
+{
+    uvisor_rpc_t * rpc = uvisor_rpc(bench_box_index(caller_box));
+    uvisor_pool_queue_t * queue = &rpc->outgoing_message_queue.queue;
+
+    uvisor_pool_slot_t slot = uvisor_pool_queue_allocate(queue);
+    uvisor_rpc_message_t * msg = &rpc->outgoing_message_queue.messages[slot];
+    msg->p0 = p0;
+    msg->p1 = 0;
+    msg->p2 = 0;
+    msg->p3 = 0;
+    msg->gateway = &g_bench_gateway[box_id];
+    rpc->result_counter += UVISOR_RESULT_COUNTER_INCREMENT;
+    msg->match_cookie = uvisor_result_build(rpc->result_counter, slot);
+    msg->wait_cookie = msg->match_cookie;
+    msg->state = UVISOR_RPC_MESSAGE_STATE_READY_TO_SEND;
+    msg->batch_slot = UVISOR_POOL_SLOT_INVALID;
+    msg->buffer_count = buffer_count;
+    for (uint32_t i = 0; i < buffer_count; ++i) {
+        msg->buffers[i] = buffers[i];
+    }
+    msg->completion_queue = NULL;
+    msg->queued_at = 0;
+    uvisor_pool_queue_enqueue(queue, slot);
+    bench_box_index(caller_box)->doorbells.queue[UVISOR_BOX_DOORBELL_RPC_OUTGOING] = 1;
+    return slot;
+}
+
+/* Post an RPC from box 0 to another box. */
+static uvisor_pool_slot_t bench_rpc_post(int box_id, uint32_t p0)
+{
+    return bench_rpc_post_buffers(0, box_id, p0, NULL, 0);
+}
+
+/* Post a batch of RPCs from box 0 to another box, like rpc_fncall_batch does.
+ * The parameter of each RPC is its index in the batch. */
+static void bench_rpc_post_batch(int box_id, uvisor_pool_slot_t * slots, size_t count)
+{
+    uvisor_rpc_t * rpc = uvisor_rpc(bench_box_index(0));
+    uvisor_pool_queue_t * queue = &rpc->outgoing_message_queue.queue;
+
+    if (uvisor_pool_queue_allocate_n(queue, slots, count) != count) {
+        HALT_ERROR(SANITY_CHECK_FAILED, "No room for a batch of %d RPCs", (int) count);
+    }
+    rpc->outgoing_message_queue.messages[slots[0]].batch_pending = count;
+    for (size_t i = 0; i < count; ++i) {
+        uvisor_rpc_message_t * msg = &rpc->outgoing_message_queue.messages[slots[i]];
+        msg->p0 = i;
+        msg->p1 = 0;
+        msg->p2 = 0;
+        msg->p3 = 0;
+        msg->gateway = &g_bench_gateway[box_id];
+        rpc->result_counter += UVISOR_RESULT_COUNTER_INCREMENT;
+        msg->match_cookie = uvisor_result_build(rpc->result_counter, slots[i]);
+        msg->wait_cookie = uvisor_result_build((uint32_t) UVISOR_RESULT_INVALID_COUNTER, slots[i]);
+        msg->state = UVISOR_RPC_MESSAGE_STATE_READY_TO_SEND;
+        msg->batch_slot = slots[0];
+        msg->buffer_count = 0;
+        msg->completion_queue = NULL;
+        msg->queued_at = 0;
+    }
+    uvisor_pool_queue_try_enqueue_batch(queue, slots, count);
+    bench_box_index(0)->doorbells.queue[UVISOR_BOX_DOORBELL_RPC_OUTGOING] = 1;
+}
+
+/* Post one RPC from box 0 to every other box. */
+static void bench_rpc_send(int box_count)
+{
+    for (int box_id = 1; box_id < box_count; ++box_id) {
+        g_bench_rpc_slot[box_id] = bench_rpc_post(box_id, box_id);
+    }
+}
+
+/* Fill or empty the incoming message pool of a box, so that no RPCs can be
+ * delivered to it. */
+static void bench_rpc_block(int box_id, bool block)
+{
+    static uvisor_pool_slot_t slots[UVISOR_MAX_BOXES][UVISOR_RPC_INCOMING_MESSAGE_SLOTS];
+    uvisor_pool_t * pool = uvisor_rpc(bench_box_index(box_id))->incoming_message_queue.todo_queue.pool;
+
+    for (int i = 0; i < UVISOR_RPC_INCOMING_MESSAGE_SLOTS; ++i) {
+        if (block) {
+            slots[box_id][i] = uvisor_pool_allocate(pool);
+        } else {
+            uvisor_pool_free(pool, slots[box_id][i]);
+        }
+    }
+}
+
+/* Serve the delivered RPC in the given callee box, as its handler thread
+ * would, and post the result. */
+static void bench_rpc_serve(int box_id)
+{
+    uvisor_rpc_t * rpc = uvisor_rpc(bench_box_index(box_id));
+    uvisor_pool_slot_t slot = uvisor_pool_queue_dequeue_first(&rpc->incoming_message_queue.todo_queue);
+    uvisor_rpc_message_t * msg = &rpc->incoming_message_queue.messages[slot];
+    if (!rpc_gateway_is_queued(msg->gateway)) {
+        /* The handler thread drops the message without completing it. */
+        return;
+    }
+    msg->result = bench_rpc_target(msg->p0, msg->p1, msg->p2, msg->p3);
+    msg->state = UVISOR_RPC_MESSAGE_STATE_DONE;
+    uvisor_pool_queue_enqueue(&rpc->incoming_message_queue.done_queue, slot);
+    bench_box_index(box_id)->doorbells.queue[UVISOR_BOX_DOORBELL_RPC_DONE] = 1;
+}
+
+/* Collect all the results in box 0 and free the outgoing messages. */
+static void bench_rpc_collect(int box_count)
+{
+    uvisor_rpc_t * rpc = uvisor_rpc(bench_box_index(0));
+    for (int box_id = 1; box_id < box_count; ++box_id) {
+        uvisor_pool_slot_t slot = g_bench_rpc_slot[box_id];
+        uvisor_rpc_message_t * msg = &rpc->outgoing_message_queue.messages[slot];
+        if (msg->state != UVISOR_RPC_MESSAGE_STATE_DONE) {
+            HALT_ERROR(SANITY_CHECK_FAILED, "RPC in slot %d not completed", slot);
+        }
+        msg->state = UVISOR_RPC_MESSAGE_STATE_IDLE;
+        uvisor_pool_queue_free(&rpc->outgoing_message_queue.queue, slot);
+    }
+}
+
+/* Time the delivery of one RPC to each callee box. */
+static void bm_rpc_drain_message_queue(BenchState * state)
+{
+    int box_count = state->arg;
+    bench_rpc_init(box_count);
+
+    while (bench_keep_running(state)) {
+        bench_pause_timing(state);
+        bench_rpc_send(box_count);
+        bench_resume_timing(state);
+
+        bench_box_switch(0);
+        drain_message_queue();
+
+        bench_pause_timing(state);
+        for (int box_id = 1; box_id < box_count; ++box_id) {
+            bench_rpc_serve(box_id);
+            bench_box_switch(box_id);
+            drain_result_queue();
+        }
+        bench_rpc_collect(box_count);
+        bench_resume_timing(state);
+    }
+}
+
+/* Time the delivery of one RPC to each callee box and of all the results
+ * back to the caller, including the work done by the boxes themselves. */
+static void bm_rpc_round_trip(BenchState * state)
+{
+    int box_count = state->arg;
+    bench_rpc_init(box_count);
+
+    while (bench_keep_running(state)) {
+        bench_rpc_send(box_count);
+        bench_box_switch(0);
+        drain_message_queue();
+        for (int box_id = 1; box_id < box_count; ++box_id) {
+            bench_rpc_serve(box_id);
+            bench_box_switch(box_id);
+            drain_result_queue();
+        }
+        bench_rpc_collect(box_count);
+    }
+}
+
+/* Time an RPC from box 0 to box 1 and back, delivered by the drains of the
+ * next thread switches (arg 0) or kicked through right away (arg 1). On the
+ * target the drains wait for the next thread switch, often a whole RTOS tick,
+ * while a kick wakes the other box up before the SVC returns. */
+static void bm_rpc_ping_pong(BenchState * state)
+{
+    bench_rpc_init(2);
+
+    while (bench_keep_running(state)) {
+        bench_rpc_send(2);
+        bench_box_switch(0);
+        if (state->arg) {
+            doorbell_kick(1);
+        } else {
+            drain_message_queue();
+            drain_result_queue();
+            ipc_drain_queue();
+            channel_drain();
+        }
+
+        bench_rpc_serve(1);
+        bench_box_switch(1);
+        if (state->arg) {
+            doorbell_kick(0);
+        } else {
+            drain_message_queue();
+            drain_result_queue();
+            ipc_drain_queue();
+            channel_drain();
+        }
+        bench_rpc_collect(2);
+    }
+}
+
+/* Time the delivery of one RPC to a box with 8 registered function groups of
+ * 6 functions each, using the function index (arg 1) or searching the
+ * function groups (arg 0). */
+static void bm_rpc_wake_up(BenchState * state)
+{
+    bench_rpc_init(2);
+    bench_rpc_register(1, UVISOR_RPC_FN_GROUP_SLOTS);
+    if (!state->arg) {
+        uvisor_rpc_fn_index_t * fn_index = &uvisor_rpc(bench_box_index(1))->fn_index;
+        memset((void *) fn_index->entries, 0, sizeof(fn_index->entries));
+        fn_index->overflow = 1;
+    }
+
+    while (bench_keep_running(state)) {
+        bench_pause_timing(state);
+        bench_rpc_send(2);
+        bench_resume_timing(state);
+
+        bench_box_switch(0);
+        drain_message_queue();
+
+        bench_pause_timing(state);
+        bench_rpc_serve(1);
+        bench_box_switch(1);
+        drain_result_queue();
+        bench_rpc_collect(2);
+        bench_resume_timing(state);
+    }
+}
+
+/* Time the delivery of one RPC to each of the other boxes, behind an RPC to
+ * box 1 that cannot be delivered. */
+static void bm_rpc_drain_blocked(BenchState * state)
+{
+    int box_count = state->arg;
+    bench_rpc_init(box_count);
+    bench_rpc_block(1, true);
+
+    while (bench_keep_running(state)) {
+        bench_pause_timing(state);
+        bench_rpc_post(1, 0);
+        for (int box_id = 2; box_id < box_count; ++box_id) {
+            g_bench_rpc_slot[box_id] = bench_rpc_post(box_id, box_id);
+            bench_rpc_post(1, box_id);
+        }
+        bench_resume_timing(state);
+
+        bench_box_switch(0);
+        drain_message_queue();
+
+        bench_pause_timing(state);
+        for (int box_id = 2; box_id < box_count; ++box_id) {
+            bench_rpc_serve(box_id);
+            bench_box_switch(box_id);
+            drain_result_queue();
+        }
+        /* Free the delivered RPCs and drop the blocked ones. */
+        uvisor_pool_queue_t * queue = &uvisor_rpc(bench_box_index(0))->outgoing_message_queue.queue;
+        uvisor_pool_slot_t slot;
+        while ((slot = uvisor_pool_queue_try_dequeue_first(queue)) < queue->pool->num) {
+            uvisor_pool_free(queue->pool, slot);
+        }
+        for (int box_id = 2; box_id < box_count; ++box_id) {
+            uvisor_pool_queue_free(queue, g_bench_rpc_slot[box_id]);
+        }
+        bench_resume_timing(state);
+    }
+}
+
+/* Check that an RPC to a box that can't take it only holds back the RPCs to
+ * the same box, and that those are delivered in order later. */
+static int check_rpc_lanes(void)
+{
+    bench_rpc_init(3);
+    bench_rpc_block(1, true);
+    uint32_t count = g_rpc_wait_count;
+    uint32_t total = g_rpc_wait_total;
+
+    for (int i = 0; i < 6; ++i) {
+        bench_rpc_post(1 + i % 2, i);
+    }
+    bench_box_switch(0);
+    drain_message_queue();
+    uvisor_rpc_t * callee = uvisor_rpc(bench_box_index(2));
+    for (int i = 1; i < 6; i += 2) {
+        uvisor_pool_slot_t slot = uvisor_pool_queue_dequeue_first(&callee->incoming_message_queue.todo_queue);
+        if (slot >= UVISOR_RPC_INCOMING_MESSAGE_SLOTS || callee->incoming_message_queue.messages[slot].p0 != i) {
+            printf("rpc_lanes: RPC %d to an idle box held back\n", i);
+            return 1;
+        }
+    }
+
+    bench_rpc_block(1, false);
+    drain_message_queue();
+    callee = uvisor_rpc(bench_box_index(1));
+    for (int i = 0; i < 6; i += 2) {
+        uvisor_pool_slot_t slot = uvisor_pool_queue_dequeue_first(&callee->incoming_message_queue.todo_queue);
+        if (slot >= UVISOR_RPC_INCOMING_MESSAGE_SLOTS || callee->incoming_message_queue.messages[slot].p0 != i) {
+            printf("rpc_lanes: RPC %d to a blocked box out of order\n", i);
+            return 1;
+        }
+    }
+    if (g_rpc_wait_count - count != 6 || g_rpc_wait_total - total != 3) {
+        printf("rpc_lanes: %u RPCs waited for %u drains\n", g_rpc_wait_count - count, g_rpc_wait_total - total);
+        return 1;
+    }
+
+    printf("rpc_lanes: RPCs to a blocked box only hold back each other\n");
+    return 0;
+}
+
+/* Check that RPCs wake up exactly the function groups handling their
+ * target, whether the target is in the function index or not. */
+static int check_rpc_wake_up(void)
+{
+    for (int overflow = 0; overflow < 2; ++overflow) {
+        bench_rpc_init(2);
+        bench_rpc_register(1, UVISOR_RPC_FN_GROUP_SLOTS);
+        uvisor_rpc_t * rpc = uvisor_rpc(bench_box_index(1));
+        if (overflow) {
+            memset((void *) rpc->fn_index.entries, 0, sizeof(rpc->fn_index.entries));
+            rpc->fn_index.overflow = 1;
+        } else if (rpc->fn_index.overflow) {
+            printf("rpc_wake_up: %d functions overflowed the index\n", UVISOR_RPC_FN_GROUP_SLOTS * BENCH_RPC_GROUP_FNS);
+            return 1;
+        }
+
+        uint32_t posts = g_bench_semaphore_posts;
+        bench_rpc_send(2);
+        bench_box_switch(0);
+        drain_message_queue();
+        if (g_bench_semaphore_posts - posts != 1 ||
+            g_bench_semaphore_last != &rpc->fn_group_queue.fn_groups[UVISOR_RPC_FN_GROUP_SLOTS - 1].semaphore) {
+            printf("rpc_wake_up: wrong function groups woken up\n");
+            return 1;
+        }
+        bench_rpc_serve(1);
+        bench_box_switch(1);
+        drain_result_queue();
+        bench_rpc_collect(2);
+    }
+
+    printf("rpc_wake_up: function groups woken up through the index\n");
+    return 0;
+}
+
+/* Time 8 RPCs from box 0 to box 1, from posting them to freeing their
+ * results, either one by one (arg 0) or as a batch (arg 1). */
+static void bm_rpc_batch(BenchState * state)
+{
+    uvisor_rpc_t * rpc = uvisor_rpc(bench_box_index(0));
+    uvisor_pool_slot_t slots[UVISOR_RPC_OUTGOING_MESSAGE_SLOTS];
+    size_t count = UVISOR_ARRAY_COUNT(slots);
+
+    bench_rpc_init(2);
+    bench_rpc_register(1, 1);
+
+    while (bench_keep_running(state)) {
+        if (state->arg) {
+            bench_rpc_post_batch(1, slots, count);
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                slots[i] = bench_rpc_post(1, i);
+            }
+        }
+        bench_box_switch(0);
+        drain_message_queue();
+        for (size_t i = 0; i < count; ++i) {
+            bench_rpc_serve(1);
+        }
+        bench_box_switch(1);
+        drain_result_queue();
+        for (size_t i = 0; i < count; ++i) {
+            uvisor_pool_queue_free(&rpc->outgoing_message_queue.queue, slots[i]);
+        }
+    }
+}
+
+/* Check that a batch of RPCs is delivered in order and completed with a
+ * single post once all of its results are back. */
+static int check_rpc_batch(void)
+{
+    uvisor_pool_slot_t slots[UVISOR_RPC_OUTGOING_MESSAGE_SLOTS + 1];
+    size_t count = 6;
+
+    bench_rpc_init(2);
+    bench_rpc_register(1, 1);
+    uvisor_rpc_t * caller = uvisor_rpc(bench_box_index(0));
+    uvisor_rpc_t * callee = uvisor_rpc(bench_box_index(1));
+
+    /* The slots of a batch are allocated all at once or not at all. */
+    if (uvisor_pool_queue_allocate_n(&caller->outgoing_message_queue.queue, slots, UVISOR_ARRAY_COUNT(slots)) != 0 ||
+        caller->outgoing_message_queue.queue.pool->num_allocated != 0) {
+        printf("rpc_batch: oversized batch allocated\n");
+        return 1;
+    }
+
+    uint32_t posts = g_bench_semaphore_posts;
+    bench_rpc_post_batch(1, slots, count);
+    bench_box_switch(0);
+    drain_message_queue();
+    if (g_bench_semaphore_posts - posts != count) {
+        printf("rpc_batch: handlers woken up %u times for %d RPCs\n", g_bench_semaphore_posts - posts, (int) count);
+        return 1;
+    }
+
+    /* Serve the batch in order, then complete it. */
+    for (size_t i = 0; i < count; ++i) {
+        uvisor_pool_slot_t slot = caller->outgoing_message_queue.queue.head;
+        if (slot < UVISOR_RPC_OUTGOING_MESSAGE_SLOTS) {
+            printf("rpc_batch: RPC left in the outgoing queue\n");
+            return 1;
+        }
+        slot = callee->incoming_message_queue.todo_queue.head;
+        if (slot >= UVISOR_RPC_INCOMING_MESSAGE_SLOTS || callee->incoming_message_queue.messages[slot].p0 != i) {
+            printf("rpc_batch: RPC %d delivered out of order\n", (int) i);
+            return 1;
+        }
+        bench_rpc_serve(1);
+    }
+    posts = g_bench_semaphore_posts;
+    bench_box_switch(1);
+    drain_result_queue();
+    uvisor_rpc_message_t * first = &caller->outgoing_message_queue.messages[slots[0]];
+    if (g_bench_semaphore_posts - posts != 1 || g_bench_semaphore_last != &first->semaphore || first->batch_pending) {
+        printf("rpc_batch: batch completed with %u posts\n", g_bench_semaphore_posts - posts);
+        return 1;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        uvisor_rpc_message_t * msg = &caller->outgoing_message_queue.messages[slots[i]];
+        if (msg->state != UVISOR_RPC_MESSAGE_STATE_DONE || msg->result != i) {
+            printf("rpc_batch: wrong result for RPC %d\n", (int) i);
+            return 1;
+        }
+        uvisor_pool_queue_free(&caller->outgoing_message_queue.queue, slots[i]);
+    }
+
+    printf("rpc_batch: batch delivered in order and completed once\n");
+    return 0;
+}
+
+/* Check that the RPCs started with a completion queue complete into it in the
+ * order they finish, with one wake up while the queue isn't emptied. */
+static int check_rpc_completion(void)
+{
+    static uvisor_rpc_completion_queue_t cq;
+    uvisor_pool_slot_t slots[3];
+    const int callees[3] = {1, 1, 2};
+
+    bench_rpc_init(3);
+    uvisor_rpc_t * caller = uvisor_rpc(bench_box_index(0));
+    memset(&cq, 0, sizeof(cq));
+
+    for (int i = 0; i < 3; ++i) {
+        slots[i] = bench_rpc_post(callees[i], i);
+        caller->outgoing_message_queue.messages[slots[i]].completion_queue = &cq;
+    }
+    bench_box_switch(0);
+    drain_message_queue();
+
+    /* Box 2 finishes first. */
+    uint32_t posts = g_bench_semaphore_posts;
+    bench_rpc_serve(2);
+    bench_box_switch(2);
+    drain_result_queue();
+    bench_rpc_serve(1);
+    bench_rpc_serve(1);
+    bench_box_switch(1);
+    drain_result_queue();
+    if (g_bench_semaphore_posts - posts != 1) {
+        printf("rpc_completion: waiting thread woken up %u times\n", g_bench_semaphore_posts - posts);
+        return 1;
+    }
+    if (cq.head != 3 || cq.slots[0] != slots[2] || cq.slots[1] != slots[0] || cq.slots[2] != slots[1]) {
+        printf("rpc_completion: RPCs not completed in the order they finished\n");
+        return 1;
+    }
+    for (int i = 0; i < 3; ++i) {
+        if (caller->outgoing_message_queue.messages[slots[i]].result != bench_rpc_target(i, 0, 0, 0)) {
+            printf("rpc_completion: wrong result for RPC %d\n", i);
+            return 1;
+        }
+        uvisor_pool_queue_free(&caller->outgoing_message_queue.queue, slots[i]);
+    }
+
+    /* Once the queue was emptied, the next completion wakes the thread up
+     * again. */
+    cq.tail = cq.head;
+    slots[0] = bench_rpc_post(1, 0);
+    caller->outgoing_message_queue.messages[slots[0]].completion_queue = &cq;
+    bench_box_switch(0);
+    drain_message_queue();
+    posts = g_bench_semaphore_posts;
+    bench_rpc_serve(1);
+    bench_box_switch(1);
+    drain_result_queue();
+    if (g_bench_semaphore_posts - posts != 1 || cq.head != 4) {
+        printf("rpc_completion: emptied queue not woken up\n");
+        return 1;
+    }
+    uvisor_pool_queue_free(&caller->outgoing_message_queue.queue, slots[0]);
+
+    printf("rpc_completion: RPCs completed into one queue with one wake up\n");
+    return 0;
+}
+
+/* Time one RPC from box 2 to box 1 and its result, either without buffers
+ * (arg 0) or passing a 512-byte buffer in a page of box 2 by reference
+ * (arg 1). */
+static void bm_rpc_buffer(BenchState * state)
+{
+    bench_rpc_init(3);
+    bench_page_heap_reset();
+    uvisor_rpc_buffer_t buffer = {bench_page_heap_alloc(2), 512, UVISOR_RPC_BUFFER_IN};
+    uvisor_pool_queue_t * queue = &uvisor_rpc(bench_box_index(2))->outgoing_message_queue.queue;
+
+    while (bench_keep_running(state)) {
+        uvisor_pool_slot_t slot = bench_rpc_post_buffers(2, 1, 0, &buffer, state->arg);
+        bench_box_switch(2);
+        drain_message_queue();
+        bench_rpc_serve(1);
+        bench_box_switch(1);
+        drain_result_queue();
+        uvisor_pool_queue_free(queue, slot);
+    }
+}
+
+/* Check that the buffers passed by reference are granted to the callee box
+ * until their RPCs complete, and that invalid buffers are rejected. */
+static int check_rpc_buffers(void)
+{
+    bench_rpc_init(4);
+    bench_page_heap_reset();
+    uint8_t * page = bench_page_heap_alloc(2);
+    uvisor_rpc_t * caller = uvisor_rpc(bench_box_index(2));
+    uvisor_rpc_t * callee = uvisor_rpc(bench_box_index(1));
+    uvisor_rpc_buffer_t in = {page + 16, 512, UVISOR_RPC_BUFFER_IN};
+    uvisor_rpc_buffer_t out = {page, 64, UVISOR_RPC_BUFFER_OUT};
+    uvisor_pool_slot_t slots[2];
+
+    if (vmpu_buffer_access_is_ok(1, in.address, in.size)) {
+        printf("rpc_buffers: page accessible before the RPC\n");
+        return 1;
+    }
+
+    /* Two RPCs pass buffers in the same page, for reading and for writing. */
+    slots[0] = bench_rpc_post_buffers(2, 1, 0, &in, 1);
+    bench_box_switch(2);
+    drain_message_queue();
+    if (!vmpu_buffer_access_is_ok(1, in.address, in.size) || !page_allocator_is_read_only(1, (uint32_t) page)) {
+        printf("rpc_buffers: input buffer not granted for reading\n");
+        return 1;
+    }
+    slots[1] = bench_rpc_post_buffers(2, 1, 1, &out, 1);
+    drain_message_queue();
+    if (page_allocator_is_read_only(1, (uint32_t) page)) {
+        printf("rpc_buffers: output buffer not granted for writing\n");
+        return 1;
+    }
+
+    /* The page stays granted until the last of the RPCs completes. */
+    uint32_t invalidations = g_bench_mpu_invalidations;
+    uint32_t page_invalidations = g_bench_mpu_page_invalidations;
+    for (int i = 0; i < 2; ++i) {
+        bench_rpc_serve(1);
+        bench_box_switch(1);
+        drain_result_queue();
+        if (vmpu_buffer_access_is_ok(1, in.address, in.size) != (i == 0)) {
+            printf("rpc_buffers: page still granted after RPC %d\n", i);
+            return 1;
+        }
+        if (caller->outgoing_message_queue.messages[slots[i]].state != UVISOR_RPC_MESSAGE_STATE_DONE) {
+            printf("rpc_buffers: RPC %d not completed\n", i);
+            return 1;
+        }
+        uvisor_pool_queue_free(&caller->outgoing_message_queue.queue, slots[i]);
+    }
+    if (g_bench_mpu_page_invalidations - page_invalidations != 2 || g_bench_mpu_invalidations != invalidations) {
+        printf("rpc_buffers: page heap regions not invalidated after the grants ended\n");
+        return 1;
+    }
+
+    /* Buffers in pages of other boxes, or across pages, are rejected. */
+    uint8_t * other_page = bench_page_heap_alloc(3);
+    uvisor_rpc_buffer_t invalid[] = {
+        {other_page, 16, UVISOR_RPC_BUFFER_IN},
+        {page + 1024 - 8, 16, UVISOR_RPC_BUFFER_IN},
+        {page, 16, 0},
+    };
+    for (int i = 0; i < (int) UVISOR_ARRAY_COUNT(invalid); ++i) {
+        uint32_t posts = g_bench_semaphore_posts;
+        uvisor_pool_slot_t slot = bench_rpc_post_buffers(2, 1, 0, &invalid[i], 1);
+        bench_box_switch(2);
+        drain_message_queue();
+        if (caller->outgoing_message_queue.messages[slot].state != UVISOR_RPC_MESSAGE_STATE_REJECTED ||
+            g_bench_semaphore_posts - posts != 1 ||
+            callee->incoming_message_queue.todo_queue.head != UVISOR_POOL_SLOT_INVALID) {
+            printf("rpc_buffers: invalid buffer %d not rejected\n", i);
+            return 1;
+        }
+        uvisor_pool_queue_free(&caller->outgoing_message_queue.queue, slot);
+    }
+
+    printf("rpc_buffers: buffers granted for the duration of their RPCs\n");
+    return 0;
+}
+
+/* Take all the delivered RPCs out of the todo queue of a box, serving them,
+ * and return how many there were. */
+static int bench_rpc_serve_all(int box_id)
+{
+    uvisor_rpc_t * rpc = uvisor_rpc(bench_box_index(box_id));
+    int count = 0;
+
+    while (rpc->incoming_message_queue.todo_queue.head != UVISOR_POOL_SLOT_INVALID) {
+        bench_rpc_serve(box_id);
+        ++count;
+    }
+    return count;
+}
+
+/* Check that only direct gateways can be called directly, and that direct
+ * gateways can still be called through the RPC queues. */
+static int check_rpc_direct(void)
+{
+    bench_rpc_init(3);
+    g_bench_gateway[1].magic = UVISOR_RPC_GATEWAY_MAGIC_DIRECT;
+
+    if (rpc_direct_callee_box_id(&g_bench_gateway[1]) != 1 || rpc_direct_callee_box_id(&g_bench_gateway[2]) != -1) {
+        printf("rpc_direct: direct gateways not told apart\n");
+        return 1;
+    }
+
+    bench_rpc_send(3);
+    bench_box_switch(0);
+    drain_message_queue();
+    if (bench_rpc_serve_all(1) != 1 || bench_rpc_serve_all(2) != 1) {
+        printf("rpc_direct: queued RPCs not delivered\n");
+        return 1;
+    }
+    for (int box_id = 1; box_id < 3; ++box_id) {
+        bench_box_switch(box_id);
+        drain_result_queue();
+    }
+    bench_rpc_collect(3);
+
+    printf("rpc_direct: direct gateways accepted\n");
+    return 0;
+}
+
+/* Check that an RPC through a direct gateway that went through the RPC
+ * queues, like rpc_fncall_direct does on ARMv8-M, is served and completed. */
+static int check_rpc_direct_fallback(void)
+{
+    bench_rpc_init(2);
+    g_bench_gateway[1].magic = UVISOR_RPC_GATEWAY_MAGIC_DIRECT;
+    uvisor_rpc_t * rpc = uvisor_rpc(bench_box_index(0));
+
+    g_bench_rpc_slot[1] = bench_rpc_post(1, 42);
+    bench_box_switch(0);
+    drain_message_queue();
+    bench_rpc_serve(1);
+    bench_box_switch(1);
+    drain_result_queue();
+
+    uvisor_rpc_message_t * msg = &rpc->outgoing_message_queue.messages[g_bench_rpc_slot[1]];
+    if (msg->state != UVISOR_RPC_MESSAGE_STATE_DONE || msg->result != 42) {
+        printf("rpc_direct_fallback: queued direct RPC not completed\n");
+        return 1;
+    }
+    bench_rpc_collect(2);
+
+    printf("rpc_direct_fallback: queued direct RPC completed\n");
+    return 0;
+}
+
+/* Return the stats entry of the RPCs from box 0 to the benchmark target, or
+ * NULL. */
+static const uvisor_rpc_stats_entry_t * bench_rpc_stats_entry(const uvisor_rpc_stats_t * stats)
+{
+    for (int i = 0; i < UVISOR_RPC_STATS_ENTRIES; ++i) {
+        const uvisor_rpc_stats_entry_t * entry = &stats->entries[i];
+        if (entry->target == (uint32_t) bench_rpc_target && entry->caller_box == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/* Check that a kick only delivers the RPCs and the results for the box it
+ * names, and leaves the others for the next drain. */
+static int check_rpc_kick(void)
+{
+    bench_rpc_init(4);
+    uvisor_rpc_t * rpc0 = uvisor_rpc(bench_box_index(0));
+    uvisor_rpc_t * rpc1 = uvisor_rpc(bench_box_index(1));
+
+    /* Box 0 calls boxes 1 and 2, and box 1 calls box 2. */
+    bench_rpc_send(3);
+    uvisor_pool_slot_t slot1 = bench_rpc_post_buffers(1, 2, 1, NULL, 0);
+    bench_box_switch(0);
+    if (doorbell_kick(0) != UVISOR_ERROR_INVALID_BOX_ID || doorbell_kick(-1) != UVISOR_ERROR_INVALID_BOX_ID ||
+        doorbell_kick(g_vmpu_box_count) != UVISOR_ERROR_INVALID_BOX_ID) {
+        printf("rpc_kick: bad box kicked\n");
+        return 1;
+    }
+    doorbell_kick(2);
+    if (bench_rpc_serve_all(1) != 0 || bench_rpc_serve_all(2) != 1 ||
+        !bench_box_index(0)->doorbells.queue[UVISOR_BOX_DOORBELL_RPC_OUTGOING]) {
+        printf("rpc_kick: RPCs to other boxes delivered\n");
+        return 1;
+    }
+    drain_message_queue();
+    bench_box_switch(1);
+    doorbell_kick(2);
+    if (bench_rpc_serve_all(1) != 1 || bench_rpc_serve_all(2) != 1) {
+        printf("rpc_kick: RPCs not delivered\n");
+        return 1;
+    }
+
+    /* Box 2 holds a result for box 0 and one for box 1. */
+    bench_box_switch(2);
+    doorbell_kick(1);
+    if (rpc1->outgoing_message_queue.messages[slot1].state != UVISOR_RPC_MESSAGE_STATE_DONE ||
+        rpc0->outgoing_message_queue.messages[g_bench_rpc_slot[2]].state == UVISOR_RPC_MESSAGE_STATE_DONE ||
+        !bench_box_index(2)->doorbells.queue[UVISOR_BOX_DOORBELL_RPC_DONE]) {
+        printf("rpc_kick: results to other boxes returned\n");
+        return 1;
+    }
+    drain_result_queue();
+    bench_box_switch(1);
+    drain_result_queue();
+    bench_rpc_collect(3);
+
+    printf("rpc_kick: only the kicked box delivered to\n");
+    return 0;
+}
+
+/* Check that the latencies of an RPC are split at its delivery and counted in
+ * the right buckets, and that only the public box can read them. */
+static int check_rpc_stats(void)
+{
+    static uvisor_rpc_stats_t before;
+    static uvisor_rpc_stats_t after;
+
+    bench_rpc_init(2);
+    bench_box_switch(0);
+    if (rpc_get_stats(&before) || before.magic != UVISOR_RPC_STATS_MAGIC) {
+        printf("rpc_stats: latencies not readable\n");
+        return 1;
+    }
+
+    /* The RPC waits behind a full callee queue for 100 cycles, and its result
+     * is taken 5000 cycles after the delivery. */
+    g_bench_cycles = 1000;
+    bench_rpc_block(1, true);
+    bench_rpc_send(2);
+    drain_message_queue();
+    g_bench_cycles += 100;
+    bench_rpc_block(1, false);
+    drain_message_queue();
+    bench_rpc_serve(1);
+    g_bench_cycles += 5000;
+    bench_box_switch(1);
+    drain_result_queue();
+    if (rpc_get_stats(&after) != UVISOR_ERROR_INVALID_BOX_ID) {
+        printf("rpc_stats: latencies readable outside of the public box\n");
+        return 1;
+    }
+    bench_rpc_collect(2);
+
+    bench_box_switch(0);
+    rpc_get_stats(&after);
+    const uvisor_rpc_stats_entry_t * old = bench_rpc_stats_entry(&before);
+    const uvisor_rpc_stats_entry_t * entry = bench_rpc_stats_entry(&after);
+    /* 100 cycles is in [2^6, 2^7), 5000 in [2^12, 2^13), 5100 too. */
+    uint32_t wait = old ? old->wait[0] : 0;
+    uint32_t service = old ? old->service[12 - UVISOR_RPC_STATS_BUCKET_SHIFT] : 0;
+    uint32_t total = old ? old->total[12 - UVISOR_RPC_STATS_BUCKET_SHIFT] : 0;
+    if (entry == NULL || entry->count != (old ? old->count : 0) + 1 || entry->max < 5100 ||
+        entry->wait[0] != wait + 1 ||
+        entry->service[12 - UVISOR_RPC_STATS_BUCKET_SHIFT] != service + 1 ||
+        entry->total[12 - UVISOR_RPC_STATS_BUCKET_SHIFT] != total + 1) {
+        printf("rpc_stats: latencies not recorded\n");
+        return 1;
+    }
+
+    printf("rpc_stats: latencies recorded at the delivery and the result\n");
+    return 0;
+}
+
+/* Check that the RPC queues of each box have the number of slots configured
+ * for the box. */
+static int check_rpc_slots(void)
+{
+    UvisorBoxQueueSlots slots[3];
+    for (int box_id = 0; box_id < 3; ++box_id) {
+        slots[box_id] = (UvisorBoxQueueSlots) {
+            UVISOR_RPC_OUTGOING_MESSAGE_SLOTS,
+            UVISOR_RPC_INCOMING_MESSAGE_SLOTS,
+            UVISOR_RPC_FN_GROUP_SLOTS,
+            UVISOR_IPC_SEND_SLOTS,
+            UVISOR_IPC_RECV_SLOTS,
+        };
+    }
+    slots[0].rpc_outgoing = UVISOR_RPC_MESSAGE_SLOTS_MAX;
+    slots[1].rpc_incoming = 2;
+    slots[2].rpc_incoming = UVISOR_RPC_MESSAGE_SLOTS_MAX;
+
+    bench_rpc_init_slots(3, slots);
+    bench_rpc_register(1, 1);
+    bench_rpc_register(2, 1);
+    for (int box_id = 0; box_id < 3; ++box_id) {
+        uvisor_rpc_t * rpc = uvisor_rpc(bench_box_index(box_id));
+        if (rpc->outgoing_message_queue.queue.pool->num != slots[box_id].rpc_outgoing ||
+            rpc->incoming_message_queue.todo_queue.pool->num != slots[box_id].rpc_incoming ||
+            rpc->incoming_message_queue.done_queue.pool != rpc->incoming_message_queue.todo_queue.pool ||
+            rpc->fn_group_queue.queue.pool->num != slots[box_id].rpc_fn_group ||
+            uvisor_ipc(bench_box_index(box_id))->recv_queue.queue.pool->num != slots[box_id].ipc_recv) {
+            printf("rpc_slots: box %d queues not laid out as configured\n", box_id);
+            return 1;
+        }
+    }
+
+    /* The shallow box only takes 2 RPCs at a time, the deep one takes all of
+     * the RPCs sent to it. */
+    for (int i = 0; i < UVISOR_RPC_MESSAGE_SLOTS_MAX; ++i) {
+        bench_rpc_post(i < 4 ? 1 : 2, i);
+    }
+    bench_box_switch(0);
+    drain_message_queue();
+    int shallow = bench_rpc_serve_all(1);
+    int deep = bench_rpc_serve_all(2);
+    if (shallow != 2 || deep != UVISOR_RPC_MESSAGE_SLOTS_MAX - 4) {
+        printf("rpc_slots: %d and %d RPCs delivered\n", shallow, deep);
+        return 1;
+    }
+    bench_box_switch(1);
+    drain_result_queue();
+    bench_box_switch(2);
+    drain_result_queue();
+    bench_box_switch(0);
+    drain_message_queue();
+    shallow = bench_rpc_serve_all(1);
+    if (shallow != 2) {
+        printf("rpc_slots: %d held back RPCs delivered\n", shallow);
+        return 1;
+    }
+    bench_box_switch(1);
+    drain_result_queue();
+
+    /* All the RPCs completed. */
+    uvisor_rpc_t * caller = uvisor_rpc(bench_box_index(0));
+    for (uvisor_pool_slot_t slot = 0; slot < UVISOR_RPC_MESSAGE_SLOTS_MAX; ++slot) {
+        if (caller->outgoing_message_queue.messages[slot].state != UVISOR_RPC_MESSAGE_STATE_DONE) {
+            printf("rpc_slots: RPC in slot %d not completed\n", slot);
+            return 1;
+        }
+    }
+
+    printf("rpc_slots: queues sized per box\n");
+    return 0;
+}
+
+/* Time the drains of a thread switch into a box that has not queued any
+ * RPCs. */
+static void bm_rpc_drain_idle(BenchState * state)
+{
+    bench_rpc_init(2);
+    bench_box_switch(1);
+
+    while (bench_keep_running(state)) {
+        drain_message_queue();
+        drain_result_queue();
+    }
+}
+
+/* Check that the RPC queues of a box are only drained after the box rang
+ * their doorbells. */
+int bench_rpc_check(void)
+{
+    bench_rpc_init(2);
+    uint32_t skipped = g_rpc_drain_skipped;
+
+    /* Nothing was queued, so both queues are skipped. */
+    bench_box_switch(0);
+    drain_message_queue();
+    drain_result_queue();
+    if (g_rpc_drain_skipped - skipped != 2) {
+        printf("rpc_doorbell: %u of 2 idle drains skipped\n", g_rpc_drain_skipped - skipped);
+        return 1;
+    }
+
+    /* Only the rung doorbells are answered, once each. */
+    bench_rpc_send(2);
+    drain_message_queue();
+    drain_message_queue();
+    bench_rpc_serve(1);
+    bench_box_switch(1);
+    drain_result_queue();
+    bench_rpc_collect(2);
+    if (g_rpc_drain_skipped - skipped != 3 || bench_box_index(0)->doorbells.any || bench_box_index(1)->doorbells.any) {
+        printf("rpc_doorbell: %u drains skipped\n", g_rpc_drain_skipped - skipped);
+        return 1;
+    }
+
+    printf("rpc_doorbell: idle RPC queues skipped\n");
+    return check_rpc_wake_up() || check_rpc_lanes() || check_rpc_batch() || check_rpc_buffers() ||
+           check_rpc_completion() || check_rpc_slots() || check_rpc_direct() || check_rpc_direct_fallback() ||
+           check_rpc_stats() || check_rpc_kick();
+}
+
+const Bench g_bench_rpc[] = {
+    {"rpc_drain_idle", bm_rpc_drain_idle, 0},
+    {"rpc_drain_message_queue", bm_rpc_drain_message_queue, 2},
+    {"rpc_drain_message_queue", bm_rpc_drain_message_queue, UVISOR_MAX_BOXES},
+    {"rpc_round_trip", bm_rpc_round_trip, 2},
+    {"rpc_round_trip", bm_rpc_round_trip, UVISOR_MAX_BOXES},
+    {"rpc_ping_pong", bm_rpc_ping_pong, 0},
+    {"rpc_ping_pong", bm_rpc_ping_pong, 1},
+    {"rpc_drain_blocked", bm_rpc_drain_blocked, 3},
+    {"rpc_drain_blocked", bm_rpc_drain_blocked, UVISOR_MAX_BOXES},
+    {"rpc_wake_up", bm_rpc_wake_up, 0},
+    {"rpc_wake_up", bm_rpc_wake_up, 1},
+    {"rpc_batch", bm_rpc_batch, 0},
+    {"rpc_batch", bm_rpc_batch, 1},
+    {"rpc_buffer", bm_rpc_buffer, 0},
+    {"rpc_buffer", bm_rpc_buffer, 1},
+    {NULL},
+};
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <uvisor.h>
+#include "bench.h"
+#include "vmpu_armv7m_mpu.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The exhaustive search is only run for as many regions as the boxes use. */
+#define BENCH_VMPU_SEARCH_REGIONS (UVISOR_MAX_BOXES + 2)
+#define BENCH_VMPU_MAX_REGIONS    32
+
+/* Memory used by laying out the regions in the given order. */
+static uint32_t bench_vmpu_layout_size(uint32_t const * region_size, int const * order, int count, uint32_t start)
+{
+    uint32_t offset = start;
+    for (int i = 0; i < count; ++i) {
+        uint32_t size = region_size[order[i]];
+        offset = (offset + size - 1) & ~(size - 1);
+        offset += size;
+    }
+    return offset - start;
+}
+
+/* Smallest memory used by any order of the regions, found by trying all the
+ * permutations of the regions after the first `fixed` ones. */
+static uint32_t bench_vmpu_best_size(uint32_t const * region_size, int * order, int fixed, int count, uint32_t start)
+{
+    if (fixed == count) {
+        return bench_vmpu_layout_size(region_size, order, count, start);
+    }
+
+    uint32_t best = UINT32_MAX;
+    for (int i = fixed; i < count; ++i) {
+        int tmp = order[fixed];
+        order[fixed] = order[i];
+        order[i] = tmp;
+
+        uint32_t size = bench_vmpu_best_size(region_size, order, fixed + 1, count, start);
+        if (size < best) {
+            best = size;
+        }
+
+        order[i] = order[fixed];
+        order[fixed] = tmp;
+    }
+    return best;
+}
+
+static void bench_vmpu_random_regions(uint32_t * region_size, int count, uint32_t * start)
+{
+    for (int i = 0; i < count; ++i) {
+        region_size[i] = 1UL << (8 + rand() % 7);
+    }
+    *start = 0x20000000UL + (rand() % 1024) * 32;
+}
+
+/* Registers of the dynamic MPU regions, as written by the image diff. */
+static uint32_t g_bench_mpu_rbar[ARMv7M_MPU_REGIONS_MAX];
+static uint32_t g_bench_mpu_rasr[ARMv7M_MPU_REGIONS_MAX];
+
+/* Build an MPU image the way vmpu_switch expects it: the box stack first, then
+ * the page heap slot, then the other regions of the box. */
+static void bench_vmpu_image_build(MpuImage * image, uint32_t stack, const MpuRegion * regions, int count)
+{
+    MpuRegion region = {.start = stack, .end = stack + 0x400, .config = (9 << 1) | 1};
+
+    vmpu_mpu_image_init(image);
+    vmpu_mpu_image_push(image, &region, 255);
+    image->page_slot = vmpu_mpu_image_push(image, NULL, 100);
+    for (int i = 0; i < count; ++i) {
+        vmpu_mpu_image_push(image, &regions[i], 2);
+    }
+}
+
+/* Load an image into the MPU model and check that only the slots that change
+ * are written, and that the MPU then matches the image. */
+static int bench_vmpu_image_load(MpuImage * loaded, const MpuImage * image, const MpuRegion * page_region)
+{
+    uint32_t writes[2 * ARMv7M_MPU_REGIONS_MAX];
+    uint32_t disable;
+    uint32_t enabled = 0;
+    uint32_t saved = vmpu_mpu_get_writes_saved();
+    int count = vmpu_mpu_image_diff(loaded, image, page_region, writes, &disable);
+
+    for (int i = 0; i < count; i += 2) {
+        uint8_t slot = writes[i] & 0xF;
+        if (!(writes[i] & MPU_RBAR_VALID_Msk) || slot < ARMv7M_MPU_REGIONS_STATIC || slot >= ARMv7M_MPU_REGIONS_MAX ||
+            (g_bench_mpu_rasr[slot] == writes[i + 1] && (!writes[i + 1] || g_bench_mpu_rbar[slot] == writes[i]))) {
+            printf("vmpu_image: slot %u written without a change\n", slot);
+            return 1;
+        }
+        if (g_bench_mpu_rasr[slot]) {
+            enabled |= (1UL << slot);
+        }
+    }
+
+    /* Enabled regions are disabled before they are written. */
+    if (disable != enabled) {
+        printf("vmpu_image: slots 0x%02X disabled instead of 0x%02X\n", disable, enabled);
+        return 1;
+    }
+    for (int i = 0; i < count; i += 2) {
+        g_bench_mpu_rbar[writes[i] & 0xF] = writes[i];
+        g_bench_mpu_rasr[writes[i] & 0xF] = writes[i + 1];
+    }
+
+    for (uint8_t slot = ARMv7M_MPU_REGIONS_STATIC; slot < ARMv7M_MPU_REGIONS_MAX; ++slot) {
+        uint32_t rbar = image->rbar[slot];
+        uint32_t rasr = image->rasr[slot];
+        if (slot == image->page_slot && page_region) {
+            rbar = MPU_RBAR(slot, page_region->start);
+            rasr = page_region->config;
+        }
+        if (g_bench_mpu_rasr[slot] != rasr || (rasr && g_bench_mpu_rbar[slot] != rbar)) {
+            printf("vmpu_image: slot %u does not match the image\n", slot);
+            return 1;
+        }
+    }
+
+    uint32_t full = 3 * (ARMv7M_MPU_REGIONS_MAX - ARMv7M_MPU_REGIONS_STATIC) + 2 * image->pushes;
+    uint32_t written = count + 2 * __builtin_popcount(disable);
+    if (vmpu_mpu_get_writes_saved() - saved != full - written) {
+        printf("vmpu_image: %u writes saved instead of %u\n", vmpu_mpu_get_writes_saved() - saved, full - written);
+        return 1;
+    }
+    return 0;
+}
+
+/* Check that switching between the MPU images of two boxes only writes the
+ * MPU slots in which they differ. */
+static int check_vmpu_image(void)
+{
+    static const MpuRegion regions[] = {
+        {.start = 0x40000000, .end = 0x40001000, .config = (11 << 1) | 1},
+        {.start = 0x40010000, .end = 0x40010400, .config = (9 << 1) | 1},
+    };
+    MpuRegion page_region = {.start = 0x20008000, .end = 0x2000A000, .config = (12 << 1) | 1};
+    MpuImage images[2];
+    MpuImage loaded;
+
+    bench_vmpu_image_build(&images[0], 0x20001000, regions, 2);
+    bench_vmpu_image_build(&images[1], 0x20002000, regions, 2);
+    vmpu_mpu_image_init(&loaded);
+    memset(g_bench_mpu_rasr, 0, sizeof(g_bench_mpu_rasr));
+
+    if (bench_vmpu_image_load(&loaded, &images[0], &page_region)) {
+        return 1;
+    }
+
+    /* Loading the same image again writes nothing. */
+    uint32_t writes[2 * ARMv7M_MPU_REGIONS_MAX];
+    uint32_t disable;
+    if (vmpu_mpu_image_diff(&loaded, &images[0], &page_region, writes, &disable) != 0 || disable) {
+        printf("vmpu_image: same image written again\n");
+        return 1;
+    }
+
+    /* The boxes only differ in their stack and page heap regions. The stack
+     * region is always disabled first, and so is the page heap region when it
+     * is dropped. */
+    for (int i = 0; i < 4; ++i) {
+        uint32_t saved = vmpu_mpu_get_writes_saved();
+        if (bench_vmpu_image_load(&loaded, &images[(i + 1) % 2], (i % 2) ? &page_region : NULL)) {
+            return 1;
+        }
+        if (vmpu_mpu_get_writes_saved() - saved !=
+            3 * (ARMv7M_MPU_REGIONS_MAX - ARMv7M_MPU_REGIONS_STATIC) + 2 * 4 - 4 - 2 * ((i % 2) ? 1 : 2)) {
+            printf("vmpu_image: unchanged slots written\n");
+            return 1;
+        }
+    }
+
+    printf("vmpu_image: only the changed MPU slots written\n");
+    return 0;
+}
+
+/* Compare the greedy box ordering against an exhaustive search. */
+int bench_vmpu_check(void)
+{
+    static const int cases = 20000;
+    uint32_t region_size[BENCH_VMPU_SEARCH_REGIONS];
+    int order[BENCH_VMPU_SEARCH_REGIONS];
+    int best_order[BENCH_VMPU_SEARCH_REGIONS];
+    uint32_t start;
+
+    srand(1);
+    for (int i = 0; i < cases; ++i) {
+        int count = 1 + i % BENCH_VMPU_SEARCH_REGIONS;
+        bench_vmpu_random_regions(region_size, count, &start);
+
+        uint32_t size = vmpu_order_regions(region_size, count, start, order);
+        if (size != bench_vmpu_layout_size(region_size, order, count, start)) {
+            printf("vmpu_order_regions: wrong size for case %d\n", i);
+            return 1;
+        }
+
+        for (int j = 0; j < count; ++j) {
+            best_order[j] = j;
+        }
+        uint32_t best = bench_vmpu_best_size(region_size, best_order, 0, count, start);
+        if (size != best) {
+            printf("vmpu_order_regions: case %d uses %u bytes instead of %u\n", i, size, best);
+            return 1;
+        }
+    }
+
+    printf("vmpu_order_regions: %d cases match the exhaustive search\n", cases);
+    return check_vmpu_image();
+}
+
+static void bm_vmpu_order_regions(BenchState * state)
+{
+    uint32_t region_size[BENCH_VMPU_MAX_REGIONS];
+    int order[BENCH_VMPU_MAX_REGIONS];
+    uint32_t start;
+
+    srand(1);
+    bench_vmpu_random_regions(region_size, state->arg, &start);
+    while (bench_keep_running(state)) {
+        uint32_t size = vmpu_order_regions(region_size, state->arg, start, order);
+        bench_do_not_optimize(size);
+    }
+}
+
+const Bench g_bench_vmpu[] = {
+    {"vmpu_order_regions", bm_vmpu_order_regions, 2},
+    {"vmpu_order_regions", bm_vmpu_order_regions, UVISOR_MAX_BOXES - 1},
+    {"vmpu_order_regions", bm_vmpu_order_regions, BENCH_VMPU_SEARCH_REGIONS},
+    {"vmpu_order_regions", bm_vmpu_order_regions, BENCH_VMPU_MAX_REGIONS},
+    {NULL},
+};
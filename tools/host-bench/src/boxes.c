@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <uvisor.h>
+#include "api/inc/ipc_exports.h"
+#include "api/inc/rpc_exports.h"
+#include "api/inc/vmpu_exports.h"
+#include "bench.h"
+#include "context.h"
+#include "ipc.h"
+#include "vmpu.h"
+#include <string.h>
+
+/* Host model of the box BSS sections.
+ * The core stores addresses as 32-bit values, so all the box memories are
+ * statically allocated. The benchmark is linked as a non-PIE executable, which
+ * places them in the lower 4GB of the address space. The RPC and IPC sections
+ * are large enough for the maximum number of queue slots. */
+#define BENCH_BOX_RPC_SIZE \
+    UVISOR_RPC_SIZE(UVISOR_RPC_MESSAGE_SLOTS_MAX, UVISOR_RPC_MESSAGE_SLOTS_MAX, UVISOR_RPC_FN_GROUP_SLOTS_MAX)
+#define BENCH_BOX_IPC_SIZE \
+    UVISOR_IPC_SIZE(UVISOR_IPC_SLOTS_MAX, UVISOR_IPC_SLOTS_MAX)
+
+typedef struct {
+    UvisorBoxIndex index;
+    uint8_t rpc[BENCH_BOX_RPC_SIZE] __attribute__((aligned(8)));
+    uint8_t ipc[BENCH_BOX_IPC_SIZE] __attribute__((aligned(8)));
+} BenchBoxBss;
+
+static BenchBoxBss g_bench_box_bss[UVISOR_MAX_BOXES] __attribute__((aligned(32)));
+
+/* The box configuration table pointers. Only their addresses are used, to
+ * identify the callee box of an RPC gateway. */
+static uint32_t g_bench_cfgtbl_ptr[UVISOR_MAX_BOXES];
+
+/* Pointer to the active box index. */
+static uint32_t * g_bench_box_context;
+
+UvisorConfig const __uvisor_config = {
+    .cfgtbl_ptr_start = g_bench_cfgtbl_ptr,
+    .cfgtbl_ptr_end = g_bench_cfgtbl_ptr + UVISOR_MAX_BOXES,
+    .uvisor_box_context = &g_bench_box_context,
+};
+
+/* The queue slots of a box that does not configure them. */
+static const UvisorBoxQueueSlots g_bench_default_slots = {
+    UVISOR_RPC_OUTGOING_MESSAGE_SLOTS,
+    UVISOR_RPC_INCOMING_MESSAGE_SLOTS,
+    UVISOR_RPC_FN_GROUP_SLOTS,
+    UVISOR_IPC_SEND_SLOTS,
+    UVISOR_IPC_RECV_SLOTS,
+};
+
+void bench_boxes_init(int box_count)
+{
+    bench_boxes_init_slots(box_count, NULL);
+}
+
+void bench_boxes_init_slots(int box_count, const UvisorBoxQueueSlots * slots)
+{
+    memset(g_bench_box_bss, 0, sizeof(g_bench_box_bss));
+
+    g_vmpu_box_count = box_count;
+    g_vmpu_boxes_counted = true;
+
+    for (int box_id = 0; box_id < box_count; ++box_id) {
+        BenchBoxBss * bss = &g_bench_box_bss[box_id];
+        const UvisorBoxQueueSlots * box_slots = slots ? &slots[box_id] : &g_bench_default_slots;
+
+        bss->index.bss.address_of.index = (uint32_t) &bss->index;
+        bss->index.bss.address_of.rpc = (uint32_t) bss->rpc;
+        bss->index.bss.address_of.ipc = (uint32_t) bss->ipc;
+        bss->index.box_id_self = box_id;
+
+        g_context_current_states[box_id].bss = (uint32_t) bss;
+        g_context_current_states[box_id].bss_size = sizeof(*bss);
+
+        uvisor_rpc_t * rpc = uvisor_rpc(&bss->index);
+        if (uvisor_rpc_queues_init(rpc, box_slots)) {
+            HALT_ERROR(SANITY_CHECK_FAILED, "box %d: bad RPC queue slots", box_id);
+        }
+        uvisor_spin_init(&rpc->fn_index.lock);
+        ipc_box_init(box_id, box_slots);
+    }
+
+    bench_box_switch(0);
+}
+
+void bench_box_switch(int box_id)
+{
+    g_active_box = box_id;
+    g_bench_box_context = (uint32_t *) &g_bench_box_bss[box_id].index;
+}
+
+uint32_t bench_box_ptr(int box_id)
+{
+    return (uint32_t) &g_bench_cfgtbl_ptr[box_id];
+}
+
+UvisorBoxIndex * bench_box_index(int box_id)
+{
+    return &g_bench_box_bss[box_id].index;
+}
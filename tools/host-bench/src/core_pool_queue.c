@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/* Build the pool queue implementation for the host.
+ * The pool layout check in pool_queue.c assumes 32-bit pointers, so it is
+ * disabled here. The host code never shares pools with the target. */
+#include "api/inc/uvisor_exports.h"
+
+#undef UVISOR_STATIC_ASSERT
+#define UVISOR_STATIC_ASSERT(cond, msg)
+
+#include "core/system/src/pool_queue.c"
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2017, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <uvisor.h>
+#include "api/inc/halt_exports.h"
+#include "halt.h"
+#include "page_allocator.h"
+#include "page_allocator_faults.h"
+#include "semaphore.h"
+#include "vmpu.h"
+#include "vmpu_mpu.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Host stubs for the core symbols used by the benchmarked sources. */
+
+uint8_t g_vmpu_box_count;
+bool g_vmpu_boxes_counted;
+
+/* Number of posts to any semaphore. */
+uint32_t g_bench_semaphore_posts;
+/* The semaphore posted to last. */
+UvisorSemaphore * g_bench_semaphore_last;
+
+void halt_line(const char * file, uint32_t line, THaltError reason, const char * fmt, ...)
+{
+    va_list args;
+
+    fprintf(stderr, "HALTED(%s:%u): reason %i: ", file, (unsigned int) line, (int) reason);
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    abort();
+}
+
+void halt(THaltError reason)
+{
+    fprintf(stderr, "HALTED: reason %i\n", (int) reason);
+    abort();
+}
+
+int semaphore_post(UvisorSemaphore * semaphore)
+{
+    g_bench_semaphore_posts++;
+    g_bench_semaphore_last = semaphore;
+    return 0;
+}
+
+/* Number of MPU invalidations. */
+uint32_t g_bench_mpu_invalidations;
+/* Number of MPU invalidations of the page heap regions only. */
+uint32_t g_bench_mpu_page_invalidations;
+
+uint32_t g_bench_cycles;
+
+/* Buffers in the page heap are checked like on the target. All the other
+ * memory is accessible to all boxes. */
+bool vmpu_buffer_access_is_ok(int box_id, const void * addr, size_t size)
+{
+    uint32_t start_addr = (uint32_t) addr;
+    uint32_t end_addr = start_addr + size - 1;
+
+    if (page_allocator_get_page_from_address(start_addr) == UVISOR_PAGE_UNUSED) {
+        return true;
+    }
+    return page_allocator_check_range_for_box(box_id, start_addr, end_addr) == UVISOR_ERROR_PAGE_OK;
+}
+
+void vmpu_mpu_invalidate(void)
+{
+    g_bench_mpu_invalidations++;
+}
+
+void vmpu_mpu_invalidate_pages(void)
+{
+    g_bench_mpu_page_invalidations++;
+}
+
+/* Same constraints as the ARMv7-M MPU: The size is a power of two. */
+int vmpu_is_region_size_valid(uint32_t size)
+{
+    return size >= 32 && !(size & (size - 1));
+}
+
+uint32_t vmpu_round_up_region(uint32_t addr, uint32_t size)
+{
+    if (!vmpu_is_region_size_valid(size)) {
+        return 0;
+    }
+    const uint32_t mask = size - 1;
+    const uint32_t rounded_addr = addr + mask;
+    if (rounded_addr < addr) {
+        return 0;
+    }
+    return (rounded_addr & ~mask);
+}
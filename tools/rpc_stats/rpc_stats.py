@@ -0,0 +1,160 @@
+#!/usr/bin/env python
+###########################################################################
+#
+#  Copyright (c) 2017, ARM Limited, All Rights Reserved
+#  SPDX-License-Identifier: Apache-2.0
+#
+#  Licensed under the Apache License, Version 2.0 (the "License"); you may
+#  not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+#  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+###########################################################################
+import argparse
+import struct
+import sys
+
+
+# See uvisor_rpc_stats_t in api/inc/rpc_exports.h.
+RPC_STATS_MAGIC = 0x53435052
+RPC_STATS_HEADER_WORDS = 5
+RPC_STATS_ENTRY_HEADER_WORDS = 4
+RPC_STATS_HISTOGRAMS = ('wait', 'service', 'total')
+RPC_STATS_PERCENTILES = (50, 90, 99)
+
+
+def get_parser():
+
+    parser = argparse.ArgumentParser(
+        description='Print the RPC latency percentiles from a memory dump of '
+                    'the uVisor RPC statistics (uvisor_rpc_stats_t)',
+        formatter_class=argparse.ArgumentDefaultsHelpFormatter
+    )
+
+    parser.add_argument(
+        'dump',
+        help='binary memory dump, as written by rpc_get_stats'
+    )
+
+    parser.add_argument(
+        '-o',
+        '--offset',
+        type=lambda x: int(x, 0),
+        default=0,
+        help='offset of the statistics in the dump, in bytes'
+    )
+
+    parser.add_argument(
+        '-m',
+        '--mhz',
+        type=float,
+        default=0,
+        help='CPU clock in MHz, to print microseconds instead of cycles'
+    )
+
+    return parser
+
+
+def read_words(data, offset, count):
+    end = offset + 4 * count
+    if end > len(data):
+        raise ValueError('The dump ends before the RPC statistics do.')
+    return list(struct.unpack_from('<%dI' % count, data, offset))
+
+
+def decode(data, offset):
+    magic, entry_count, bucket_count, bucket_shift, dropped = \
+        read_words(data, offset, RPC_STATS_HEADER_WORDS)
+    if magic != RPC_STATS_MAGIC:
+        raise ValueError('Bad magic 0x%08X; is uVisor built with '
+                         'UVISOR_RPC_STATS?' % magic)
+
+    entries = []
+    offset += 4 * RPC_STATS_HEADER_WORDS
+    entry_words = RPC_STATS_ENTRY_HEADER_WORDS + \
+        len(RPC_STATS_HISTOGRAMS) * bucket_count
+    for _ in range(entry_count):
+        words = read_words(data, offset, entry_words)
+        offset += 4 * entry_words
+        target, caller_box, count, latency_max = \
+            words[:RPC_STATS_ENTRY_HEADER_WORDS]
+        if target == 0:
+            continue
+        entry = {
+            'target': target,
+            'caller_box': caller_box,
+            'count': count,
+            'max': latency_max,
+        }
+        buckets = words[RPC_STATS_ENTRY_HEADER_WORDS:]
+        for i, name in enumerate(RPC_STATS_HISTOGRAMS):
+            entry[name] = buckets[i * bucket_count:(i + 1) * bucket_count]
+        entries.append(entry)
+
+    return entries, bucket_shift, dropped
+
+
+def percentile(histogram, bucket_shift, latency_max, p):
+    """Return the upper bound of the bucket the p-th percentile falls in.
+
+    The bound is capped at the longest latency recorded, which is exact for
+    the total latency and an upper bound for its parts.
+    """
+    count = sum(histogram)
+    if count == 0:
+        return 0
+    rank = (count * p + 99) // 100
+    seen = 0
+    for i, bucket in enumerate(histogram):
+        seen += bucket
+        if seen >= rank:
+            if i == len(histogram) - 1:
+                return latency_max
+            return min(1 << (bucket_shift + i + 1), latency_max)
+    return latency_max
+
+
+def main():
+    parser = get_parser()
+    args = parser.parse_args()
+
+    with open(args.dump, 'rb') as dump:
+        data = dump.read()
+    try:
+        entries, bucket_shift, dropped = decode(data, args.offset)
+    except ValueError as e:
+        sys.exit('Error: %s' % e)
+
+    if args.mhz:
+        unit = 'us'
+        scale = lambda cycles: '%.1f' % (cycles / args.mhz)
+    else:
+        unit = 'cycles'
+        scale = str
+
+    columns = ['p%d' % p for p in RPC_STATS_PERCENTILES] + ['max']
+    print('%-10s %-4s %-8s %-7s %s (%s)' % (
+        'target', 'box', 'count', 'latency',
+        ' '.join('%10s' % column for column in columns), unit))
+    for entry in entries:
+        for name in RPC_STATS_HISTOGRAMS:
+            values = [scale(percentile(entry[name], bucket_shift, entry['max'], p))
+                      for p in RPC_STATS_PERCENTILES]
+            # Only the longest total latency is kept.
+            values.append(scale(entry['max']) if name == 'total' else '-')
+            print('0x%08X %-4d %-8d %-7s %s' % (
+                entry['target'], entry['caller_box'], entry['count'], name,
+                ' '.join('%10s' % value for value in values)))
+    if dropped:
+        print('%d RPCs not recorded: all the entries were taken.' % dropped)
+
+
+if __name__ == '__main__':
+    main()